@@ -220,6 +220,7 @@ lapiz_document_loader_init (LapizDocumentLoader *loader)
 {
 	loader->used = FALSE;
 	loader->auto_detected_newline_type = LAPIZ_DOCUMENT_NEWLINE_TYPE_DEFAULT;
+	loader->auto_detected_encoding_confidence = 0.0;
 }
 
 void
@@ -325,6 +326,8 @@ lapiz_document_loader_get_bytes_read (LapizDocumentLoader *loader)
 	return LAPIZ_DOCUMENT_LOADER_GET_CLASS (loader)->get_bytes_read (loader);
 }
 
+/* See lapiz_document_loader_get_encoding_confidence() to know how much an
+ * auto detected encoding can be trusted */
 const LapizEncoding *
 lapiz_document_loader_get_encoding (LapizDocumentLoader *loader)
 {
@@ -339,6 +342,27 @@ lapiz_document_loader_get_encoding (LapizDocumentLoader *loader)
 	return loader->auto_detected_encoding;
 }
 
+/**
+ * lapiz_document_loader_get_encoding_confidence:
+ * @loader: a #LapizDocumentLoader
+ *
+ * Gets how much the encoding returned by lapiz_document_loader_get_encoding()
+ * can be trusted, from 0 to 1. An encoding given by the user is always
+ * trusted.
+ *
+ * Returns: the confidence of the encoding.
+ */
+gdouble
+lapiz_document_loader_get_encoding_confidence (LapizDocumentLoader *loader)
+{
+	g_return_val_if_fail (LAPIZ_IS_DOCUMENT_LOADER (loader), 0.0);
+
+	if (loader->encoding != NULL)
+		return 1.0;
+
+	return loader->auto_detected_encoding_confidence;
+}
+
 LapizDocumentNewlineType
 lapiz_document_loader_get_newline_type (LapizDocumentLoader *loader)
 {
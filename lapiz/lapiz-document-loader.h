@@ -66,6 +66,7 @@ struct _LapizDocumentLoader
 	gchar			 *uri;
 	const LapizEncoding	 *encoding;
 	const LapizEncoding	 *auto_detected_encoding;
+	gdouble			  auto_detected_encoding_confidence;
 	LapizDocumentNewlineType  auto_detected_newline_type;
 };
 
@@ -117,6 +118,9 @@ const gchar		*lapiz_document_loader_get_uri		(LapizDocumentLoader *loader);
 
 const LapizEncoding	*lapiz_document_loader_get_encoding	(LapizDocumentLoader *loader);
 
+gdouble			 lapiz_document_loader_get_encoding_confidence
+								(LapizDocumentLoader *loader);
+
 LapizDocumentNewlineType lapiz_document_loader_get_newline_type (LapizDocumentLoader *loader);
 
 goffset			 lapiz_document_loader_get_bytes_read	(LapizDocumentLoader *loader);
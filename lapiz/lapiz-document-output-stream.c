@@ -27,6 +27,7 @@
 #include <glib/gi18n.h>
 #include <gio/gio.h>
 #include "lapiz-document-output-stream.h"
+#include "lapiz-utf8-scanner.h"
 
 /* NOTE: never use async methods on this stream, the stream is just
  * a wrapper around CtkTextBuffer api so that we can use GIO Stream
@@ -36,14 +37,28 @@
 
 #define MAX_UNICHAR_LEN 6
 
+/* Validated text is collected and inserted in the buffer in segments of
+ * this size, so that insert-text is emitted once per segment and not once
+ * per write */
+#define SEGMENT_SIZE (1024 * 1024)
+
 struct _LapizDocumentOutputStreamPrivate
 {
 	LapizDocument *doc;
 	CtkTextIter    pos;
 
-	gchar *buffer;
+	/* incomplete char or CR waiting for the next write */
+	gchar buffer[MAX_UNICHAR_LEN];
 	gsize buflen;
 
+	/* validated text not inserted yet */
+	gchar *segment;
+	gsize segment_len;
+	gsize segment_size;
+
+	/* stats of the text written so far */
+	LapizUtf8Scan scan;
+
 	guint is_initialized : 1;
 	guint is_closed : 1;
 };
@@ -115,7 +130,7 @@ lapiz_document_output_stream_finalize (GObject *object)
 {
 	LapizDocumentOutputStream *stream = LAPIZ_DOCUMENT_OUTPUT_STREAM (object);
 
-	g_free (stream->priv->buffer);
+	g_free (stream->priv->segment);
 
 	G_OBJECT_CLASS (lapiz_document_output_stream_parent_class)->finalize (object);
 }
@@ -172,41 +187,16 @@ lapiz_document_output_stream_init (LapizDocumentOutputStream *stream)
 {
 	stream->priv = lapiz_document_output_stream_get_instance_private (stream);
 
-	stream->priv->buffer = NULL;
 	stream->priv->buflen = 0;
 
-	stream->priv->is_initialized = FALSE;
-	stream->priv->is_closed = FALSE;
-}
-
-static LapizDocumentNewlineType
-get_newline_type (CtkTextIter *end)
-{
-	LapizDocumentNewlineType res;
-	CtkTextIter copy;
-	gunichar c;
+	stream->priv->segment = NULL;
+	stream->priv->segment_len = 0;
+	stream->priv->segment_size = 0;
 
-	copy = *end;
-	c = ctk_text_iter_get_char (&copy);
-
-	if (g_unichar_break_type (c) == G_UNICODE_BREAK_CARRIAGE_RETURN)
-	{
-		if (ctk_text_iter_forward_char (&copy) &&
-		    g_unichar_break_type (ctk_text_iter_get_char (&copy)) == G_UNICODE_BREAK_LINE_FEED)
-		{
-			res = LAPIZ_DOCUMENT_NEWLINE_TYPE_CR_LF;
-		}
-		else
-		{
-			res = LAPIZ_DOCUMENT_NEWLINE_TYPE_CR;
-		}
-	}
-	else
-	{
-		res = LAPIZ_DOCUMENT_NEWLINE_TYPE_LF;
-	}
+	lapiz_utf8_scan_init (&stream->priv->scan);
 
-	return res;
+	stream->priv->is_initialized = FALSE;
+	stream->priv->is_closed = FALSE;
 }
 
 GOutputStream *
@@ -216,26 +206,15 @@ lapiz_document_output_stream_new (LapizDocument *doc)
 					      "document", doc, NULL));
 }
 
+/* The line endings are classified while validating the written text, so
+ * there is no need to look at the buffer */
 LapizDocumentNewlineType
 lapiz_document_output_stream_detect_newline_type (LapizDocumentOutputStream *stream)
 {
-	LapizDocumentNewlineType type;
-	CtkTextIter iter;
-
 	g_return_val_if_fail (LAPIZ_IS_DOCUMENT_OUTPUT_STREAM (stream),
 			      LAPIZ_DOCUMENT_NEWLINE_TYPE_DEFAULT);
 
-	type = LAPIZ_DOCUMENT_NEWLINE_TYPE_DEFAULT;
-
-	ctk_text_buffer_get_start_iter (CTK_TEXT_BUFFER (stream->priv->doc),
-					&iter);
-
-	if (ctk_text_iter_ends_line (&iter) || ctk_text_iter_forward_to_line_end (&iter))
-	{
-		type = get_newline_type (&iter);
-	}
-
-	return type;
+	return lapiz_utf8_scan_get_newline_type (&stream->priv->scan);
 }
 
 /* If the last char is a newline, remove it from the buffer (otherwise
@@ -277,114 +256,227 @@ end_append_text_to_document (LapizDocumentOutputStream *stream)
 	ctk_source_buffer_end_not_undoable_action (CTK_SOURCE_BUFFER (stream->priv->doc));
 }
 
-static gssize
-lapiz_document_output_stream_write (GOutputStream            *stream,
-				    const void               *buffer,
-				    gsize                     count,
-				    GCancellable             *cancellable,
-				    GError                  **error)
+static void
+begin_append_text_to_document (LapizDocumentOutputStream *stream)
 {
-	LapizDocumentOutputStream *ostream;
-	gchar *text;
-	gsize len;
-	gboolean freetext = FALSE;
-	const gchar *end;
-	gboolean valid;
+	if (stream->priv->is_initialized)
+		return;
 
-	if (g_cancellable_set_error_if_cancelled (cancellable, error))
-		return -1;
+	/* Init the undoable action */
+	ctk_source_buffer_begin_not_undoable_action (CTK_SOURCE_BUFFER (stream->priv->doc));
 
-	ostream = LAPIZ_DOCUMENT_OUTPUT_STREAM (stream);
+	ctk_text_buffer_get_start_iter (CTK_TEXT_BUFFER (stream->priv->doc),
+					&stream->priv->pos);
+	stream->priv->is_initialized = TRUE;
+}
 
-	if (!ostream->priv->is_initialized)
+static void
+insert_segment (LapizDocumentOutputStream *stream,
+		gboolean                   keep_cr)
+{
+	gsize len = stream->priv->segment_len;
+	gboolean held_cr = FALSE;
+
+	if (len == 0)
+		return;
+
+	/* Avoid splitting a CRLF across two inserts. */
+	if (keep_cr && stream->priv->segment[len - 1] == '\r')
 	{
-		/* Init the undoable action */
-		ctk_source_buffer_begin_not_undoable_action (CTK_SOURCE_BUFFER (ostream->priv->doc));
+		held_cr = TRUE;
+		len--;
+	}
 
-		ctk_text_buffer_get_start_iter (CTK_TEXT_BUFFER (ostream->priv->doc),
-						&ostream->priv->pos);
-		ostream->priv->is_initialized = TRUE;
+	if (len > 0)
+	{
+		ctk_text_buffer_insert (CTK_TEXT_BUFFER (stream->priv->doc),
+					&stream->priv->pos,
+					stream->priv->segment,
+					len);
 	}
 
-	if (ostream->priv->buflen > 0)
+	if (held_cr)
 	{
-		len = ostream->priv->buflen + count;
-		text = g_new (gchar , len + 1);
-		memcpy (text, ostream->priv->buffer, ostream->priv->buflen);
-		memcpy (text + ostream->priv->buflen, buffer, count);
-		text[len] = '\0';
-		g_free (ostream->priv->buffer);
-		ostream->priv->buffer = NULL;
-		ostream->priv->buflen = 0;
-		freetext = TRUE;
+		stream->priv->segment[0] = '\r';
+		stream->priv->segment_len = 1;
 	}
 	else
 	{
-		text = (gchar *) buffer;
-		len = count;
+		stream->priv->segment_len = 0;
 	}
+}
 
-	/* validate */
-	valid = g_utf8_validate (text, len, &end);
-
-	/* Avoid keeping a CRLF across two buffers. */
-	if (valid && len > 1 && end[-1] == '\r')
-	{
-		valid = FALSE;
-		end--;
-	}
+/* Returns how many bytes of text can be inserted, the rest is an incomplete
+ * char which must wait for the next write. Returns -1 if the text is not
+ * valid UTF-8. The valid text is accounted in the stream stats. */
+static gssize
+validate_text (LapizDocumentOutputStream  *stream,
+	       const gchar                *text,
+	       gsize                       len,
+	       GError                    **error)
+{
+	const gchar *end;
 
-	if (!valid)
+	if (!lapiz_utf8_scan (&stream->priv->scan, text, len, &end))
 	{
 		gsize nvalid = end - text;
 		gsize remainder = len - nvalid;
-		gunichar ch;
 
 		if ((remainder < MAX_UNICHAR_LEN) &&
-		    ((ch = g_utf8_get_char_validated (text + nvalid, remainder)) == (gunichar)-2 ||
-		     ch == (gunichar)'\r'))
+		    g_utf8_get_char_validated (end, remainder) == (gunichar)-2)
 		{
-			ostream->priv->buffer = g_strndup (end, remainder);
-			ostream->priv->buflen = remainder;
-			len -= remainder;
+			return nvalid;
 		}
-		else
-		{
-			/* TODO: we could escape invalid text and tag it in red
-			 * and make the doc readonly.
-			 */
-			g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
-				     _("Invalid UTF-8 sequence in input"));
 
-			if (freetext)
-				g_free (text);
+		/* TODO: we could escape invalid text and tag it in red
+		 * and make the doc readonly.
+		 */
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+			     _("Invalid UTF-8 sequence in input"));
+
+		return -1;
+	}
+
+	return len;
+}
+
+
+/**
+ * lapiz_document_output_stream_write_validated:
+ * @stream: a #LapizDocumentOutputStream
+ * @text: valid UTF-8 text
+ * @len: length of @text in bytes
+ *
+ * Appends @text to the document skipping the UTF-8 validation done by
+ * g_output_stream_write(). This is meant for loaders that already validated
+ * the text off the main thread: @text must be complete, valid UTF-8 and,
+ * unless it is the last chunk, must not end with a '\r' so that a CRLF is
+ * never split across two inserts. @scan holds the stats of @text and is
+ * added to the ones of the stream.
+ */
+void
+lapiz_document_output_stream_write_validated (LapizDocumentOutputStream *stream,
+					      const gchar               *text,
+					      gsize                      len,
+					      const LapizUtf8Scan       *scan)
+{
+	g_return_if_fail (LAPIZ_IS_DOCUMENT_OUTPUT_STREAM (stream));
+	g_return_if_fail (!stream->priv->is_closed);
+	g_return_if_fail (stream->priv->buflen == 0);
+	g_return_if_fail (scan != NULL);
+
+	begin_append_text_to_document (stream);
+
+	insert_segment (stream, FALSE);
+
+	lapiz_utf8_scan_merge (&stream->priv->scan, scan);
+
+	if (len == 0)
+		return;
+
+	ctk_text_buffer_insert (CTK_TEXT_BUFFER (stream->priv->doc),
+				&stream->priv->pos, text, len);
+}
+
+static gssize
+lapiz_document_output_stream_write (GOutputStream            *stream,
+				    const void               *buffer,
+				    gsize                     count,
+				    GCancellable             *cancellable,
+				    GError                  **error)
+{
+	LapizDocumentOutputStreamPrivate *priv;
+	gchar *text;
+	gsize len;
+	gssize nvalid;
+
+	if (g_cancellable_set_error_if_cancelled (cancellable, error))
+		return -1;
+
+	priv = LAPIZ_DOCUMENT_OUTPUT_STREAM (stream)->priv;
+
+	begin_append_text_to_document (LAPIZ_DOCUMENT_OUTPUT_STREAM (stream));
+
+	/* Big writes with nothing pending are inserted without copying */
+	if (priv->buflen == 0 && priv->segment_len == 0 && count >= SEGMENT_SIZE)
+	{
+		gsize ninsert;
+
+		nvalid = validate_text (LAPIZ_DOCUMENT_OUTPUT_STREAM (stream),
+					buffer, count, error);
 
+		if (nvalid == -1)
 			return -1;
+
+		ninsert = nvalid;
+
+		/* Avoid splitting a CRLF across two inserts, a trailing
+		 * CR waits in the segment. */
+		if (ninsert > 0 && ((const gchar *) buffer)[ninsert - 1] == '\r')
+		{
+			if (priv->segment_size == 0)
+			{
+				priv->segment_size = SEGMENT_SIZE;
+				priv->segment = g_malloc (priv->segment_size);
+			}
+
+			priv->segment[0] = '\r';
+			priv->segment_len = 1;
+			ninsert--;
 		}
+
+		ctk_text_buffer_insert (CTK_TEXT_BUFFER (priv->doc),
+					&priv->pos, buffer, ninsert);
+
+		priv->buflen = count - nvalid;
+		memcpy (priv->buffer, (const gchar *) buffer + nvalid, priv->buflen);
+
+		return count;
 	}
 
-	ctk_text_buffer_insert (CTK_TEXT_BUFFER (ostream->priv->doc),
-				&ostream->priv->pos, text, len);
+	len = priv->buflen + count;
 
-	if (freetext)
-		g_free (text);
+	if (priv->segment_len + len > priv->segment_size)
+	{
+		insert_segment (LAPIZ_DOCUMENT_OUTPUT_STREAM (stream), TRUE);
+	}
+
+	if (priv->segment_len + len > priv->segment_size)
+	{
+		priv->segment_size = MAX (SEGMENT_SIZE, priv->segment_len + len);
+		priv->segment = g_realloc (priv->segment, priv->segment_size);
+	}
+
+	/* the carried tail goes right before the new text */
+	text = priv->segment + priv->segment_len;
+	memcpy (text, priv->buffer, priv->buflen);
+	memcpy (text + priv->buflen, buffer, count);
+	priv->buflen = 0;
+
+	nvalid = validate_text (LAPIZ_DOCUMENT_OUTPUT_STREAM (stream),
+				text, len, error);
+
+	if (nvalid == -1)
+		return -1;
+
+	priv->buflen = len - nvalid;
+	memcpy (priv->buffer, text + nvalid, priv->buflen);
+
+	priv->segment_len += nvalid;
 
 	return count;
 }
 
 static gboolean
 lapiz_document_output_stream_flush (GOutputStream *stream,
-                                    GCancellable  *cancellable,
-                                    GError        **error)
+                                    GCancellable  *cancellable G_GNUC_UNUSED,
+                                    GError        **error G_GNUC_UNUSED)
 {
 	LapizDocumentOutputStream *ostream = LAPIZ_DOCUMENT_OUTPUT_STREAM (stream);
 
-	/* Flush deferred data if some. */
-	if (!ostream->priv->is_closed && ostream->priv->is_initialized &&
-	    ostream->priv->buflen > 0 &&
-	    lapiz_document_output_stream_write (stream, "", 0, cancellable,
-						error) == -1)
-		return FALSE;
+	/* Flush deferred data if some, an incomplete char stays pending. */
+	if (!ostream->priv->is_closed && ostream->priv->is_initialized)
+		insert_segment (ostream, FALSE);
 
 	return TRUE;
 }
@@ -398,8 +490,15 @@ lapiz_document_output_stream_close (GOutputStream     *stream,
 
 	if (!ostream->priv->is_closed && ostream->priv->is_initialized)
 	{
+		/* an incomplete char is reported below */
+		insert_segment (ostream, FALSE);
+
 		end_append_text_to_document (ostream);
 		ostream->priv->is_closed = TRUE;
+
+		g_free (ostream->priv->segment);
+		ostream->priv->segment = NULL;
+		ostream->priv->segment_size = 0;
 	}
 
 	if (ostream->priv->buflen > 0)
@@ -26,6 +26,7 @@
 
 #include <gio/gio.h>
 #include "lapiz-document.h"
+#include "lapiz-utf8-scanner.h"
 
 G_BEGIN_DECLS
 
@@ -59,6 +60,11 @@ GOutputStream		*lapiz_document_output_stream_new		(LapizDocument *doc);
 
 LapizDocumentNewlineType lapiz_document_output_stream_detect_newline_type (LapizDocumentOutputStream *stream);
 
+void			 lapiz_document_output_stream_write_validated	(LapizDocumentOutputStream *stream,
+									 const gchar               *text,
+									 gsize                      len,
+									 const LapizUtf8Scan       *scan);
+
 G_END_DECLS
 
 #endif /* __LAPIZ_DOCUMENT_OUTPUT_STREAM_H__ */
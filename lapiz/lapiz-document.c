@@ -51,6 +51,8 @@
 #include "lapiz-marshal.h"
 #include "lapiz-enum-types.h"
 #include "lapiztextregion.h"
+#include "lapiz-literal-search.h"
+#include "lapiz-match-index.h"
 
 #ifndef ENABLE_GVFS_METADATA
 #include "lapiz-metadata-manager.h"
@@ -76,6 +78,18 @@ PROFILE (static GTimer *timer = NULL)
 #define LAPIZ_MAX_PATH_LEN  2048
 #endif
 
+/* The match index is built in idle slices of about this many characters */
+#define MATCH_INDEX_SLICE_CHARS (256 * 1024)
+
+/* The search matches are highlighted on the lines the view shows plus a
+ * margin, a few lines at a time, for at most SEARCH_HIGHLIGHT_SLICE_USEC
+ * per main loop iteration. The first slice runs after the view is
+ * resized and before it is redrawn, the rest at idle priority. */
+#define SEARCH_HIGHLIGHT_MARGIN_LINES	50
+#define SEARCH_HIGHLIGHT_CHUNK_LINES	20
+#define SEARCH_HIGHLIGHT_SLICE_USEC	4000
+#define SEARCH_HIGHLIGHT_PRIORITY	(G_PRIORITY_HIGH_IDLE + 15)
+
 static void	lapiz_document_load_real	(LapizDocument          *doc,
 						 const gchar            *uri,
 						 const LapizEncoding    *encoding,
@@ -96,6 +110,8 @@ static void 	insert_text_cb		 	(LapizDocument *doc,
 static void	delete_range_cb 		(LapizDocument *doc,
 						 CtkTextIter   *start,
 						 CtkTextIter   *end);
+static void	reset_match_index		(LapizDocument *doc);
+static void	cancel_search_highlight		(LapizDocument *doc);
 
 struct _LapizDocumentPrivate
 {
@@ -117,6 +133,16 @@ struct _LapizDocumentPrivate
 	gchar       *last_replace_text;
 	gint	     num_of_lines_search_text;
 
+	/* prepared search of search_text, when it is not a regex */
+	LapizLiteralSearch *literal_search;
+	GRegex             *search_regex;
+
+	/* Matches of search_text, built in the background */
+	LapizMatchIndex *match_index;
+	gint             match_index_scanned;
+	gint             match_index_n_chars;
+	guint            match_index_id;
+
 	LapizDocumentNewlineType newline_type;
 
 	/* Temp data while loading */
@@ -132,6 +158,9 @@ struct _LapizDocumentPrivate
 	/* Search highlighting support variables */
 	LapizTextRegion *to_search_region;
 	CtkTextTag      *found_tag;
+	gint             highlight_visible_start;
+	gint             highlight_visible_end;
+	guint            highlight_id;
 
 	/* Mount operation factory */
 	LapizMountOperationFactory  mount_operation_factory;
@@ -142,6 +171,7 @@ struct _LapizDocumentPrivate
 	gint language_set_by_user : 1;
 	gint stop_cursor_moved_emission : 1;
 	gint dispose_has_run : 1;
+	gint changed_during_save : 1;
 };
 
 enum {
@@ -155,7 +185,8 @@ enum {
 	PROP_ENCODING,
 	PROP_CAN_SEARCH_AGAIN,
 	PROP_ENABLE_SEARCH_HIGHLIGHTING,
-	PROP_NEWLINE_TYPE
+	PROP_NEWLINE_TYPE,
+	PROP_SEARCH_MATCH_COUNT
 };
 
 enum {
@@ -273,6 +304,14 @@ lapiz_document_dispose (GObject *object)
 		doc->priv->loader = NULL;
 	}
 
+	if (doc->priv->match_index_id != 0)
+	{
+		g_source_remove (doc->priv->match_index_id);
+		doc->priv->match_index_id = 0;
+	}
+
+	cancel_search_highlight (doc);
+
 	if (doc->priv->metadata_info != NULL)
 	{
 		g_object_unref (doc->priv->metadata_info);
@@ -301,6 +340,11 @@ lapiz_document_finalize (GObject *object)
 	g_free (doc->priv->content_type);
 	g_free (doc->priv->search_text);
 	g_free (doc->priv->last_replace_text);
+	lapiz_literal_search_free (doc->priv->literal_search);
+	lapiz_match_index_free (doc->priv->match_index);
+
+	if (doc->priv->search_regex != NULL)
+		g_regex_unref (doc->priv->search_regex);
 
 	if (doc->priv->to_search_region != NULL)
 	{
@@ -348,6 +392,9 @@ lapiz_document_get_property (GObject    *object,
 		case PROP_NEWLINE_TYPE:
 			g_value_set_enum (value, doc->priv->newline_type);
 			break;
+		case PROP_SEARCH_MATCH_COUNT:
+			g_value_set_int (value, lapiz_document_get_search_match_count (doc));
+			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 			break;
@@ -418,7 +465,14 @@ lapiz_document_mark_set (CtkTextBuffer     *buffer,
 static void
 lapiz_document_changed (CtkTextBuffer *buffer)
 {
-	emit_cursor_moved (LAPIZ_DOCUMENT (buffer));
+	LapizDocument *doc = LAPIZ_DOCUMENT (buffer);
+
+	/* the saver writes a snapshot taken when the save started, so an
+	 * edit made meanwhile is not on disk */
+	if (doc->priv->saver != NULL)
+		doc->priv->changed_during_save = TRUE;
+
+	emit_cursor_moved (doc);
 
 	CTK_TEXT_BUFFER_CLASS (lapiz_document_parent_class)->changed (buffer);
 }
@@ -520,6 +574,16 @@ lapiz_document_class_init (LapizDocumentClass *klass)
 	                                                    G_PARAM_STATIC_NAME |
 	                                                    G_PARAM_STATIC_BLURB));
 
+	g_object_class_install_property (object_class, PROP_SEARCH_MATCH_COUNT,
+					 g_param_spec_int ("search-match-count",
+							   "Search match count",
+							   "The number of matches of the search text",
+							   -1,
+							   G_MAXINT,
+							   -1,
+							   G_PARAM_READABLE |
+							   G_PARAM_STATIC_STRINGS));
+
 	/* This signal is used to update the cursor position is the statusbar,
 	 * it's emitted either when the insert mark is moved explicitely or
 	 * when the buffer changes (insert/delete).
@@ -1419,6 +1483,15 @@ document_loader_loaded (LapizDocumentLoader *loader,
 		}
 
 		ctk_text_buffer_place_cursor (CTK_TEXT_BUFFER (doc), &iter);
+
+		/* insertions are not tracked while loading */
+		if (doc->priv->to_search_region != NULL)
+		{
+			CtkTextIter start, end;
+
+			ctk_text_buffer_get_bounds (CTK_TEXT_BUFFER (doc), &start, &end);
+			to_search_region_range (doc, &start, &end);
+		}
 	}
 
 	/* special case creating a named new doc */
@@ -1426,22 +1499,19 @@ document_loader_loaded (LapizDocumentLoader *loader,
 	         (error->domain == G_IO_ERROR && error->code == G_IO_ERROR_NOT_FOUND) &&
 	         (lapiz_utils_uri_has_file_scheme (doc->priv->uri)))
 	{
-		reset_temp_loading_data (doc);
-
-		g_signal_emit (doc,
-			       document_signals[LOADED],
-			       0,
-			       NULL);
-
-		return;
+		error = NULL;
 	}
 
+	/* lapiz_document_is_loading() is FALSE in the "loaded" handlers,
+	 * which may well insert text. The error stays valid meanwhile,
+	 * the loader holds a reference on itself while it emits. */
+	reset_temp_loading_data (doc);
+	reset_match_index (doc);
+
 	g_signal_emit (doc,
 		       document_signals[LOADED],
 		       0,
 		       error);
-
-	reset_temp_loading_data (doc);
 }
 
 static void
@@ -1502,6 +1572,9 @@ lapiz_document_load_real (LapizDocument       *doc,
 	set_uri (doc, uri);
 	set_content_type (doc, NULL);
 
+	/* insertions are not tracked while loading */
+	reset_match_index (doc);
+
 	lapiz_document_loader_load (doc->priv->loader);
 }
 
@@ -1596,8 +1669,9 @@ document_saver_saving (LapizDocumentSaver *saver,
 
 			_lapiz_document_set_readonly (doc, FALSE);
 
-			ctk_text_buffer_set_modified (CTK_TEXT_BUFFER (doc),
-						      FALSE);
+			if (!doc->priv->changed_during_save)
+				ctk_text_buffer_set_modified (CTK_TEXT_BUFFER (doc),
+							      FALSE);
 
 			set_encoding (doc,
 				      doc->priv->requested_encoding,
@@ -1639,6 +1713,8 @@ lapiz_document_save_real (LapizDocument          *doc,
 {
 	g_return_if_fail (doc->priv->saver == NULL);
 
+	doc->priv->changed_during_save = FALSE;
+
 	/* create a saver, it will be destroyed once saving is complete */
 	doc->priv->saver = lapiz_document_saver_new (doc, uri, encoding,
 						     doc->priv->newline_type,
@@ -1754,6 +1830,24 @@ lapiz_document_is_local (LapizDocument *doc)
 	return lapiz_utils_uri_has_file_scheme (doc->priv->uri);
 }
 
+/**
+ * lapiz_document_is_loading:
+ * @doc: a #LapizDocument
+ *
+ * While a document is loading its text is inserted in big chunks and
+ * per-insert work (search highlighting, spell checking...) should rather be
+ * done once the "loaded" signal is emitted.
+ *
+ * Returns: %TRUE if @doc is being loaded.
+ */
+gboolean
+lapiz_document_is_loading (LapizDocument *doc)
+{
+	g_return_val_if_fail (LAPIZ_IS_DOCUMENT (doc), FALSE);
+
+	return (doc->priv->loader != NULL);
+}
+
 gboolean
 lapiz_document_get_deleted (LapizDocument *doc)
 {
@@ -1860,6 +1954,613 @@ compute_num_of_lines (const gchar *text)
 	return n;
 }
 
+static void
+clear_compiled_search (LapizDocument *doc)
+{
+	lapiz_literal_search_free (doc->priv->literal_search);
+	doc->priv->literal_search = NULL;
+
+	if (doc->priv->search_regex != NULL)
+	{
+		g_regex_unref (doc->priv->search_regex);
+		doc->priv->search_regex = NULL;
+	}
+}
+
+static LapizLiteralSearch *
+get_literal_search (LapizDocument *doc)
+{
+	if (doc->priv->literal_search == NULL)
+		doc->priv->literal_search = lapiz_literal_search_new (doc->priv->search_text,
+								      doc->priv->search_flags);
+
+	return doc->priv->literal_search;
+}
+
+static GRegex *
+get_search_regex (LapizDocument *doc)
+{
+	if (doc->priv->search_regex == NULL)
+	{
+		GRegexCompileFlags compile_flags = G_REGEX_OPTIMIZE;
+
+		if (!LAPIZ_SEARCH_IS_CASE_SENSITIVE (doc->priv->search_flags))
+			compile_flags |= G_REGEX_CASELESS;
+
+		doc->priv->search_regex = g_regex_new (doc->priv->search_text,
+						       compile_flags,
+						       0,
+						       NULL);
+	}
+
+	return doc->priv->search_regex;
+}
+
+/* Calls @func on the non empty matches of the search regex between @start
+ * and @end. The text is read once; if it skips hidden text or embedded
+ * objects the matches are looked for one at a time. */
+static gboolean
+regex_foreach (LapizDocument          *doc,
+	       const CtkTextIter      *start,
+	       const CtkTextIter      *end,
+	       LapizLiteralSearchFunc  func,
+	       gpointer                user_data)
+{
+	CtkTextBuffer *buffer = CTK_TEXT_BUFFER (doc);
+	GRegexMatchFlags match_flags = 0;
+	GRegex *regex;
+	GMatchInfo *match_info;
+	gchar *text;
+	gint pos = 0;
+	gint pos_offset;
+
+	regex = get_search_regex (doc);
+
+	if (regex == NULL)
+		return FALSE;
+
+	text = ctk_text_iter_get_visible_text (start, end);
+	pos_offset = ctk_text_iter_get_offset (start);
+
+	if (g_utf8_strlen (text, -1) != ctk_text_iter_get_offset (end) - pos_offset)
+	{
+		CtkTextSearchFlags search_flags;
+		CtkTextIter iter = *start;
+		CtkTextIter limit = *end;
+		CtkTextIter m_start, m_end;
+		gint end_offset = ctk_text_iter_get_offset (end);
+
+		g_free (text);
+
+		search_flags = CTK_TEXT_SEARCH_VISIBLE_ONLY | CTK_TEXT_SEARCH_TEXT_ONLY;
+
+		if (!LAPIZ_SEARCH_IS_CASE_SENSITIVE (doc->priv->search_flags))
+			search_flags |= CTK_TEXT_SEARCH_CASE_INSENSITIVE;
+
+		while (lapiz_ctk_text_iter_regex_search (&iter,
+							 doc->priv->search_text,
+							 search_flags,
+							 &m_start,
+							 &m_end,
+							 &limit,
+							 TRUE,
+							 NULL))
+		{
+			gint offset = ctk_text_iter_get_offset (&m_end);
+
+			if (ctk_text_iter_equal (&m_start, &m_end))
+			{
+				++offset;
+			}
+			else if (!LAPIZ_SEARCH_IS_ENTIRE_WORD (doc->priv->search_flags) ||
+				 (ctk_text_iter_starts_word (&m_start) &&
+				  ctk_text_iter_ends_word (&m_end)))
+			{
+				func (&m_start, &m_end, user_data);
+			}
+
+			if (offset >= end_offset)
+				break;
+
+			/* tagging invalidates the iters */
+			ctk_text_buffer_get_iter_at_offset (buffer, &iter, offset);
+			ctk_text_buffer_get_iter_at_offset (buffer, &limit, end_offset);
+		}
+
+		return TRUE;
+	}
+
+	if (!ctk_text_iter_is_start (start))
+		match_flags |= G_REGEX_MATCH_NOTBOL;
+
+	if (!ctk_text_iter_is_end (end))
+		match_flags |= G_REGEX_MATCH_NOTEOL;
+
+	g_regex_match_full (regex, text, -1, 0, match_flags, &match_info, NULL);
+
+	while (g_match_info_matches (match_info))
+	{
+		gint start_pos;
+		gint end_pos;
+
+		g_match_info_fetch_pos (match_info, 0, &start_pos, &end_pos);
+
+		if (end_pos > start_pos)
+		{
+			CtkTextIter m_start, m_end;
+			gint start_offset;
+
+			start_offset = pos_offset + g_utf8_pointer_to_offset (text + pos, text + start_pos);
+			pos_offset = start_offset + g_utf8_pointer_to_offset (text + start_pos, text + end_pos);
+			pos = end_pos;
+
+			ctk_text_buffer_get_iter_at_offset (buffer, &m_start, start_offset);
+			ctk_text_buffer_get_iter_at_offset (buffer, &m_end, pos_offset);
+
+			if (!LAPIZ_SEARCH_IS_ENTIRE_WORD (doc->priv->search_flags) ||
+			    (ctk_text_iter_starts_word (&m_start) &&
+			     ctk_text_iter_ends_word (&m_end)))
+			{
+				func (&m_start, &m_end, user_data);
+			}
+		}
+
+		g_match_info_next (match_info, NULL);
+	}
+
+	g_match_info_free (match_info);
+	g_free (text);
+
+	return TRUE;
+}
+
+/* Calls @func on the matches of the search text between @start and @end,
+ * in order. Returns FALSE if the search text is an invalid regex. */
+static gboolean
+search_foreach (LapizDocument          *doc,
+		const CtkTextIter      *start,
+		const CtkTextIter      *end,
+		LapizLiteralSearchFunc  func,
+		gpointer                user_data)
+{
+	if (LAPIZ_SEARCH_IS_MATCH_REGEX (doc->priv->search_flags))
+		return regex_foreach (doc, start, end, func, user_data);
+
+	lapiz_literal_search_foreach (get_literal_search (doc),
+				      start,
+				      end,
+				      func,
+				      user_data);
+
+	return TRUE;
+}
+
+/* Whether the matches may span more lines than the search text has: the
+ * match index and the highlighting of a few lines at a time rely on them
+ * not to */
+static gboolean
+search_spans_lines (LapizDocument *doc)
+{
+	/* a "\n" typed in the search is a newline by now, a "\\n" is
+	 * still an escape for the regex */
+	return LAPIZ_SEARCH_IS_MATCH_REGEX (doc->priv->search_flags) &&
+	       (doc->priv->search_text != NULL) &&
+	       ((strchr (doc->priv->search_text, '\n') != NULL) ||
+		(strstr (doc->priv->search_text, "\\n") != NULL));
+}
+
+static gboolean
+match_index_is_complete (LapizDocument *doc)
+{
+	return (doc->priv->match_index != NULL) &&
+	       (doc->priv->match_index_scanned >= ctk_text_buffer_get_char_count (CTK_TEXT_BUFFER (doc)));
+}
+
+typedef struct
+{
+	LapizMatchIndex *index;
+	guint            n;
+	gint             limit;
+	gint             last_end;
+} IndexScan;
+
+static void
+index_match (const CtkTextIter *match_start,
+	     const CtkTextIter *match_end,
+	     IndexScan         *scan)
+{
+	gint start;
+
+	start = ctk_text_iter_get_offset (match_start);
+
+	/* found by the lookahead, they belong to the next scan */
+	if (start >= scan->limit)
+		return;
+
+	scan->last_end = ctk_text_iter_get_offset (match_end);
+	lapiz_match_index_insert (scan->index, scan->n++, start, scan->last_end);
+}
+
+/* Adds to the match index, from position @n on, the matches starting
+ * between @from and @limit. Returns the offset from which the search goes
+ * on, past the last match found, or -1 if the search cannot be done. */
+static gint
+scan_matches (LapizDocument *doc,
+	      guint          n,
+	      gint           from,
+	      gint           limit,
+	      guint         *n_found)
+{
+	CtkTextIter start;
+	CtkTextIter end;
+	IndexScan scan;
+
+	ctk_text_buffer_get_iter_at_offset (CTK_TEXT_BUFFER (doc), &start, from);
+	ctk_text_buffer_get_iter_at_offset (CTK_TEXT_BUFFER (doc), &end, limit);
+
+	/* a match starting before limit can span some lines after it */
+	ctk_text_iter_forward_lines (&end, doc->priv->num_of_lines_search_text);
+
+	scan.index = doc->priv->match_index;
+	scan.n = n;
+	scan.limit = limit;
+	scan.last_end = from;
+
+	if (!search_foreach (doc, &start, &end, (LapizLiteralSearchFunc) index_match, &scan))
+		return -1;
+
+	*n_found = scan.n - n;
+
+	return MAX (limit, scan.last_end);
+}
+
+static void
+disable_match_index (LapizDocument *doc)
+{
+	if (doc->priv->match_index_id != 0)
+	{
+		g_source_remove (doc->priv->match_index_id);
+		doc->priv->match_index_id = 0;
+	}
+
+	lapiz_match_index_free (doc->priv->match_index);
+	doc->priv->match_index = NULL;
+}
+
+static gboolean
+build_match_index (LapizDocument *doc)
+{
+	CtkTextIter iter;
+	gint n_chars;
+	gint next;
+	guint n_found;
+
+	n_chars = ctk_text_buffer_get_char_count (CTK_TEXT_BUFFER (doc));
+
+	/* slices end at a line start */
+	ctk_text_buffer_get_iter_at_offset (CTK_TEXT_BUFFER (doc),
+					    &iter,
+					    MIN (doc->priv->match_index_scanned + MATCH_INDEX_SLICE_CHARS,
+						 n_chars));
+	ctk_text_iter_forward_line (&iter);
+
+	next = scan_matches (doc,
+			     lapiz_match_index_get_length (doc->priv->match_index),
+			     doc->priv->match_index_scanned,
+			     ctk_text_iter_get_offset (&iter),
+			     &n_found);
+
+	if (next < 0)
+	{
+		doc->priv->match_index_id = 0;
+		disable_match_index (doc);
+
+		return FALSE;
+	}
+
+	doc->priv->match_index_scanned = next;
+
+	if (next < n_chars)
+		return TRUE;
+
+	doc->priv->match_index_id = 0;
+	g_object_notify (G_OBJECT (doc), "search-match-count");
+
+	return FALSE;
+}
+
+static void
+reset_match_index (LapizDocument *doc)
+{
+	gboolean notify;
+
+	notify = match_index_is_complete (doc);
+
+	disable_match_index (doc);
+
+	if (lapiz_document_get_can_search_again (doc) &&
+	    !search_spans_lines (doc) &&
+	    (doc->priv->loader == NULL))
+	{
+		doc->priv->match_index = lapiz_match_index_new ();
+		doc->priv->match_index_scanned = 0;
+		doc->priv->match_index_n_chars = ctk_text_buffer_get_char_count (CTK_TEXT_BUFFER (doc));
+
+		doc->priv->match_index_id = g_idle_add_full (G_PRIORITY_LOW,
+							     (GSourceFunc) build_match_index,
+							     doc,
+							     NULL);
+	}
+
+	if (notify)
+		g_object_notify (G_OBJECT (doc), "search-match-count");
+}
+
+/* Brings the match index up to date after @n_deleted characters were
+ * deleted at @start, or the text between @start and @end was inserted.
+ * Only the lines around the change are searched again, and the ones
+ * after them as long as the matches found there differ from the old
+ * ones (for instance "aa" in a run of 'a'). */
+static void
+update_match_index (LapizDocument     *doc,
+		    const CtkTextIter *start,
+		    const CtkTextIter *end,
+		    gint               n_deleted)
+{
+	LapizMatchIndex *index = doc->priv->match_index;
+	CtkTextIter iter;
+	gint offset;
+	gint n_inserted;
+	gint scanned;
+	gint pos;
+	gint limit;
+	gint old_reach;
+	guint old_length;
+	guint n, i;
+
+	if (index == NULL)
+		return;
+
+	old_length = lapiz_match_index_get_length (index);
+	offset = ctk_text_iter_get_offset (start);
+	n_inserted = ctk_text_iter_get_offset (end) - offset;
+
+	/* the matches touching the change go away and the ones after it
+	 * are moved */
+	n = lapiz_match_index_find_prev (index, offset) + 1;
+	i = lapiz_match_index_find_next (index, offset + n_deleted);
+	old_reach = offset;
+
+	if (i > n)
+	{
+		gint match_end;
+
+		lapiz_match_index_get_nth (index, i - 1, NULL, &match_end);
+
+		if (match_end > offset + n_deleted)
+			old_reach = match_end + n_inserted - n_deleted;
+
+		lapiz_match_index_remove (index, n, i - n);
+	}
+
+	lapiz_match_index_shift (index, offset, n_inserted - n_deleted);
+
+	/* a complete index stays complete */
+	scanned = doc->priv->match_index_scanned;
+
+	if ((offset < scanned) || (scanned >= doc->priv->match_index_n_chars))
+		scanned = MAX (scanned + n_inserted - n_deleted, offset);
+
+	doc->priv->match_index_n_chars += n_inserted - n_deleted;
+
+	/* the lines around the change */
+	iter = *start;
+	ctk_text_iter_backward_lines (&iter, doc->priv->num_of_lines_search_text);
+	pos = ctk_text_iter_get_offset (&iter);
+
+	iter = *end;
+	ctk_text_iter_forward_line (&iter);
+	limit = MIN (ctk_text_iter_get_offset (&iter), scanned);
+
+	if (pos < scanned)
+	{
+		n = lapiz_match_index_find_prev (index, pos) + 1;
+
+		/* a match across the start of the lines is searched again
+		 * as a whole */
+		if (n < lapiz_match_index_get_length (index))
+		{
+			gint match_start;
+
+			lapiz_match_index_get_nth (index, n, &match_start, NULL);
+			pos = MIN (pos, match_start);
+		}
+
+		while (TRUE)
+		{
+			guint n_found;
+			gint match_start;
+
+			/* drop the old matches starting before limit */
+			i = lapiz_match_index_find_next (index, limit);
+
+			if (i > n)
+			{
+				gint match_end;
+
+				lapiz_match_index_get_nth (index, i - 1, NULL, &match_end);
+				old_reach = MAX (old_reach, match_end);
+				lapiz_match_index_remove (index, n, i - n);
+			}
+
+			pos = scan_matches (doc, n, pos, limit, &n_found);
+
+			if (pos < 0)
+			{
+				disable_match_index (doc);
+				g_object_notify (G_OBJECT (doc), "search-match-count");
+				return;
+			}
+
+			n += n_found;
+			scanned = MAX (scanned, pos);
+
+			if (limit >= scanned)
+				break;
+
+			if (n < lapiz_match_index_get_length (index))
+				lapiz_match_index_get_nth (index, n, &match_start, NULL);
+			else
+				match_start = G_MAXINT;
+
+			/* the new matches meet the old ones */
+			if ((old_reach <= pos) && (match_start >= pos))
+				break;
+
+			ctk_text_buffer_get_iter_at_offset (CTK_TEXT_BUFFER (doc),
+							    &iter,
+							    MAX (old_reach, pos));
+			ctk_text_iter_forward_line (&iter);
+			limit = MIN (ctk_text_iter_get_offset (&iter), scanned);
+		}
+	}
+
+	doc->priv->match_index_scanned = scanned;
+
+	if (match_index_is_complete (doc) &&
+	    (lapiz_match_index_get_length (index) != old_length))
+	{
+		g_object_notify (G_OBJECT (doc), "search-match-count");
+	}
+}
+
+/* Looks for the first match after @start, or the last one before @end,
+ * in the match index. Returns FALSE if the index does not cover the
+ * whole document yet. */
+static gboolean
+search_match_index (LapizDocument     *doc,
+		    const CtkTextIter *start,
+		    const CtkTextIter *end,
+		    gboolean           forward,
+		    CtkTextIter       *match_start,
+		    CtkTextIter       *match_end,
+		    gboolean          *found)
+{
+	LapizMatchIndex *index = doc->priv->match_index;
+	gint from, to;
+	gint m_start, m_end;
+
+	if (!match_index_is_complete (doc))
+		return FALSE;
+
+	from = (start != NULL) ? ctk_text_iter_get_offset (start) : 0;
+	to = (end != NULL) ? ctk_text_iter_get_offset (end) :
+			     ctk_text_buffer_get_char_count (CTK_TEXT_BUFFER (doc));
+
+	*found = FALSE;
+
+	if (forward)
+	{
+		guint n = lapiz_match_index_find_next (index, from);
+
+		if (n == lapiz_match_index_get_length (index))
+			return TRUE;
+
+		lapiz_match_index_get_nth (index, n, &m_start, &m_end);
+	}
+	else
+	{
+		gint n = lapiz_match_index_find_prev (index, to);
+
+		if (n < 0)
+			return TRUE;
+
+		lapiz_match_index_get_nth (index, n, &m_start, &m_end);
+	}
+
+	if ((m_start < from) || (m_end > to))
+		return TRUE;
+
+	ctk_text_buffer_get_iter_at_offset (CTK_TEXT_BUFFER (doc), match_start, m_start);
+	ctk_text_buffer_get_iter_at_offset (CTK_TEXT_BUFFER (doc), match_end, m_end);
+
+	/* the regex search also expands the replacement with the match */
+	if (LAPIZ_SEARCH_IS_MATCH_REGEX (doc->priv->search_flags))
+	{
+		CtkTextSearchFlags search_flags = 0;
+		CtkTextIter iter = *match_start;
+		CtkTextIter limit = *match_end;
+
+		if (!LAPIZ_SEARCH_IS_CASE_SENSITIVE (doc->priv->search_flags))
+			search_flags |= CTK_TEXT_SEARCH_CASE_INSENSITIVE;
+
+		if (!lapiz_ctk_text_iter_regex_search (&iter,
+						       doc->priv->search_text,
+						       search_flags,
+						       match_start,
+						       match_end,
+						       &limit,
+						       TRUE,
+						       &doc->priv->last_replace_text))
+		{
+			return FALSE;
+		}
+	}
+
+	*found = TRUE;
+
+	return TRUE;
+}
+
+/**
+ * lapiz_document_get_search_match_count:
+ * @doc: a #LapizDocument
+ *
+ * Returns the number of matches of the search text in @doc. The matches
+ * are counted in the background when the search text is set.
+ *
+ * Return value: the number of matches, or -1 if they have not been
+ * counted yet.
+ */
+gint
+lapiz_document_get_search_match_count (LapizDocument *doc)
+{
+	g_return_val_if_fail (LAPIZ_IS_DOCUMENT (doc), -1);
+
+	if (!match_index_is_complete (doc))
+		return -1;
+
+	return lapiz_match_index_get_length (doc->priv->match_index);
+}
+
+/**
+ * lapiz_document_get_search_match_index:
+ * @doc: a #LapizDocument
+ * @match_start: the start of a match
+ * @match_end: the end of a match
+ *
+ * Returns the position of the match going from @match_start to @match_end
+ * among all the matches of the search text in @doc.
+ *
+ * Return value: the position of the match, counting from 1, or 0 if it
+ * is not a match or the matches have not been counted yet.
+ */
+gint
+lapiz_document_get_search_match_index (LapizDocument     *doc,
+				       const CtkTextIter *match_start,
+				       const CtkTextIter *match_end)
+{
+	g_return_val_if_fail (LAPIZ_IS_DOCUMENT (doc), 0);
+	g_return_val_if_fail (match_start != NULL && match_end != NULL, 0);
+
+	if (!match_index_is_complete (doc))
+		return 0;
+
+	return lapiz_match_index_lookup (doc->priv->match_index,
+					 ctk_text_iter_get_offset (match_start),
+					 ctk_text_iter_get_offset (match_end)) + 1;
+}
+
 /**
  * lapiz_document_set_search_text:
  * @doc:
@@ -1897,6 +2598,7 @@ lapiz_document_set_search_text (LapizDocument *doc,
 		g_free (doc->priv->search_text);
 
 		doc->priv->search_text = converted_text;
+		clear_compiled_search (doc);
 		doc->priv->num_of_lines_search_text = compute_num_of_lines (doc->priv->search_text);
 		update_to_search_region = TRUE;
 	}
@@ -1904,7 +2606,10 @@ lapiz_document_set_search_text (LapizDocument *doc,
 	if (!LAPIZ_SEARCH_IS_DONT_SET_FLAGS (flags))
 	{
 		if (doc->priv->search_flags != flags)
+		{
 			update_to_search_region = TRUE;
+			clear_compiled_search (doc);
+		}
 
 		doc->priv->search_flags = flags;
 
@@ -1915,6 +2620,10 @@ lapiz_document_set_search_text (LapizDocument *doc,
 		CtkTextIter begin;
 		CtkTextIter end;
 
+		/* the views ask again for the lines they show */
+		cancel_search_highlight (doc);
+		reset_match_index (doc);
+
 		ctk_text_buffer_get_bounds (CTK_TEXT_BUFFER (doc),
 					    &begin,
 					    &end);
@@ -2023,44 +2732,50 @@ lapiz_document_search_forward (LapizDocument     *doc,
 	else
 		iter = *start;
 
-	search_flags = CTK_TEXT_SEARCH_VISIBLE_ONLY | CTK_TEXT_SEARCH_TEXT_ONLY;
-
-	if (!LAPIZ_SEARCH_IS_CASE_SENSITIVE (doc->priv->search_flags))
-	{
-		search_flags = search_flags | CTK_TEXT_SEARCH_CASE_INSENSITIVE;
-	}
-
-	while (!found)
+	if (!search_match_index (doc, &iter, end, TRUE,
+				 &m_start, &m_end, &found))
 	{
-		if(!LAPIZ_SEARCH_IS_MATCH_REGEX(doc->priv->search_flags))
+		if (!LAPIZ_SEARCH_IS_MATCH_REGEX (doc->priv->search_flags))
 		{
-			found = ctk_text_iter_forward_search (&iter,
-							      doc->priv->search_text,
-							      search_flags,
+			/* entire words are checked by the literal search */
+			found = lapiz_literal_search_forward (get_literal_search (doc),
+							      &iter,
+							      end,
 							      &m_start,
-							      &m_end,
-							      end);
-		} else {
-			found = lapiz_ctk_text_iter_regex_search (&iter,
-								  doc->priv->search_text,
-								  search_flags,
-								  &m_start,
-								  &m_end,
-								  end,
-								  TRUE,
-								  &doc->priv->last_replace_text);
+							      &m_end);
 		}
-
-		if (found && LAPIZ_SEARCH_IS_ENTIRE_WORD (doc->priv->search_flags))
+		else
 		{
-			found = ctk_text_iter_starts_word (&m_start) &&
-					ctk_text_iter_ends_word (&m_end);
+			search_flags = CTK_TEXT_SEARCH_VISIBLE_ONLY | CTK_TEXT_SEARCH_TEXT_ONLY;
 
-			if (!found)
-				iter = m_end;
+			if (!LAPIZ_SEARCH_IS_CASE_SENSITIVE (doc->priv->search_flags))
+			{
+				search_flags = search_flags | CTK_TEXT_SEARCH_CASE_INSENSITIVE;
+			}
+
+			while (!found)
+			{
+				found = lapiz_ctk_text_iter_regex_search (&iter,
+									  doc->priv->search_text,
+									  search_flags,
+									  &m_start,
+									  &m_end,
+									  end,
+									  TRUE,
+									  &doc->priv->last_replace_text);
+
+				if (found && LAPIZ_SEARCH_IS_ENTIRE_WORD (doc->priv->search_flags))
+				{
+					found = ctk_text_iter_starts_word (&m_start) &&
+							ctk_text_iter_ends_word (&m_end);
+
+					if (!found)
+						iter = m_end;
+				}
+				else
+					break;
+			}
 		}
-		else
-			break;
 	}
 
 	if (found && (match_start != NULL))
@@ -2112,46 +2827,50 @@ lapiz_document_search_backward (LapizDocument     *doc,
 	else
 		iter = *end;
 
-	search_flags = CTK_TEXT_SEARCH_VISIBLE_ONLY | CTK_TEXT_SEARCH_TEXT_ONLY;
-
-	if (!LAPIZ_SEARCH_IS_CASE_SENSITIVE (doc->priv->search_flags))
-	{
-		search_flags = search_flags | CTK_TEXT_SEARCH_CASE_INSENSITIVE;
-	}
-
-	while (!found)
+	if (!search_match_index (doc, start, &iter, FALSE,
+				 &m_start, &m_end, &found))
 	{
-		if(!LAPIZ_SEARCH_IS_MATCH_REGEX(doc->priv->search_flags))
+		if (!LAPIZ_SEARCH_IS_MATCH_REGEX (doc->priv->search_flags))
 		{
-			found = ctk_text_iter_backward_search (&iter,
-							       doc->priv->search_text,
-							       search_flags,
+			/* entire words are checked by the literal search */
+			found = lapiz_literal_search_backward (get_literal_search (doc),
+							       &iter,
+							       start,
 							       &m_start,
-							       &m_end,
-							       start);
+							       &m_end);
 		}
 		else
 		{
-			found = lapiz_ctk_text_iter_regex_search (&iter,
-								  doc->priv->search_text,
-								  search_flags,
-								  &m_start,
-								  &m_end,
-								  start,
-								  FALSE,
-								  &doc->priv->last_replace_text);
-		}
+			search_flags = CTK_TEXT_SEARCH_VISIBLE_ONLY | CTK_TEXT_SEARCH_TEXT_ONLY;
 
-		if (found && LAPIZ_SEARCH_IS_ENTIRE_WORD (doc->priv->search_flags))
-		{
-			found = ctk_text_iter_starts_word (&m_start) &&
-			ctk_text_iter_ends_word (&m_end);
+			if (!LAPIZ_SEARCH_IS_CASE_SENSITIVE (doc->priv->search_flags))
+			{
+				search_flags = search_flags | CTK_TEXT_SEARCH_CASE_INSENSITIVE;
+			}
 
-			if (!found)
-				iter = m_start;
+			while (!found)
+			{
+				found = lapiz_ctk_text_iter_regex_search (&iter,
+									  doc->priv->search_text,
+									  search_flags,
+									  &m_start,
+									  &m_end,
+									  start,
+									  FALSE,
+									  &doc->priv->last_replace_text);
+
+				if (found && LAPIZ_SEARCH_IS_ENTIRE_WORD (doc->priv->search_flags))
+				{
+					found = ctk_text_iter_starts_word (&m_start) &&
+					ctk_text_iter_ends_word (&m_end);
+
+					if (!found)
+						iter = m_start;
+				}
+				else
+					break;
+			}
 		}
-		else
-			break;
 	}
 
 	if (found && (match_start != NULL))
@@ -2163,6 +2882,144 @@ lapiz_document_search_backward (LapizDocument     *doc,
 	return found;
 }
 
+typedef struct
+{
+	gint start;
+	gint end;
+	gsize replace_pos;
+	gsize replace_len;
+} RegexReplacement;
+
+/* Replaces all the matches of the regex @search_text: the text is read
+ * and matched once, then each match is replaced on its own, from the
+ * last to the first so that the offsets of the previous ones stay
+ * valid. The text between the matches is left alone, with its marks
+ * and tags. Returns the number of replacements, or -1 if the buffer
+ * cannot be handled this way because the text skips hidden text or
+ * embedded objects. */
+static gint
+regex_replace_all (LapizDocument *doc,
+		   const gchar   *search_text,
+		   const gchar   *replace,
+		   guint          flags)
+{
+	CtkTextBuffer *buffer = CTK_TEXT_BUFFER (doc);
+	GRegexCompileFlags compile_flags = 0;
+	GRegex *regex;
+	GMatchInfo *match_info;
+	CtkTextIter start;
+	CtkTextIter end;
+	CtkTextIter word_iter;
+	GArray *replacements;
+	GString *new_text;
+	gchar *text;
+	gint last_pos = 0;
+	gint last_offset = 0;
+	gint word_iter_offset = 0;
+	gint cont;
+	gint i;
+
+	if (!LAPIZ_SEARCH_IS_CASE_SENSITIVE (flags))
+		compile_flags |= G_REGEX_CASELESS;
+
+	regex = lapiz_utils_get_cached_regex (buffer, search_text, compile_flags);
+
+	if (regex == NULL)
+		return 0;
+
+	if (!g_regex_check_replacement (replace, NULL, NULL))
+	{
+		g_regex_unref (regex);
+		return 0;
+	}
+
+	ctk_text_buffer_get_bounds (buffer, &start, &end);
+	text = ctk_text_iter_get_visible_text (&start, &end);
+
+	if (g_utf8_strlen (text, -1) != ctk_text_buffer_get_char_count (buffer))
+	{
+		g_free (text);
+		g_regex_unref (regex);
+		return -1;
+	}
+
+	replacements = g_array_new (FALSE, FALSE, sizeof (RegexReplacement));
+	new_text = g_string_new (NULL);
+	word_iter = start;
+
+	g_regex_match (regex, text, 0, &match_info);
+
+	while (g_match_info_matches (match_info))
+	{
+		RegexReplacement r;
+		gint start_pos;
+		gint end_pos;
+
+		g_match_info_fetch_pos (match_info, 0, &start_pos, &end_pos);
+
+		/* the offsets only move forward, by the distance from
+		 * the previous match */
+		r.start = last_offset + g_utf8_pointer_to_offset (text + last_pos,
+								  text + start_pos);
+		r.end = r.start + g_utf8_pointer_to_offset (text + start_pos,
+							    text + end_pos);
+
+		last_pos = start_pos;
+		last_offset = r.start;
+
+		if (LAPIZ_SEARCH_IS_ENTIRE_WORD (flags))
+		{
+			CtkTextIter word_end;
+
+			ctk_text_iter_forward_chars (&word_iter, r.start - word_iter_offset);
+			word_iter_offset = r.start;
+
+			word_end = word_iter;
+			ctk_text_iter_forward_chars (&word_end, r.end - r.start);
+
+			if (!ctk_text_iter_starts_word (&word_iter) ||
+			    !ctk_text_iter_ends_word (&word_end))
+			{
+				g_match_info_next (match_info, NULL);
+				continue;
+			}
+		}
+
+		r.replace_pos = new_text->len;
+		g_match_info_expand_references (match_info, replace, new_text);
+		r.replace_len = new_text->len - r.replace_pos;
+
+		g_array_append_val (replacements, r);
+
+		g_match_info_next (match_info, NULL);
+	}
+
+	g_match_info_free (match_info);
+	g_regex_unref (regex);
+	g_free (text);
+
+	cont = replacements->len;
+
+	for (i = cont - 1; i >= 0; --i)
+	{
+		RegexReplacement *r = &g_array_index (replacements, RegexReplacement, i);
+
+		ctk_text_buffer_get_iter_at_offset (buffer, &start, r->start);
+		ctk_text_buffer_get_iter_at_offset (buffer, &end, r->end);
+
+		ctk_text_buffer_delete (buffer, &start, &end);
+		ctk_text_buffer_insert (buffer,
+					&start,
+					new_text->str + r->replace_pos,
+					r->replace_len);
+	}
+
+	g_string_free (new_text, TRUE);
+	g_array_unref (replacements);
+
+	return cont;
+}
+
 /* FIXME this is an issue for introspection regardning @find */
 gint
 lapiz_document_replace_all (LapizDocument       *doc,
@@ -2226,7 +3083,16 @@ lapiz_document_replace_all (LapizDocument       *doc,
 
 	ctk_text_buffer_begin_user_action (buffer);
 
-	do
+	if (LAPIZ_SEARCH_IS_MATCH_REGEX (flags))
+	{
+		cont = regex_replace_all (doc, search_text, replace, flags);
+
+		/* the matches are already replaced */
+		found = (cont < 0);
+		cont = MAX (cont, 0);
+	}
+
+	while (found)
 	{
 		if(!LAPIZ_SEARCH_IS_MATCH_REGEX(flags))
 		{
@@ -2279,8 +3145,7 @@ lapiz_document_replace_all (LapizDocument       *doc,
 
 			iter = m_start;
         }
-
-	} while (found);
+	}
 
 	ctk_text_buffer_end_user_action (buffer);
 
@@ -2445,7 +3310,22 @@ text_tag_set_highest_priority (CtkTextTag    *tag,
 
 	table = ctk_text_buffer_get_tag_table (buffer);
 	n = ctk_text_tag_table_get_size (table);
-	ctk_text_tag_set_priority (tag, n - 1);
+
+	/* setting the priority renumbers all the tags of the table,
+	 * only do it when a tag was added since the last time */
+	if (ctk_text_tag_get_priority (tag) != n - 1)
+		ctk_text_tag_set_priority (tag, n - 1);
+}
+
+static void
+apply_found_tag (const CtkTextIter *match_start,
+		 const CtkTextIter *match_end,
+		 LapizDocument     *doc)
+{
+	ctk_text_buffer_apply_tag (CTK_TEXT_BUFFER (doc),
+				   doc->priv->found_tag,
+				   match_start,
+				   match_end);
 }
 
 static void
@@ -2453,12 +3333,6 @@ search_region (LapizDocument *doc,
 	       CtkTextIter   *start,
 	       CtkTextIter   *end)
 {
-	CtkTextIter iter;
-	CtkTextIter m_start;
-	CtkTextIter m_end;
-	CtkTextSearchFlags search_flags = 0;
-	gboolean found = TRUE;
-
 	CtkTextBuffer *buffer;
 
 	lapiz_debug (DEBUG_DOCUMENT);
@@ -2514,49 +3388,47 @@ search_region (LapizDocument *doc,
 	if (*doc->priv->search_text == '\0')
 		return;
 
-	iter = *start;
-
-	search_flags = CTK_TEXT_SEARCH_VISIBLE_ONLY | CTK_TEXT_SEARCH_TEXT_ONLY;
-
-	if (!LAPIZ_SEARCH_IS_CASE_SENSITIVE (doc->priv->search_flags))
+	/* once the matches are all indexed the region is not searched */
+	if (match_index_is_complete (doc))
 	{
-		search_flags = search_flags | CTK_TEXT_SEARCH_CASE_INSENSITIVE;
-	}
+		gint start_offset, end_offset;
+		guint n, length;
 
-	do
-	{
-		if ((end != NULL) && ctk_text_iter_is_end (end))
-			end = NULL;
+		start_offset = ctk_text_iter_get_offset (start);
+		end_offset = ctk_text_iter_get_offset (end);
+		length = lapiz_match_index_get_length (doc->priv->match_index);
 
-		found = ctk_text_iter_forward_search (&iter,
-							doc->priv->search_text,
-							search_flags,
-                        	                	&m_start,
-                        	                	&m_end,
-                                	               	end);
+		for (n = lapiz_match_index_find_next (doc->priv->match_index, start_offset);
+		     n < length;
+		     ++n)
+		{
+			CtkTextIter m_start, m_end;
+			gint m_start_offset, m_end_offset;
 
-		iter = m_end;
+			lapiz_match_index_get_nth (doc->priv->match_index,
+						   n,
+						   &m_start_offset,
+						   &m_end_offset);
 
-		if (found && LAPIZ_SEARCH_IS_ENTIRE_WORD (doc->priv->search_flags))
-		{
-			gboolean word;
+			if (m_end_offset > end_offset)
+				break;
 
-			word = ctk_text_iter_starts_word (&m_start) &&
-			       ctk_text_iter_ends_word (&m_end);
+			ctk_text_buffer_get_iter_at_offset (buffer, &m_start, m_start_offset);
+			ctk_text_buffer_get_iter_at_offset (buffer, &m_end, m_end_offset);
 
-			if (!word)
-				continue;
+			apply_found_tag (&m_start, &m_end, doc);
 		}
 
-		if (found)
-		{
-			ctk_text_buffer_apply_tag (buffer,
-						   doc->priv->found_tag,
-						   &m_start,
-						   &m_end);
-		}
+		return;
+	}
 
-	} while (found);
+	/* the text of the region is read once and all the matches are
+	 * tagged from it */
+	search_foreach (doc,
+			start,
+			end,
+			(LapizLiteralSearchFunc) apply_found_tag,
+			doc);
 }
 
 static void
@@ -2587,13 +3459,130 @@ to_search_region_range (LapizDocument *doc,
 	g_signal_emit (doc, document_signals [SEARCH_HIGHLIGHT_UPDATED], 0, start, end);
 }
 
+static void
+cancel_search_highlight (LapizDocument *doc)
+{
+	if (doc->priv->highlight_id != 0)
+	{
+		g_source_remove (doc->priv->highlight_id);
+		doc->priv->highlight_id = 0;
+	}
+}
+
+/* gets the first part of lines [start_line, end_line) still to be
+ * highlighted, no longer than SEARCH_HIGHLIGHT_CHUNK_LINES */
+static gboolean
+get_search_highlight_chunk (LapizDocument *doc,
+			    gint           start_line,
+			    gint           end_line,
+			    CtkTextIter   *chunk_start,
+			    CtkTextIter   *chunk_end)
+{
+	CtkTextBuffer *buffer;
+	LapizTextRegion *region;
+	CtkTextIter start, end, limit;
+
+	buffer = CTK_TEXT_BUFFER (doc);
+
+	ctk_text_buffer_get_iter_at_line (buffer, &start, MAX (start_line, 0));
+	ctk_text_buffer_get_iter_at_line (buffer, &end, end_line);
+	if (ctk_text_iter_get_line (&end) < end_line)
+		ctk_text_buffer_get_end_iter (buffer, &end);
+
+	region = lapiz_text_region_intersect (doc->priv->to_search_region,
+					      &start,
+					      &end);
+	if (region == NULL)
+		return FALSE;
+
+	lapiz_text_region_nth_subregion (region, 0, chunk_start, chunk_end);
+	lapiz_text_region_destroy (region, TRUE);
+
+	limit = *chunk_start;
+	ctk_text_iter_forward_lines (&limit, SEARCH_HIGHLIGHT_CHUNK_LINES);
+
+	if (ctk_text_iter_compare (&limit, chunk_end) < 0)
+		*chunk_end = limit;
+
+	return TRUE;
+}
+
+static gboolean
+search_highlight_slice (LapizDocument *doc)
+{
+	gint64 deadline;
+
+	lapiz_debug (DEBUG_DOCUMENT);
+
+	/* the chunks would cut the matches, search the whole text at once */
+	if (search_spans_lines (doc))
+	{
+		CtkTextIter start, end;
+
+		if (lapiz_text_region_subregions (doc->priv->to_search_region) > 0)
+		{
+			ctk_text_buffer_get_bounds (CTK_TEXT_BUFFER (doc), &start, &end);
+			search_region (doc, &start, &end);
+
+			ctk_text_buffer_get_bounds (CTK_TEXT_BUFFER (doc), &start, &end);
+			lapiz_text_region_subtract (doc->priv->to_search_region,
+						    &start,
+						    &end);
+		}
+
+		doc->priv->highlight_id = 0;
+		return FALSE;
+	}
+
+	deadline = g_get_monotonic_time () + SEARCH_HIGHLIGHT_SLICE_USEC;
+
+	do
+	{
+		CtkTextIter chunk_start, chunk_end;
+		CtkTextIter start_search, end_search;
+
+		/* the visible lines first, then the margin around them */
+		if (!get_search_highlight_chunk (doc,
+						 doc->priv->highlight_visible_start,
+						 doc->priv->highlight_visible_end,
+						 &chunk_start,
+						 &chunk_end) &&
+		    !get_search_highlight_chunk (doc,
+						 doc->priv->highlight_visible_start -
+						 SEARCH_HIGHLIGHT_MARGIN_LINES,
+						 doc->priv->highlight_visible_end +
+						 SEARCH_HIGHLIGHT_MARGIN_LINES,
+						 &chunk_start,
+						 &chunk_end))
+		{
+			doc->priv->highlight_id = 0;
+			return FALSE;
+		}
+
+		start_search = chunk_start;
+		end_search = chunk_end;
+
+		search_region (doc, &start_search, &end_search);
+
+		/* remove the just highlighted chunk */
+		lapiz_text_region_subtract (doc->priv->to_search_region,
+					    &chunk_start,
+					    &chunk_end);
+	}
+	while (g_get_monotonic_time () < deadline);
+
+	/* let the view redraw before going on */
+	doc->priv->highlight_id = g_idle_add ((GSourceFunc) search_highlight_slice,
+					      doc);
+
+	return FALSE;
+}
+
 void
 _lapiz_document_search_region (LapizDocument     *doc,
 			       const CtkTextIter *start,
 			       const CtkTextIter *end)
 {
-	LapizTextRegion *region;
-
 	lapiz_debug (DEBUG_DOCUMENT);
 
 	g_return_if_fail (LAPIZ_IS_DOCUMENT (doc));
@@ -2608,38 +3597,17 @@ _lapiz_document_search_region (LapizDocument     *doc,
 					   ctk_text_iter_get_line (end), ctk_text_iter_get_offset (end));
 	*/
 
-	/* get the subregions not yet highlighted */
-	region = lapiz_text_region_intersect (doc->priv->to_search_region,
-					      start,
-					      end);
-	if (region)
-	{
-		gint i;
-		CtkTextIter start_search;
-		CtkTextIter end_search;
-
-		i = lapiz_text_region_subregions (region);
-		lapiz_text_region_nth_subregion (region,
-						 0,
-						 &start_search,
-						 NULL);
-
-		lapiz_text_region_nth_subregion (region,
-						 i - 1,
-						 NULL,
-						 &end_search);
-
-		lapiz_text_region_destroy (region, TRUE);
-
-		ctk_text_iter_order (&start_search, &end_search);
+	/* only the lines shown last are highlighted, the work left for
+	 * the lines shown before is dropped */
+	doc->priv->highlight_visible_start = ctk_text_iter_get_line (start);
+	doc->priv->highlight_visible_end = ctk_text_iter_get_line (end) + 1;
 
-		search_region (doc, &start_search, &end_search);
+	cancel_search_highlight (doc);
 
-		/* remove the just highlighted region */
-		lapiz_text_region_subtract (doc->priv->to_search_region,
-					    start,
-					    end);
-	}
+	doc->priv->highlight_id = g_idle_add_full (SEARCH_HIGHLIGHT_PRIORITY,
+						   (GSourceFunc) search_highlight_slice,
+						   doc,
+						   NULL);
 }
 
 static void
@@ -2653,6 +3621,10 @@ insert_text_cb (LapizDocument *doc,
 
 	lapiz_debug (DEBUG_DOCUMENT);
 
+	/* the whole text is searched once loaded */
+	if (doc->priv->loader != NULL)
+		return;
+
 	start = end = *pos;
 
 	/*
@@ -2664,6 +3636,8 @@ insert_text_cb (LapizDocument *doc,
 	ctk_text_iter_backward_chars (&start,
 				      g_utf8_strlen (text, length));
 
+	update_match_index (doc, &start, &end, 0);
+
 	to_search_region_range (doc, &start, &end);
 }
 
@@ -2677,9 +3651,22 @@ delete_range_cb (LapizDocument *doc,
 
 	lapiz_debug (DEBUG_DOCUMENT);
 
+	if (doc->priv->loader != NULL)
+		return;
+
 	d_start = *start;
 	d_end = *end;
 
+	if (doc->priv->match_index != NULL)
+	{
+		gint n_deleted;
+
+		n_deleted = doc->priv->match_index_n_chars -
+			    ctk_text_buffer_get_char_count (CTK_TEXT_BUFFER (doc));
+
+		update_match_index (doc, &d_start, &d_end, n_deleted);
+	}
+
 	to_search_region_range (doc, &d_start, &d_end);
 }
 
@@ -2713,6 +3700,8 @@ lapiz_document_set_enable_search_highlighting (LapizDocument *doc,
 				    		    &end);
 		}
 
+		cancel_search_highlight (doc);
+
 		lapiz_text_region_destroy (doc->priv->to_search_region,
 					   TRUE);
 		doc->priv->to_search_region = NULL;
@@ -220,6 +220,8 @@ gboolean	 lapiz_document_is_untitled 	(LapizDocument       *doc);
 
 gboolean	 lapiz_document_is_local	(LapizDocument       *doc);
 
+gboolean	 lapiz_document_is_loading	(LapizDocument       *doc);
+
 gboolean	 lapiz_document_get_deleted	(LapizDocument       *doc);
 
 gboolean	 lapiz_document_goto_line 	(LapizDocument       *doc,
@@ -258,6 +260,14 @@ gboolean	 lapiz_document_search_backward	(LapizDocument       *doc,
 						 CtkTextIter         *match_start,
 						 CtkTextIter         *match_end);
 
+gint		 lapiz_document_get_search_match_count
+						(LapizDocument       *doc);
+
+gint		 lapiz_document_get_search_match_index
+						(LapizDocument       *doc,
+						 const CtkTextIter   *match_start,
+						 const CtkTextIter   *match_end);
+
 gint		 lapiz_document_replace_all 	(LapizDocument       *doc,
 				            	 const gchar         *find,
 						 const gchar         *replace,
@@ -34,6 +34,7 @@
 #include <config.h>
 #endif
 
+#include <string.h>
 #include <glib/gi18n.h>
 #include <glib/gstdio.h>
 #include <gio/gio.h>
@@ -41,6 +42,7 @@
 #include "lapiz-gio-document-loader.h"
 #include "lapiz-document-output-stream.h"
 #include "lapiz-smart-charset-converter.h"
+#include "lapiz-utf8-scanner.h"
 #include "lapiz-prefs-manager.h"
 #include "lapiz-debug.h"
 #include "lapiz-utils.h"
@@ -59,6 +61,13 @@ typedef struct
 } AsyncData;
 
 #define READ_CHUNK_SIZE 8192
+
+/* Native files are mapped and converted on a worker thread in blocks of
+ * NATIVE_READ_CHUNK_SIZE; at most NATIVE_MAX_PENDING_CHUNKS converted blocks
+ * wait for the main loop to insert them before the worker blocks. */
+#define NATIVE_READ_CHUNK_SIZE (1024 * 1024)
+#define NATIVE_MAX_PENDING_CHUNKS 8
+#define MAX_UNICHAR_LEN 6
 #define REMOTE_QUERY_ATTRIBUTES G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE "," \
 				G_FILE_ATTRIBUTE_STANDARD_TYPE "," \
 				G_FILE_ATTRIBUTE_TIME_MODIFIED "," \
@@ -71,7 +80,44 @@ static void	    lapiz_gio_document_loader_load		(LapizDocumentLoader *loader);
 static gboolean     lapiz_gio_document_loader_cancel		(LapizDocumentLoader *loader);
 static goffset      lapiz_gio_document_loader_get_bytes_read	(LapizDocumentLoader *loader);
 
+typedef struct
+{
+	gchar *text;
+	gsize  len;
+
+	/* bytes of the file consumed to produce text */
+	gsize  bytes_read;
+
+	LapizUtf8Scan scan;
+} NativeChunk;
+
+typedef struct
+{
+	GThread                    *thread;
+	AsyncData                  *async;
+
+	gchar                      *path;
+	LapizSmartCharsetConverter *converter;
+	GCancellable               *cancellable;
+	gulong                      cancelled_id;
+
+	/* set from the main thread to stop the worker, atomic */
+	gint                        abort;
+
+	/* everything below is protected by the lock */
+	GMutex                      lock;
+	GCond                       cond;
+	GQueue                      chunks;
+	GError                     *error;
+	guint                       idle_id;
+	gboolean                    done;
+
+	/* the file could not be mapped, it is read from the stream */
+	gboolean                    fallback;
+} NativeLoad;
+
 static void open_async_read (AsyncData *async);
+static void native_load_free (NativeLoad *native);
 
 struct _LapizGioDocumentLoaderPrivate
 {
@@ -88,6 +134,9 @@ struct _LapizGioDocumentLoaderPrivate
 
 	gchar             buffer[READ_CHUNK_SIZE];
 
+	/* Fast path for local files */
+	NativeLoad       *native;
+
 	GError           *error;
 };
 
@@ -107,6 +156,12 @@ lapiz_gio_document_loader_dispose (GObject *object)
 		priv->cancellable = NULL;
 	}
 
+	if (priv->native != NULL)
+	{
+		native_load_free (priv->native);
+		priv->native = NULL;
+	}
+
 	if (priv->stream != NULL)
 	{
 		g_object_unref (priv->stream);
@@ -159,6 +214,7 @@ lapiz_gio_document_loader_init (LapizGioDocumentLoader *gvloader)
 	gvloader->priv = lapiz_gio_document_loader_get_instance_private (gvloader);
 
 	gvloader->priv->converter = NULL;
+	gvloader->priv->native = NULL;
 	gvloader->priv->error = NULL;
 }
 
@@ -290,6 +346,43 @@ write_complete (AsyncData *async)
 					    async);
 }
 
+static void
+finish_reading (AsyncData *async)
+{
+	LapizGioDocumentLoader *gvloader;
+	LapizDocumentLoader *loader;
+
+	gvloader = async->loader;
+	loader = LAPIZ_DOCUMENT_LOADER (gvloader);
+
+	g_output_stream_flush (gvloader->priv->output,
+			       NULL,
+			       &gvloader->priv->error);
+
+	loader->auto_detected_encoding =
+		lapiz_smart_charset_converter_get_guessed (gvloader->priv->converter);
+	loader->auto_detected_encoding_confidence =
+		lapiz_smart_charset_converter_get_confidence (gvloader->priv->converter);
+
+	loader->auto_detected_newline_type =
+		lapiz_document_output_stream_detect_newline_type (LAPIZ_DOCUMENT_OUTPUT_STREAM (gvloader->priv->output));
+
+	/* Check if we needed some fallback char, if so, check if there was
+	   a previous error and if not set a fallback used error */
+	/* FIXME Uncomment this when we want to manage conversion fallback */
+	/*if ((lapiz_smart_charset_converter_get_num_fallbacks (gvloader->priv->converter) != 0) &&
+	    gvloader->priv->error == NULL)
+	{
+		g_set_error_literal (&gvloader->priv->error,
+				     LAPIZ_DOCUMENT_ERROR,
+				     LAPIZ_DOCUMENT_ERROR_CONVERSION_FALLBACK,
+				     "There was a conversion error and it was "
+				     "needed to use a fallback char");
+	}*/
+
+	write_complete (async);
+}
+
 /* prototype, because they call each other... isn't C lovely */
 static void	read_file_chunk		(AsyncData *async);
 
@@ -375,35 +468,7 @@ async_read_cb (GInputStream *stream,
 	/* end of the file, we are done! */
 	if (async->read == 0)
 	{
-		LapizDocumentLoader *loader;
-
-		loader = LAPIZ_DOCUMENT_LOADER (gvloader);
-
-		g_output_stream_flush (gvloader->priv->output,
-				       NULL,
-				       &gvloader->priv->error);
-
-		loader->auto_detected_encoding =
-			lapiz_smart_charset_converter_get_guessed (gvloader->priv->converter);
-
-		loader->auto_detected_newline_type =
-			lapiz_document_output_stream_detect_newline_type (LAPIZ_DOCUMENT_OUTPUT_STREAM (gvloader->priv->output));
-
-		/* Check if we needed some fallback char, if so, check if there was
-		   a previous error and if not set a fallback used error */
-		/* FIXME Uncomment this when we want to manage conversion fallback */
-		/*if ((lapiz_smart_charset_converter_get_num_fallbacks (gvloader->priv->converter) != 0) &&
-		    gvloader->priv->error == NULL)
-		{
-			g_set_error_literal (&gvloader->priv->error,
-					     LAPIZ_DOCUMENT_ERROR,
-					     LAPIZ_DOCUMENT_ERROR_CONVERSION_FALLBACK,
-					     "There was a conversion error and it was "
-					     "needed to use a fallback char");
-		}*/
-
-		write_complete (async);
-
+		finish_reading (async);
 		return;
 	}
 
@@ -426,6 +491,427 @@ read_file_chunk (AsyncData *async)
 				   async);
 }
 
+static void
+start_stream_load (AsyncData *async)
+{
+	LapizGioDocumentLoader *gvloader;
+	GInputStream *conv_stream;
+
+	gvloader = async->loader;
+
+	conv_stream = g_converter_input_stream_new (gvloader->priv->stream,
+						    G_CONVERTER (gvloader->priv->converter));
+	g_object_unref (gvloader->priv->stream);
+
+	gvloader->priv->stream = conv_stream;
+
+	/* start reading */
+	read_file_chunk (async);
+}
+
+/*
+ * Native files: the file is mapped and a worker thread runs the encoding
+ * detection, the conversion and the UTF-8 validation in large blocks. The
+ * main loop only has to insert the finished chunks into the buffer, so the
+ * load time depends on memory bandwidth instead of on the number of main
+ * loop iterations.
+ */
+
+static void
+native_chunk_free (NativeChunk *chunk)
+{
+	g_free (chunk->text);
+	g_slice_free (NativeChunk, chunk);
+}
+
+static void
+native_load_free (NativeLoad *native)
+{
+	g_atomic_int_set (&native->abort, TRUE);
+
+	g_mutex_lock (&native->lock);
+	g_cond_broadcast (&native->cond);
+	g_mutex_unlock (&native->lock);
+
+	if (native->thread != NULL)
+		g_thread_join (native->thread);
+
+	/* the worker is gone, no need to lock anymore */
+	if (native->idle_id != 0)
+		g_source_remove (native->idle_id);
+
+	g_cancellable_disconnect (native->cancellable, native->cancelled_id);
+
+	g_queue_foreach (&native->chunks, (GFunc) native_chunk_free, NULL);
+	g_queue_clear (&native->chunks);
+
+	if (native->async != NULL)
+		async_data_free (native->async);
+
+	if (native->error != NULL)
+		g_error_free (native->error);
+
+	g_object_unref (native->converter);
+	g_object_unref (native->cancellable);
+	g_free (native->path);
+
+	g_mutex_clear (&native->lock);
+	g_cond_clear (&native->cond);
+
+	g_slice_free (NativeLoad, native);
+}
+
+static void
+native_load_cancelled_cb (GCancellable *cancellable G_GNUC_UNUSED,
+			  NativeLoad   *native)
+{
+	/* wake up the worker if it is waiting for the main loop */
+	g_mutex_lock (&native->lock);
+	g_cond_broadcast (&native->cond);
+	g_mutex_unlock (&native->lock);
+}
+
+static gboolean native_load_idle (AsyncData *async);
+
+/* called with the lock held */
+static void
+native_load_schedule_idle (NativeLoad *native)
+{
+	if (native->idle_id == 0 && !g_atomic_int_get (&native->abort))
+	{
+		native->idle_id = g_idle_add_full (G_PRIORITY_HIGH_IDLE,
+						   (GSourceFunc) native_load_idle,
+						   native->async,
+						   NULL);
+	}
+}
+
+static gboolean
+native_load_should_stop (NativeLoad *native)
+{
+	return g_atomic_int_get (&native->abort) ||
+	       g_cancellable_is_cancelled (native->cancellable);
+}
+
+/* Converts the block of the mapped file at @in to UTF-8, prepending the
+ * @tail left over by the previous block. On return @tail contains the bytes
+ * that cannot be inserted yet (a truncated character or a trailing CR) and
+ * @nread the number of input bytes consumed. */
+static NativeChunk *
+native_convert_block (NativeLoad   *native,
+		      const gchar  *in,
+		      gsize         inlen,
+		      gboolean      at_end,
+		      gchar        *tail,
+		      gsize        *tail_len,
+		      gsize        *nread,
+		      GError      **error)
+{
+	NativeChunk *chunk;
+	LapizUtf8Scan scan;
+	gchar *out;
+	gsize out_size;
+	gsize nwritten;
+	const gchar *end;
+	gsize valid_len;
+
+	out_size = *tail_len + inlen * 4 + MAX_UNICHAR_LEN;
+	out = g_malloc (out_size);
+
+	memcpy (out, tail, *tail_len);
+	nwritten = *tail_len;
+	*tail_len = 0;
+	*nread = 0;
+
+	while (TRUE)
+	{
+		GConverterResult res;
+		gsize bytes_read;
+		gsize bytes_written;
+		GError *err = NULL;
+
+		res = g_converter_convert (G_CONVERTER (native->converter),
+					   in + *nread,
+					   inlen - *nread,
+					   out + nwritten,
+					   out_size - nwritten,
+					   at_end ? G_CONVERTER_INPUT_AT_END : G_CONVERTER_NO_FLAGS,
+					   &bytes_read,
+					   &bytes_written,
+					   &err);
+
+		if (res == G_CONVERTER_ERROR)
+		{
+			if (!at_end &&
+			    g_error_matches (err, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT))
+			{
+				/* the rest goes with the next block */
+				g_error_free (err);
+				break;
+			}
+
+			if (g_error_matches (err, G_IO_ERROR, G_IO_ERROR_NO_SPACE))
+			{
+				g_error_free (err);
+				out_size *= 2;
+				out = g_realloc (out, out_size);
+				continue;
+			}
+
+			g_propagate_error (error, err);
+			g_free (out);
+			return NULL;
+		}
+
+		*nread += bytes_read;
+		nwritten += bytes_written;
+
+		if (res == G_CONVERTER_FINISHED || *nread == inlen ||
+		    (bytes_read == 0 && bytes_written == 0))
+		{
+			break;
+		}
+	}
+
+	lapiz_utf8_scan_init (&scan);
+
+	if (!lapiz_utf8_scan (&scan, out, nwritten, &end))
+	{
+		gsize remainder = nwritten - (end - out);
+
+		if (at_end || remainder >= MAX_UNICHAR_LEN ||
+		    g_utf8_get_char_validated (end, remainder) != (gunichar)-2)
+		{
+			g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+					     at_end && remainder < MAX_UNICHAR_LEN ?
+					     _("Incomplete UTF-8 sequence in input") :
+					     _("Invalid UTF-8 sequence in input"));
+			g_free (out);
+			return NULL;
+		}
+	}
+
+	valid_len = end - out;
+
+	/* Avoid keeping a CRLF across two chunks: a CR ending the valid
+	 * text, even if a truncated character follows it, is held back and
+	 * scanned with the next chunk, so the chunks never end with a
+	 * pending CR and each one can start with a fresh scan. */
+	if (at_end)
+		lapiz_utf8_scan_finish (&scan);
+	else if (lapiz_utf8_scan_drop_pending_cr (&scan))
+		valid_len--;
+
+	*tail_len = nwritten - valid_len;
+	memcpy (tail, out + valid_len, *tail_len);
+
+	chunk = g_slice_new (NativeChunk);
+	chunk->text = out;
+	chunk->len = valid_len;
+	chunk->bytes_read = *nread;
+	chunk->scan = scan;
+
+	return chunk;
+}
+
+static gpointer
+native_load_thread (NativeLoad *native)
+{
+	GMappedFile *mapped;
+	const gchar *contents;
+	gsize size;
+	gsize offset = 0;
+	gchar tail[MAX_UNICHAR_LEN + 1];
+	gsize tail_len = 0;
+	gboolean fallback = FALSE;
+	GError *error = NULL;
+
+	mapped = g_mapped_file_new (native->path, FALSE, NULL);
+
+	if (mapped == NULL)
+	{
+		fallback = TRUE;
+	}
+	else
+	{
+		contents = g_mapped_file_get_contents (mapped);
+		size = g_mapped_file_get_length (mapped);
+
+		/* run at least once so that empty files get an encoding too */
+		do
+		{
+			NativeChunk *chunk;
+			gsize inlen;
+			gsize nread;
+			gboolean at_end;
+
+			if (native_load_should_stop (native))
+				break;
+
+			inlen = MIN (NATIVE_READ_CHUNK_SIZE, size - offset);
+			at_end = (offset + inlen == size);
+
+			chunk = native_convert_block (native,
+						      contents + offset,
+						      inlen,
+						      at_end,
+						      tail,
+						      &tail_len,
+						      &nread,
+						      &error);
+
+			if (chunk == NULL)
+				break;
+
+			/* the converter must make progress on a whole block */
+			if (nread == 0 && !at_end)
+			{
+				native_chunk_free (chunk);
+				g_set_error_literal (&error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+						     _("Incomplete UTF-8 sequence in input"));
+				break;
+			}
+
+			offset += nread;
+
+			g_mutex_lock (&native->lock);
+
+			while (g_queue_get_length (&native->chunks) >= NATIVE_MAX_PENDING_CHUNKS &&
+			       !native_load_should_stop (native))
+			{
+				g_cond_wait (&native->cond, &native->lock);
+			}
+
+			g_queue_push_tail (&native->chunks, chunk);
+			native_load_schedule_idle (native);
+
+			g_mutex_unlock (&native->lock);
+
+			if (at_end)
+				break;
+		}
+		while (TRUE);
+
+		g_mapped_file_unref (mapped);
+	}
+
+	g_mutex_lock (&native->lock);
+	native->error = error;
+	native->fallback = fallback;
+	native->done = TRUE;
+	native_load_schedule_idle (native);
+	g_mutex_unlock (&native->lock);
+
+	return NULL;
+}
+
+static gboolean
+native_load_idle (AsyncData *async)
+{
+	LapizGioDocumentLoader *gvloader;
+	NativeLoad *native;
+	NativeChunk *chunk;
+	gboolean fallback;
+	GError *error = NULL;
+
+	gvloader = async->loader;
+	native = gvloader->priv->native;
+
+	g_mutex_lock (&native->lock);
+
+	/* check cancelled state manually, the async data is freed
+	 * together with the native load on dispose */
+	if (g_cancellable_is_cancelled (async->cancellable))
+	{
+		native->idle_id = 0;
+		g_mutex_unlock (&native->lock);
+		return FALSE;
+	}
+
+	chunk = g_queue_pop_head (&native->chunks);
+
+	if (chunk == NULL)
+	{
+		native->idle_id = 0;
+
+		if (!native->done)
+		{
+			/* the worker adds the idle again on the next chunk */
+			g_mutex_unlock (&native->lock);
+			return FALSE;
+		}
+
+		error = native->error;
+		native->error = NULL;
+		fallback = native->fallback;
+		g_mutex_unlock (&native->lock);
+
+		/* we are done, hand the async data back */
+		native->async = NULL;
+		native_load_free (native);
+		gvloader->priv->native = NULL;
+
+		if (error != NULL)
+			async_failed (async, error);
+		else if (fallback)
+			start_stream_load (async);
+		else
+			finish_reading (async);
+
+		return FALSE;
+	}
+
+	g_cond_signal (&native->cond);
+	g_mutex_unlock (&native->lock);
+
+	lapiz_document_output_stream_write_validated (LAPIZ_DOCUMENT_OUTPUT_STREAM (gvloader->priv->output),
+						      chunk->text,
+						      chunk->len,
+						      &chunk->scan);
+
+	gvloader->priv->bytes_read += chunk->bytes_read;
+	native_chunk_free (chunk);
+
+	lapiz_document_loader_loading (LAPIZ_DOCUMENT_LOADER (gvloader),
+				       FALSE,
+				       NULL);
+
+	return TRUE;
+}
+
+static void
+start_native_load (AsyncData *async,
+		   gchar     *path)
+{
+	LapizGioDocumentLoader *gvloader;
+	NativeLoad *native;
+
+	lapiz_debug (DEBUG_LOADER);
+
+	gvloader = async->loader;
+
+	native = g_slice_new0 (NativeLoad);
+	native->async = async;
+	native->path = path;
+	native->converter = g_object_ref (gvloader->priv->converter);
+	native->cancellable = g_object_ref (async->cancellable);
+
+	g_mutex_init (&native->lock);
+	g_cond_init (&native->cond);
+	g_queue_init (&native->chunks);
+
+	gvloader->priv->native = native;
+
+	native->cancelled_id = g_cancellable_connect (native->cancellable,
+						      G_CALLBACK (native_load_cancelled_cb),
+						      native,
+						      NULL);
+
+	native->thread = g_thread_new ("lapiz-loader",
+				       (GThreadFunc) native_load_thread,
+				       native);
+}
+
 static GSList *
 get_candidate_encodings (LapizGioDocumentLoader *gvloader)
 {
@@ -448,9 +934,9 @@ finish_query_info (AsyncData *async)
 {
 	LapizGioDocumentLoader *gvloader;
 	LapizDocumentLoader *loader;
-	GInputStream *conv_stream;
 	GFileInfo *info;
 	GSList *candidate_encodings;
+	gchar *path;
 
 	gvloader = async->loader;
 	loader = LAPIZ_DOCUMENT_LOADER (gvloader);
@@ -483,17 +969,25 @@ finish_query_info (AsyncData *async)
 	gvloader->priv->converter = lapiz_smart_charset_converter_new (candidate_encodings);
 	g_slist_free (candidate_encodings);
 
-	conv_stream = g_converter_input_stream_new (gvloader->priv->stream,
-						    G_CONVERTER (gvloader->priv->converter));
-	g_object_unref (gvloader->priv->stream);
-
-	gvloader->priv->stream = conv_stream;
-
 	/* Output stream */
 	gvloader->priv->output = lapiz_document_output_stream_new (loader->document);
 
-	/* start reading */
-	read_file_chunk (async);
+	/* Local files are mapped and converted off the main loop, the
+	 * opened stream is just kept until the load is complete, or read
+	 * if the file cannot be mapped. Files which report no size, like
+	 * the ones of /proc and /sys, are always read from the stream. */
+	if (g_file_is_native (gvloader->priv->gfile) &&
+	    g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_STANDARD_TYPE) &&
+	    g_file_info_get_file_type (info) == G_FILE_TYPE_REGULAR &&
+	    g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_STANDARD_SIZE) &&
+	    g_file_info_get_size (info) > 0 &&
+	    (path = g_file_get_path (gvloader->priv->gfile)) != NULL)
+	{
+		start_native_load (async, path);
+		return;
+	}
+
+	start_stream_load (async);
 }
 
 static void
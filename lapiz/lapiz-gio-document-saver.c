@@ -38,22 +38,36 @@
 #include <string.h>
 
 #include "lapiz-gio-document-saver.h"
-#include "lapiz-document-input-stream.h"
 #include "lapiz-debug.h"
 
-#define WRITE_CHUNK_SIZE 8192
+/* The text of the document is copied in chunks of this many characters
+ * when the save starts, so that the worker thread never touches the
+ * buffer */
+#define SNAPSHOT_CHUNK_CHARS (1024 * 1024)
 
 typedef struct
 {
 	LapizGioDocumentSaver *saver;
-	gchar 		       buffer[WRITE_CHUNK_SIZE];
 	GCancellable 	      *cancellable;
 	gboolean	       tried_mount;
-	gssize		       written;
-	gssize		       read;
 	GError                *error;
 } AsyncData;
 
+typedef struct
+{
+	gchar *text;
+	gsize  len;
+	gint   n_chars;
+} SnapshotChunk;
+
+/* Owned by the GTask of the worker thread */
+typedef struct
+{
+	GOutputStream            *stream;
+	GArray                   *snapshot;
+	LapizDocumentNewlineType  newline_type;
+} WriteData;
+
 #define REMOTE_QUERY_ATTRIBUTES G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE "," \
 				G_FILE_ATTRIBUTE_TIME_MODIFIED "," \
 				G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC
@@ -71,14 +85,20 @@ struct _LapizGioDocumentSaverPrivate
 	gint64			  old_mtime;
 
 	goffset			  size;
+
+	/* written by the worker thread */
+	GMutex			  bytes_written_lock;
 	goffset			  bytes_written;
+	gint			  progress_pending;
 
 	GFile			 *gfile;
 	GCancellable		 *cancellable;
 	GOutputStream		 *stream;
-	GInputStream		 *input;
+	GArray			 *snapshot;
 
 	GError                   *error;
+
+	guint			  writing : 1;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE (LapizGioDocumentSaver, lapiz_gio_document_saver, LAPIZ_TYPE_DOCUMENT_SAVER)
@@ -113,15 +133,25 @@ lapiz_gio_document_saver_dispose (GObject *object)
 		priv->stream = NULL;
 	}
 
-	if (priv->input != NULL)
+	if (priv->snapshot != NULL)
 	{
-		g_object_unref (priv->input);
-		priv->input = NULL;
+		g_array_unref (priv->snapshot);
+		priv->snapshot = NULL;
 	}
 
 	G_OBJECT_CLASS (lapiz_gio_document_saver_parent_class)->dispose (object);
 }
 
+static void
+lapiz_gio_document_saver_finalize (GObject *object)
+{
+	LapizGioDocumentSaverPrivate *priv = LAPIZ_GIO_DOCUMENT_SAVER (object)->priv;
+
+	g_mutex_clear (&priv->bytes_written_lock);
+
+	G_OBJECT_CLASS (lapiz_gio_document_saver_parent_class)->finalize (object);
+}
+
 static AsyncData *
 async_data_new (LapizGioDocumentSaver *gvsaver)
 {
@@ -132,8 +162,6 @@ async_data_new (LapizGioDocumentSaver *gvsaver)
 	async->cancellable = g_object_ref (gvsaver->priv->cancellable);
 
 	async->tried_mount = FALSE;
-	async->written = 0;
-	async->read = 0;
 
 	async->error = NULL;
 
@@ -160,6 +188,7 @@ lapiz_gio_document_saver_class_init (LapizGioDocumentSaverClass *klass)
 	LapizDocumentSaverClass *saver_class = LAPIZ_DOCUMENT_SAVER_CLASS (klass);
 
 	object_class->dispose = lapiz_gio_document_saver_dispose;
+	object_class->finalize = lapiz_gio_document_saver_finalize;
 
 	saver_class->save = lapiz_gio_document_saver_save;
 	saver_class->get_file_size = lapiz_gio_document_saver_get_file_size;
@@ -173,6 +202,23 @@ lapiz_gio_document_saver_init (LapizGioDocumentSaver *gvsaver)
 
 	gvsaver->priv->cancellable = g_cancellable_new ();
 	gvsaver->priv->error = NULL;
+
+	g_mutex_init (&gvsaver->priv->bytes_written_lock);
+}
+
+static void
+snapshot_chunk_clear (SnapshotChunk *chunk)
+{
+	g_free (chunk->text);
+}
+
+static void
+write_data_free (WriteData *data)
+{
+	g_object_unref (data->stream);
+	g_array_unref (data->snapshot);
+
+	g_slice_free (WriteData, data);
 }
 
 static void
@@ -357,19 +403,7 @@ close_async_ready_get_info_cb (GOutputStream *stream,
 static void
 write_complete (AsyncData *async)
 {
-	GError *error = NULL;
-
-	/* first we close the input stream */
-	lapiz_debug_message (DEBUG_SAVER, "Close input stream");
-	if (!g_input_stream_close (async->saver->priv->input,
-				   async->cancellable, &error))
-	{
-		lapiz_debug_message (DEBUG_SAVER, "Closing input stream error: %s", error->message);
-		cancel_output_stream_and_fail (async, error);
-		return;
-	}
-
-	/* now we close the output stream */
+	/* the whole snapshot is written, close the output stream */
 	lapiz_debug_message (DEBUG_SAVER, "Close output stream");
 	g_output_stream_close_async (async->saver->priv->stream,
 				     G_PRIORITY_HIGH,
@@ -378,115 +412,276 @@ write_complete (AsyncData *async)
 				     async);
 }
 
-/* prototype, because they call each other... isn't C lovely */
-static void read_file_chunk (AsyncData *async);
-static void write_file_chunk (AsyncData *async);
+static gboolean
+notify_progress_idle (LapizGioDocumentSaver *gvsaver)
+{
+	g_atomic_int_set (&gvsaver->priv->progress_pending, FALSE);
 
+	if (gvsaver->priv->writing)
+	{
+		lapiz_document_saver_saving (LAPIZ_DOCUMENT_SAVER (gvsaver),
+					     FALSE,
+					     NULL);
+	}
+
+	return FALSE;
+}
+
+/* Called from the worker thread. At most one notification is queued in
+ * the main loop at a time, so a fast disk does not flood it. */
 static void
-async_write_cb (GOutputStream *stream,
-		GAsyncResult  *res,
-		AsyncData     *async)
+add_bytes_written (LapizGioDocumentSaver *gvsaver,
+		   gint                   n_chars)
 {
-	LapizGioDocumentSaver *gvsaver;
-	gssize bytes_written;
-	GError *error = NULL;
+	g_mutex_lock (&gvsaver->priv->bytes_written_lock);
+	gvsaver->priv->bytes_written += n_chars;
+	g_mutex_unlock (&gvsaver->priv->bytes_written_lock);
 
-	lapiz_debug (DEBUG_SAVER);
+	if (g_atomic_int_compare_and_exchange (&gvsaver->priv->progress_pending,
+					       FALSE, TRUE))
+	{
+		g_idle_add_full (G_PRIORITY_HIGH_IDLE,
+				 (GSourceFunc) notify_progress_idle,
+				 g_object_ref (gvsaver),
+				 g_object_unref);
+	}
+}
 
-	/* Check cancelled state manually */
-	if (g_cancellable_is_cancelled (async->cancellable))
+static gsize
+get_new_line_size (LapizDocumentNewlineType type)
+{
+	gsize ret;
+
+	switch (type)
 	{
-		cancel_output_stream (async);
-		return;
+		case LAPIZ_DOCUMENT_NEWLINE_TYPE_CR:
+		case LAPIZ_DOCUMENT_NEWLINE_TYPE_LF:
+			ret = 1;
+			break;
+
+		case LAPIZ_DOCUMENT_NEWLINE_TYPE_CR_LF:
+			ret = 2;
+			break;
+
+		default:
+			g_warn_if_reached ();
+			ret = 1;
+			break;
 	}
 
-	bytes_written = g_output_stream_write_finish (stream, res, &error);
+	return ret;
+}
 
-	lapiz_debug_message (DEBUG_SAVER, "Written: %" G_GSSIZE_FORMAT, bytes_written);
+static const gchar *
+get_new_line (LapizDocumentNewlineType type)
+{
+	const gchar *ret;
 
-	if (bytes_written == -1)
+	switch (type)
 	{
-		lapiz_debug_message (DEBUG_SAVER, "Write error: %s", error->message);
-		cancel_output_stream_and_fail (async, error);
-		return;
+		case LAPIZ_DOCUMENT_NEWLINE_TYPE_CR:
+			ret = "\r";
+			break;
+
+		case LAPIZ_DOCUMENT_NEWLINE_TYPE_LF:
+			ret = "\n";
+			break;
+
+		case LAPIZ_DOCUMENT_NEWLINE_TYPE_CR_LF:
+			ret = "\r\n";
+			break;
+
+		default:
+			g_warn_if_reached ();
+			ret = "\n";
+			break;
 	}
 
-	gvsaver = async->saver;
-	async->written += bytes_written;
+	return ret;
+}
+
+/* Copies @len bytes of @text to @outbuf replacing each line delimiter of
+ * the buffer (\n, \r, \r\n or U+2029) with the newline of @type.
+ * @outbuf must have room for 2 * @len bytes. Returns the number of bytes
+ * written. */
+static gsize
+convert_newlines (gchar                    *outbuf,
+		  const gchar              *text,
+		  gsize                     len,
+		  LapizDocumentNewlineType  type)
+{
+	const gchar *p = text;
+	const gchar *end = text + len;
+	const gchar *newline;
+	gsize newline_size;
+	gchar *out = outbuf;
+
+	newline = get_new_line (type);
+	newline_size = get_new_line_size (type);
 
-	/* write again */
-	if (async->written != async->read)
+	while (p < end)
 	{
-		write_file_chunk (async);
-		return;
-	}
+		const gchar *run = p;
+		gsize delimiter_size;
 
-	/* note that this signal blocks the write... check if it isn't
-	 * a performance problem
-	 */
-	lapiz_document_saver_saving (LAPIZ_DOCUMENT_SAVER (gvsaver),
-				     FALSE,
-				     NULL);
+		while (p < end && *p != '\n' && *p != '\r' && (guchar)*p != 0xe2)
+			p++;
 
-	read_file_chunk (async);
+		memcpy (out, run, p - run);
+		out += p - run;
+
+		if (p == end)
+			break;
+
+		if (*p == '\r')
+			delimiter_size = (p + 1 < end && p[1] == '\n') ? 2 : 1;
+		else if (*p == '\n')
+			delimiter_size = 1;
+		else if (end - p >= 3 && (guchar)p[1] == 0x80 && (guchar)p[2] == 0xa9)
+			delimiter_size = 3;
+		else
+			delimiter_size = 0;
+
+		if (delimiter_size == 0)
+		{
+			*out++ = *p++;
+			continue;
+		}
+
+		memcpy (out, newline, newline_size);
+		out += newline_size;
+		p += delimiter_size;
+	}
+
+	return out - outbuf;
 }
 
+/* Runs in a worker thread: converts the newlines of the snapshot and
+ * writes it through the (possibly converting) output stream. Neither the
+ * snapshot nor the stream are touched by the main thread meanwhile. */
 static void
-write_file_chunk (AsyncData *async)
+write_snapshot_thread (GTask        *task,
+		       gpointer      source_object,
+		       gpointer      task_data,
+		       GCancellable *cancellable)
 {
-	LapizGioDocumentSaver *gvsaver;
+	LapizGioDocumentSaver *gvsaver = source_object;
+	WriteData *data = task_data;
+	gchar *buffer = NULL;
+	gsize buffer_size = 0;
+	guint i;
 
-	lapiz_debug (DEBUG_SAVER);
+	for (i = 0; i < data->snapshot->len; i++)
+	{
+		SnapshotChunk *chunk;
+		gsize len;
+		GError *error = NULL;
 
-	gvsaver = async->saver;
+		chunk = &g_array_index (data->snapshot, SnapshotChunk, i);
 
-	g_output_stream_write_async (G_OUTPUT_STREAM (gvsaver->priv->stream),
-				     async->buffer + async->written,
-				     async->read - async->written,
-				     G_PRIORITY_HIGH,
-				     async->cancellable,
-				     (GAsyncReadyCallback) async_write_cb,
-				     async);
+		/* newlines at most double the size, plus the final newline */
+		if (buffer_size < chunk->len * 2 + 2)
+		{
+			buffer_size = chunk->len * 2 + 2;
+			buffer = g_realloc (buffer, buffer_size);
+		}
+
+		len = convert_newlines (buffer,
+					chunk->text,
+					chunk->len,
+					data->newline_type);
+
+		/* Make sure that non-empty files are always terminated with \n
+		 * (see bug #95676). Note that we strip the trailing \n when
+		 * loading the file */
+		if (i == data->snapshot->len - 1)
+		{
+			len += convert_newlines (buffer + len,
+						 "\n",
+						 1,
+						 data->newline_type);
+		}
+
+		/* the chunk is not needed anymore */
+		g_free (chunk->text);
+		chunk->text = NULL;
+
+		if (!g_output_stream_write_all (data->stream,
+						buffer,
+						len,
+						NULL,
+						cancellable,
+						&error))
+		{
+			lapiz_debug_message (DEBUG_SAVER, "Write error: %s", error->message);
+
+			g_free (buffer);
+			g_task_return_error (task, error);
+			return;
+		}
+
+		lapiz_debug_message (DEBUG_SAVER, "Written: %" G_GSIZE_FORMAT, len);
+
+		add_bytes_written (gvsaver, chunk->n_chars);
+	}
+
+	g_free (buffer);
+	g_task_return_boolean (task, TRUE);
 }
 
 static void
-read_file_chunk (AsyncData *async)
+write_snapshot_ready_cb (LapizGioDocumentSaver *gvsaver,
+			 GAsyncResult          *result,
+			 AsyncData             *async)
 {
-	LapizGioDocumentSaver *gvsaver;
-	LapizDocumentInputStream *dstream;
 	GError *error = NULL;
 
 	lapiz_debug (DEBUG_SAVER);
 
-	gvsaver = async->saver;
-	async->written = 0;
-
-	/* we use sync methods on doc stream since it is in memory. Using async
-	   would be racy and we can endup with invalidated iters */
-	async->read = g_input_stream_read (gvsaver->priv->input,
-					   async->buffer,
-					   WRITE_CHUNK_SIZE,
-					   async->cancellable,
-					   &error);
+	gvsaver->priv->writing = FALSE;
 
-	if (error != NULL)
+	/* Check cancelled state manually */
+	if (g_cancellable_is_cancelled (async->cancellable))
 	{
-		cancel_output_stream_and_fail (async, error);
+		cancel_output_stream (async);
 		return;
 	}
 
-	/* Check if we finished reading and writing */
-	if (async->read == 0)
+	if (!g_task_propagate_boolean (G_TASK (result), &error))
 	{
-		write_complete (async);
+		cancel_output_stream_and_fail (async, error);
 		return;
 	}
 
-	/* Get how many chars have been read */
-	dstream = LAPIZ_DOCUMENT_INPUT_STREAM (gvsaver->priv->input);
-	gvsaver->priv->bytes_written = lapiz_document_input_stream_tell (dstream);
+	write_complete (async);
+}
 
-	write_file_chunk (async);
+static void
+write_snapshot_async (AsyncData *async)
+{
+	LapizGioDocumentSaver *gvsaver;
+	WriteData *data;
+	GTask *task;
+
+	lapiz_debug (DEBUG_SAVER);
+
+	gvsaver = async->saver;
+
+	data = g_slice_new (WriteData);
+	data->stream = g_object_ref (gvsaver->priv->stream);
+	data->snapshot = gvsaver->priv->snapshot;
+	data->newline_type = LAPIZ_DOCUMENT_SAVER (gvsaver)->newline_type;
+	gvsaver->priv->snapshot = NULL;
+
+	gvsaver->priv->writing = TRUE;
+
+	task = g_task_new (gvsaver,
+			   async->cancellable,
+			   (GAsyncReadyCallback) write_snapshot_ready_cb,
+			   async);
+	g_task_set_task_data (task, data, (GDestroyNotify) write_data_free);
+	g_task_run_in_thread (task, write_snapshot_thread);
+	g_object_unref (task);
 }
 
 static void
@@ -541,12 +736,7 @@ async_replace_ready_callback (GFile        *source,
 		gvsaver->priv->stream = G_OUTPUT_STREAM (file_stream);
 	}
 
-	gvsaver->priv->input = lapiz_document_input_stream_new (CTK_TEXT_BUFFER (saver->document),
-								saver->newline_type);
-
-	gvsaver->priv->size = lapiz_document_input_stream_get_total_size (LAPIZ_DOCUMENT_INPUT_STREAM (gvsaver->priv->input));
-
-	read_file_chunk (async);
+	write_snapshot_async (async);
 }
 
 static void
@@ -746,6 +936,57 @@ save_remote_file_real (LapizGioDocumentSaver *gvsaver)
 	return FALSE;
 }
 
+/* Copies the text of the document. This is the only part of the save
+ * that reads the buffer, everything else works on the copy so the user
+ * can keep editing while the file is written. */
+static void
+take_snapshot (LapizGioDocumentSaver *gvsaver)
+{
+	CtkTextBuffer *buffer;
+	CtkTextIter start, end;
+	GArray *snapshot;
+
+	buffer = CTK_TEXT_BUFFER (LAPIZ_DOCUMENT_SAVER (gvsaver)->document);
+
+	snapshot = g_array_new (FALSE, FALSE, sizeof (SnapshotChunk));
+	g_array_set_clear_func (snapshot, (GDestroyNotify) snapshot_chunk_clear);
+
+	ctk_text_buffer_get_start_iter (buffer, &start);
+
+	while (!ctk_text_iter_is_end (&start))
+	{
+		SnapshotChunk chunk;
+
+		end = start;
+		ctk_text_iter_forward_chars (&end, SNAPSHOT_CHUNK_CHARS);
+
+		/* do not split a \r\n between two chunks, it would be
+		 * written as two newlines */
+		if (ctk_text_iter_get_char (&end) == '\n')
+		{
+			CtkTextIter prev = end;
+
+			if (ctk_text_iter_backward_char (&prev) &&
+			    ctk_text_iter_get_char (&prev) == '\r')
+			{
+				ctk_text_iter_forward_char (&end);
+			}
+		}
+
+		chunk.text = ctk_text_iter_get_slice (&start, &end);
+		chunk.len = strlen (chunk.text);
+		chunk.n_chars = ctk_text_iter_get_offset (&end) -
+				ctk_text_iter_get_offset (&start);
+
+		g_array_append_val (snapshot, chunk);
+
+		start = end;
+	}
+
+	gvsaver->priv->snapshot = snapshot;
+	gvsaver->priv->size = ctk_text_buffer_get_char_count (buffer);
+}
+
 static void
 lapiz_gio_document_saver_save (LapizDocumentSaver *saver,
                                gint64             *old_mtime)
@@ -755,6 +996,8 @@ lapiz_gio_document_saver_save (LapizDocumentSaver *saver,
 	gvsaver->priv->old_mtime = *old_mtime;
 	gvsaver->priv->gfile = g_file_new_for_uri (saver->uri);
 
+	take_snapshot (gvsaver);
+
 	/* saving start */
 	lapiz_document_saver_saving (saver, FALSE, NULL);
 
@@ -774,5 +1017,12 @@ lapiz_gio_document_saver_get_file_size (LapizDocumentSaver *saver)
 static goffset
 lapiz_gio_document_saver_get_bytes_written (LapizDocumentSaver *saver)
 {
-	return LAPIZ_GIO_DOCUMENT_SAVER (saver)->priv->bytes_written;
+	LapizGioDocumentSaverPrivate *priv = LAPIZ_GIO_DOCUMENT_SAVER (saver)->priv;
+	goffset bytes_written;
+
+	g_mutex_lock (&priv->bytes_written_lock);
+	bytes_written = priv->bytes_written;
+	g_mutex_unlock (&priv->bytes_written_lock);
+
+	return bytes_written;
 }
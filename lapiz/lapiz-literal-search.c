@@ -0,0 +1,878 @@
+/*
+ * lapiz-literal-search.c
+ * This file is part of lapiz
+ *
+ * lapiz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * lapiz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lapiz; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Plain text search over the bytes of the buffer. ctk_text_iter_forward_search()
+ * walks the buffer one character at a time through CtkTextIter and folds the
+ * case of every line it visits; here the text is copied in big windows and
+ * scanned with memchr (or SSE2 when the first byte has two cases) for short
+ * needles and with Boyer-Moore-Horspool for longer ones.
+ *
+ * The case of ASCII needles is folded through a table, so the byte offsets
+ * of the text are kept. Other needles are compared character by character
+ * with g_unichar_tolower(), which also keeps them.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include "lapiz-literal-search.h"
+#include "lapiz-document.h"
+
+#if defined (__SSE2__) && defined (__GNUC__)
+#include <emmintrin.h>
+#define SEARCH_SSE2 1
+#endif
+
+/* Needles shorter than this are found scanning for their first byte */
+#define BMH_MIN_LENGTH 4
+
+/* The buffer is copied in windows of about this many characters, rounded
+ * up to the end of the line */
+#define SEARCH_WINDOW_CHARS (64 * 1024)
+
+struct _LapizLiteralSearch
+{
+	/* folded if the search is not case sensitive */
+	gchar    *needle;
+	gsize     len;
+	glong     n_chars;
+
+	/* needle folded with g_unichar_tolower(), when it is not ASCII */
+	gunichar *chars;
+
+	gsize     shift[256];
+
+	guint     case_sensitive : 1;
+	guint     entire_word : 1;
+};
+
+static guchar fold_table[256];
+
+static void
+init_fold_table (void)
+{
+	static gsize initialized = 0;
+
+	if (g_once_init_enter (&initialized))
+	{
+		gint i;
+
+		for (i = 0; i < 256; i++)
+			fold_table[i] = g_ascii_tolower (i);
+
+		g_once_init_leave (&initialized, 1);
+	}
+}
+
+static gboolean
+is_ascii (const gchar *str)
+{
+	for (; *str != '\0'; str++)
+	{
+		if ((guchar) *str >= 0x80)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * lapiz_literal_search_new:
+ * @needle: the text to look for
+ * @flags: the #LapizSearchFlags of the search
+ *
+ * Prepares the search of @needle. Only %LAPIZ_SEARCH_CASE_SENSITIVE and
+ * %LAPIZ_SEARCH_ENTIRE_WORD are taken into account.
+ *
+ * Returns: a new #LapizLiteralSearch, free it with lapiz_literal_search_free()
+ */
+LapizLiteralSearch *
+lapiz_literal_search_new (const gchar *needle,
+			  guint        flags)
+{
+	LapizLiteralSearch *search;
+	gsize i;
+
+	g_return_val_if_fail (needle != NULL, NULL);
+
+	init_fold_table ();
+
+	search = g_slice_new0 (LapizLiteralSearch);
+
+	search->case_sensitive = LAPIZ_SEARCH_IS_CASE_SENSITIVE (flags);
+	search->entire_word = LAPIZ_SEARCH_IS_ENTIRE_WORD (flags);
+	search->n_chars = g_utf8_strlen (needle, -1);
+
+	if (search->case_sensitive || is_ascii (needle))
+	{
+		search->needle = g_strdup (needle);
+		search->len = strlen (needle);
+
+		if (!search->case_sensitive)
+		{
+			for (i = 0; i < search->len; i++)
+				search->needle[i] = fold_table[(guchar) search->needle[i]];
+		}
+
+		for (i = 0; i < 256; i++)
+			search->shift[i] = search->len;
+
+		for (i = 0; i + 1 < search->len; i++)
+			search->shift[(guchar) search->needle[i]] = search->len - 1 - i;
+	}
+	else
+	{
+		const gchar *p;
+		glong n;
+
+		search->needle = g_utf8_strdown (needle, -1);
+		search->len = strlen (search->needle);
+		search->chars = g_new (gunichar, search->n_chars);
+
+		for (p = needle, n = 0; *p != '\0'; p = g_utf8_next_char (p), n++)
+			search->chars[n] = g_unichar_tolower (g_utf8_get_char (p));
+	}
+
+	return search;
+}
+
+void
+lapiz_literal_search_free (LapizLiteralSearch *search)
+{
+	if (search == NULL)
+		return;
+
+	g_free (search->needle);
+	g_free (search->chars);
+
+	g_slice_free (LapizLiteralSearch, search);
+}
+
+/* Returns the first occurrence of @c1 or @c2 in [@p, @end) */
+static const gchar *
+scan_first_byte (const gchar *p,
+		 const gchar *end,
+		 guchar       c1,
+		 guchar       c2)
+{
+	if (c1 == c2)
+		return memchr (p, c1, end - p);
+
+#ifdef SEARCH_SSE2
+	{
+		const __m128i c1_v = _mm_set1_epi8 ((gchar) c1);
+		const __m128i c2_v = _mm_set1_epi8 ((gchar) c2);
+
+		while (end - p >= 16)
+		{
+			__m128i v;
+			guint mask;
+
+			v = _mm_loadu_si128 ((const __m128i *) p);
+			mask = _mm_movemask_epi8 (_mm_or_si128 (_mm_cmpeq_epi8 (v, c1_v),
+								_mm_cmpeq_epi8 (v, c2_v)));
+
+			if (mask != 0)
+				return p + __builtin_ctz (mask);
+
+			p += 16;
+		}
+	}
+#endif
+
+	for (; p < end; p++)
+	{
+		if ((guchar) *p == c1 || (guchar) *p == c2)
+			return p;
+	}
+
+	return NULL;
+}
+
+static inline gboolean
+bytes_equal (LapizLiteralSearch *search,
+	     const gchar        *p,
+	     gsize               len)
+{
+	gsize i;
+
+	if (search->case_sensitive)
+		return memcmp (p, search->needle, len) == 0;
+
+	for (i = 0; i < len; i++)
+	{
+		if (fold_table[(guchar) p[i]] != (guchar) search->needle[i])
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* First occurrence of the needle starting in [@p, @end - len] */
+static const gchar *
+find_bytes (LapizLiteralSearch *search,
+	    const gchar        *p,
+	    const gchar        *end)
+{
+	gsize m = search->len;
+
+	if ((gsize) (end - p) < m)
+		return NULL;
+
+	if (m < BMH_MIN_LENGTH)
+	{
+		guchar first = search->needle[0];
+		guchar other = search->case_sensitive ? first : g_ascii_toupper (first);
+
+		while ((p = scan_first_byte (p, end - m + 1, first, other)) != NULL)
+		{
+			if (bytes_equal (search, p, m))
+				return p;
+
+			p++;
+		}
+
+		return NULL;
+	}
+
+	while ((gsize) (end - p) >= m)
+	{
+		guchar last = fold_table[(guchar) p[m - 1]];
+
+		if (search->case_sensitive)
+			last = (guchar) p[m - 1];
+
+		if (last == (guchar) search->needle[m - 1] &&
+		    bytes_equal (search, p, m - 1))
+		{
+			return p;
+		}
+
+		p += search->shift[last];
+	}
+
+	return NULL;
+}
+
+/* Compares the folded needle with the text at @p. On success @match_end
+ * is set past the last matched byte, which is never beyond @end. */
+static gboolean
+chars_equal (LapizLiteralSearch  *search,
+	     const gchar         *p,
+	     const gchar         *end,
+	     const gchar        **match_end)
+{
+	glong i;
+
+	for (i = 0; i < search->n_chars; i++)
+	{
+		if (p >= end ||
+		    g_unichar_tolower (g_utf8_get_char (p)) != search->chars[i])
+		{
+			return FALSE;
+		}
+
+		p = g_utf8_next_char (p);
+	}
+
+	if (p > end)
+		return FALSE;
+
+	*match_end = p;
+
+	return TRUE;
+}
+
+static const gchar *
+find_chars (LapizLiteralSearch  *search,
+	    const gchar         *p,
+	    const gchar         *end,
+	    const gchar        **match_end)
+{
+	gchar lower[6];
+	gchar upper[6];
+	guchar first;
+	guchar other;
+
+	/* look for the lead byte of the lowercase and of the uppercase
+	 * form of the first character */
+	g_unichar_to_utf8 (search->chars[0], lower);
+	g_unichar_to_utf8 (g_unichar_toupper (search->chars[0]), upper);
+	first = lower[0];
+	other = upper[0];
+
+	while ((p = scan_first_byte (p, end, first, other)) != NULL)
+	{
+		if (chars_equal (search, p, end, match_end))
+			return p;
+
+		p = g_utf8_next_char (p);
+	}
+
+	return NULL;
+}
+
+static inline gboolean
+is_word_char (gunichar c)
+{
+	return g_unichar_isalnum (c) || g_unichar_ismark (c) || c == '_';
+}
+
+/* The word boundaries are looked at on the bytes: the match must start
+ * and end with a word character, and must not have one right before or
+ * right after it. */
+static gboolean
+is_entire_word (const gchar *text,
+		gsize        text_len,
+		gsize        start,
+		gsize        end)
+{
+	const gchar *last;
+
+	if (start == end)
+		return FALSE;
+
+	if (!is_word_char (g_utf8_get_char (text + start)))
+		return FALSE;
+
+	if (start > 0 &&
+	    is_word_char (g_utf8_get_char (g_utf8_find_prev_char (text, text + start))))
+		return FALSE;
+
+	last = g_utf8_find_prev_char (text, text + end);
+	if (!is_word_char (g_utf8_get_char (last)))
+		return FALSE;
+
+	if (end < text_len && is_word_char (g_utf8_get_char (text + end)))
+		return FALSE;
+
+	return TRUE;
+}
+
+/**
+ * lapiz_literal_search_find:
+ * @search: a #LapizLiteralSearch
+ * @text: a nul-terminated UTF-8 text
+ * @from: the byte offset where the match can start
+ * @to: the byte offset where the match must end at most
+ * @match_start: (out): return location for the offset of the match
+ * @match_end: (out): return location for the end of the match
+ *
+ * Finds the first occurrence of the needle in the part of @text between
+ * @from and @to. The text before @from and after @to is only looked at
+ * to find out word boundaries.
+ *
+ * Returns: %TRUE if a match was found
+ */
+gboolean
+lapiz_literal_search_find (LapizLiteralSearch *search,
+			   const gchar        *text,
+			   gsize               from,
+			   gsize               to,
+			   gsize              *match_start,
+			   gsize              *match_end)
+{
+	const gchar *p;
+	const gchar *end;
+	gsize text_len = 0;
+
+	g_return_val_if_fail (search != NULL, FALSE);
+	g_return_val_if_fail (text != NULL, FALSE);
+	g_return_val_if_fail (from <= to, FALSE);
+
+	if (search->len == 0)
+		return FALSE;
+
+	if (search->entire_word)
+		text_len = to + strlen (text + to);
+
+	p = text + from;
+	end = text + to;
+
+	while (p < end)
+	{
+		const gchar *m_end;
+
+		if (search->chars == NULL)
+			p = find_bytes (search, p, end);
+		else
+			p = find_chars (search, p, end, &m_end);
+
+		if (p == NULL)
+			return FALSE;
+
+		if (search->chars == NULL)
+			m_end = p + search->len;
+
+		if (!search->entire_word ||
+		    is_entire_word (text, text_len, p - text, m_end - text))
+		{
+			*match_start = p - text;
+			*match_end = m_end - text;
+
+			return TRUE;
+		}
+
+		p = g_utf8_next_char (p);
+	}
+
+	return FALSE;
+}
+
+/**
+ * lapiz_literal_search_find_last:
+ * @search: a #LapizLiteralSearch
+ * @text: a nul-terminated UTF-8 text
+ * @from: the byte offset where the match can start
+ * @to: the byte offset where the match must end at most
+ * @match_start: (out): return location for the offset of the match
+ * @match_end: (out): return location for the end of the match
+ *
+ * Like lapiz_literal_search_find(), but finds the last occurrence.
+ *
+ * Returns: %TRUE if a match was found
+ */
+gboolean
+lapiz_literal_search_find_last (LapizLiteralSearch *search,
+				const gchar        *text,
+				gsize               from,
+				gsize               to,
+				gsize              *match_start,
+				gsize              *match_end)
+{
+	gsize start, end;
+	gboolean found = FALSE;
+
+	g_return_val_if_fail (search != NULL, FALSE);
+	g_return_val_if_fail (text != NULL, FALSE);
+
+	while (lapiz_literal_search_find (search, text, from, to, &start, &end))
+	{
+		*match_start = start;
+		*match_end = end;
+		found = TRUE;
+
+		from = g_utf8_next_char (text + start) - text;
+	}
+
+	return found;
+}
+
+static gchar *
+get_window_text (const CtkTextIter *start,
+		 const CtkTextIter *end,
+		 glong             *n_chars)
+{
+	gchar *text;
+
+	text = ctk_text_iter_get_visible_text (start, end);
+
+	*n_chars = ctk_text_iter_get_offset (end) - ctk_text_iter_get_offset (start);
+
+	/* hidden text and embedded objects are not in the text, so its
+	 * offsets would not be the ones of the buffer */
+	if (g_utf8_strlen (text, -1) != *n_chars)
+	{
+		g_free (text);
+		return NULL;
+	}
+
+	return text;
+}
+
+static void
+offsets_to_iters (const CtkTextIter *text_start,
+		  const gchar       *text,
+		  gsize              start,
+		  gsize              end,
+		  CtkTextIter       *match_start,
+		  CtkTextIter       *match_end)
+{
+	*match_start = *text_start;
+	ctk_text_iter_forward_chars (match_start,
+				     g_utf8_pointer_to_offset (text, text + start));
+
+	*match_end = *match_start;
+	ctk_text_iter_forward_chars (match_end,
+				     g_utf8_pointer_to_offset (text + start, text + end));
+}
+
+static CtkTextSearchFlags
+get_ctk_search_flags (LapizLiteralSearch *search)
+{
+	CtkTextSearchFlags flags;
+
+	flags = CTK_TEXT_SEARCH_VISIBLE_ONLY | CTK_TEXT_SEARCH_TEXT_ONLY;
+
+	if (!search->case_sensitive)
+		flags |= CTK_TEXT_SEARCH_CASE_INSENSITIVE;
+
+	return flags;
+}
+
+/* Used for the windows that have hidden text or embedded objects */
+static gboolean
+ctk_search (LapizLiteralSearch *search,
+	    const CtkTextIter  *iter,
+	    const CtkTextIter  *limit,
+	    gboolean            forward,
+	    CtkTextIter        *match_start,
+	    CtkTextIter        *match_end)
+{
+	CtkTextIter pos = *iter;
+	gboolean found;
+
+	while (TRUE)
+	{
+		if (forward)
+			found = ctk_text_iter_forward_search (&pos,
+							      search->needle,
+							      get_ctk_search_flags (search),
+							      match_start,
+							      match_end,
+							      limit);
+		else
+			found = ctk_text_iter_backward_search (&pos,
+							       search->needle,
+							       get_ctk_search_flags (search),
+							       match_start,
+							       match_end,
+							       limit);
+
+		if (!found || !search->entire_word)
+			return found;
+
+		if (ctk_text_iter_starts_word (match_start) &&
+		    ctk_text_iter_ends_word (match_end))
+			return TRUE;
+
+		pos = forward ? *match_end : *match_start;
+	}
+}
+
+/* Moves @start one character back and @end one character forward, if
+ * they can, and tells how many bytes were added */
+static void
+add_context (CtkTextIter *start,
+	     CtkTextIter *end,
+	     gboolean    *before,
+	     gboolean    *after)
+{
+	*before = ctk_text_iter_backward_char (start);
+	*after = ctk_text_iter_forward_char (end);
+}
+
+static void
+get_search_range (const gchar *text,
+		  gboolean     before,
+		  gboolean     after,
+		  gsize       *from,
+		  gsize       *to)
+{
+	gsize len = strlen (text);
+
+	*from = before ? (gsize) (g_utf8_next_char (text) - text) : 0;
+	*to = after ? (gsize) (g_utf8_find_prev_char (text, text + len) - text) : len;
+}
+
+/**
+ * lapiz_literal_search_forward:
+ * @search: a #LapizLiteralSearch
+ * @iter: start of the search
+ * @limit: (allow-none): bound of the search, or %NULL for the end of the buffer
+ * @match_start: (out): return location for start of match
+ * @match_end: (out): return location for end of match
+ *
+ * Finds the first match after @iter, like ctk_text_iter_forward_search()
+ * with %CTK_TEXT_SEARCH_VISIBLE_ONLY and %CTK_TEXT_SEARCH_TEXT_ONLY.
+ *
+ * Returns: %TRUE if a match was found
+ */
+gboolean
+lapiz_literal_search_forward (LapizLiteralSearch *search,
+			      const CtkTextIter  *iter,
+			      const CtkTextIter  *limit,
+			      CtkTextIter        *match_start,
+			      CtkTextIter        *match_end)
+{
+	CtkTextIter start;
+	CtkTextIter bound;
+	glong window_chars;
+
+	g_return_val_if_fail (search != NULL, FALSE);
+	g_return_val_if_fail (iter != NULL, FALSE);
+
+	if (search->len == 0)
+		return FALSE;
+
+	if (limit != NULL)
+		bound = *limit;
+	else
+		ctk_text_buffer_get_end_iter (ctk_text_iter_get_buffer (iter), &bound);
+
+	/* consecutive windows overlap by the length of the needle */
+	window_chars = MAX (SEARCH_WINDOW_CHARS, 2 * search->n_chars);
+	start = *iter;
+
+	while (ctk_text_iter_compare (&start, &bound) < 0)
+	{
+		CtkTextIter win_end;
+		CtkTextIter ctx_start;
+		CtkTextIter ctx_end;
+		gboolean before, after;
+		gchar *text;
+		glong n_chars;
+		gsize from, to;
+		gsize m_start, m_end;
+		gboolean found;
+
+		win_end = start;
+		ctk_text_iter_forward_chars (&win_end, window_chars);
+		if (!ctk_text_iter_ends_line (&win_end))
+			ctk_text_iter_forward_to_line_end (&win_end);
+
+		if (ctk_text_iter_compare (&win_end, &bound) > 0)
+			win_end = bound;
+
+		ctx_start = start;
+		ctx_end = win_end;
+		add_context (&ctx_start, &ctx_end, &before, &after);
+
+		text = get_window_text (&ctx_start, &ctx_end, &n_chars);
+
+		if (text == NULL)
+			return ctk_search (search, &start, &bound, TRUE,
+					   match_start, match_end);
+
+		get_search_range (text, before, after, &from, &to);
+
+		found = lapiz_literal_search_find (search, text, from, to,
+						   &m_start, &m_end);
+
+		if (found)
+			offsets_to_iters (&ctx_start, text, m_start, m_end,
+					  match_start, match_end);
+
+		g_free (text);
+
+		if (found)
+			return TRUE;
+
+		if (ctk_text_iter_equal (&win_end, &bound))
+			break;
+
+		start = win_end;
+		ctk_text_iter_backward_chars (&start, search->n_chars - 1);
+	}
+
+	return FALSE;
+}
+
+/**
+ * lapiz_literal_search_backward:
+ * @search: a #LapizLiteralSearch
+ * @iter: start of the search
+ * @limit: (allow-none): bound of the search, or %NULL for the start of the buffer
+ * @match_start: (out): return location for start of match
+ * @match_end: (out): return location for end of match
+ *
+ * Finds the last match before @iter, like ctk_text_iter_backward_search()
+ * with %CTK_TEXT_SEARCH_VISIBLE_ONLY and %CTK_TEXT_SEARCH_TEXT_ONLY.
+ *
+ * Returns: %TRUE if a match was found
+ */
+gboolean
+lapiz_literal_search_backward (LapizLiteralSearch *search,
+			       const CtkTextIter  *iter,
+			       const CtkTextIter  *limit,
+			       CtkTextIter        *match_start,
+			       CtkTextIter        *match_end)
+{
+	CtkTextIter end;
+	CtkTextIter bound;
+	glong window_chars;
+
+	g_return_val_if_fail (search != NULL, FALSE);
+	g_return_val_if_fail (iter != NULL, FALSE);
+
+	if (search->len == 0)
+		return FALSE;
+
+	if (limit != NULL)
+		bound = *limit;
+	else
+		ctk_text_buffer_get_start_iter (ctk_text_iter_get_buffer (iter), &bound);
+
+	window_chars = MAX (SEARCH_WINDOW_CHARS, 2 * search->n_chars);
+	end = *iter;
+
+	while (ctk_text_iter_compare (&end, &bound) > 0)
+	{
+		CtkTextIter win_start;
+		CtkTextIter ctx_start;
+		CtkTextIter ctx_end;
+		gboolean before, after;
+		gchar *text;
+		glong n_chars;
+		gsize from, to;
+		gsize m_start, m_end;
+		gboolean found;
+
+		win_start = end;
+		ctk_text_iter_backward_chars (&win_start, window_chars);
+		if (!ctk_text_iter_starts_line (&win_start))
+			ctk_text_iter_set_line_offset (&win_start, 0);
+
+		if (ctk_text_iter_compare (&win_start, &bound) < 0)
+			win_start = bound;
+
+		ctx_start = win_start;
+		ctx_end = end;
+		add_context (&ctx_start, &ctx_end, &before, &after);
+
+		text = get_window_text (&ctx_start, &ctx_end, &n_chars);
+
+		if (text == NULL)
+			return ctk_search (search, &end, &bound, FALSE,
+					   match_start, match_end);
+
+		get_search_range (text, before, after, &from, &to);
+
+		found = lapiz_literal_search_find_last (search, text, from, to,
+							&m_start, &m_end);
+
+		if (found)
+			offsets_to_iters (&ctx_start, text, m_start, m_end,
+					  match_start, match_end);
+
+		g_free (text);
+
+		if (found)
+			return TRUE;
+
+		if (ctk_text_iter_equal (&win_start, &bound))
+			break;
+
+		end = win_start;
+		ctk_text_iter_forward_chars (&end, search->n_chars - 1);
+	}
+
+	return FALSE;
+}
+
+/**
+ * lapiz_literal_search_foreach:
+ * @search: a #LapizLiteralSearch
+ * @start: start of the range
+ * @end: end of the range
+ * @func: (scope call): function called for each match
+ * @user_data: data passed to @func
+ *
+ * Calls @func for each match between @start and @end, in order. Matches
+ * do not overlap. The text of the range is copied once, so @func can
+ * apply tags to the matches but must not change the text.
+ */
+void
+lapiz_literal_search_foreach (LapizLiteralSearch     *search,
+			      const CtkTextIter      *start,
+			      const CtkTextIter      *end,
+			      LapizLiteralSearchFunc  func,
+			      gpointer                user_data)
+{
+	CtkTextBuffer *buffer;
+	CtkTextIter ctx_start;
+	CtkTextIter ctx_end;
+	gboolean before, after;
+	gchar *text;
+	glong n_chars;
+	gsize from, to;
+	gsize pos;
+	gint pos_offset;
+	gsize m_start, m_end;
+
+	g_return_if_fail (search != NULL);
+	g_return_if_fail (start != NULL && end != NULL);
+	g_return_if_fail (func != NULL);
+
+	if (search->len == 0)
+		return;
+
+	buffer = ctk_text_iter_get_buffer (start);
+
+	ctx_start = *start;
+	ctx_end = *end;
+	add_context (&ctx_start, &ctx_end, &before, &after);
+
+	text = get_window_text (&ctx_start, &ctx_end, &n_chars);
+
+	if (text == NULL)
+	{
+		CtkTextIter iter, limit;
+		CtkTextIter match_start, match_end;
+		gint end_offset;
+
+		iter = *start;
+		limit = *end;
+		end_offset = ctk_text_iter_get_offset (end);
+
+		while (ctk_search (search, &iter, &limit, TRUE, &match_start, &match_end))
+		{
+			gint offset = ctk_text_iter_get_offset (&match_end);
+
+			func (&match_start, &match_end, user_data);
+
+			/* tagging invalidates the iters */
+			ctk_text_buffer_get_iter_at_offset (buffer, &iter, offset);
+			ctk_text_buffer_get_iter_at_offset (buffer, &limit, end_offset);
+		}
+
+		return;
+	}
+
+	get_search_range (text, before, after, &from, &to);
+
+	/* the character offset of the matches is counted from match to
+	 * match, since tagging invalidates the iters */
+	pos = 0;
+	pos_offset = ctk_text_iter_get_offset (&ctx_start);
+
+	while (lapiz_literal_search_find (search, text, from, to, &m_start, &m_end))
+	{
+		CtkTextIter match_start, match_end;
+		gint start_offset;
+
+		start_offset = pos_offset + g_utf8_pointer_to_offset (text + pos, text + m_start);
+		pos_offset = start_offset + g_utf8_pointer_to_offset (text + m_start, text + m_end);
+		pos = m_end;
+
+		ctk_text_buffer_get_iter_at_offset (buffer, &match_start, start_offset);
+		ctk_text_buffer_get_iter_at_offset (buffer, &match_end, pos_offset);
+
+		func (&match_start, &match_end, user_data);
+
+		from = m_end;
+	}
+
+	g_free (text);
+}
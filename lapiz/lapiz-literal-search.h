@@ -0,0 +1,73 @@
+/*
+ * lapiz-literal-search.h
+ * This file is part of lapiz
+ *
+ * lapiz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * lapiz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lapiz; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef __LAPIZ_LITERAL_SEARCH_H__
+#define __LAPIZ_LITERAL_SEARCH_H__
+
+#include <ctk/ctk.h>
+
+G_BEGIN_DECLS
+
+typedef struct _LapizLiteralSearch LapizLiteralSearch;
+
+typedef void (* LapizLiteralSearchFunc) (const CtkTextIter *match_start,
+					 const CtkTextIter *match_end,
+					 gpointer           user_data);
+
+LapizLiteralSearch	*lapiz_literal_search_new	(const gchar         *needle,
+							 guint                flags);
+
+void			 lapiz_literal_search_free	(LapizLiteralSearch  *search);
+
+gboolean		 lapiz_literal_search_find	(LapizLiteralSearch  *search,
+							 const gchar         *text,
+							 gsize                from,
+							 gsize                to,
+							 gsize               *match_start,
+							 gsize               *match_end);
+
+gboolean		 lapiz_literal_search_find_last	(LapizLiteralSearch  *search,
+							 const gchar         *text,
+							 gsize                from,
+							 gsize                to,
+							 gsize               *match_start,
+							 gsize               *match_end);
+
+gboolean		 lapiz_literal_search_forward	(LapizLiteralSearch  *search,
+							 const CtkTextIter   *iter,
+							 const CtkTextIter   *limit,
+							 CtkTextIter         *match_start,
+							 CtkTextIter         *match_end);
+
+gboolean		 lapiz_literal_search_backward	(LapizLiteralSearch  *search,
+							 const CtkTextIter   *iter,
+							 const CtkTextIter   *limit,
+							 CtkTextIter         *match_start,
+							 CtkTextIter         *match_end);
+
+void			 lapiz_literal_search_foreach	(LapizLiteralSearch    *search,
+							 const CtkTextIter     *start,
+							 const CtkTextIter     *end,
+							 LapizLiteralSearchFunc func,
+							 gpointer               user_data);
+
+G_END_DECLS
+
+#endif /* __LAPIZ_LITERAL_SEARCH_H__ */
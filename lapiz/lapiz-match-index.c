@@ -0,0 +1,343 @@
+/*
+ * lapiz-match-index.c
+ * This file is part of lapiz
+ *
+ * lapiz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * lapiz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lapiz; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*
+ * The matches of the search of a document, as a sorted array of character
+ * offsets. The matches do not overlap, so both their starts and their ends
+ * are sorted and can be looked up with a binary search. LapizTextRegion
+ * keeps its subregions the same way.
+ *
+ * An edit moves all the matches after it. Rather than updating them all on
+ * every keystroke, the shift is kept pending for the matches from a given
+ * position on: a following edit near the same place only has to update
+ * the matches between the two positions.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "lapiz-match-index.h"
+
+typedef struct
+{
+	gint start;
+	gint end;
+} Match;
+
+struct _LapizMatchIndex
+{
+	GArray *matches;
+
+	/* the matches from shift_from on are shift characters after the
+	 * offsets they hold */
+	guint   shift_from;
+	gint    shift;
+};
+
+LapizMatchIndex *
+lapiz_match_index_new (void)
+{
+	LapizMatchIndex *index;
+
+	index = g_slice_new (LapizMatchIndex);
+	index->matches = g_array_new (FALSE, FALSE, sizeof (Match));
+	index->shift_from = 0;
+	index->shift = 0;
+
+	return index;
+}
+
+void
+lapiz_match_index_free (LapizMatchIndex *index)
+{
+	if (index == NULL)
+		return;
+
+	g_array_free (index->matches, TRUE);
+	g_slice_free (LapizMatchIndex, index);
+}
+
+guint
+lapiz_match_index_get_length (LapizMatchIndex *index)
+{
+	g_return_val_if_fail (index != NULL, 0);
+
+	return index->matches->len;
+}
+
+static void
+get_nth (LapizMatchIndex *index,
+	 guint            n,
+	 gint            *start,
+	 gint            *end)
+{
+	Match *match;
+	gint shift;
+
+	match = &g_array_index (index->matches, Match, n);
+	shift = (n >= index->shift_from) ? index->shift : 0;
+
+	if (start != NULL)
+		*start = match->start + shift;
+	if (end != NULL)
+		*end = match->end + shift;
+}
+
+void
+lapiz_match_index_get_nth (LapizMatchIndex *index,
+			   guint            n,
+			   gint            *start,
+			   gint            *end)
+{
+	g_return_if_fail (index != NULL);
+	g_return_if_fail (n < index->matches->len);
+
+	get_nth (index, n, start, end);
+}
+
+/* The new offsets must keep the starts and the ends of the matches
+ * sorted */
+void
+lapiz_match_index_set_nth (LapizMatchIndex *index,
+			   guint            n,
+			   gint             start,
+			   gint             end)
+{
+	Match *match;
+	gint shift;
+
+	g_return_if_fail (index != NULL);
+	g_return_if_fail (n < index->matches->len);
+	g_return_if_fail (start <= end);
+
+	match = &g_array_index (index->matches, Match, n);
+	shift = (n >= index->shift_from) ? index->shift : 0;
+
+	match->start = start - shift;
+	match->end = end - shift;
+}
+
+/* Moves the start of the pending shift to @n, applying it to the matches
+ * that leave or enter it. */
+static void
+move_shift (LapizMatchIndex *index,
+	    guint            n)
+{
+	guint i;
+
+	if (index->shift == 0)
+	{
+		index->shift_from = n;
+		return;
+	}
+
+	for (i = n; i < index->shift_from; ++i)
+	{
+		Match *match = &g_array_index (index->matches, Match, i);
+
+		match->start -= index->shift;
+		match->end -= index->shift;
+	}
+
+	for (i = index->shift_from; i < n; ++i)
+	{
+		Match *match = &g_array_index (index->matches, Match, i);
+
+		match->start += index->shift;
+		match->end += index->shift;
+	}
+
+	index->shift_from = n;
+}
+
+void
+lapiz_match_index_append (LapizMatchIndex *index,
+			  gint             start,
+			  gint             end)
+{
+	g_return_if_fail (index != NULL);
+
+	lapiz_match_index_insert (index, index->matches->len, start, end);
+}
+
+void
+lapiz_match_index_insert (LapizMatchIndex *index,
+			  guint            n,
+			  gint             start,
+			  gint             end)
+{
+	Match match;
+
+	g_return_if_fail (index != NULL);
+	g_return_if_fail (n <= index->matches->len);
+	g_return_if_fail (start <= end);
+
+	move_shift (index, n);
+
+	/* the new match is stored before the shift */
+	match.start = start;
+	match.end = end;
+	g_array_insert_val (index->matches, n, match);
+
+	++index->shift_from;
+}
+
+void
+lapiz_match_index_remove (LapizMatchIndex *index,
+			  guint            n,
+			  guint            n_matches)
+{
+	g_return_if_fail (index != NULL);
+	g_return_if_fail (n + n_matches <= index->matches->len);
+
+	if (n_matches == 0)
+		return;
+
+	move_shift (index, n);
+	g_array_remove_range (index->matches, n, n_matches);
+}
+
+/**
+ * lapiz_match_index_shift:
+ * @index: a #LapizMatchIndex
+ * @offset: the offset of an insertion or a deletion
+ * @delta: the number of characters inserted, or minus the number of
+ * characters deleted
+ *
+ * Moves the matches that start at @offset or after by @delta characters.
+ * The matches that contain @offset are left as they are: the caller is
+ * expected to search their text again.
+ */
+void
+lapiz_match_index_shift (LapizMatchIndex *index,
+			 gint             offset,
+			 gint             delta)
+{
+	g_return_if_fail (index != NULL);
+
+	if (delta == 0)
+		return;
+
+	move_shift (index, lapiz_match_index_find_next (index, offset));
+	index->shift += delta;
+}
+
+/**
+ * lapiz_match_index_find_next:
+ * @index: a #LapizMatchIndex
+ * @offset: a character offset
+ *
+ * Returns: the position of the first match starting at @offset or after
+ * it, or the length of @index if there is none.
+ */
+guint
+lapiz_match_index_find_next (LapizMatchIndex *index,
+			     gint             offset)
+{
+	guint low, high;
+
+	g_return_val_if_fail (index != NULL, 0);
+
+	low = 0;
+	high = index->matches->len;
+
+	while (low < high)
+	{
+		guint mid = low + (high - low) / 2;
+		gint start;
+
+		get_nth (index, mid, &start, NULL);
+
+		if (start < offset)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+/**
+ * lapiz_match_index_find_prev:
+ * @index: a #LapizMatchIndex
+ * @offset: a character offset
+ *
+ * Returns: the position of the last match ending at @offset or before it,
+ * or -1 if there is none.
+ */
+gint
+lapiz_match_index_find_prev (LapizMatchIndex *index,
+			     gint             offset)
+{
+	guint low, high;
+
+	g_return_val_if_fail (index != NULL, -1);
+
+	low = 0;
+	high = index->matches->len;
+
+	while (low < high)
+	{
+		guint mid = low + (high - low) / 2;
+		gint end;
+
+		get_nth (index, mid, NULL, &end);
+
+		if (end <= offset)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return (gint) low - 1;
+}
+
+/**
+ * lapiz_match_index_lookup:
+ * @index: a #LapizMatchIndex
+ * @start: the start offset of a match
+ * @end: the end offset of a match
+ *
+ * Returns: the position of the match going from @start to @end, or -1 if
+ * it is not in @index.
+ */
+gint
+lapiz_match_index_lookup (LapizMatchIndex *index,
+			  gint             start,
+			  gint             end)
+{
+	guint n;
+	gint match_start, match_end;
+
+	g_return_val_if_fail (index != NULL, -1);
+
+	n = lapiz_match_index_find_next (index, start);
+
+	if (n == index->matches->len)
+		return -1;
+
+	get_nth (index, n, &match_start, &match_end);
+
+	if (match_start != start || match_end != end)
+		return -1;
+
+	return n;
+}
@@ -0,0 +1,75 @@
+/*
+ * lapiz-match-index.h
+ * This file is part of lapiz
+ *
+ * lapiz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * lapiz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lapiz; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef __LAPIZ_MATCH_INDEX_H__
+#define __LAPIZ_MATCH_INDEX_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _LapizMatchIndex LapizMatchIndex;
+
+LapizMatchIndex	*lapiz_match_index_new		(void);
+
+void		 lapiz_match_index_free		(LapizMatchIndex *index);
+
+guint		 lapiz_match_index_get_length	(LapizMatchIndex *index);
+
+void		 lapiz_match_index_get_nth	(LapizMatchIndex *index,
+						 guint            n,
+						 gint            *start,
+						 gint            *end);
+
+void		 lapiz_match_index_set_nth	(LapizMatchIndex *index,
+						 guint            n,
+						 gint             start,
+						 gint             end);
+
+void		 lapiz_match_index_append	(LapizMatchIndex *index,
+						 gint             start,
+						 gint             end);
+
+void		 lapiz_match_index_insert	(LapizMatchIndex *index,
+						 guint            n,
+						 gint             start,
+						 gint             end);
+
+void		 lapiz_match_index_remove	(LapizMatchIndex *index,
+						 guint            n,
+						 guint            n_matches);
+
+void		 lapiz_match_index_shift	(LapizMatchIndex *index,
+						 gint             offset,
+						 gint             delta);
+
+guint		 lapiz_match_index_find_next	(LapizMatchIndex *index,
+						 gint             offset);
+
+gint		 lapiz_match_index_find_prev	(LapizMatchIndex *index,
+						 gint             offset);
+
+gint		 lapiz_match_index_lookup	(LapizMatchIndex *index,
+						 gint             start,
+						 gint             end);
+
+G_END_DECLS
+
+#endif /* __LAPIZ_MATCH_INDEX_H__ */
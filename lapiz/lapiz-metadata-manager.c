@@ -33,6 +33,9 @@
 
 #include <time.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib/gstdio.h>
 #include <libxml/xmlreader.h>
 #include "lapiz-metadata-manager.h"
 #include "lapiz-debug.h"
@@ -42,9 +45,28 @@
 #define LAPIZ_METADATA_VERBOSE_DEBUG	1
 */
 
-#define METADATA_FILE 	"lapiz-metadata.xml"
+/* The metadata are kept in an append-only log of records, one per line:
+ *
+ *   S <uri> <key> <value>	set a value
+ *   R <uri> <key>		remove a value
+ *   T <uri>			the document has been accessed
+ *   D <uri>			the document has been dropped
+ *
+ * Fields are separated by tabs and escaped. Replaying the log in order
+ * rebuilds both the values and the order of last access. Changes are
+ * appended to the file, which is only rewritten (atomically) when it
+ * holds too many stale records, or when its last record is truncated.
+ */
+#define METADATA_FILE 		"lapiz-metadata.log"
+#define METADATA_HEADER		"lapiz-metadata 1\n"
+
+/* The file used by older versions, imported when there is no log yet */
+#define LEGACY_METADATA_FILE 	"lapiz-metadata.xml"
+
+#define MAX_ITEMS		20000
 
-#define MAX_ITEMS	50
+/* Number of stale records after which the log gets compacted */
+#define MAX_STALE_RECORDS	4096
 
 typedef struct _LapizMetadataManager LapizMetadataManager;
 
@@ -52,9 +74,11 @@ typedef struct _Item Item;
 
 struct _Item
 {
-	time_t	 	 atime; /* time of last access */
+	gchar		*uri;
 
 	GHashTable	*values;
+
+	GList		*link; /* in the list of items */
 };
 
 struct _LapizMetadataManager
@@ -65,6 +89,17 @@ struct _LapizMetadataManager
 	guint 		 timeout_id;
 
 	GHashTable	*items;
+
+	/* Items by time of last access, most recent first */
+	GQueue		 lru;
+
+	/* Records not yet appended to the file */
+	GString		*pending;
+
+	guint		 n_records; /* records in the file */
+	guint		 n_values; /* values of all the items */
+
+	gboolean	 needs_compaction;
 };
 
 static gboolean lapiz_metadata_manager_save (gpointer data);
@@ -85,8 +120,8 @@ item_free (gpointer data)
 
 	item = (Item *)data;
 
-	if (item->values != NULL)
-		g_hash_table_destroy (item->values);
+	g_hash_table_destroy (item->values);
+	g_free (item->uri);
 
 	g_free (item);
 }
@@ -117,12 +152,17 @@ lapiz_metadata_manager_init (void)
 
 	lapiz_metadata_manager->values_loaded = FALSE;
 
+	/* items own their uri */
 	lapiz_metadata_manager->items =
 		g_hash_table_new_full (g_str_hash,
 				       g_str_equal,
-				       g_free,
+				       NULL,
 				       item_free);
 
+	g_queue_init (&lapiz_metadata_manager->lru);
+
+	lapiz_metadata_manager->pending = g_string_new (NULL);
+
 	return TRUE;
 }
 
@@ -142,17 +182,264 @@ lapiz_metadata_manager_shutdown (void)
 		lapiz_metadata_manager_save (NULL);
 	}
 
+	g_queue_clear (&lapiz_metadata_manager->lru);
+
 	if (lapiz_metadata_manager->items != NULL)
 		g_hash_table_destroy (lapiz_metadata_manager->items);
 
+	g_string_free (lapiz_metadata_manager->pending, TRUE);
+
 	g_free (lapiz_metadata_manager);
 	lapiz_metadata_manager = NULL;
 }
 
+static gchar *
+get_metadata_filename (const gchar *name)
+{
+	gchar *cache_dir;
+	gchar *metadata;
+
+	cache_dir = lapiz_dirs_get_user_cache_dir ();
+
+	metadata = g_build_filename (cache_dir,
+				     name,
+				     NULL);
+
+	g_free (cache_dir);
+
+	return metadata;
+}
+
+static void
+append_field (GString     *str,
+	      const gchar *field)
+{
+	g_string_append_c (str, '\t');
+
+	for (; *field != '\0'; field++)
+	{
+		switch (*field)
+		{
+			case '\\':
+				g_string_append (str, "\\\\");
+				break;
+			case '\t':
+				g_string_append (str, "\\t");
+				break;
+			case '\n':
+				g_string_append (str, "\\n");
+				break;
+			case '\r':
+				g_string_append (str, "\\r");
+				break;
+			default:
+				g_string_append_c (str, *field);
+				break;
+		}
+	}
+}
+
+static void
+append_record (GString     *str,
+	       gchar        op,
+	       const gchar *uri,
+	       const gchar *key,
+	       const gchar *value)
+{
+	g_string_append_c (str, op);
+	append_field (str, uri);
+
+	if (key != NULL)
+		append_field (str, key);
+	if (value != NULL)
+		append_field (str, value);
+
+	g_string_append_c (str, '\n');
+}
+
+static void
+log_record (gchar        op,
+	    const gchar *uri,
+	    const gchar *key,
+	    const gchar *value)
+{
+	append_record (lapiz_metadata_manager->pending, op, uri, key, value);
+
+	lapiz_metadata_manager_arm_timeout ();
+}
+
+static void
+remove_item (Item *item)
+{
+	lapiz_metadata_manager->n_values -= g_hash_table_size (item->values);
+
+	g_queue_delete_link (&lapiz_metadata_manager->lru, item->link);
+
+	g_hash_table_remove (lapiz_metadata_manager->items, item->uri);
+}
+
+/* Drop the least recently accessed items */
+static void
+resize_items (gboolean log)
+{
+	while (g_hash_table_size (lapiz_metadata_manager->items) > MAX_ITEMS)
+	{
+		Item *item;
+
+		item = g_queue_peek_tail (&lapiz_metadata_manager->lru);
+
+		if (log)
+			log_record ('D', item->uri, NULL, NULL);
+
+		remove_item (item);
+	}
+}
+
+static Item *
+add_item (const gchar *uri)
+{
+	Item *item;
+
+	item = g_new0 (Item, 1);
+
+	item->uri = g_strdup (uri);
+	item->values = g_hash_table_new_full (g_str_hash,
+					      g_str_equal,
+					      g_free,
+					      g_free);
+
+	g_queue_push_head (&lapiz_metadata_manager->lru, item);
+	item->link = lapiz_metadata_manager->lru.head;
+
+	g_hash_table_insert (lapiz_metadata_manager->items, item->uri, item);
+
+	return item;
+}
+
+/* Returns whether the item was not already the most recently accessed one */
+static gboolean
+touch_item (Item *item)
+{
+	GQueue *lru = &lapiz_metadata_manager->lru;
+
+	if (lru->head == item->link)
+		return FALSE;
+
+	g_queue_unlink (lru, item->link);
+	g_queue_push_head_link (lru, item->link);
+
+	return TRUE;
+}
+
+static void
+set_value (Item        *item,
+	   const gchar *key,
+	   const gchar *value)
+{
+	gboolean existed;
+
+	if (value != NULL)
+	{
+		existed = !g_hash_table_replace (item->values,
+						 g_strdup (key),
+						 g_strdup (value));
+	}
+	else
+	{
+		existed = g_hash_table_remove (item->values, key);
+	}
+
+	if (value != NULL && !existed)
+		lapiz_metadata_manager->n_values++;
+	else if (value == NULL && existed)
+		lapiz_metadata_manager->n_values--;
+}
+
 static void
-parseItem (xmlDocPtr doc, xmlNodePtr cur)
+replay_record (gchar *line)
 {
+	gchar **fields;
+	guint n_fields;
 	Item *item;
+	guint i;
+
+	fields = g_strsplit (line, "\t", 4);
+	n_fields = g_strv_length (fields);
+
+	if (n_fields < 2)
+	{
+		g_strfreev (fields);
+		return;
+	}
+
+	for (i = 1; i < n_fields; i++)
+	{
+		gchar *field = g_strcompress (fields[i]);
+
+		g_free (fields[i]);
+		fields[i] = field;
+	}
+
+	item = g_hash_table_lookup (lapiz_metadata_manager->items, fields[1]);
+
+	switch (fields[0][0])
+	{
+		case 'S':
+			if (n_fields < 4)
+				break;
+
+			if (item == NULL)
+				item = add_item (fields[1]);
+			else
+				touch_item (item);
+
+			set_value (item, fields[2], fields[3]);
+			break;
+		case 'R':
+			if (n_fields < 3 || item == NULL)
+				break;
+
+			touch_item (item);
+			set_value (item, fields[2], NULL);
+			break;
+		case 'T':
+			if (item != NULL)
+				touch_item (item);
+			break;
+		case 'D':
+			if (item != NULL)
+				remove_item (item);
+			break;
+		default:
+			break;
+	}
+
+	g_strfreev (fields);
+}
+
+typedef struct _LegacyItem LegacyItem;
+
+struct _LegacyItem
+{
+	time_t	 atime; /* time of last access */
+	gchar	*uri;
+	GSList	*entries; /* keys and values, alternated */
+};
+
+static gint
+compare_legacy_items (gconstpointer a,
+		      gconstpointer b)
+{
+	const LegacyItem *item_a = *(const LegacyItem **)a;
+	const LegacyItem *item_b = *(const LegacyItem **)b;
+
+	return (item_a->atime > item_b->atime) - (item_a->atime < item_b->atime);
+}
+
+static void
+parseItem (xmlDocPtr doc, xmlNodePtr cur, GPtrArray *legacy_items)
+{
+	LegacyItem *item;
 
 	xmlChar *uri;
 	xmlChar *atime;
@@ -175,14 +462,10 @@ parseItem (xmlDocPtr doc, xmlNodePtr cur)
 		return;
 	}
 
-	item = g_new0 (Item, 1);
+	item = g_new0 (LegacyItem, 1);
 
 	item->atime = g_ascii_strtoull ((char *)atime, NULL, 0);
-
-	item->values = g_hash_table_new_full (g_str_hash,
-					      g_str_equal,
-					      g_free,
-					      g_free);
+	item->uri = g_strdup ((gchar *)uri);
 
 	cur = cur->xmlChildrenNode;
 
@@ -197,9 +480,12 @@ parseItem (xmlDocPtr doc, xmlNodePtr cur)
 			value = xmlGetProp (cur, (const xmlChar *)"value");
 
 			if ((key != NULL) && (value != NULL))
-				g_hash_table_insert (item->values,
-						     g_strdup ((gchar *)key),
-						     g_strdup ((gchar *)value));
+			{
+				item->entries = g_slist_prepend (item->entries,
+								 g_strdup ((gchar *)value));
+				item->entries = g_slist_prepend (item->entries,
+								 g_strdup ((gchar *)key));
+			}
 
 			if (key != NULL)
 				xmlFree (key);
@@ -210,54 +496,33 @@ parseItem (xmlDocPtr doc, xmlNodePtr cur)
 		cur = cur->next;
 	}
 
-	g_hash_table_insert (lapiz_metadata_manager->items,
-			     g_strdup ((gchar *)uri),
-			     item);
+	g_ptr_array_add (legacy_items, item);
 
 	xmlFree (uri);
 	xmlFree (atime);
 }
 
-static gchar *
-get_metadata_filename (void)
-{
-	gchar *cache_dir;
-	gchar *metadata;
-
-	cache_dir = lapiz_dirs_get_user_cache_dir ();
-
-	metadata = g_build_filename (cache_dir,
-				     METADATA_FILE,
-				     NULL);
-
-	g_free (cache_dir);
-
-	return metadata;
-}
-
-static gboolean
-load_values (void)
+/* Import the XML file of older versions, oldest documents first so that
+ * they end up in the same order of access.
+ */
+static void
+load_legacy_values (void)
 {
 	xmlDocPtr doc;
 	xmlNodePtr cur;
 	gchar *file_name;
+	GPtrArray *legacy_items;
+	guint i;
 
 	lapiz_debug (DEBUG_METADATA);
 
-	g_return_val_if_fail (lapiz_metadata_manager != NULL, FALSE);
-	g_return_val_if_fail (lapiz_metadata_manager->values_loaded == FALSE, FALSE);
-
-	lapiz_metadata_manager->values_loaded = TRUE;
-
 	xmlKeepBlanksDefault (0);
 
-	/* FIXME: file locking - Paolo */
-	file_name = get_metadata_filename ();
-	if ((file_name == NULL) ||
-	    (!g_file_test (file_name, G_FILE_TEST_EXISTS)))
+	file_name = get_metadata_filename (LEGACY_METADATA_FILE);
+	if (!g_file_test (file_name, G_FILE_TEST_EXISTS))
 	{
 		g_free (file_name);
-		return FALSE;
+		return;
 	}
 
 	doc = xmlParseFile (file_name);
@@ -265,38 +530,132 @@ load_values (void)
 
 	if (doc == NULL)
 	{
-		return FALSE;
+		return;
 	}
 
 	cur = xmlDocGetRootElement (doc);
 	if (cur == NULL)
 	{
-		g_message ("The metadata file '%s' is empty", METADATA_FILE);
+		g_message ("The metadata file '%s' is empty", LEGACY_METADATA_FILE);
 		xmlFreeDoc (doc);
 
-		return FALSE;
+		return;
 	}
 
 	if (xmlStrcmp (cur->name, (const xmlChar *) "metadata"))
 	{
-		g_message ("File '%s' is of the wrong type", METADATA_FILE);
+		g_message ("File '%s' is of the wrong type", LEGACY_METADATA_FILE);
 		xmlFreeDoc (doc);
 
-		return FALSE;
+		return;
 	}
 
-	cur = xmlDocGetRootElement (doc);
+	legacy_items = g_ptr_array_new ();
+
 	cur = cur->xmlChildrenNode;
 
 	while (cur != NULL)
 	{
-		parseItem (doc, cur);
+		parseItem (doc, cur, legacy_items);
 
 		cur = cur->next;
 	}
 
 	xmlFreeDoc (doc);
 
+	g_ptr_array_sort (legacy_items, compare_legacy_items);
+
+	for (i = 0; i < legacy_items->len; i++)
+	{
+		LegacyItem *legacy = g_ptr_array_index (legacy_items, i);
+		Item *item;
+		GSList *l;
+
+		item = g_hash_table_lookup (lapiz_metadata_manager->items,
+					    legacy->uri);
+		if (item == NULL)
+			item = add_item (legacy->uri);
+
+		for (l = legacy->entries; l != NULL && l->next != NULL; l = l->next->next)
+			set_value (item, l->data, l->next->data);
+
+		g_slist_free_full (legacy->entries, g_free);
+		g_free (legacy->uri);
+		g_free (legacy);
+	}
+
+	g_ptr_array_free (legacy_items, TRUE);
+
+	/* write the log on the next save */
+	lapiz_metadata_manager->needs_compaction = TRUE;
+}
+
+static gboolean
+load_values (void)
+{
+	gchar *file_name;
+	gchar *contents;
+	gsize length;
+	gchar *line;
+	gchar *end;
+
+	lapiz_debug (DEBUG_METADATA);
+
+	g_return_val_if_fail (lapiz_metadata_manager != NULL, FALSE);
+	g_return_val_if_fail (lapiz_metadata_manager->values_loaded == FALSE, FALSE);
+
+	lapiz_metadata_manager->values_loaded = TRUE;
+
+	file_name = get_metadata_filename (METADATA_FILE);
+
+	if (!g_file_get_contents (file_name, &contents, &length, NULL))
+	{
+		g_free (file_name);
+
+		load_legacy_values ();
+
+		return TRUE;
+	}
+
+	g_free (file_name);
+
+	if (!g_str_has_prefix (contents, METADATA_HEADER))
+	{
+		g_message ("File '%s' is of the wrong type", METADATA_FILE);
+		g_free (contents);
+
+		/* overwrite it on the next save */
+		lapiz_metadata_manager->needs_compaction = TRUE;
+
+		return TRUE;
+	}
+
+	line = contents + strlen (METADATA_HEADER);
+
+	while ((end = memchr (line, '\n', contents + length - line)) != NULL)
+	{
+		*end = '\0';
+
+		replay_record (line);
+		lapiz_metadata_manager->n_records++;
+
+		line = end + 1;
+	}
+
+	/* The last record was not completely written: the log has to be
+	 * rewritten before anything can be appended to it.
+	 */
+	if (line != contents + length)
+	{
+		lapiz_debug_message (DEBUG_METADATA, "Truncated record");
+
+		lapiz_metadata_manager->needs_compaction = TRUE;
+	}
+
+	g_free (contents);
+
+	resize_items (FALSE);
+
 	return TRUE;
 }
 
@@ -330,10 +689,8 @@ lapiz_metadata_manager_get (const gchar *uri,
 	if (item == NULL)
 		return NULL;
 
-	item->atime = time (NULL);
-
-	if (item->values == NULL)
-		return NULL;
+	if (touch_item (item))
+		log_record ('T', uri, NULL, NULL);
 
 	value = g_hash_table_lookup (item->values, key);
 
@@ -372,192 +729,143 @@ lapiz_metadata_manager_set (const gchar *uri,
 
 	if (item == NULL)
 	{
-		item = g_new0 (Item, 1);
+		if (value == NULL)
+			return;
 
-		g_hash_table_insert (lapiz_metadata_manager->items,
-				     g_strdup (uri),
-				     item);
+		item = add_item (uri);
 	}
-
-	if (item->values == NULL)
-		 item->values = g_hash_table_new_full (g_str_hash,
-				 		       g_str_equal,
-						       g_free,
-						       g_free);
-	if (value != NULL)
-		g_hash_table_insert (item->values,
-				     g_strdup (key),
-				     g_strdup (value));
 	else
-		g_hash_table_remove (item->values,
-				     key);
+	{
+		touch_item (item);
+	}
 
-	item->atime = time (NULL);
+	set_value (item, key, value);
 
-	lapiz_metadata_manager_arm_timeout ();
+	log_record (value != NULL ? 'S' : 'R', uri, key, value);
+
+	resize_items (TRUE);
 }
 
-static void
-save_values (const gchar *key, const gchar *value, xmlNodePtr parent)
+static gboolean
+ensure_cache_dir (void)
 {
-	xmlNodePtr xml_node;
-
-#ifdef LAPIZ_METADATA_VERBOSE_DEBUG
-	lapiz_debug (DEBUG_METADATA);
-#endif
-
-	g_return_if_fail (key != NULL);
-
-	if (value == NULL)
-		return;
-
-	xml_node = xmlNewChild (parent,
-				NULL,
-				(const xmlChar *)"entry",
-				NULL);
+	gchar *cache_dir;
+	int res;
 
-	xmlSetProp (xml_node,
-		    (const xmlChar *)"key",
-		    (const xmlChar *)key);
-	xmlSetProp (xml_node,
-		    (const xmlChar *)"value",
-		    (const xmlChar *)value);
+	/* make sure the cache dir exists */
+	cache_dir = lapiz_dirs_get_user_cache_dir ();
+	res = g_mkdir_with_parents (cache_dir, 0755);
+	g_free (cache_dir);
 
-#ifdef LAPIZ_METADATA_VERBOSE_DEBUG
-	lapiz_debug_message (DEBUG_METADATA, "entry: %s = %s", key, value);
-#endif
+	return res != -1;
 }
 
+/* Replace the log with one holding a single record per value, oldest
+ * documents first.
+ */
 static void
-save_item (const gchar *key, const gpointer *data, xmlNodePtr parent)
+compact_log (const gchar *file_name)
 {
-	xmlNodePtr xml_node;
-	const Item *item = (const Item *)data;
-	gchar *atime;
+	GString *contents;
+	GList *l;
+	GError *error = NULL;
 
-#ifdef LAPIZ_METADATA_VERBOSE_DEBUG
 	lapiz_debug (DEBUG_METADATA);
-#endif
-
-	g_return_if_fail (key != NULL);
-
-	if (item == NULL)
-		return;
-
-	xml_node = xmlNewChild (parent, NULL, (const xmlChar *)"document", NULL);
-
-	xmlSetProp (xml_node, (const xmlChar *)"uri", (const xmlChar *)key);
-
-#ifdef LAPIZ_METADATA_VERBOSE_DEBUG
-	lapiz_debug_message (DEBUG_METADATA, "uri: %s", key);
-#endif
-
-	atime = g_strdup_printf ("%ld", item->atime);
-	xmlSetProp (xml_node, (const xmlChar *)"atime", (const xmlChar *)atime);
-
-#ifdef LAPIZ_METADATA_VERBOSE_DEBUG
-	lapiz_debug_message (DEBUG_METADATA, "atime: %s", atime);
-#endif
 
-	g_free (atime);
+	contents = g_string_new (METADATA_HEADER);
 
-    	g_hash_table_foreach (item->values,
-			      (GHFunc)save_values,
-			      xml_node);
-}
+	for (l = lapiz_metadata_manager->lru.tail; l != NULL; l = l->prev)
+	{
+		Item *item = l->data;
+		GHashTableIter iter;
+		gpointer key, value;
 
-static void
-get_oldest (const gchar *key, const gpointer value, const gchar ** key_to_remove)
-{
-	const Item *item = (const Item *)value;
+		g_hash_table_iter_init (&iter, item->values);
+		while (g_hash_table_iter_next (&iter, &key, &value))
+			append_record (contents, 'S', item->uri, key, value);
+	}
 
-	if (*key_to_remove == NULL)
+	if (g_file_set_contents (file_name, contents->str, contents->len, &error))
 	{
-		*key_to_remove = key;
+		lapiz_metadata_manager->n_records = lapiz_metadata_manager->n_values;
+		lapiz_metadata_manager->needs_compaction = FALSE;
 	}
 	else
 	{
-		const Item *item_to_remove =
-			g_hash_table_lookup (lapiz_metadata_manager->items,
-					     *key_to_remove);
-
-		g_return_if_fail (item_to_remove != NULL);
-
-		if (item->atime < item_to_remove->atime)
-		{
-			*key_to_remove = key;
-		}
+		g_warning ("Could not save the metadata: %s", error->message);
+		g_error_free (error);
 	}
+
+	g_string_free (contents, TRUE);
 }
 
 static void
-resize_items (void)
+append_log (const gchar *file_name)
 {
-	while (g_hash_table_size (lapiz_metadata_manager->items) > MAX_ITEMS)
-	{
-		gpointer key_to_remove = NULL;
+	GString *pending = lapiz_metadata_manager->pending;
+	const gchar *p;
+	FILE *file;
+	gboolean written;
 
-		g_hash_table_foreach (lapiz_metadata_manager->items,
-				      (GHFunc)get_oldest,
-				      &key_to_remove);
+	lapiz_debug (DEBUG_METADATA);
 
-		g_return_if_fail (key_to_remove != NULL);
+	file = g_fopen (file_name, "ab");
+	if (file == NULL)
+	{
+		lapiz_metadata_manager->needs_compaction = TRUE;
+		return;
+	}
+
+	written = fwrite (pending->str, 1, pending->len, file) == pending->len;
+	written = (fclose (file) == 0) && written;
 
-		g_hash_table_remove (lapiz_metadata_manager->items,
-				     key_to_remove);
+	/* A partial write leaves a truncated record behind */
+	if (!written)
+	{
+		lapiz_metadata_manager->needs_compaction = TRUE;
+		return;
 	}
+
+	for (p = pending->str; (p = strchr (p, '\n')) != NULL; p++)
+		lapiz_metadata_manager->n_records++;
 }
 
 static gboolean
 lapiz_metadata_manager_save (gpointer data)
 {
-	xmlDocPtr  doc;
-	xmlNodePtr root;
 	gchar *file_name;
 
 	lapiz_debug (DEBUG_METADATA);
 
 	lapiz_metadata_manager->timeout_id = 0;
 
-	resize_items ();
-
-	xmlIndentTreeOutput = TRUE;
-
-	doc = xmlNewDoc ((const xmlChar *)"1.0");
-	if (doc == NULL)
-		return TRUE;
-
-	/* Create metadata root */
-	root = xmlNewDocNode (doc, NULL, (const xmlChar *)"metadata", NULL);
-	xmlDocSetRootElement (doc, root);
-
-    	g_hash_table_foreach (lapiz_metadata_manager->items,
-			      (GHFunc)save_item,
-			      root);
+	if (!ensure_cache_dir ())
+		return FALSE;
 
 	/* FIXME: lock file - Paolo */
-	file_name = get_metadata_filename ();
-	if (file_name != NULL)
+	file_name = get_metadata_filename (METADATA_FILE);
+
+	if (!lapiz_metadata_manager->needs_compaction &&
+	    !g_file_test (file_name, G_FILE_TEST_EXISTS))
 	{
-		gchar *cache_dir;
-		int res;
+		lapiz_metadata_manager->needs_compaction = TRUE;
+	}
 
-		/* make sure the cache dir exists */
-		cache_dir = lapiz_dirs_get_user_cache_dir ();
-		res = g_mkdir_with_parents (cache_dir, 0755);
-		if (res != -1)
-		{
-			xmlSaveFormatFile (file_name, doc, 1);
-		}
+	if (!lapiz_metadata_manager->needs_compaction)
+		append_log (file_name);
 
-		g_free (cache_dir);
-		g_free (file_name);
+	if (lapiz_metadata_manager->needs_compaction ||
+	    lapiz_metadata_manager->n_records >
+	    lapiz_metadata_manager->n_values + MAX_STALE_RECORDS)
+	{
+		compact_log (file_name);
 	}
 
-	xmlFreeDoc (doc);
+	g_string_truncate (lapiz_metadata_manager->pending, 0);
+
+	g_free (file_name);
 
 	lapiz_debug_message (DEBUG_METADATA, "DONE");
 
 	return FALSE;
 }
-
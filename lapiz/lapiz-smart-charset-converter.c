@@ -23,19 +23,65 @@
 #include "lapiz-smart-charset-converter.h"
 #include "lapiz-debug.h"
 #include "lapiz-document.h"
+#include "lapiz-utf8-scanner.h"
 
 #include <gio/gio.h>
 #include <glib/gi18n.h>
+#include <string.h>
+
+/* The input is buffered while guessing, up to GUESS_MAX_SIZE bytes (plus
+ * the bytes needed to complete a character). The guess is committed earlier
+ * when the leading candidate has seen GUESS_MIN_EVIDENCE non-ASCII bytes and
+ * every candidate preferred to it has been ruled out. */
+#define GUESS_MAX_SIZE		(64 * 1024)
+#define GUESS_MIN_EVIDENCE	1024
+#define GUESS_MIN_ABSORB	16
+#define GUESS_SCRATCH_SIZE	8192
+
+/* Pure ASCII input does not tell the candidates apart, so a guess made
+ * on it is only provisional: when the first non-ASCII byte shows up, the
+ * guessing starts over from there among the ASCII compatible candidates,
+ * which would all have decoded the text already converted the same way. */
+#define ASCII_SAMPLE		"\t\n\r !09AZaz~"
+
+/* A candidate whose decoded text has more than one suspicious character
+ * every GUESS_MAX_SUSPICIOUS is considered implausible */
+#define GUESS_MAX_SUSPICIOUS	100
+
+typedef struct
+{
+	const LapizEncoding *encoding;
+
+	/* NULL for UTF-8, which is validated in place */
+	GCharsetConverter *conv;
+
+	/* bytes of the buffered input already decoded */
+	gsize consumed;
+
+	gsize n_chars;
+	gsize n_suspicious;
+
+	guint alive : 1;
+} Candidate;
 
 struct _LapizSmartCharsetConverterPrivate
 {
 	GCharsetConverter *charset_conv;
 
 	GSList *encodings;
-	GSList *current_encoding;
+	const LapizEncoding *guessed;
+	gdouble confidence;
+
+	/* guessing state */
+	Candidate *candidates;
+	guint n_candidates;
+	GByteArray *pending;
+	gsize pending_pos;
+	gsize n_high_bytes;
 
 	guint is_utf8 : 1;
-	guint use_first : 1;
+	guint ascii_only : 1;
+	guint ascii_compatible_only : 1;
 };
 
 static void lapiz_smart_charset_converter_iface_init    (GConverterIface *iface);
@@ -46,6 +92,34 @@ G_DEFINE_TYPE_WITH_CODE (LapizSmartCharsetConverter, lapiz_smart_charset_convert
 			 G_IMPLEMENT_INTERFACE (G_TYPE_CONVERTER,
 						lapiz_smart_charset_converter_iface_init))
 
+static void
+free_candidates (LapizSmartCharsetConverter *smart)
+{
+	guint i;
+
+	for (i = 0; i < smart->priv->n_candidates; i++)
+	{
+		if (smart->priv->candidates[i].conv != NULL)
+			g_object_unref (smart->priv->candidates[i].conv);
+	}
+
+	g_free (smart->priv->candidates);
+	smart->priv->candidates = NULL;
+	smart->priv->n_candidates = 0;
+}
+
+static void
+free_pending (LapizSmartCharsetConverter *smart)
+{
+	if (smart->priv->pending != NULL)
+	{
+		g_byte_array_unref (smart->priv->pending);
+		smart->priv->pending = NULL;
+	}
+
+	smart->priv->pending_pos = 0;
+}
+
 static void
 lapiz_smart_charset_converter_finalize (GObject *object)
 {
@@ -69,6 +143,9 @@ lapiz_smart_charset_converter_dispose (GObject *object)
 		smart->priv->charset_conv = NULL;
 	}
 
+	free_candidates (smart);
+	free_pending (smart);
+
 	lapiz_debug_message (DEBUG_UTILS, "disposing smart charset converter");
 
 	G_OBJECT_CLASS (lapiz_smart_charset_converter_parent_class)->dispose (object);
@@ -90,200 +167,550 @@ lapiz_smart_charset_converter_init (LapizSmartCharsetConverter *smart)
 
 	smart->priv->charset_conv = NULL;
 	smart->priv->encodings = NULL;
-	smart->priv->current_encoding = NULL;
+	smart->priv->guessed = NULL;
+	smart->priv->confidence = 0.0;
+	smart->priv->candidates = NULL;
+	smart->priv->n_candidates = 0;
+	smart->priv->pending = NULL;
+	smart->priv->pending_pos = 0;
+	smart->priv->n_high_bytes = 0;
 	smart->priv->is_utf8 = FALSE;
-	smart->priv->use_first = FALSE;
+	smart->priv->ascii_only = FALSE;
+	smart->priv->ascii_compatible_only = FALSE;
 
 	lapiz_debug_message (DEBUG_UTILS, "initializing smart charset converter");
 }
 
-static const LapizEncoding *
-get_encoding (LapizSmartCharsetConverter *smart)
+static gboolean
+is_ascii_compatible (GCharsetConverter *conv)
 {
-	if (smart->priv->current_encoding == NULL)
-	{
-		smart->priv->current_encoding = smart->priv->encodings;
-	}
-	else
+	gchar out[64];
+	gsize bytes_read;
+	gsize bytes_written;
+	GConverterResult res;
+	gboolean ret;
+
+	res = g_converter_convert (G_CONVERTER (conv),
+				   ASCII_SAMPLE,
+				   strlen (ASCII_SAMPLE),
+				   out,
+				   sizeof (out),
+				   G_CONVERTER_INPUT_AT_END,
+				   &bytes_read,
+				   &bytes_written,
+				   NULL);
+
+	ret = res == G_CONVERTER_FINISHED &&
+	      bytes_written == strlen (ASCII_SAMPLE) &&
+	      memcmp (out, ASCII_SAMPLE, bytes_written) == 0;
+
+	g_converter_reset (G_CONVERTER (conv));
+
+	return ret;
+}
+
+static void
+init_candidates (LapizSmartCharsetConverter *smart)
+{
+	GSList *l;
+	guint i = 0;
+
+	smart->priv->n_candidates = g_slist_length (smart->priv->encodings);
+	smart->priv->candidates = g_new0 (Candidate, smart->priv->n_candidates);
+
+	for (l = smart->priv->encodings; l != NULL; l = g_slist_next (l))
 	{
-		smart->priv->current_encoding = g_slist_next (smart->priv->current_encoding);
-	}
+		Candidate *cand = &smart->priv->candidates[i++];
 
-	if (smart->priv->current_encoding != NULL)
-		return (const LapizEncoding *)smart->priv->current_encoding->data;
+		cand->encoding = (const LapizEncoding *)l->data;
+		cand->alive = TRUE;
 
-#if 0
-	FIXME: uncomment this when using fallback
-	/* If we tried all encodings, we return the first encoding */
-	smart->priv->use_first = TRUE;
-	smart->priv->current_encoding = smart->priv->encodings;
+		if (cand->encoding != lapiz_encoding_get_utf8 ())
+		{
+			cand->conv = g_charset_converter_new ("UTF-8",
+							      lapiz_encoding_get_charset (cand->encoding),
+							      NULL);
+
+			/* the charset is not supported by iconv */
+			if (cand->conv == NULL)
+				cand->alive = FALSE;
+			else if (smart->priv->ascii_compatible_only)
+				cand->alive = is_ascii_compatible (cand->conv);
+		}
+	}
 
-	return (const LapizEncoding *)smart->priv->current_encoding->data;
-#endif
-	return NULL;
+	smart->priv->pending = g_byte_array_sized_new (GUESS_MAX_SIZE + GUESS_MIN_ABSORB);
 }
 
-static gboolean
-try_convert (GCharsetConverter *converter,
-             const void        *inbuf,
-             gsize              inbuf_size)
+static inline gboolean
+is_suspicious_char (gunichar c)
 {
-	GError *err;
-	gsize bytes_read, nread;
-	gsize bytes_written, nwritten;
-	GConverterResult res;
-	gchar *out;
-	gboolean ret;
-	gsize out_size;
+	if (c < 0x20)
+		return c != '\t' && c != '\n' && c != '\v' &&
+		       c != '\f' && c != '\r' && c != 0x1b;
+
+	/* DEL, C1 controls, the replacement character and the private
+	 * use area are unlikely in text decoded with the right charset */
+	return (c >= 0x7f && c <= 0x9f) ||
+	       c == 0xfffd ||
+	       (c >= 0xe000 && c <= 0xf8ff);
+}
+
+/* Accounts valid UTF-8 text decoded by the candidate */
+static void
+score_text (Candidate   *cand,
+	    const gchar *text,
+	    gsize        len)
+{
+	const gchar *p = text;
+	const gchar *end = text + len;
 
-	if (inbuf == NULL || inbuf_size == 0)
+	while (p < end)
 	{
-		return FALSE;
+		if ((guchar)*p < 0x80)
+		{
+			if (is_suspicious_char ((guchar)*p))
+				cand->n_suspicious++;
+
+			p++;
+		}
+		else
+		{
+			if (is_suspicious_char (g_utf8_get_char (p)))
+				cand->n_suspicious++;
+
+			p = g_utf8_next_char (p);
+		}
+
+		cand->n_chars++;
 	}
+}
 
-	err = NULL;
-	nread = 0;
-	nwritten = 0;
-	out_size = inbuf_size * 4;
-	out = g_malloc (out_size);
+/* Decodes the buffered input the candidate did not see yet. A candidate is
+ * ruled out on the first invalid sequence; a character cut at the end of the
+ * buffer waits for the next input. NUL characters rule the candidate out
+ * too, since the document cannot hold them. */
+static void
+feed_candidate (Candidate    *cand,
+		const guint8 *data,
+		gsize         len,
+		gboolean      at_end)
+{
+	gsize n = 0;
 
-	do
+	if (cand->conv == NULL)
 	{
-		res = g_converter_convert (G_CONVERTER (converter),
-		                           (void *) ((gsize) inbuf + nread),
-		                           inbuf_size - nread,
-		                           out + nwritten,
-		                           out_size - nwritten,
-		                           G_CONVERTER_INPUT_AT_END,
-		                           &bytes_read,
-		                           &bytes_written,
-		                           &err);
-
-		nread += bytes_read;
-		nwritten += bytes_written;
-	} while (res != G_CONVERTER_FINISHED && res != G_CONVERTER_ERROR && err == NULL);
-
-	if (err != NULL)
+		const gchar *end;
+		gsize valid;
+
+		if (lapiz_utf8_validate ((const gchar *)data, len, &end))
+		{
+			score_text (cand, (const gchar *)data, len);
+			cand->consumed += len;
+			return;
+		}
+
+		valid = end - (const gchar *)data;
+		score_text (cand, (const gchar *)data, valid);
+		cand->consumed += valid;
+
+		if (at_end || len - valid >= 6 ||
+		    g_utf8_get_char_validated (end, len - valid) != (gunichar)-2)
+		{
+			cand->alive = FALSE;
+		}
+
+		return;
+	}
+
+	while (n < len)
 	{
-		if (err->code == G_CONVERT_ERROR_PARTIAL_INPUT)
+		gchar scratch[GUESS_SCRATCH_SIZE];
+		GConverterResult res;
+		gsize bytes_read;
+		gsize bytes_written;
+		GError *err = NULL;
+
+		res = g_converter_convert (G_CONVERTER (cand->conv),
+					   data + n,
+					   len - n,
+					   scratch,
+					   sizeof (scratch),
+					   at_end ? G_CONVERTER_INPUT_AT_END : G_CONVERTER_NO_FLAGS,
+					   &bytes_read,
+					   &bytes_written,
+					   &err);
+
+		if (res == G_CONVERTER_ERROR)
 		{
-			/* FIXME We can get partial input while guessing the
-			   encoding because we just take some amount of text
-			   to guess from. */
-			ret = TRUE;
+			if (at_end ||
+			    !g_error_matches (err, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT))
+			{
+				cand->alive = FALSE;
+			}
+
+			g_error_free (err);
+			break;
 		}
-		else
+
+		if (!lapiz_utf8_validate (scratch, bytes_written, NULL))
 		{
-			ret = FALSE;
+			cand->alive = FALSE;
+			break;
 		}
 
-		g_error_free (err);
+		score_text (cand, scratch, bytes_written);
+		n += bytes_read;
+
+		if (res == G_CONVERTER_FINISHED ||
+		    (bytes_read == 0 && bytes_written == 0))
+		{
+			break;
+		}
 	}
-	else
+
+	cand->consumed += n;
+}
+
+static gboolean
+is_plausible (const Candidate *cand)
+{
+	return cand->alive &&
+	       cand->n_suspicious * GUESS_MAX_SUSPICIOUS <= cand->n_chars;
+}
+
+/* The leader is the first plausible candidate in the order of preference,
+ * or the first one still alive if none is plausible */
+static Candidate *
+get_leader (LapizSmartCharsetConverter *smart)
+{
+	Candidate *first_alive = NULL;
+	guint i;
+
+	for (i = 0; i < smart->priv->n_candidates; i++)
+	{
+		Candidate *cand = &smart->priv->candidates[i];
+
+		if (is_plausible (cand))
+			return cand;
+
+		if (cand->alive && first_alive == NULL)
+			first_alive = cand;
+	}
+
+	return first_alive;
+}
+
+static gboolean
+leader_is_clearly_ahead (LapizSmartCharsetConverter *smart,
+			 Candidate                  *leader)
+{
+	Candidate *cand;
+
+	if (!is_plausible (leader) ||
+	    smart->priv->n_high_bytes < GUESS_MIN_EVIDENCE)
 	{
-		ret = TRUE;
+		return FALSE;
 	}
 
-	/* FIXME: Check the remainder? */
-	if (ret == TRUE && !g_utf8_validate (out, nwritten, NULL))
+	for (cand = smart->priv->candidates; cand < leader; cand++)
 	{
-		ret = FALSE;
+		if (cand->alive)
+			return FALSE;
 	}
 
-	g_free (out);
+	return TRUE;
+}
 
-	return ret;
+/* How much the guess can be trusted, from 0 to 1: the share of plausible
+ * characters, lowered while other candidates remain possible and not enough
+ * non-ASCII text was seen to tell them apart. Pure ASCII text decodes the
+ * same way in every candidate that is still alive. */
+static gdouble
+compute_confidence (LapizSmartCharsetConverter *smart,
+		    Candidate                  *leader)
+{
+	gdouble confidence;
+	gboolean has_rivals = FALSE;
+	guint i;
+
+	confidence = 1.0;
+	if (leader->n_chars > 0)
+		confidence -= (gdouble)leader->n_suspicious / leader->n_chars;
+
+	for (i = 0; i < smart->priv->n_candidates; i++)
+	{
+		Candidate *cand = &smart->priv->candidates[i];
+
+		if (cand != leader && cand->alive)
+			has_rivals = TRUE;
+	}
+
+	if (has_rivals && smart->priv->n_high_bytes > 0)
+	{
+		gdouble evidence;
+
+		evidence = MIN (1.0, (gdouble)smart->priv->n_high_bytes / GUESS_MIN_EVIDENCE);
+		confidence *= 0.5 + 0.5 * evidence;
+	}
+
+	return CLAMP (confidence, 0.0, 1.0);
 }
 
-static GCharsetConverter *
+static void
+set_guessed (LapizSmartCharsetConverter *smart,
+	     const LapizEncoding        *enc,
+	     gdouble                     confidence)
+{
+	lapiz_debug_message (DEBUG_UTILS, "guessed charset: %s (confidence %.2f)",
+			     lapiz_encoding_get_charset (enc), confidence);
+
+	smart->priv->guessed = enc;
+	smart->priv->confidence = confidence;
+
+	free_candidates (smart);
+
+	if (enc == lapiz_encoding_get_utf8 ())
+	{
+		smart->priv->is_utf8 = TRUE;
+	}
+	else
+	{
+		smart->priv->charset_conv = g_charset_converter_new ("UTF-8",
+								     lapiz_encoding_get_charset (enc),
+								     NULL);
+
+		/* FIXME: uncomment this when we want to use the fallback
+		g_charset_converter_set_use_fallback (smart->priv->charset_conv, TRUE);*/
+	}
+}
+
+/* Buffers the input and scores every candidate on it, committing to the
+ * leading candidate once it is clearly ahead, enough input was seen or the
+ * input is over. The input is only ever read once: the buffered part is
+ * converted with the committed charset before the rest.
+ *
+ * Returns the bytes of @inbuf that were buffered in @bytes_read. When the
+ * guess is committed the buffered input ends on a character boundary of
+ * the guessed charset, unless it is the end of the input. */
+static gboolean
 guess_encoding (LapizSmartCharsetConverter *smart,
 		const void                 *inbuf,
-		gsize                       inbuf_size)
+		gsize                       inbuf_size,
+		gboolean                    at_end,
+		gsize                      *bytes_read,
+		GError                    **error)
 {
-	GCharsetConverter *conv = NULL;
+	GByteArray *pending;
+	Candidate *leader;
+	gsize old_len;
+	gsize absorb;
+	gboolean last;
+	guint i;
+
+	*bytes_read = 0;
+
+	/* Nothing to guess from */
+	if (smart->priv->encodings == NULL ||
+	    (at_end && inbuf_size == 0 &&
+	     (smart->priv->pending == NULL || smart->priv->pending->len == 0)))
+	{
+		set_guessed (smart, lapiz_encoding_get_utf8 (), 1.0);
+		return TRUE;
+	}
 
-	if (inbuf == NULL || inbuf_size == 0)
+	/* If there is only one candidate we just use it */
+	if (smart->priv->encodings->next == NULL)
 	{
-		smart->priv->is_utf8 = TRUE;
-		return NULL;
+		set_guessed (smart, smart->priv->encodings->data, 1.0);
+		return TRUE;
 	}
 
-	if (smart->priv->encodings != NULL &&
-	    smart->priv->encodings->next == NULL)
-		smart->priv->use_first = TRUE;
+	if (smart->priv->candidates == NULL)
+		init_candidates (smart);
+
+	pending = smart->priv->pending;
+	old_len = pending->len;
+
+	absorb = MAX (GUESS_MAX_SIZE - MIN (old_len, GUESS_MAX_SIZE), GUESS_MIN_ABSORB);
+	absorb = MIN (absorb, inbuf_size);
+	last = at_end && absorb == inbuf_size;
+
+	g_byte_array_append (pending, inbuf, absorb);
 
-	/* We just check the first block */
-	while (TRUE)
+	for (i = 0; i < absorb; i++)
 	{
-		const LapizEncoding *enc;
+		if (((const guint8 *)inbuf)[i] >= 0x80)
+			smart->priv->n_high_bytes++;
+	}
+
+	for (i = 0; i < smart->priv->n_candidates; i++)
+	{
+		Candidate *cand = &smart->priv->candidates[i];
 
-		if (conv != NULL)
+		if (cand->alive)
 		{
-			g_object_unref (conv);
-			conv = NULL;
+			feed_candidate (cand,
+					pending->data + cand->consumed,
+					pending->len - cand->consumed,
+					last);
 		}
+	}
 
-		/* We get an encoding from the list */
-		enc = get_encoding (smart);
+	leader = get_leader (smart);
 
-		/* if it is NULL we didn't guess anything */
-		if (enc == NULL)
-		{
-			break;
-		}
+	if (leader == NULL)
+	{
+		/* FIXME: Add a different domain when we kill lapiz_convert */
+		g_set_error_literal (error, LAPIZ_DOCUMENT_ERROR,
+				     LAPIZ_DOCUMENT_ERROR_ENCODING_AUTO_DETECTION_FAILED,
+				     _("It is not possible to detect the encoding automatically"));
+		return FALSE;
+	}
 
-		lapiz_debug_message (DEBUG_UTILS, "trying charset: %s",
-				     lapiz_encoding_get_charset (smart->priv->current_encoding->data));
+	*bytes_read = absorb;
 
-		if (enc == lapiz_encoding_get_utf8 ())
-		{
-			gsize remainder;
-			const gchar *end;
+	if (!last &&
+	    pending->len < GUESS_MAX_SIZE &&
+	    !leader_is_clearly_ahead (smart, leader))
+	{
+		return TRUE;
+	}
 
-			if (g_utf8_validate (inbuf, inbuf_size, &end) ||
-			    smart->priv->use_first)
-			{
-				smart->priv->is_utf8 = TRUE;
-				break;
-			}
+	if (!last)
+	{
+		/* A character cut by the end of the input cannot be given
+		 * back if its beginning was buffered by a previous call */
+		if (leader->consumed < old_len)
+			return TRUE;
 
-			/* Check if the end is less than one char */
-			remainder = inbuf_size - (end - (gchar *)inbuf);
-			if (remainder < 6)
-			{
-				smart->priv->is_utf8 = TRUE;
-				break;
-			}
+		*bytes_read = leader->consumed - old_len;
+		g_byte_array_set_size (pending, leader->consumed);
+	}
 
-			continue;
-		}
+	smart->priv->ascii_only = smart->priv->n_high_bytes == 0 &&
+				  leader->encoding == lapiz_encoding_get_utf8 ();
 
-		conv = g_charset_converter_new ("UTF-8",
-						lapiz_encoding_get_charset (enc),
-						NULL);
+	set_guessed (smart, leader->encoding, compute_confidence (smart, leader));
 
-		/* If we tried all encodings we use the first one */
-		if (smart->priv->use_first)
-		{
+	return TRUE;
+}
+
+static gsize
+find_non_ascii (const guint8 *data,
+		gsize         len)
+{
+	gsize i = 0;
+
+	for (; i + sizeof (guint64) <= len; i += sizeof (guint64))
+	{
+		guint64 word;
+
+		memcpy (&word, data + i, sizeof (word));
+
+		if ((word & G_GUINT64_CONSTANT (0x8080808080808080)) != 0)
 			break;
-		}
+	}
 
-		/* Try to convert */
-		if (try_convert (conv, inbuf, inbuf_size))
-		{
+	for (; i < len; i++)
+	{
+		if (data[i] >= 0x80)
 			break;
-		}
 	}
 
-	if (conv != NULL)
+	return i;
+}
+
+/* Forgets a provisional guess, see ASCII_SAMPLE */
+static void
+restart_guessing (LapizSmartCharsetConverter *smart)
+{
+	lapiz_debug_message (DEBUG_UTILS, "non-ASCII text found, guessing again");
+
+	smart->priv->guessed = NULL;
+	smart->priv->confidence = 0.0;
+	smart->priv->n_high_bytes = 0;
+	smart->priv->is_utf8 = FALSE;
+	smart->priv->ascii_only = FALSE;
+	smart->priv->ascii_compatible_only = TRUE;
+}
+
+static GConverterResult
+passthrough (const void      *inbuf,
+	     gsize            inbuf_size,
+	     void            *outbuf,
+	     gsize            outbuf_size,
+	     GConverterFlags  flags,
+	     gsize           *bytes_read,
+	     gsize           *bytes_written)
+{
+	gsize size;
+
+	size = MIN (inbuf_size, outbuf_size);
+
+	memcpy (outbuf, inbuf, size);
+	*bytes_read = size;
+	*bytes_written = size;
+
+	if (size == inbuf_size)
 	{
-		g_converter_reset (G_CONVERTER (conv));
+		if (flags & G_CONVERTER_INPUT_AT_END)
+			return G_CONVERTER_FINISHED;
+		else if (flags & G_CONVERTER_FLUSH)
+			return G_CONVERTER_FLUSHED;
+	}
 
-		/* FIXME: uncomment this when we want to use the fallback
-		g_charset_converter_set_use_fallback (conv, TRUE);*/
+	return G_CONVERTER_CONVERTED;
+}
+
+static GConverterResult
+convert_committed (LapizSmartCharsetConverter *smart,
+		   const void                 *inbuf,
+		   gsize                       inbuf_size,
+		   void                       *outbuf,
+		   gsize                       outbuf_size,
+		   GConverterFlags             flags,
+		   gsize                      *bytes_read,
+		   gsize                      *bytes_written,
+		   GError                    **error)
+{
+	/* Now if the encoding is utf8 just redirect the input to the output */
+	if (smart->priv->is_utf8)
+	{
+		if (smart->priv->ascii_only)
+		{
+			gsize ascii_len;
+
+			ascii_len = find_non_ascii (inbuf, MIN (inbuf_size, outbuf_size));
+
+			/* stop right before the first non-ASCII byte */
+			if (ascii_len < MIN (inbuf_size, outbuf_size))
+			{
+				memcpy (outbuf, inbuf, ascii_len);
+				*bytes_read = ascii_len;
+				*bytes_written = ascii_len;
+
+				return G_CONVERTER_CONVERTED;
+			}
+		}
+
+		return passthrough (inbuf, inbuf_size,
+				    outbuf, outbuf_size,
+				    flags,
+				    bytes_read, bytes_written);
 	}
 
-	return conv;
+	/* If we reached here is because we need to convert the text so, we
+	   convert it with the charset converter */
+	return g_converter_convert (G_CONVERTER (smart->priv->charset_conv),
+				    inbuf,
+				    inbuf_size,
+				    outbuf,
+				    outbuf_size,
+				    flags,
+				    bytes_read,
+				    bytes_written,
+				    error);
 }
 
 static GConverterResult
@@ -298,59 +725,88 @@ lapiz_smart_charset_converter_convert (GConverter *converter,
 				       GError    **error)
 {
 	LapizSmartCharsetConverter *smart = LAPIZ_SMART_CHARSET_CONVERTER (converter);
+	gsize absorbed = 0;
 
-	/* Guess the encoding if we didn't make it yet */
-	if (smart->priv->charset_conv == NULL &&
-	    !smart->priv->is_utf8)
+	if (smart->priv->ascii_only &&
+	    smart->priv->pending == NULL &&
+	    inbuf_size > 0 &&
+	    *(const guint8 *)inbuf >= 0x80)
 	{
-		smart->priv->charset_conv = guess_encoding (smart, inbuf, inbuf_size);
+		restart_guessing (smart);
+	}
 
-		/* If we still have the previous case is that we didn't guess
-		   anything */
-		if (smart->priv->charset_conv == NULL &&
-		    !smart->priv->is_utf8)
+	/* Guess the encoding if we didn't make it yet */
+	if (smart->priv->guessed == NULL)
+	{
+		if (!guess_encoding (smart,
+				     inbuf,
+				     inbuf_size,
+				     (flags & (G_CONVERTER_INPUT_AT_END | G_CONVERTER_FLUSH)) != 0,
+				     &absorbed,
+				     error))
 		{
-			/* FIXME: Add a different domain when we kill lapiz_convert */
-			g_set_error_literal (error, LAPIZ_DOCUMENT_ERROR,
-					     LAPIZ_DOCUMENT_ERROR_ENCODING_AUTO_DETECTION_FAILED,
-					     _("It is not possible to detect the encoding automatically"));
 			return G_CONVERTER_ERROR;
 		}
+
+		/* Still guessing: the input is buffered */
+		if (smart->priv->guessed == NULL)
+		{
+			*bytes_read = absorbed;
+			*bytes_written = 0;
+
+			return G_CONVERTER_CONVERTED;
+		}
+
+		inbuf = (const guint8 *)inbuf + absorbed;
+		inbuf_size -= absorbed;
 	}
 
-	/* Now if the encoding is utf8 just redirect the input to the output */
-	if (smart->priv->is_utf8)
+	if (smart->priv->pending != NULL &&
+	    smart->priv->pending_pos == smart->priv->pending->len)
 	{
-		gsize size;
-		GConverterResult ret;
+		free_pending (smart);
+	}
 
-		size = MIN (inbuf_size, outbuf_size);
+	/* Convert what was buffered while guessing before any new input */
+	if (smart->priv->pending != NULL)
+	{
+		GByteArray *pending = smart->priv->pending;
+		GConverterResult res;
+		gsize nread;
+
+		res = convert_committed (smart,
+					 pending->data + smart->priv->pending_pos,
+					 pending->len - smart->priv->pending_pos,
+					 outbuf,
+					 outbuf_size,
+					 inbuf_size == 0 ? flags : G_CONVERTER_NO_FLAGS,
+					 &nread,
+					 bytes_written,
+					 error);
+
+		if (res == G_CONVERTER_ERROR)
+			return G_CONVERTER_ERROR;
 
-		memcpy (outbuf, inbuf, size);
-		*bytes_read = size;
-		*bytes_written = size;
+		smart->priv->pending_pos += nread;
+		*bytes_read = absorbed;
 
-		ret = G_CONVERTER_CONVERTED;
+		if (smart->priv->pending_pos < pending->len)
+			return G_CONVERTER_CONVERTED;
 
-		if (flags & G_CONVERTER_INPUT_AT_END)
-			ret = G_CONVERTER_FINISHED;
-		else if (flags & G_CONVERTER_FLUSH)
-			ret = G_CONVERTER_FLUSHED;
+		free_pending (smart);
 
-		return ret;
+		return res;
 	}
 
-	/* If we reached here is because we need to convert the text so, we
-	   convert it with the charset converter */
-	return g_converter_convert (G_CONVERTER (smart->priv->charset_conv),
-				    inbuf,
-				    inbuf_size,
-				    outbuf,
-				    outbuf_size,
-				    flags,
-				    bytes_read,
-				    bytes_written,
-				    error);
+	return convert_committed (smart,
+				  inbuf,
+				  inbuf_size,
+				  outbuf,
+				  outbuf_size,
+				  flags,
+				  bytes_read,
+				  bytes_written,
+				  error);
 }
 
 static void
@@ -358,14 +814,21 @@ lapiz_smart_charset_converter_reset (GConverter *converter)
 {
 	LapizSmartCharsetConverter *smart = LAPIZ_SMART_CHARSET_CONVERTER (converter);
 
-	smart->priv->current_encoding = NULL;
+	smart->priv->guessed = NULL;
+	smart->priv->confidence = 0.0;
+	smart->priv->n_high_bytes = 0;
 	smart->priv->is_utf8 = FALSE;
+	smart->priv->ascii_only = FALSE;
+	smart->priv->ascii_compatible_only = FALSE;
 
 	if (smart->priv->charset_conv != NULL)
 	{
 		g_object_unref (smart->priv->charset_conv);
 		smart->priv->charset_conv = NULL;
 	}
+
+	free_candidates (smart);
+	free_pending (smart);
 }
 
 static void
@@ -394,16 +857,25 @@ lapiz_smart_charset_converter_get_guessed (LapizSmartCharsetConverter *smart)
 {
 	g_return_val_if_fail (LAPIZ_IS_SMART_CHARSET_CONVERTER (smart), NULL);
 
-	if (smart->priv->current_encoding != NULL)
-	{
-		return (const LapizEncoding *)smart->priv->current_encoding->data;
-	}
-	else if (smart->priv->is_utf8)
-	{
-		return lapiz_encoding_get_utf8 ();
-	}
+	return smart->priv->guessed;
+}
+
+/**
+ * lapiz_smart_charset_converter_get_confidence:
+ * @smart: a #LapizSmartCharsetConverter
+ *
+ * Gets how much the guessed encoding can be trusted, from 0 (not guessed
+ * yet, or hardly distinguishable from other candidates) to 1. It is 1
+ * when there was a single candidate.
+ *
+ * Returns: the confidence of the guess.
+ */
+gdouble
+lapiz_smart_charset_converter_get_confidence (LapizSmartCharsetConverter *smart)
+{
+	g_return_val_if_fail (LAPIZ_IS_SMART_CHARSET_CONVERTER (smart), 0.0);
 
-	return NULL;
+	return smart->priv->confidence;
 }
 
 guint
@@ -59,6 +59,8 @@ LapizSmartCharsetConverter	*lapiz_smart_charset_converter_new		(GSList *candidat
 
 const LapizEncoding		*lapiz_smart_charset_converter_get_guessed	(LapizSmartCharsetConverter *smart);
 
+gdouble				 lapiz_smart_charset_converter_get_confidence	(LapizSmartCharsetConverter *smart);
+
 guint				 lapiz_smart_charset_converter_get_num_fallbacks(LapizSmartCharsetConverter *smart);
 
 G_END_DECLS
@@ -42,6 +42,7 @@ struct _LapizStatusbarPrivate
 {
 	CtkWidget     *overwrite_mode_label;
 	CtkWidget     *cursor_position_label;
+	CtkWidget     *search_matches_label;
 
 	CtkWidget     *state_frame;
 	CtkWidget     *load_image;
@@ -123,6 +124,12 @@ lapiz_statusbar_init (LapizStatusbar *statusbar)
 					  statusbar->priv->cursor_position_label,
 					  FALSE, TRUE, 0);
 
+	statusbar->priv->search_matches_label = ctk_label_new (NULL);
+	ctk_widget_show (statusbar->priv->search_matches_label);
+	ctk_box_pack_end (CTK_BOX (statusbar),
+					  statusbar->priv->search_matches_label,
+					  FALSE, TRUE, 0);
+
 	statusbar->priv->state_frame = ctk_frame_new (NULL);
 	ctk_frame_set_shadow_type (CTK_FRAME (statusbar->priv->state_frame),
 							   CTK_SHADOW_IN);
@@ -250,6 +257,46 @@ lapiz_statusbar_set_cursor_position (LapizStatusbar *statusbar,
 	g_free (msg);
 }
 
+/**
+ * lapiz_statusbar_set_search_matches:
+ * @statusbar: an #LapizStatusbar
+ * @index: the position of the selected match, counting from 1, or 0
+ * @count: the number of matches, or -1 to clear the field
+ *
+ * Sets the number of matches of the search on the statusbar and, if one
+ * of them is selected, which one it is.
+ **/
+void
+lapiz_statusbar_set_search_matches (LapizStatusbar *statusbar,
+				    gint            index,
+				    gint            count)
+{
+	gchar *matches = NULL;
+	gchar *msg = NULL;
+
+	g_return_if_fail (LAPIZ_IS_STATUSBAR (statusbar));
+
+	if ((count >= 0) && (index > 0))
+	{
+		matches = g_strdup_printf (_("Match %d of %d"), index, count);
+	}
+	else if (count >= 0)
+	{
+		matches = g_strdup_printf (ngettext ("%d match",
+						     "%d matches",
+						     count),
+					   count);
+	}
+
+	if (matches != NULL)
+		msg = g_strdup_printf ("  %s", matches);
+
+	ctk_label_set_text (CTK_LABEL (statusbar->priv->search_matches_label), msg);
+
+	g_free (matches);
+	g_free (msg);
+}
+
 static gboolean
 remove_message_timeout (LapizStatusbar *statusbar)
 {
@@ -73,6 +73,10 @@ void		 lapiz_statusbar_set_cursor_position	(LapizStatusbar   *statusbar,
 							 gint              line,
 							 gint              col);
 
+void		 lapiz_statusbar_set_search_matches	(LapizStatusbar   *statusbar,
+							 gint              index,
+							 gint              count);
+
 void		 lapiz_statusbar_clear_overwrite 	(LapizStatusbar   *statusbar);
 
 void		 lapiz_statusbar_flash_message		(LapizStatusbar   *statusbar,
@@ -77,6 +77,7 @@ struct _LapizTabPrivate
 
 	gint	                not_editable : 1;
 	gint                    auto_save : 1;
+	gint                    auto_saving : 1;
 
 	gint                    ask_if_externally_modified : 1;
 
@@ -308,8 +309,18 @@ lapiz_tab_get_state (LapizTab *tab)
 	return tab->priv->state;
 }
 
+/* An auto-save writes a snapshot of the document in the background, so
+ * the user can keep editing meanwhile */
+static gboolean
+is_auto_saving (LapizTab      *tab,
+		LapizTabState  state)
+{
+	return (state == LAPIZ_TAB_STATE_SAVING) && tab->priv->auto_saving;
+}
+
 static void
-set_cursor_according_to_state (CtkTextView   *view,
+set_cursor_according_to_state (LapizTab      *tab,
+			       CtkTextView   *view,
 			       LapizTabState  state)
 {
 	CdkCursor *cursor;
@@ -321,7 +332,8 @@ set_cursor_according_to_state (CtkTextView   *view,
 
 	if ((state == LAPIZ_TAB_STATE_LOADING)          ||
 	    (state == LAPIZ_TAB_STATE_REVERTING)        ||
-	    (state == LAPIZ_TAB_STATE_SAVING)           ||
+	    ((state == LAPIZ_TAB_STATE_SAVING) &&
+	     !is_auto_saving (tab, state))              ||
 	    (state == LAPIZ_TAB_STATE_PRINTING)         ||
 	    (state == LAPIZ_TAB_STATE_PRINT_PREVIEWING) ||
 	    (state == LAPIZ_TAB_STATE_CLOSING))
@@ -356,7 +368,7 @@ static void
 view_realized (CtkTextView *view,
 	       LapizTab    *tab)
 {
-	set_cursor_according_to_state (view, tab->priv->state);
+	set_cursor_according_to_state (tab, view, tab->priv->state);
 }
 
 static void
@@ -365,7 +377,8 @@ set_view_properties_according_to_state (LapizTab      *tab,
 {
 	gboolean val;
 
-	val = ((state == LAPIZ_TAB_STATE_NORMAL) &&
+	val = (((state == LAPIZ_TAB_STATE_NORMAL) ||
+		is_auto_saving (tab, state)) &&
 	       (tab->priv->print_preview == NULL) &&
 	       !tab->priv->not_editable);
 	ctk_text_view_set_editable (CTK_TEXT_VIEW (tab->priv->view), val);
@@ -405,7 +418,8 @@ lapiz_tab_set_state (LapizTab      *tab,
 			ctk_widget_show (tab->priv->view_scrolled_window);
 	}
 
-	set_cursor_according_to_state (CTK_TEXT_VIEW (tab->priv->view),
+	set_cursor_according_to_state (tab,
+				       CTK_TEXT_VIEW (tab->priv->view),
 				       state);
 
 	g_object_notify (G_OBJECT (tab), "state");
@@ -1267,6 +1281,8 @@ document_saved (LapizDocument *document,
 	tab->priv->timer = NULL;
 	tab->priv->times_called = 0;
 
+	tab->priv->auto_saving = FALSE;
+
 	set_message_area (tab, NULL);
 
 	if (error != NULL)
@@ -2121,6 +2137,7 @@ lapiz_tab_auto_save (LapizTab *tab)
 		return FALSE;
 	}
 
+	tab->priv->auto_saving = TRUE;
 	lapiz_tab_set_state (tab, LAPIZ_TAB_STATE_SAVING);
 
 	/* uri used in error messages, will be freed in document_saved */
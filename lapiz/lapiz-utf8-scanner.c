@@ -0,0 +1,382 @@
+/*
+ * lapiz-utf8-scanner.c
+ * This file is part of lapiz
+ *
+ * lapiz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * lapiz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lapiz; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Single pass UTF-8 validation, character and line counting and newline
+ * classification. Loaded text used to be walked once by g_utf8_validate()
+ * and once more to find out the line endings; the scanner does both at
+ * once and classifies plain ASCII 16 bytes at a time when SSE2 is
+ * available.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "lapiz-utf8-scanner.h"
+
+#if defined (__SSE2__) && defined (__GNUC__)
+#include <emmintrin.h>
+#define SCAN_SSE2 1
+#define SCAN_BLOCK_SIZE 16
+#endif
+
+void
+lapiz_utf8_scan_init (LapizUtf8Scan *scan)
+{
+	g_return_if_fail (scan != NULL);
+
+	scan->n_bytes = 0;
+	scan->n_chars = 0;
+	scan->n_lf = 0;
+	scan->n_cr = 0;
+	scan->n_crlf = 0;
+
+	scan->first_newline = LAPIZ_DOCUMENT_NEWLINE_TYPE_DEFAULT;
+	scan->has_newline = FALSE;
+	scan->pending_cr = FALSE;
+}
+
+static inline void
+set_first_newline (LapizUtf8Scan            *scan,
+		   LapizDocumentNewlineType  type)
+{
+	if (!scan->has_newline)
+	{
+		scan->first_newline = type;
+		scan->has_newline = TRUE;
+	}
+}
+
+/* Returns the length of the multibyte sequence starting at p or 0 if it is
+ * invalid, overlong, a surrogate, out of range or truncated. */
+static inline gsize
+multibyte_length (const guchar *p,
+		  gsize         avail)
+{
+	guchar lo = 0x80;
+	guchar hi = 0xBF;
+	gsize len;
+
+	if (p[0] >= 0xC2 && p[0] <= 0xDF)
+	{
+		len = 2;
+	}
+	else if (p[0] >= 0xE0 && p[0] <= 0xEF)
+	{
+		len = 3;
+
+		if (p[0] == 0xE0)
+			lo = 0xA0;
+		else if (p[0] == 0xED)
+			hi = 0x9F;
+	}
+	else if (p[0] >= 0xF0 && p[0] <= 0xF4)
+	{
+		len = 4;
+
+		if (p[0] == 0xF0)
+			lo = 0x90;
+		else if (p[0] == 0xF4)
+			hi = 0x8F;
+	}
+	else
+	{
+		return 0;
+	}
+
+	if (avail < len)
+		return 0;
+
+	if (p[1] < lo || p[1] > hi)
+		return 0;
+
+	if (len > 2 && (p[2] & 0xC0) != 0x80)
+		return 0;
+
+	if (len > 3 && (p[3] & 0xC0) != 0x80)
+		return 0;
+
+	return len;
+}
+
+/**
+ * lapiz_utf8_scan:
+ * @scan: a #LapizUtf8Scan
+ * @text: the text to scan
+ * @len: length of @text in bytes
+ * @end: (out) (allow-none): return location for the end of the valid text
+ *
+ * Validates @text like g_utf8_validate() does and adds its characters and
+ * line endings to @scan. Only the valid part of @text is accounted.
+ *
+ * Returns: %TRUE if the whole @text is valid UTF-8.
+ */
+gboolean
+lapiz_utf8_scan (LapizUtf8Scan  *scan,
+		 const gchar    *text,
+		 gsize           len,
+		 const gchar   **end)
+{
+	const guchar *p;
+	const guchar *e;
+	gboolean valid = TRUE;
+#ifdef SCAN_SSE2
+	const guchar *simd_from;
+	const __m128i lf_v = _mm_set1_epi8 ('\n');
+	const __m128i cr_v = _mm_set1_epi8 ('\r');
+	const __m128i zero_v = _mm_setzero_si128 ();
+#endif
+
+	g_return_val_if_fail (scan != NULL, FALSE);
+	g_return_val_if_fail (text != NULL || len == 0, FALSE);
+
+	p = (const guchar *) text;
+	e = p + len;
+
+#ifdef SCAN_SSE2
+	simd_from = p;
+#endif
+
+	while (p < e)
+	{
+		gsize clen;
+
+#ifdef SCAN_SSE2
+		/* Blocks of plain ASCII with LF or CRLF line endings are
+		 * classified at once, everything else goes through the
+		 * scalar path below for the rest of the block. */
+		if (p >= simd_from && !scan->pending_cr && e - p >= SCAN_BLOCK_SIZE)
+		{
+			__m128i v;
+			guint high, nul, lf, cr;
+
+			v = _mm_loadu_si128 ((const __m128i *) p);
+			high = _mm_movemask_epi8 (v);
+			nul = _mm_movemask_epi8 (_mm_cmpeq_epi8 (v, zero_v));
+			lf = _mm_movemask_epi8 (_mm_cmpeq_epi8 (v, lf_v));
+			cr = _mm_movemask_epi8 (_mm_cmpeq_epi8 (v, cr_v));
+
+			/* every CR must be followed by a LF in the block */
+			if (high == 0 && nul == 0 && (cr & ~(lf >> 1)) == 0)
+			{
+				if ((cr | lf) != 0)
+				{
+					guint ncr = __builtin_popcount (cr);
+					guint first = (cr | lf) & -(cr | lf);
+
+					set_first_newline (scan, (first & cr) ?
+							   LAPIZ_DOCUMENT_NEWLINE_TYPE_CR_LF :
+							   LAPIZ_DOCUMENT_NEWLINE_TYPE_LF);
+
+					scan->n_crlf += ncr;
+					scan->n_lf += __builtin_popcount (lf) - ncr;
+				}
+
+				scan->n_chars += SCAN_BLOCK_SIZE;
+				scan->n_bytes += SCAN_BLOCK_SIZE;
+				p += SCAN_BLOCK_SIZE;
+
+				continue;
+			}
+
+			simd_from = p + SCAN_BLOCK_SIZE;
+		}
+#endif
+
+		if (scan->pending_cr)
+		{
+			scan->pending_cr = FALSE;
+
+			if (*p == '\n')
+			{
+				scan->n_crlf++;
+				set_first_newline (scan, LAPIZ_DOCUMENT_NEWLINE_TYPE_CR_LF);
+
+				scan->n_chars++;
+				scan->n_bytes++;
+				p++;
+
+				continue;
+			}
+
+			scan->n_cr++;
+			set_first_newline (scan, LAPIZ_DOCUMENT_NEWLINE_TYPE_CR);
+		}
+
+		if (*p < 0x80)
+		{
+			if (*p == '\0')
+			{
+				valid = FALSE;
+				break;
+			}
+
+			if (*p == '\n')
+			{
+				scan->n_lf++;
+				set_first_newline (scan, LAPIZ_DOCUMENT_NEWLINE_TYPE_LF);
+			}
+			else if (*p == '\r')
+			{
+				scan->pending_cr = TRUE;
+			}
+
+			clen = 1;
+		}
+		else
+		{
+			clen = multibyte_length (p, e - p);
+
+			if (clen == 0)
+			{
+				valid = FALSE;
+				break;
+			}
+		}
+
+		scan->n_chars++;
+		scan->n_bytes += clen;
+		p += clen;
+	}
+
+	if (end != NULL)
+		*end = (const gchar *) p;
+
+	return valid;
+}
+
+/**
+ * lapiz_utf8_scan_finish:
+ * @scan: a #LapizUtf8Scan
+ *
+ * Tells @scan that there is no more text, so a pending CR is a line
+ * ending on its own.
+ */
+void
+lapiz_utf8_scan_finish (LapizUtf8Scan *scan)
+{
+	g_return_if_fail (scan != NULL);
+
+	if (scan->pending_cr)
+	{
+		scan->pending_cr = FALSE;
+		scan->n_cr++;
+		set_first_newline (scan, LAPIZ_DOCUMENT_NEWLINE_TYPE_CR);
+	}
+}
+
+/**
+ * lapiz_utf8_scan_drop_pending_cr:
+ * @scan: a #LapizUtf8Scan
+ *
+ * Takes a pending CR, which is always the last character scanned, out of
+ * @scan, so that it can be scanned again with the text following it.
+ *
+ * Returns: whether there was a pending CR
+ */
+gboolean
+lapiz_utf8_scan_drop_pending_cr (LapizUtf8Scan *scan)
+{
+	g_return_val_if_fail (scan != NULL, FALSE);
+
+	if (!scan->pending_cr)
+		return FALSE;
+
+	scan->pending_cr = FALSE;
+	scan->n_chars--;
+	scan->n_bytes--;
+
+	return TRUE;
+}
+
+/**
+ * lapiz_utf8_scan_merge:
+ * @scan: a #LapizUtf8Scan without a pending CR
+ * @other: the statistics of the text following the one of @scan
+ *
+ * Adds @other to @scan.
+ */
+void
+lapiz_utf8_scan_merge (LapizUtf8Scan       *scan,
+		       const LapizUtf8Scan *other)
+{
+	g_return_if_fail (scan != NULL);
+	g_return_if_fail (other != NULL);
+	g_return_if_fail (!scan->pending_cr);
+
+	scan->n_bytes += other->n_bytes;
+	scan->n_chars += other->n_chars;
+	scan->n_lf += other->n_lf;
+	scan->n_cr += other->n_cr;
+	scan->n_crlf += other->n_crlf;
+
+	if (other->has_newline)
+		set_first_newline (scan, other->first_newline);
+
+	scan->pending_cr = other->pending_cr;
+}
+
+gsize
+lapiz_utf8_scan_get_line_count (const LapizUtf8Scan *scan)
+{
+	g_return_val_if_fail (scan != NULL, 0);
+
+	return scan->n_lf + scan->n_cr + scan->n_crlf +
+	       (scan->pending_cr ? 1 : 0) + 1;
+}
+
+/* The newline type of a document is the one of its first line */
+LapizDocumentNewlineType
+lapiz_utf8_scan_get_newline_type (const LapizUtf8Scan *scan)
+{
+	g_return_val_if_fail (scan != NULL, LAPIZ_DOCUMENT_NEWLINE_TYPE_DEFAULT);
+
+	if (scan->has_newline)
+		return scan->first_newline;
+
+	if (scan->pending_cr)
+		return LAPIZ_DOCUMENT_NEWLINE_TYPE_CR;
+
+	return LAPIZ_DOCUMENT_NEWLINE_TYPE_DEFAULT;
+}
+
+/**
+ * lapiz_utf8_validate:
+ * @text: the text to validate
+ * @len: length of @text in bytes
+ * @end: (out) (allow-none): return location for the end of the valid text
+ *
+ * Same as g_utf8_validate() with an explicit length, using the scanner
+ * fast path.
+ *
+ * Returns: %TRUE if the whole @text is valid UTF-8.
+ */
+gboolean
+lapiz_utf8_validate (const gchar  *text,
+		     gsize         len,
+		     const gchar **end)
+{
+	LapizUtf8Scan scan;
+
+	lapiz_utf8_scan_init (&scan);
+
+	return lapiz_utf8_scan (&scan, text, len, end);
+}
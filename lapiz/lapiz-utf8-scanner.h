@@ -0,0 +1,75 @@
+/*
+ * lapiz-utf8-scanner.h
+ * This file is part of lapiz
+ *
+ * lapiz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * lapiz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lapiz; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef __LAPIZ_UTF8_SCANNER_H__
+#define __LAPIZ_UTF8_SCANNER_H__
+
+#include <glib.h>
+
+#include "lapiz-document.h"
+
+G_BEGIN_DECLS
+
+typedef struct _LapizUtf8Scan LapizUtf8Scan;
+
+/* Statistics of the text scanned so far. The text can be scanned in
+ * consecutive chunks: a CR ending a chunk stays pending until the next chunk
+ * tells whether it is part of a CRLF. */
+struct _LapizUtf8Scan
+{
+	gsize n_bytes;
+	gsize n_chars;
+	gsize n_lf;
+	gsize n_cr;
+	gsize n_crlf;
+
+	/*< private >*/
+	LapizDocumentNewlineType first_newline;
+	guint has_newline : 1;
+	guint pending_cr : 1;
+};
+
+void		lapiz_utf8_scan_init		(LapizUtf8Scan      *scan);
+
+gboolean	lapiz_utf8_scan			(LapizUtf8Scan      *scan,
+						 const gchar        *text,
+						 gsize               len,
+						 const gchar       **end);
+
+void		lapiz_utf8_scan_finish		(LapizUtf8Scan      *scan);
+
+gboolean	lapiz_utf8_scan_drop_pending_cr	(LapizUtf8Scan      *scan);
+
+void		lapiz_utf8_scan_merge		(LapizUtf8Scan       *scan,
+						 const LapizUtf8Scan *other);
+
+gsize		lapiz_utf8_scan_get_line_count	(const LapizUtf8Scan *scan);
+
+LapizDocumentNewlineType
+		lapiz_utf8_scan_get_newline_type
+						(const LapizUtf8Scan *scan);
+
+gboolean	lapiz_utf8_validate		(const gchar        *text,
+						 gsize               len,
+						 const gchar       **end);
+
+G_END_DECLS
+
+#endif /* __LAPIZ_UTF8_SCANNER_H__ */
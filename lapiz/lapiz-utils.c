@@ -1561,114 +1561,511 @@ lapiz_utils_decode_uri (const gchar  *uri,
 	return TRUE;
 }
 
-gboolean
-lapiz_ctk_text_iter_regex_search (const CtkTextIter *iter,
-				  const gchar       *str,
-				  CtkTextSearchFlags flags,
-				  CtkTextIter       *match_start,
-				  CtkTextIter       *match_end,
-				  const CtkTextIter *limit,
-				  gboolean forward_search,
-				  gchar            **replace_text)
+/* The compiled regex of the last search is kept on the buffer, so that
+ * find next does not compile the pattern again */
+#define LAPIZ_REGEX_CACHE_KEY "LapizRegexCacheKey"
+
+/* The text is matched in windows of about this many characters, rounded
+ * up to the end of the line. A match that may continue past the window
+ * is retried in a bigger one. */
+#define REGEX_SEARCH_WINDOW_CHARS (64 * 1024)
+
+/* Characters of the previous window given as context to the next one,
+ * so that lookbehind (or, searching backward, lookahead) assertions still
+ * see them */
+#define REGEX_SEARCH_OVERLAP_CHARS 256
+
+typedef struct
 {
+	gchar              *pattern;
+	GRegexCompileFlags  compile_flags;
+	GRegex             *regex;
+} RegexCache;
+
+static void
+regex_cache_free (RegexCache *cache)
+{
+	g_free (cache->pattern);
+	g_regex_unref (cache->regex);
+
+	g_slice_free (RegexCache, cache);
+}
+
+/**
+ * lapiz_utils_get_cached_regex:
+ * @buffer: a #CtkTextBuffer
+ * @pattern: the regular expression
+ * @compile_flags: the compile flags, #G_REGEX_OPTIMIZE is always added
+ *
+ * Gets the compiled @pattern kept on @buffer by the last search, or
+ * compiles it and keeps it there for the next one.
+ *
+ * Returns: (transfer full): the compiled regex, or %NULL if @pattern
+ * is not valid
+ */
+GRegex *
+lapiz_utils_get_cached_regex (CtkTextBuffer      *buffer,
+			      const gchar        *pattern,
+			      GRegexCompileFlags  compile_flags)
+{
+	RegexCache *cache;
 	GRegex *regex;
-	GRegexCompileFlags compile_flags;
-	GMatchInfo *match_info;
-	gchar *text;
-	CtkTextIter *begin_iter;
-	CtkTextIter *end_iter;
-	gchar *match_string;
-	gboolean found;
 
-	match_string = "";
-	compile_flags = 0;
+	cache = g_object_get_data (G_OBJECT (buffer), LAPIZ_REGEX_CACHE_KEY);
 
-	if ((flags & CTK_TEXT_SEARCH_CASE_INSENSITIVE) != 0)
-		compile_flags |= G_REGEX_CASELESS;
+	if (cache != NULL &&
+	    cache->compile_flags == compile_flags &&
+	    strcmp (cache->pattern, pattern) == 0)
+	{
+		return g_regex_ref (cache->regex);
+	}
 
-	regex = g_regex_new (str,compile_flags,0,NULL);
+	regex = g_regex_new (pattern,
+			     compile_flags | G_REGEX_OPTIMIZE,
+			     0,
+			     NULL);
 
 	if (regex == NULL)
-		return FALSE;
+		return NULL;
 
-	begin_iter = ctk_text_iter_copy (iter);
+	cache = g_slice_new (RegexCache);
+	cache->pattern = g_strdup (pattern);
+	cache->compile_flags = compile_flags;
+	cache->regex = g_regex_ref (regex);
+
+	g_object_set_data_full (G_OBJECT (buffer),
+				LAPIZ_REGEX_CACHE_KEY,
+				cache,
+				(GDestroyNotify) regex_cache_free);
+
+	return regex;
+}
 
-	if (limit == NULL)
+static gchar *
+get_search_text (const CtkTextIter  *start,
+		 const CtkTextIter  *end,
+		 CtkTextSearchFlags  flags)
+{
+	if ((flags & CTK_TEXT_SEARCH_TEXT_ONLY) != 0)
 	{
-		end_iter = ctk_text_iter_copy (begin_iter);
-		if (forward_search)
-		{
-			ctk_text_buffer_get_end_iter (ctk_text_iter_get_buffer(begin_iter),
-						      end_iter);
-		}
+		if ((flags & CTK_TEXT_SEARCH_VISIBLE_ONLY) != 0)
+			return ctk_text_iter_get_visible_text (start, end);
 		else
-		{
-			ctk_text_buffer_get_start_iter (ctk_text_iter_get_buffer (begin_iter),
-							end_iter);
-		}
+			return ctk_text_iter_get_text (start, end);
 	}
+	else if ((flags & CTK_TEXT_SEARCH_VISIBLE_ONLY) != 0)
+		return ctk_text_iter_get_visible_slice (start, end);
 	else
+		return ctk_text_iter_get_slice (start, end);
+}
+
+/* Turns the match at [@start_pos, @end_pos) of @text, the text of the
+ * window starting at @win_start, into iters. If the window has hidden
+ * text or embedded objects skipped by @flags, the offsets of the text
+ * and of the buffer differ: then look for the matched string itself,
+ * as the buffer search does. */
+static gboolean
+get_match_iters (const CtkTextIter  *win_start,
+		 const CtkTextIter  *win_end,
+		 const gchar        *text,
+		 gint                start_pos,
+		 gint                end_pos,
+		 CtkTextSearchFlags  flags,
+		 gboolean            forward_search,
+		 const CtkTextIter  *limit,
+		 CtkTextIter        *match_start,
+		 CtkTextIter        *match_end)
+{
+	CtkTextIter start;
+	glong n_chars;
+	gchar *match_string;
+	gboolean found;
+
+	n_chars = ctk_text_iter_get_offset (win_end) - ctk_text_iter_get_offset (win_start);
+
+	if (g_utf8_strlen (text, -1) == n_chars)
 	{
-		end_iter = ctk_text_iter_copy (limit);
+		*match_start = *win_start;
+		ctk_text_iter_forward_chars (match_start,
+					     g_utf8_pointer_to_offset (text, text + start_pos));
+
+		*match_end = *match_start;
+		ctk_text_iter_forward_chars (match_end,
+					     g_utf8_pointer_to_offset (text + start_pos, text + end_pos));
+
+		return TRUE;
 	}
 
-	if ((flags & CTK_TEXT_SEARCH_TEXT_ONLY) != 0)
+	match_string = g_strndup (text + start_pos, end_pos - start_pos);
+
+	if (forward_search)
 	{
-		if ((flags & CTK_TEXT_SEARCH_VISIBLE_ONLY) != 0)
-			text = ctk_text_iter_get_visible_text (begin_iter, end_iter);
-		else
-			text = ctk_text_iter_get_text (begin_iter, end_iter);
+		start = *win_start;
+		found = ctk_text_iter_forward_search (&start,
+						      match_string,
+						      flags,
+						      match_start,
+						      match_end,
+						      limit);
 	}
-	else if ((flags & CTK_TEXT_SEARCH_VISIBLE_ONLY) != 0)
-		text = ctk_text_iter_get_visible_slice (begin_iter, end_iter);
 	else
-		text = ctk_text_iter_get_slice (begin_iter, end_iter);
+	{
+		start = *win_end;
+		found = ctk_text_iter_backward_search (&start,
+						       match_string,
+						       flags,
+						       match_start,
+						       match_end,
+						       limit);
+	}
+
+	g_free (match_string);
+
+	return found;
+}
+
+static void
+expand_replace_text (GMatchInfo  *match_info,
+		     gchar      **replace_text)
+{
+	gchar *expanded;
 
-	found = g_regex_match (regex, text, 0, &match_info);
+	if ((replace_text == NULL) || (*replace_text == NULL))
+		return;
 
-	if (!found)
-		goto free_resources;
+	expanded = g_match_info_expand_references (match_info,
+						   *replace_text,
+						   NULL);
 
-	if((replace_text != NULL) && (*replace_text != NULL))
+	if (expanded != NULL)
 	{
-		*replace_text = g_match_info_expand_references (match_info,
-								*replace_text,
-								NULL);
+		g_free (*replace_text);
+		*replace_text = expanded;
 	}
+}
+
+static gboolean
+regex_search_forward (GRegex             *regex,
+		      const CtkTextIter  *iter,
+		      CtkTextSearchFlags  flags,
+		      const CtkTextIter  *limit,
+		      CtkTextIter        *match_start,
+		      CtkTextIter        *match_end,
+		      gchar             **replace_text)
+{
+	CtkTextIter start;
+	gint window_chars = REGEX_SEARCH_WINDOW_CHARS;
+
+	/* matches are looked for from @start on */
+	start = *iter;
 
-	while (g_match_info_matches (match_info))
+	while (TRUE)
 	{
-		match_string = g_match_info_fetch (match_info, 0);
+		CtkTextIter win_start;
+		CtkTextIter win_end;
+		GRegexMatchFlags match_flags = 0;
+		GMatchInfo *match_info;
+		gchar *text;
+		gchar *context;
+		gint start_pos;
+		gint end_pos;
+		gboolean found;
+
+		win_start = start;
+		if (!ctk_text_iter_equal (&start, iter))
+		{
+			ctk_text_iter_backward_chars (&win_start, REGEX_SEARCH_OVERLAP_CHARS);
 
-		if (forward_search)
-			break;
+			if (ctk_text_iter_compare (&win_start, iter) < 0)
+				win_start = *iter;
+
+			/* ^ only matches where the search started */
+			match_flags |= G_REGEX_MATCH_NOTBOL;
+		}
+
+		win_end = start;
+		ctk_text_iter_forward_chars (&win_end, window_chars);
+		if (!ctk_text_iter_ends_line (&win_end))
+			ctk_text_iter_forward_to_line_end (&win_end);
+
+		if (ctk_text_iter_compare (&win_end, limit) >= 0)
+			win_end = *limit;
+		else
+			/* report a match reaching the end of the window as
+			 * partial, the next window tells how it ends */
+			match_flags |= G_REGEX_MATCH_PARTIAL_HARD;
+
+		context = get_search_text (&win_start, &start, flags);
+		start_pos = strlen (context);
+		g_free (context);
+
+		text = get_search_text (&win_start, &win_end, flags);
+
+		found = g_regex_match_full (regex,
+					    text,
+					    -1,
+					    start_pos,
+					    match_flags,
+					    &match_info,
+					    NULL);
+
+		if (found)
+		{
+			g_match_info_fetch_pos (match_info, 0, &start_pos, &end_pos);
+			expand_replace_text (match_info, replace_text);
+
+			found = get_match_iters (&win_start, &win_end, text,
+						 start_pos, end_pos,
+						 flags, TRUE, limit,
+						 match_start, match_end);
+
+			g_match_info_free (match_info);
+			g_free (text);
+
+			return found;
+		}
+
+		if (g_match_info_is_partial_match (match_info))
+		{
+			CtkTextIter partial_start;
+			CtkTextIter partial_end;
+
+			/* restart from the partial match, with a bigger
+			 * window if it already started there */
+			if (g_match_info_fetch_pos (match_info, 0, &start_pos, &end_pos) &&
+			    get_match_iters (&win_start, &win_end, text,
+					     start_pos, end_pos,
+					     flags, TRUE, limit,
+					     &partial_start, &partial_end) &&
+			    ctk_text_iter_compare (&partial_start, &start) > 0)
+			{
+				start = partial_start;
+			}
+			else
+			{
+				window_chars *= 2;
+			}
+		}
+		else if (ctk_text_iter_equal (&win_end, limit))
+		{
+			g_match_info_free (match_info);
+			g_free (text);
+
+			return FALSE;
+		}
+		else
+		{
+			start = win_end;
+		}
 
-		g_match_info_next (match_info, NULL);
+		g_match_info_free (match_info);
+		g_free (text);
 	}
+}
+
+/* Finds the last match that starts before @iter. Each window looks for
+ * the last match in it, and the previous window is only read if there
+ * is none. A match that starts exactly at the beginning of a window may
+ * be the tail of a longer one, so it is left to the previous window. A
+ * match that may go on past the text following the window is retried
+ * with more of that text. */
+static gboolean
+regex_search_backward (GRegex             *regex,
+		       const CtkTextIter  *iter,
+		       CtkTextSearchFlags  flags,
+		       const CtkTextIter  *limit,
+		       CtkTextIter        *match_start,
+		       CtkTextIter        *match_end,
+		       gchar             **replace_text)
+{
+	CtkTextIter end;
+	gint overlap_chars = REGEX_SEARCH_OVERLAP_CHARS;
 
+	/* matches are looked for before @end */
+	end = *iter;
 
-	if (forward_search)
+	while (TRUE)
 	{
-		ctk_text_iter_forward_search (begin_iter,
-					      match_string,
-					      flags,
-					      match_start,
-					      match_end,
-					      limit);
-	} else {
-		ctk_text_iter_backward_search (begin_iter,
-					       match_string,
-					       flags,
-					       match_start,
-					       match_end,
-					       limit);
+		CtkTextIter win_start;
+		CtkTextIter win_end;
+		GRegexMatchFlags match_flags = 0;
+		GMatchInfo *match_info;
+		gchar *text;
+		gchar *context;
+		gsize max_pos;
+		gint last_start = -1;
+		gint last_end = -1;
+		gboolean truncated = FALSE;
+
+		win_end = end;
+		if (!ctk_text_iter_equal (&end, iter))
+		{
+			ctk_text_iter_forward_chars (&win_end, overlap_chars);
+
+			if (ctk_text_iter_compare (&win_end, iter) > 0)
+				win_end = *iter;
+		}
+
+		/* $ only matches where the search started, and a match
+		 * reaching the end of the text is reported as partial */
+		if (!ctk_text_iter_equal (&win_end, iter))
+			match_flags |= G_REGEX_MATCH_NOTEOL | G_REGEX_MATCH_PARTIAL_HARD;
+
+		win_start = end;
+		ctk_text_iter_backward_chars (&win_start, REGEX_SEARCH_WINDOW_CHARS);
+		if (!ctk_text_iter_starts_line (&win_start))
+			ctk_text_iter_set_line_offset (&win_start, 0);
+
+		if (ctk_text_iter_compare (&win_start, limit) <= 0)
+			win_start = *limit;
+		else
+			match_flags |= G_REGEX_MATCH_NOTBOL;
+
+		text = get_search_text (&win_start, &win_end, flags);
+
+		context = get_search_text (&end, &win_end, flags);
+		max_pos = strlen (text) - strlen (context);
+		g_free (context);
+
+		g_regex_match_full (regex, text, -1, 0, match_flags, &match_info, NULL);
+
+		while (g_match_info_matches (match_info))
+		{
+			gint start_pos;
+			gint end_pos;
+
+			g_match_info_fetch_pos (match_info, 0, &start_pos, &end_pos);
+
+			if ((gsize) start_pos > max_pos)
+				break;
+
+			if (start_pos > 0 || ctk_text_iter_equal (&win_start, limit))
+			{
+				last_start = start_pos;
+				last_end = end_pos;
+			}
+
+			g_match_info_next (match_info, NULL);
+		}
+
+		if (g_match_info_is_partial_match (match_info))
+		{
+			gint start_pos;
+			gint end_pos;
+
+			g_match_info_fetch_pos (match_info, 0, &start_pos, &end_pos);
+
+			/* the matches after it are not looked for either */
+			truncated = (gsize) start_pos <= max_pos;
+		}
+
+		g_match_info_free (match_info);
+
+		/* the match may be longer, or the last one, with more text */
+		if (truncated)
+		{
+			g_free (text);
+
+			overlap_chars *= 2;
+			continue;
+		}
+
+		if (last_start >= 0)
+		{
+			gboolean found;
+
+			if ((replace_text != NULL) && (*replace_text != NULL))
+			{
+				g_regex_match_full (regex, text, -1, last_start,
+						    match_flags, &match_info, NULL);
+				expand_replace_text (match_info, replace_text);
+				g_match_info_free (match_info);
+			}
+
+			found = get_match_iters (&win_start, &win_end, text,
+						 last_start, last_end,
+						 flags, FALSE, limit,
+						 match_start, match_end);
+
+			g_free (text);
+
+			return found;
+		}
+
+		g_free (text);
+
+		if (ctk_text_iter_equal (&win_start, limit))
+			return FALSE;
+
+		end = win_start;
 	}
+}
+
+/**
+ * lapiz_ctk_text_iter_regex_search:
+ * @iter: start of the search
+ * @str: the regular expression to search
+ * @flags: flags affecting how the search is done
+ * @match_start: (out): return location for start of match
+ * @match_end: (out): return location for end of match
+ * @limit: (allow-none): bound of the search, or %NULL for the end
+ *         (or the start) of the buffer
+ * @forward_search: whether to search after @iter or before it
+ * @replace_text: (inout) (allow-none): a replacement text whose
+ *                references are expanded with the match
+ *
+ * Searches @str as a regular expression. The text of the buffer is
+ * matched window by window, so finding a match costs about the distance
+ * to it, and the compiled expression is kept on the buffer for the next
+ * search.
+ *
+ * Returns: whether a match was found
+ */
+gboolean
+lapiz_ctk_text_iter_regex_search (const CtkTextIter *iter,
+				  const gchar       *str,
+				  CtkTextSearchFlags flags,
+				  CtkTextIter       *match_start,
+				  CtkTextIter       *match_end,
+				  const CtkTextIter *limit,
+				  gboolean forward_search,
+				  gchar            **replace_text)
+{
+	CtkTextBuffer *buffer;
+	GRegex *regex;
+	GRegexCompileFlags compile_flags;
+	CtkTextIter bound;
+	gboolean found;
+
+	compile_flags = 0;
+
+	if ((flags & CTK_TEXT_SEARCH_CASE_INSENSITIVE) != 0)
+		compile_flags |= G_REGEX_CASELESS;
+
+	buffer = ctk_text_iter_get_buffer (iter);
+	regex = lapiz_utils_get_cached_regex (buffer, str, compile_flags);
+
+	if (regex == NULL)
+		return FALSE;
+
+	if (limit != NULL)
+		bound = *limit;
+	else if (forward_search)
+		ctk_text_buffer_get_end_iter (buffer, &bound);
+	else
+		ctk_text_buffer_get_start_iter (buffer, &bound);
+
+	if (forward_search)
+		found = regex_search_forward (regex, iter, flags, &bound,
+					      match_start, match_end,
+					      replace_text);
+	else
+		found = regex_search_backward (regex, iter, flags, &bound,
+					       match_start, match_end,
+					       replace_text);
 
-free_resources:
-	ctk_text_iter_free (begin_iter);
-	ctk_text_iter_free (end_iter);
-	g_match_info_free (match_info);
 	g_regex_unref (regex);
+
 	return found;
 }
 
@@ -145,6 +145,13 @@ gboolean	 lapiz_utils_decode_uri 		(const gchar *uri,
 /* Turns data from a drop into a list of well formatted uris */
 gchar 	       **lapiz_utils_drop_get_uris		(CtkSelectionData *selection_data);
 
+/* Returns the compiled regex kept on @buffer for @pattern, compiling it
+ * if needed */
+GRegex *
+lapiz_utils_get_cached_regex (CtkTextBuffer      *buffer,
+			      const gchar        *pattern,
+			      GRegexCompileFlags  compile_flags);
+
 /* Provides regexp forward search */
 gboolean
 lapiz_ctk_text_iter_regex_search (const CtkTextIter *iter,
@@ -2159,6 +2159,40 @@ update_cursor_position_statusbar (CtkTextBuffer *buffer,
 				col + 1);
 }
 
+static void
+update_search_matches_statusbar (CtkTextBuffer *buffer,
+				 LapizWindow   *window)
+{
+	LapizDocument *doc;
+	CtkTextIter start, end;
+	gint count;
+	gint index = 0;
+
+	if (buffer != CTK_TEXT_BUFFER (lapiz_window_get_active_document (window)))
+		return;
+
+	doc = LAPIZ_DOCUMENT (buffer);
+	count = lapiz_document_get_search_match_count (doc);
+
+	if ((count > 0) &&
+	    ctk_text_buffer_get_selection_bounds (buffer, &start, &end))
+	{
+		index = lapiz_document_get_search_match_index (doc, &start, &end);
+	}
+
+	lapiz_statusbar_set_search_matches (LAPIZ_STATUSBAR (window->priv->statusbar),
+					    index,
+					    count);
+}
+
+static void
+search_match_count_changed (LapizDocument *doc,
+			    GParamSpec    *pspec G_GNUC_UNUSED,
+			    LapizWindow   *window)
+{
+	update_search_matches_statusbar (CTK_TEXT_BUFFER (doc), window);
+}
+
 static void
 update_overwrite_mode_statusbar (CtkTextView *view,
 				 LapizWindow *window)
@@ -2484,6 +2518,8 @@ notebook_switch_page (CtkNotebook *book,
 	/* sync the statusbar */
 	update_cursor_position_statusbar (CTK_TEXT_BUFFER (lapiz_tab_get_document (tab)),
 					  window);
+	update_search_matches_statusbar (CTK_TEXT_BUFFER (lapiz_tab_get_document (tab)),
+					 window);
 	lapiz_statusbar_set_overwrite (LAPIZ_STATUSBAR (window->priv->statusbar),
 				       ctk_text_view_get_overwrite (CTK_TEXT_VIEW (view)));
 
@@ -3248,6 +3284,14 @@ notebook_tab_added (LapizNotebook *notebook G_GNUC_UNUSED,
 			  "cursor-moved",
 			  G_CALLBACK (update_cursor_position_statusbar),
 			  window);
+	g_signal_connect (doc,
+			  "cursor-moved",
+			  G_CALLBACK (update_search_matches_statusbar),
+			  window);
+	g_signal_connect (doc,
+			  "notify::search-match-count",
+			  G_CALLBACK (search_match_count_changed),
+			  window);
 	g_signal_connect (doc,
 			  "notify::can-search-again",
 			  G_CALLBACK (can_search_again),
@@ -3319,6 +3363,12 @@ notebook_tab_removed (LapizNotebook *notebook G_GNUC_UNUSED,
 	g_signal_handlers_disconnect_by_func (doc,
 					      G_CALLBACK (update_cursor_position_statusbar),
 					      window);
+	g_signal_handlers_disconnect_by_func (doc,
+					      G_CALLBACK (update_search_matches_statusbar),
+					      window);
+	g_signal_handlers_disconnect_by_func (doc,
+					      G_CALLBACK (search_match_count_changed),
+					      window);
 	g_signal_handlers_disconnect_by_func (doc,
 					      G_CALLBACK (can_search_again),
 					      window);
@@ -3378,6 +3428,11 @@ notebook_tab_removed (LapizNotebook *notebook G_GNUC_UNUSED,
 				-1,
 				-1);
 
+		lapiz_statusbar_set_search_matches (
+				LAPIZ_STATUSBAR (window->priv->statusbar),
+				0,
+				-1);
+
 		lapiz_statusbar_clear_overwrite (
 				LAPIZ_STATUSBAR (window->priv->statusbar));
 
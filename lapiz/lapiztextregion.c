@@ -1,6 +1,6 @@
 /* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
  *
- * lapiztextregion.h - CtkTextMark based region utility functions
+ * lapiztextregion.c - offset based region utility functions
  *
  * This file is part of the CtkSourceView widget
  *
@@ -29,6 +29,7 @@
 #include <glib.h>
 
 #include "lapiztextregion.h"
+#include "lapiz-match-index.h"
 
 
 #undef ENABLE_DEBUG
@@ -42,15 +43,19 @@
 #define DEBUG(x)
 #endif
 
-typedef struct _Subregion {
-	CtkTextMark *start;
-	CtkTextMark *end;
-} Subregion;
-
+/* The subregions are kept as character offsets in a sorted array rather
+ * than as pairs of CtkTextMark: looking one up is a binary search instead
+ * of a walk over the list resolving two marks per node. The offsets
+ * follow the edits of the buffer like the marks did (the start with left
+ * gravity, the end with right gravity); the shift of the subregions after
+ * an edit is applied lazily by LapizMatchIndex. */
 struct _LapizTextRegion {
-	CtkTextBuffer *buffer;
-	GList         *subregions;
-	guint32        time_stamp;
+	CtkTextBuffer   *buffer;
+	LapizMatchIndex *subregions;
+	guint32          time_stamp;
+
+	/* some subregions may have been emptied by a deletion */
+	gboolean         has_empty;
 };
 
 typedef struct _LapizTextRegionIteratorReal LapizTextRegionIteratorReal;
@@ -59,7 +64,7 @@ struct _LapizTextRegionIteratorReal {
 	LapizTextRegion *region;
 	guint32        region_time_stamp;
 
-	GList         *subregions;
+	guint          subregion;
 };
 
 
@@ -67,52 +72,94 @@ struct _LapizTextRegionIteratorReal {
    Private interface
    ---------------------------------------------------------------------- */
 
-/* Find and return a subregion node which contains the given text
-   iter.  If left_side is TRUE, return the subregion which contains
-   the text iter or which is the leftmost; else return the rightmost
-   subregion */
-static GList *
-find_nearest_subregion (LapizTextRegion     *region,
-			const CtkTextIter *iter,
-			GList             *begin,
-			gboolean           leftmost,
-			gboolean           include_edges)
+static void
+insert_text_cb (CtkTextBuffer   *buffer,
+		CtkTextIter     *pos,
+		const gchar     *text,
+		gint             length,
+		LapizTextRegion *region)
 {
-	GList *l, *retval;
+	gint offset, n_chars;
+	guint n, last;
 
-	g_return_val_if_fail (region != NULL && iter != NULL, NULL);
+	offset = ctk_text_iter_get_offset (pos);
+	n_chars = g_utf8_strlen (text, length);
 
-	if (!begin)
-		begin = region->subregions;
+	/* the subregions around the insertion point grow, the ones after
+	 * it move */
+	n = lapiz_match_index_find_prev (region->subregions, offset - 1) + 1;
+	last = lapiz_match_index_find_next (region->subregions, offset + 1);
 
-	if (begin)
-		retval = begin->prev;
-	else
-		retval = NULL;
+	for (; n < last; ++n) {
+		gint start, end;
 
-	for (l = begin; l; l = l->next) {
-		CtkTextIter sr_iter;
-		Subregion *sr = l->data;
-		gint cmp;
+		lapiz_match_index_get_nth (region->subregions, n, &start, &end);
+		lapiz_match_index_set_nth (region->subregions, n, start, end + n_chars);
+	}
 
-		if (!leftmost) {
-			ctk_text_buffer_get_iter_at_mark (region->buffer, &sr_iter, sr->end);
-			cmp = ctk_text_iter_compare (iter, &sr_iter);
-			if (cmp < 0 || (cmp == 0 && include_edges)) {
-				retval = l;
-				break;
-			}
+	lapiz_match_index_shift (region->subregions, offset + 1, n_chars);
+}
 
-		} else {
-			ctk_text_buffer_get_iter_at_mark (region->buffer, &sr_iter, sr->start);
-			cmp = ctk_text_iter_compare (iter, &sr_iter);
-			if (cmp > 0 || (cmp == 0 && include_edges))
-				retval = l;
-			else
-				break;
-		}
+static void
+delete_range_cb (CtkTextBuffer   *buffer,
+		 CtkTextIter     *_start,
+		 CtkTextIter     *_end,
+		 LapizTextRegion *region)
+{
+	gint del_start, del_end;
+	guint n, last;
+
+	del_start = ctk_text_iter_get_offset (_start);
+	del_end = ctk_text_iter_get_offset (_end);
+
+	if (del_start > del_end) {
+		gint tmp = del_start;
+		del_start = del_end;
+		del_end = tmp;
 	}
-	return retval;
+
+	/* the subregions overlapping the deletion shrink, possibly to
+	 * nothing, the ones after it move */
+	n = lapiz_match_index_find_prev (region->subregions, del_start) + 1;
+	last = lapiz_match_index_find_next (region->subregions, del_end);
+
+	for (; n < last; ++n) {
+		gint start, end;
+
+		lapiz_match_index_get_nth (region->subregions, n, &start, &end);
+
+		start = MIN (start, del_start);
+		end = (end >= del_end) ? end - (del_end - del_start) : del_start;
+
+		if (start == end)
+			region->has_empty = TRUE;
+
+		lapiz_match_index_set_nth (region->subregions, n, start, end);
+	}
+
+	lapiz_match_index_shift (region->subregions, del_end, del_start - del_end);
+}
+
+/* Returns the position of the first subregion ending after @offset (or at
+ * it, if @include_edges) */
+static guint
+find_first_subregion (LapizTextRegion *region,
+		      gint             offset,
+		      gboolean         include_edges)
+{
+	return lapiz_match_index_find_prev (region->subregions,
+					    include_edges ? offset - 1 : offset) + 1;
+}
+
+/* Returns the position after the last subregion starting before @offset
+ * (or at it, if @include_edges) */
+static guint
+find_last_subregion (LapizTextRegion *region,
+		     gint             offset,
+		     gboolean         include_edges)
+{
+	return lapiz_match_index_find_next (region->subregions,
+					    include_edges ? offset + 1 : offset);
 }
 
 /* ----------------------------------------------------------------------
@@ -128,27 +175,32 @@ lapiz_text_region_new (CtkTextBuffer *buffer)
 
 	region = g_new (LapizTextRegion, 1);
 	region->buffer = buffer;
-	region->subregions = NULL;
+	region->subregions = lapiz_match_index_new ();
 	region->time_stamp = 0;
+	region->has_empty = FALSE;
+
+	/* the offsets are updated before the buffer changes */
+	g_signal_connect (buffer,
+			  "insert-text",
+			  G_CALLBACK (insert_text_cb),
+			  region);
+	g_signal_connect (buffer,
+			  "delete-range",
+			  G_CALLBACK (delete_range_cb),
+			  region);
 
 	return region;
 }
 
 void
-lapiz_text_region_destroy (LapizTextRegion *region, gboolean delete_marks)
+lapiz_text_region_destroy (LapizTextRegion *region, gboolean delete_marks G_GNUC_UNUSED)
 {
 	g_return_if_fail (region != NULL);
 
-	while (region->subregions) {
-		Subregion *sr = region->subregions->data;
-		if (delete_marks) {
-			ctk_text_buffer_delete_mark (region->buffer, sr->start);
-			ctk_text_buffer_delete_mark (region->buffer, sr->end);
-		}
-		g_free (sr);
-		region->subregions = g_list_delete_link (region->subregions,
-							 region->subregions);
-	}
+	/* the region has no marks to delete anymore */
+	g_signal_handlers_disconnect_by_data (region->buffer, region);
+
+	lapiz_match_index_free (region->subregions);
 	region->buffer = NULL;
 	region->time_stamp = 0;
 
@@ -166,30 +218,26 @@ lapiz_text_region_get_buffer (LapizTextRegion *region)
 static void
 lapiz_text_region_clear_zero_length_subregions (LapizTextRegion *region)
 {
-	CtkTextIter start, end;
-	GList *node;
+	guint n;
 
 	g_return_if_fail (region != NULL);
 
-	for (node = region->subregions; node; ) {
-		Subregion *sr = node->data;
-		ctk_text_buffer_get_iter_at_mark (region->buffer, &start, sr->start);
-		ctk_text_buffer_get_iter_at_mark (region->buffer, &end, sr->end);
-		if (ctk_text_iter_equal (&start, &end)) {
-			ctk_text_buffer_delete_mark (region->buffer, sr->start);
-			ctk_text_buffer_delete_mark (region->buffer, sr->end);
-			g_free (sr);
-			if (node == region->subregions)
-				region->subregions = node = g_list_delete_link (node, node);
-			else
-				node = g_list_delete_link (node, node);
+	if (!region->has_empty)
+		return;
 
-			++region->time_stamp;
+	for (n = 0; n < lapiz_match_index_get_length (region->subregions); ) {
+		gint start, end;
 
+		lapiz_match_index_get_nth (region->subregions, n, &start, &end);
+		if (start == end) {
+			lapiz_match_index_remove (region->subregions, n, 1);
+			++region->time_stamp;
 		} else {
-			node = node->next;
+			++n;
 		}
 	}
+
+	region->has_empty = FALSE;
 }
 
 void
@@ -197,79 +245,46 @@ lapiz_text_region_add (LapizTextRegion     *region,
 		     const CtkTextIter *_start,
 		     const CtkTextIter *_end)
 {
-	GList *start_node, *end_node;
-	CtkTextIter start, end;
+	CtkTextIter start_iter, end_iter;
+	gint start, end;
+	guint first, last;
 
 	g_return_if_fail (region != NULL && _start != NULL && _end != NULL);
 
-	start = *_start;
-	end = *_end;
+	start_iter = *_start;
+	end_iter = *_end;
+	ctk_text_iter_order (&start_iter, &end_iter);
+
+	start = ctk_text_iter_get_offset (&start_iter);
+	end = ctk_text_iter_get_offset (&end_iter);
 
 	DEBUG (g_print ("---\n"));
 	DEBUG (lapiz_text_region_debug_print (region));
-	DEBUG (g_message ("region_add (%d, %d)",
-			  ctk_text_iter_get_offset (&start),
-			  ctk_text_iter_get_offset (&end)));
-
-	ctk_text_iter_order (&start, &end);
+	DEBUG (g_message ("region_add (%d, %d)", start, end));
 
 	/* don't add zero-length regions */
-	if (ctk_text_iter_equal (&start, &end))
+	if (start == end)
 		return;
 
-	/* find bounding subregions */
-	start_node = find_nearest_subregion (region, &start, NULL, FALSE, TRUE);
-	end_node = find_nearest_subregion (region, &end, start_node, TRUE, TRUE);
+	/* find the subregions touching the new one */
+	first = find_first_subregion (region, start, TRUE);
+	last = find_last_subregion (region, end, TRUE);
 
-	if (start_node == NULL || end_node == NULL || end_node == start_node->prev) {
+	if (first >= last) {
 		/* create the new subregion */
-		Subregion *sr = g_new0 (Subregion, 1);
-		sr->start = ctk_text_buffer_create_mark (region->buffer, NULL, &start, TRUE);
-		sr->end = ctk_text_buffer_create_mark (region->buffer, NULL, &end, FALSE);
-
-		if (start_node == NULL) {
-			/* append the new region */
-			region->subregions = g_list_append (region->subregions, sr);
+		lapiz_match_index_insert (region->subregions, first, start, end);
+	} else {
+		/* merge them with the new one */
+		gint sr_start, sr_end;
 
-		} else if (end_node == NULL) {
-			/* prepend the new region */
-			region->subregions = g_list_prepend (region->subregions, sr);
+		lapiz_match_index_get_nth (region->subregions, first, &sr_start, NULL);
+		lapiz_match_index_get_nth (region->subregions, last - 1, NULL, &sr_end);
 
-		} else {
-			/* we are in the middle of two subregions */
-			region->subregions = g_list_insert_before (region->subregions,
-								   start_node, sr);
-		}
-	}
-	else {
-		CtkTextIter iter;
-		Subregion *sr = start_node->data;
-		if (start_node != end_node) {
-			/* we need to merge some subregions */
-			GList *l = start_node->next;
-			Subregion *q;
-
-			ctk_text_buffer_delete_mark (region->buffer, sr->end);
-			while (l != end_node) {
-				q = l->data;
-				ctk_text_buffer_delete_mark (region->buffer, q->start);
-				ctk_text_buffer_delete_mark (region->buffer, q->end);
-				g_free (q);
-				l = g_list_delete_link (l, l);
-			}
-			q = l->data;
-			ctk_text_buffer_delete_mark (region->buffer, q->start);
-			sr->end = q->end;
-			g_free (q);
-			l = g_list_delete_link (l, l);
-		}
-		/* now move marks if that action expands the region */
-		ctk_text_buffer_get_iter_at_mark (region->buffer, &iter, sr->start);
-		if (ctk_text_iter_compare (&iter, &start) > 0)
-			ctk_text_buffer_move_mark (region->buffer, sr->start, &start);
-		ctk_text_buffer_get_iter_at_mark (region->buffer, &iter, sr->end);
-		if (ctk_text_iter_compare (&iter, &end) < 0)
-			ctk_text_buffer_move_mark (region->buffer, sr->end, &end);
+		lapiz_match_index_remove (region->subregions, first + 1, last - first - 1);
+		lapiz_match_index_set_nth (region->subregions,
+					   first,
+					   MIN (start, sr_start),
+					   MAX (end, sr_end));
 	}
 
 	++region->time_stamp;
@@ -282,114 +297,56 @@ lapiz_text_region_subtract (LapizTextRegion     *region,
 			  const CtkTextIter *_start,
 			  const CtkTextIter *_end)
 {
-	GList *start_node, *end_node, *node;
-	CtkTextIter sr_start_iter, sr_end_iter;
-	gboolean done;
-	gboolean start_is_outside, end_is_outside;
-	Subregion *sr;
-	CtkTextIter start, end;
+	CtkTextIter start_iter, end_iter;
+	gint start, end;
+	gint sr_start, sr_end;
+	guint first, last;
 
 	g_return_if_fail (region != NULL && _start != NULL && _end != NULL);
 
-	start = *_start;
-	end = *_end;
+	start_iter = *_start;
+	end_iter = *_end;
+	ctk_text_iter_order (&start_iter, &end_iter);
+
+	start = ctk_text_iter_get_offset (&start_iter);
+	end = ctk_text_iter_get_offset (&end_iter);
 
 	DEBUG (g_print ("---\n"));
 	DEBUG (lapiz_text_region_debug_print (region));
-	DEBUG (g_message ("region_substract (%d, %d)",
-			  ctk_text_iter_get_offset (&start),
-			  ctk_text_iter_get_offset (&end)));
+	DEBUG (g_message ("region_substract (%d, %d)", start, end));
 
-	ctk_text_iter_order (&start, &end);
-
-	/* find bounding subregions */
-	start_node = find_nearest_subregion (region, &start, NULL, FALSE, FALSE);
-	end_node = find_nearest_subregion (region, &end, start_node, TRUE, FALSE);
+	/* find the subregions overlapping the range */
+	first = find_first_subregion (region, start, FALSE);
+	last = find_last_subregion (region, end, FALSE);
 
 	/* easy case first */
-	if (start_node == NULL || end_node == NULL || end_node == start_node->prev)
+	if (first >= last)
 		return;
 
-	/* deal with the start point */
-	start_is_outside = end_is_outside = FALSE;
-
-	sr = start_node->data;
-	ctk_text_buffer_get_iter_at_mark (region->buffer, &sr_start_iter, sr->start);
-	ctk_text_buffer_get_iter_at_mark (region->buffer, &sr_end_iter, sr->end);
-
-	if (ctk_text_iter_in_range (&start, &sr_start_iter, &sr_end_iter) &&
-	    !ctk_text_iter_equal (&start, &sr_start_iter)) {
-		/* the starting point is inside the first subregion */
-		if (ctk_text_iter_in_range (&end, &sr_start_iter, &sr_end_iter) &&
-		    !ctk_text_iter_equal (&end, &sr_end_iter)) {
-			/* the ending point is also inside the first
-                           subregion: we need to split */
-			Subregion *new_sr = g_new0 (Subregion, 1);
-			new_sr->end = sr->end;
-			new_sr->start = ctk_text_buffer_create_mark (region->buffer,
-								     NULL, &end, TRUE);
-			start_node = g_list_insert_before (start_node, start_node->next, new_sr);
-
-			sr->end = ctk_text_buffer_create_mark (region->buffer,
-							       NULL, &start, FALSE);
-
-			/* no further processing needed */
-			DEBUG (g_message ("subregion splitted"));
-
-			return;
-		} else {
-			/* the ending point is outside, so just move
-                           the end of the subregion to the starting point */
-			ctk_text_buffer_move_mark (region->buffer, sr->end, &start);
-		}
-	} else {
-		/* the starting point is outside (and so to the left)
-                   of the first subregion */
-		DEBUG (g_message ("start is outside"));
-
-		start_is_outside = TRUE;
-	}
+	lapiz_match_index_get_nth (region->subregions, first, &sr_start, NULL);
+	lapiz_match_index_get_nth (region->subregions, last - 1, NULL, &sr_end);
 
-	/* deal with the end point */
-	if (start_node != end_node) {
-		sr = end_node->data;
-		ctk_text_buffer_get_iter_at_mark (region->buffer, &sr_start_iter, sr->start);
-		ctk_text_buffer_get_iter_at_mark (region->buffer, &sr_end_iter, sr->end);
-	}
+	if (sr_start < start && sr_end > end && first + 1 == last) {
+		/* the range is inside a subregion: we need to split */
+		lapiz_match_index_set_nth (region->subregions, first, sr_start, start);
+		lapiz_match_index_insert (region->subregions, first + 1, end, sr_end);
 
-	if (ctk_text_iter_in_range (&end, &sr_start_iter, &sr_end_iter) &&
-	    !ctk_text_iter_equal (&end, &sr_end_iter)) {
-		/* ending point is inside, move the start mark */
-		ctk_text_buffer_move_mark (region->buffer, sr->start, &end);
+		DEBUG (g_message ("subregion splitted"));
 	} else {
-		end_is_outside = TRUE;
-		DEBUG (g_message ("end is outside"));
-
-	}
-
-	/* finally remove any intermediate subregions */
-	done = FALSE;
-	node = start_node;
-
-	while (!done) {
-		if (node == end_node)
-			/* we are done, exit in the next iteration */
-			done = TRUE;
+		/* keep the parts of the first and the last subregions
+		 * outside of the range, remove the others */
+		if (sr_start < start) {
+			lapiz_match_index_set_nth (region->subregions, first, sr_start, start);
+			++first;
+		}
 
-		if ((node == start_node && !start_is_outside) ||
-		    (node == end_node && !end_is_outside)) {
-			/* skip starting or ending node */
-			node = node->next;
-		} else {
-			GList *l = node->next;
-			sr = node->data;
-			ctk_text_buffer_delete_mark (region->buffer, sr->start);
-			ctk_text_buffer_delete_mark (region->buffer, sr->end);
-			g_free (sr);
-			region->subregions = g_list_delete_link (region->subregions,
-								 node);
-			node = l;
+		if (sr_end > end && first < last) {
+			lapiz_match_index_set_nth (region->subregions, last - 1, end, sr_end);
+			--last;
 		}
+
+		if (first < last)
+			lapiz_match_index_remove (region->subregions, first, last - first);
 	}
 
 	++region->time_stamp;
@@ -407,7 +364,7 @@ lapiz_text_region_subregions (LapizTextRegion *region)
 {
 	g_return_val_if_fail (region != NULL, 0);
 
-	return g_list_length (region->subregions);
+	return lapiz_match_index_get_length (region->subregions);
 }
 
 gboolean
@@ -416,18 +373,19 @@ lapiz_text_region_nth_subregion (LapizTextRegion *region,
 			       CtkTextIter   *start,
 			       CtkTextIter   *end)
 {
-	Subregion *sr;
+	gint sr_start, sr_end;
 
 	g_return_val_if_fail (region != NULL, FALSE);
 
-	sr = g_list_nth_data (region->subregions, subregion);
-	if (sr == NULL)
+	if (subregion >= lapiz_match_index_get_length (region->subregions))
 		return FALSE;
 
+	lapiz_match_index_get_nth (region->subregions, subregion, &sr_start, &sr_end);
+
 	if (start)
-		ctk_text_buffer_get_iter_at_mark (region->buffer, start, sr->start);
+		ctk_text_buffer_get_iter_at_offset (region->buffer, start, sr_start);
 	if (end)
-		ctk_text_buffer_get_iter_at_mark (region->buffer, end, sr->end);
+		ctk_text_buffer_get_iter_at_offset (region->buffer, end, sr_end);
 
 	return TRUE;
 }
@@ -437,100 +395,41 @@ lapiz_text_region_intersect (LapizTextRegion     *region,
 			   const CtkTextIter *_start,
 			   const CtkTextIter *_end)
 {
-	GList *start_node, *end_node, *node;
-	CtkTextIter sr_start_iter, sr_end_iter;
-	Subregion *sr, *new_sr;
-	gboolean done;
 	LapizTextRegion *new_region;
-	CtkTextIter start, end;
+	CtkTextIter start_iter, end_iter;
+	gint start, end;
+	guint first, last;
+	guint n;
 
 	g_return_val_if_fail (region != NULL && _start != NULL && _end != NULL, NULL);
 
-	start = *_start;
-	end = *_end;
+	start_iter = *_start;
+	end_iter = *_end;
+	ctk_text_iter_order (&start_iter, &end_iter);
 
-	ctk_text_iter_order (&start, &end);
+	start = ctk_text_iter_get_offset (&start_iter);
+	end = ctk_text_iter_get_offset (&end_iter);
 
-	/* find bounding subregions */
-	start_node = find_nearest_subregion (region, &start, NULL, FALSE, FALSE);
-	end_node = find_nearest_subregion (region, &end, start_node, TRUE, FALSE);
+	/* find the subregions overlapping the range */
+	first = find_first_subregion (region, start, FALSE);
+	last = find_last_subregion (region, end, FALSE);
 
 	/* easy case first */
-	if (start_node == NULL || end_node == NULL || end_node == start_node->prev)
+	if (first >= last)
 		return NULL;
 
 	new_region = lapiz_text_region_new (region->buffer);
-	done = FALSE;
-
-	sr = start_node->data;
-	ctk_text_buffer_get_iter_at_mark (region->buffer, &sr_start_iter, sr->start);
-	ctk_text_buffer_get_iter_at_mark (region->buffer, &sr_end_iter, sr->end);
-
-	/* starting node */
-	if (ctk_text_iter_in_range (&start, &sr_start_iter, &sr_end_iter)) {
-		new_sr = g_new0 (Subregion, 1);
-		new_region->subregions = g_list_prepend (new_region->subregions, new_sr);
-
-		new_sr->start = ctk_text_buffer_create_mark (new_region->buffer, NULL,
-							     &start, TRUE);
-		if (start_node == end_node) {
-			/* things will finish shortly */
-			done = TRUE;
-			if (ctk_text_iter_in_range (&end, &sr_start_iter, &sr_end_iter))
-				new_sr->end = ctk_text_buffer_create_mark (new_region->buffer,
-									   NULL, &end, FALSE);
-			else
-				new_sr->end = ctk_text_buffer_create_mark (new_region->buffer,
-									   NULL, &sr_end_iter,
-									   FALSE);
-		} else {
-			new_sr->end = ctk_text_buffer_create_mark (new_region->buffer, NULL,
-								   &sr_end_iter, FALSE);
-		}
-		node = start_node->next;
-	} else {
-		/* start should be the same as the subregion, so copy it in the loop */
-		node = start_node;
-	}
 
-	if (!done) {
-		while (node != end_node) {
-			/* copy intermediate subregions verbatim */
-			sr = node->data;
-			ctk_text_buffer_get_iter_at_mark (region->buffer, &sr_start_iter,
-							  sr->start);
-			ctk_text_buffer_get_iter_at_mark (region->buffer, &sr_end_iter, sr->end);
-
-			new_sr = g_new0 (Subregion, 1);
-			new_region->subregions = g_list_prepend (new_region->subregions, new_sr);
-			new_sr->start = ctk_text_buffer_create_mark (new_region->buffer, NULL,
-								     &sr_start_iter, TRUE);
-			new_sr->end = ctk_text_buffer_create_mark (new_region->buffer, NULL,
-								   &sr_end_iter, FALSE);
-			/* next node */
-			node = node->next;
-		}
-
-		/* ending node */
-		sr = node->data;
-		ctk_text_buffer_get_iter_at_mark (region->buffer, &sr_start_iter, sr->start);
-		ctk_text_buffer_get_iter_at_mark (region->buffer, &sr_end_iter, sr->end);
-
-		new_sr = g_new0 (Subregion, 1);
-		new_region->subregions = g_list_prepend (new_region->subregions, new_sr);
-
-		new_sr->start = ctk_text_buffer_create_mark (new_region->buffer, NULL,
-							     &sr_start_iter, TRUE);
+	/* copy them, cut to the range */
+	for (n = first; n < last; ++n) {
+		gint sr_start, sr_end;
 
-		if (ctk_text_iter_in_range (&end, &sr_start_iter, &sr_end_iter))
-			new_sr->end = ctk_text_buffer_create_mark (new_region->buffer, NULL,
-								   &end, FALSE);
-		else
-			new_sr->end = ctk_text_buffer_create_mark (new_region->buffer, NULL,
-								   &sr_end_iter, FALSE);
+		lapiz_match_index_get_nth (region->subregions, n, &sr_start, &sr_end);
+		lapiz_match_index_append (new_region->subregions,
+					  MAX (sr_start, start),
+					  MIN (sr_end, end));
 	}
 
-	new_region->subregions = g_list_reverse (new_region->subregions);
 	return new_region;
 }
 
@@ -563,10 +462,10 @@ lapiz_text_region_get_iterator (LapizTextRegion         *region,
 
 	real = (LapizTextRegionIteratorReal *)iter;
 
-	/* region->subregions may be NULL, -> end iter */
+	/* past the last subregion -> end iter */
 
 	real->region = region;
-	real->subregions = g_list_nth (region->subregions, start);
+	real->subregion = MIN (start, lapiz_match_index_get_length (region->subregions));
 	real->region_time_stamp = region->time_stamp;
 }
 
@@ -580,7 +479,7 @@ lapiz_text_region_iterator_is_end (LapizTextRegionIterator *iter)
 	real = (LapizTextRegionIteratorReal *)iter;
 	g_return_val_if_fail (check_iterator (real), FALSE);
 
-	return (real->subregions == NULL);
+	return (real->subregion == lapiz_match_index_get_length (real->region->subregions));
 }
 
 gboolean
@@ -593,8 +492,8 @@ lapiz_text_region_iterator_next (LapizTextRegionIterator *iter)
 	real = (LapizTextRegionIteratorReal *)iter;
 	g_return_val_if_fail (check_iterator (real), FALSE);
 
-	if (real->subregions != NULL) {
-		real->subregions = g_list_next (real->subregions);
+	if (real->subregion < lapiz_match_index_get_length (real->region->subregions)) {
+		++real->subregion;
 		return TRUE;
 	}
 	else
@@ -607,40 +506,29 @@ lapiz_text_region_iterator_get_subregion (LapizTextRegionIterator *iter,
 					CtkTextIter           *end)
 {
 	LapizTextRegionIteratorReal *real;
-	Subregion *sr;
 
 	g_return_if_fail (iter != NULL);
 
 	real = (LapizTextRegionIteratorReal *)iter;
 	g_return_if_fail (check_iterator (real));
-	g_return_if_fail (real->subregions != NULL);
+	g_return_if_fail (real->subregion < lapiz_match_index_get_length (real->region->subregions));
 
-	sr = (Subregion*)real->subregions->data;
-	g_return_if_fail (sr != NULL);
-
-	if (start)
-		ctk_text_buffer_get_iter_at_mark (real->region->buffer, start, sr->start);
-	if (end)
-		ctk_text_buffer_get_iter_at_mark (real->region->buffer, end, sr->end);
+	lapiz_text_region_nth_subregion (real->region, real->subregion, start, end);
 }
 
 void
 lapiz_text_region_debug_print (LapizTextRegion *region)
 {
-	GList *l;
+	guint n;
 
 	g_return_if_fail (region != NULL);
 
 	g_print ("Subregions: ");
-	l = region->subregions;
-	while (l) {
-		Subregion *sr = l->data;
-		CtkTextIter iter1, iter2;
-		ctk_text_buffer_get_iter_at_mark (region->buffer, &iter1, sr->start);
-		ctk_text_buffer_get_iter_at_mark (region->buffer, &iter2, sr->end);
-		g_print ("%d-%d ", ctk_text_iter_get_offset (&iter1),
-			 ctk_text_iter_get_offset (&iter2));
-		l = l->next;
+	for (n = 0; n < lapiz_match_index_get_length (region->subregions); ++n) {
+		gint start, end;
+
+		lapiz_match_index_get_nth (region->subregions, n, &start, &end);
+		g_print ("%d-%d ", start, end);
 	}
 	g_print ("\n");
 }
@@ -1,6 +1,6 @@
 /* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
  *
- * lapiztextregion.h - CtkTextMark based region utility functions
+ * lapiztextregion.h - offset based region utility functions
  *
  * This file is part of the CtkSourceView widget
  *
@@ -26,6 +26,7 @@
 
 #include "lapiz-changecase-plugin.h"
 
+#include <string.h>
 #include <glib/gi18n-lib.h>
 #include <gmodule.h>
 #include <libbean/bean-activatable.h>
@@ -63,110 +64,251 @@ typedef enum {
 	TO_TITLE_CASE,
 } ChangeCaseChoice;
 
+/* unchanged stretches shorter than this are replaced together with the
+ * changed text around them, so that a selection made mostly of words
+ * to convert is not split in one edit per word */
+#define MIN_UNCHANGED_CHARS 256
+
+typedef struct
+{
+	gint  start;		/* char offsets in the selection */
+	gint  end;
+	gsize text_start;	/* byte offsets in the converted text */
+	gsize text_end;
+} CaseRun;
+
+/* converts a run of ASCII bytes; the loops are branch free so that the
+ * compiler can turn them into vector instructions */
 static void
-do_upper_case (CtkTextBuffer *buffer,
-               CtkTextIter   *start,
-               CtkTextIter   *end)
+convert_ascii (const guchar     *src,
+               guchar           *dest,
+               gsize             len,
+               ChangeCaseChoice  choice)
 {
-	GString *s = g_string_new (NULL);
+	gsize i;
 
-	while (!ctk_text_iter_is_end (start) &&
-	       !ctk_text_iter_equal (start, end))
+	switch (choice)
 	{
-		gunichar c, nc;
-
-		c = ctk_text_iter_get_char (start);
-		nc = g_unichar_toupper (c);
-		g_string_append_unichar (s, nc);
+	case TO_UPPER_CASE:
+		for (i = 0; i < len; i++)
+			dest[i] = src[i] ^ (((guchar) (src[i] - 'a') < 26) << 5);
+		break;
+	case TO_LOWER_CASE:
+		for (i = 0; i < len; i++)
+			dest[i] = src[i] ^ (((guchar) (src[i] - 'A') < 26) << 5);
+		break;
+	case INVERT_CASE:
+		for (i = 0; i < len; i++)
+			dest[i] = src[i] ^ (((guchar) ((src[i] | 0x20) - 'a') < 26) << 5);
+		break;
+	default:
+		g_return_if_reached ();
+	}
+}
 
-		ctk_text_iter_forward_char (start);
+static gunichar
+convert_char (gunichar         c,
+              ChangeCaseChoice choice)
+{
+	switch (choice)
+	{
+	case TO_UPPER_CASE:
+		return g_unichar_toupper (c);
+	case TO_LOWER_CASE:
+		return g_unichar_tolower (c);
+	case INVERT_CASE:
+		if (g_unichar_islower (c))
+			return g_unichar_toupper (c);
+		else
+			return g_unichar_tolower (c);
+	default:
+		g_return_val_if_reached (c);
 	}
+}
 
-	ctk_text_buffer_delete_selection (buffer, TRUE, TRUE);
-	ctk_text_buffer_insert_at_cursor (buffer, s->str, s->len);
+static GString *
+convert_text (const gchar      *text,
+              gsize             len,
+              ChangeCaseChoice  choice)
+{
+	GString *s;
+	const gchar *p = text;
+	const gchar *text_end = text + len;
+
+	s = g_string_sized_new (len);
+
+	while (p < text_end)
+	{
+		const gchar *ascii_end = p;
+
+		while (ascii_end < text_end && (guchar) *ascii_end < 0x80)
+			++ascii_end;
+
+		if (ascii_end > p)
+		{
+			gsize s_len = s->len;
+
+			g_string_set_size (s, s_len + (ascii_end - p));
+			convert_ascii ((const guchar *) p,
+			               (guchar *) s->str + s_len,
+			               ascii_end - p,
+			               choice);
+			p = ascii_end;
+		}
+		else
+		{
+			g_string_append_unichar (s, convert_char (g_utf8_get_char (p), choice));
+			p = g_utf8_next_char (p);
+		}
+	}
 
-	g_string_free (s, TRUE);
+	return s;
 }
 
-static void
-do_lower_case (CtkTextBuffer *buffer,
-               CtkTextIter   *start,
-               CtkTextIter   *end)
+/* word starts are found line by line, as CtkTextIter does.
+ * @starts_word tells whether the first character starts a word in the
+ * context of the whole line, since the selection may begin mid-word */
+static GString *
+convert_title_case (const gchar *text,
+                    gsize        len,
+                    gboolean     starts_word)
 {
-	GString *s = g_string_new (NULL);
+	GString *s;
+	PangoLogAttr *attrs = NULL;
+	gint n_attrs = 0;
+	const gchar *p = text;
+	const gchar *text_end = text + len;
+
+	s = g_string_sized_new (len);
 
-	while (!ctk_text_iter_is_end (start) &&
-	       !ctk_text_iter_equal (start, end))
+	while (p < text_end)
 	{
-		gunichar c, nc;
+		gint delimiter, next;
+		gint n_chars;
+		gint i;
+
+		pango_find_paragraph_boundary (p, text_end - p, &delimiter, &next);
+
+		n_chars = g_utf8_strlen (p, next);
+		if (n_chars + 1 > n_attrs)
+		{
+			n_attrs = n_chars + 1;
+			attrs = g_renew (PangoLogAttr, attrs, n_attrs);
+		}
+
+		pango_get_log_attrs (p, next, -1, NULL, attrs, n_chars + 1);
+
+		if (p == text)
+			attrs[0].is_word_start = starts_word;
 
-		c = ctk_text_iter_get_char (start);
-		nc = g_unichar_tolower (c);
-		g_string_append_unichar (s, nc);
+		for (i = 0; i < n_chars; i++)
+		{
+			gunichar c = g_utf8_get_char (p);
 
-		ctk_text_iter_forward_char (start);
+			if (attrs[i].is_word_start)
+				g_string_append_unichar (s, g_unichar_totitle (c));
+			else
+				g_string_append_unichar (s, g_unichar_tolower (c));
+
+			p = g_utf8_next_char (p);
+		}
 	}
 
-	ctk_text_buffer_delete_selection (buffer, TRUE, TRUE);
-	ctk_text_buffer_insert_at_cursor (buffer, s->str, s->len);
+	g_free (attrs);
 
-	g_string_free (s, TRUE);
+	return s;
 }
 
-static void
-do_invert_case (CtkTextBuffer *buffer,
-                CtkTextIter   *start,
-                CtkTextIter   *end)
+/* compares the selected text with its conversion, character by
+ * character, and returns the runs that differ */
+static GArray *
+find_changed_runs (const gchar *text,
+                   const gchar *new_text)
 {
-	GString *s = g_string_new (NULL);
+	GArray *runs;
+	const gchar *p = text;
+	const gchar *q = new_text;
+	gint offset = 0;
 
-	while (!ctk_text_iter_is_end (start) &&
-	       !ctk_text_iter_equal (start, end))
+	runs = g_array_new (FALSE, FALSE, sizeof (CaseRun));
+
+	while (*p != '\0')
 	{
 		gunichar c, nc;
 
-		c = ctk_text_iter_get_char (start);
-		if (g_unichar_islower (c))
-			nc = g_unichar_toupper (c);
-		else
-			nc = g_unichar_tolower (c);
-		g_string_append_unichar (s, nc);
+		/* fast forward over unchanged ASCII */
+		while (*p == *q && (guchar) *p < 0x80 && *p != '\0')
+		{
+			++p;
+			++q;
+			++offset;
+		}
 
-		ctk_text_iter_forward_char (start);
-	}
+		if (*p == '\0')
+			break;
+
+		c = g_utf8_get_char (p);
+		nc = g_utf8_get_char (q);
+
+		if (c != nc)
+		{
+			CaseRun *last = NULL;
+
+			if (runs->len > 0)
+				last = &g_array_index (runs, CaseRun, runs->len - 1);
+
+			if (last == NULL || offset - last->end >= MIN_UNCHANGED_CHARS)
+			{
+				CaseRun run;
+
+				run.start = offset;
+				run.text_start = q - new_text;
+				g_array_append_val (runs, run);
 
-	ctk_text_buffer_delete_selection (buffer, TRUE, TRUE);
-	ctk_text_buffer_insert_at_cursor (buffer, s->str, s->len);
+				last = &g_array_index (runs, CaseRun, runs->len - 1);
+			}
 
-	g_string_free (s, TRUE);
+			last->end = offset + 1;
+			last->text_end = g_utf8_next_char (q) - new_text;
+		}
+
+		p = g_utf8_next_char (p);
+		q = g_utf8_next_char (q);
+		++offset;
+	}
+
+	return runs;
 }
 
 static void
-do_title_case (CtkTextBuffer *buffer,
-               CtkTextIter   *start,
-               CtkTextIter   *end)
+replace_changed_runs (CtkTextBuffer *buffer,
+                      gint           start_offset,
+                      const gchar   *text,
+                      const gchar   *new_text)
 {
-	GString *s = g_string_new (NULL);
+	GArray *runs;
+	gint i;
+
+	runs = find_changed_runs (text, new_text);
 
-	while (!ctk_text_iter_is_end (start) &&
-	       !ctk_text_iter_equal (start, end))
+	/* back to front, so that the offsets of the runs not replaced yet
+	 * stay valid */
+	for (i = runs->len - 1; i >= 0; --i)
 	{
-		gunichar c, nc;
+		CaseRun *run = &g_array_index (runs, CaseRun, i);
+		CtkTextIter run_start, run_end;
 
-		c = ctk_text_iter_get_char (start);
-		if (ctk_text_iter_starts_word (start))
-			nc = g_unichar_totitle (c);
-		else
-			nc = g_unichar_tolower (c);
-		g_string_append_unichar (s, nc);
+		ctk_text_buffer_get_iter_at_offset (buffer, &run_start, start_offset + run->start);
+		ctk_text_buffer_get_iter_at_offset (buffer, &run_end, start_offset + run->end);
 
-		ctk_text_iter_forward_char (start);
+		ctk_text_buffer_delete (buffer, &run_start, &run_end);
+		ctk_text_buffer_insert (buffer,
+		                        &run_start,
+		                        new_text + run->text_start,
+		                        run->text_end - run->text_start);
 	}
 
-	ctk_text_buffer_delete_selection (buffer, TRUE, TRUE);
-	ctk_text_buffer_insert_at_cursor (buffer, s->str, s->len);
-
-	g_string_free (s, TRUE);
+	g_array_free (runs, TRUE);
 }
 
 static void
@@ -174,40 +316,71 @@ change_case (LapizWindow      *window,
              ChangeCaseChoice  choice)
 {
 	LapizDocument *doc;
+	CtkTextBuffer *buffer;
 	CtkTextIter start, end;
+	CtkTextIter insert;
+	gint start_offset, end_offset;
+	gboolean insert_at_start;
+	gchar *text;
+	gsize len;
+	GString *new_text;
 
 	lapiz_debug (DEBUG_PLUGINS);
 
 	doc = lapiz_window_get_active_document (window);
 	g_return_if_fail (doc != NULL);
 
-	if (!ctk_text_buffer_get_selection_bounds (CTK_TEXT_BUFFER (doc),
-						   &start, &end))
+	buffer = CTK_TEXT_BUFFER (doc);
+
+	if (!ctk_text_buffer_get_selection_bounds (buffer, &start, &end))
 	{
 		return;
 	}
 
-	ctk_text_buffer_begin_user_action (CTK_TEXT_BUFFER (doc));
+	start_offset = ctk_text_iter_get_offset (&start);
+	end_offset = ctk_text_iter_get_offset (&end);
+
+	ctk_text_buffer_get_iter_at_mark (buffer, &insert,
+	                                  ctk_text_buffer_get_insert (buffer));
+	insert_at_start = ctk_text_iter_equal (&insert, &start);
+
+	/* hidden text and child anchors are included so that the offsets
+	 * in the slice match the buffer ones */
+	text = ctk_text_buffer_get_slice (buffer, &start, &end, TRUE);
+	len = strlen (text);
 
 	switch (choice)
 	{
 	case TO_UPPER_CASE:
-		do_upper_case (CTK_TEXT_BUFFER (doc), &start, &end);
-		break;
 	case TO_LOWER_CASE:
-		do_lower_case (CTK_TEXT_BUFFER (doc), &start, &end);
-		break;
 	case INVERT_CASE:
-		do_invert_case (CTK_TEXT_BUFFER (doc), &start, &end);
+		new_text = convert_text (text, len, choice);
 		break;
 	case TO_TITLE_CASE:
-		do_title_case (CTK_TEXT_BUFFER (doc), &start, &end);
+		new_text = convert_title_case (text, len,
+		                               ctk_text_iter_starts_word (&start));
 		break;
 	default:
+		g_free (text);
 		g_return_if_reached ();
 	}
 
-	ctk_text_buffer_end_user_action (CTK_TEXT_BUFFER (doc));
+	ctk_text_buffer_begin_user_action (buffer);
+
+	replace_changed_runs (buffer, start_offset, text, new_text->str);
+
+	/* the case change does not change the number of characters */
+	ctk_text_buffer_get_iter_at_offset (buffer, &start, start_offset);
+	ctk_text_buffer_get_iter_at_offset (buffer, &end, end_offset);
+	if (insert_at_start)
+		ctk_text_buffer_select_range (buffer, &start, &end);
+	else
+		ctk_text_buffer_select_range (buffer, &end, &start);
+
+	ctk_text_buffer_end_user_action (buffer);
+
+	g_string_free (new_text, TRUE);
+	g_free (text);
 }
 
 static void
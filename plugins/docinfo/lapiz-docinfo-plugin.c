@@ -25,11 +25,9 @@
 #endif
 
 #include "lapiz-docinfo-plugin.h"
-
-#include <string.h> /* For strlen (...) */
+#include "lapiz-docinfo-stats.h"
 
 #include <glib/gi18n-lib.h>
-#include <pango/pango-break.h>
 #include <gmodule.h>
 #include <libbean/bean-activatable.h>
 
@@ -39,6 +37,11 @@
 
 #define MENU_PATH "/MenuBar/ToolsMenu/ToolsOps_2"
 
+#define DOCINFO_STATS_KEY "LapizDocInfoPluginStatsKey"
+
+/* The word count on the statusbar is updated in idle slices this long */
+#define WORD_COUNT_SLICE_USEC 5000
+
 static void bean_activatable_iface_init (BeanActivatableInterface *iface);
 
 typedef struct
@@ -66,6 +69,11 @@ struct _LapizDocInfoPluginPrivate
 	guint ui_id;
 
 	DocInfoDialog *dialog;
+
+	/* Word count of the active document on the statusbar */
+	CtkWidget *word_count_label;
+	LapizDocument *active_doc;
+	guint word_count_id;
 };
 
 G_DEFINE_DYNAMIC_TYPE_EXTENDED (LapizDocInfoPlugin,
@@ -172,66 +180,33 @@ get_docinfo_dialog (LapizDocInfoPlugin *plugin)
 	return dialog;
 }
 
-static void
-calculate_info (LapizDocument *doc,
-		CtkTextIter   *start,
-		CtkTextIter   *end,
-		gint          *chars,
-		gint          *words,
-		gint          *white_chars,
-		gint          *bytes)
+/* The statistics of a document are created the first time they are
+ * needed and then kept up to date as long as the plugin is active */
+static LapizDocInfoStats *
+get_document_stats (LapizDocument *doc)
 {
-	gchar *text;
-
-	lapiz_debug (DEBUG_PLUGINS);
-
-	text = ctk_text_buffer_get_slice (CTK_TEXT_BUFFER (doc),
-					  start,
-					  end,
-					  TRUE);
+	LapizDocInfoStats *stats;
 
-	*chars = g_utf8_strlen (text, -1);
-	*bytes = strlen (text);
+	stats = g_object_get_data (G_OBJECT (doc), DOCINFO_STATS_KEY);
 
-	if (*chars > 0)
+	if (stats == NULL)
 	{
-		PangoLogAttr *attrs;
-		gint i;
+		stats = lapiz_docinfo_stats_new (CTK_TEXT_BUFFER (doc));
 
-		attrs = g_new0 (PangoLogAttr, *chars + 1);
-
-		pango_get_log_attrs (text,
-				     -1,
-				     0,
-				     pango_language_from_string ("C"),
-				     attrs,
-				     *chars + 1);
-
-		for (i = 0; i < (*chars); i++)
-		{
-			if (attrs[i].is_white)
-				++(*white_chars);
-
-			if (attrs[i].is_word_start)
-				++(*words);
-		}
-
-		g_free (attrs);
-	}
-	else
-	{
-		*white_chars = 0;
-		*words = 0;
+		g_object_set_data_full (G_OBJECT (doc),
+					DOCINFO_STATS_KEY,
+					stats,
+					(GDestroyNotify) lapiz_docinfo_stats_free);
 	}
 
-	g_free (text);
+	return stats;
 }
 
 static void
 docinfo_real (LapizDocument *doc,
 	      DocInfoDialog *dialog)
 {
-	CtkTextIter start, end;
+	LapizDocInfoCounts counts;
 	gint words = 0;
 	gint chars = 0;
 	gint white_chars = 0;
@@ -242,15 +217,14 @@ docinfo_real (LapizDocument *doc,
 
 	lapiz_debug (DEBUG_PLUGINS);
 
-	ctk_text_buffer_get_bounds (CTK_TEXT_BUFFER (doc),
-				    &start,
-				    &end);
-
 	lines = ctk_text_buffer_get_line_count (CTK_TEXT_BUFFER (doc));
 
-	calculate_info (doc,
-			&start, &end,
-			&chars, &words, &white_chars, &bytes);
+	lapiz_docinfo_stats_get_total (get_document_stats (doc), &counts);
+
+	chars = counts.chars;
+	words = counts.words;
+	white_chars = counts.white_chars;
+	bytes = counts.bytes;
 
 	if (chars == 0)
 		lines = 0;
@@ -309,11 +283,18 @@ selectioninfo_real (LapizDocument *doc,
 
 	if (sel)
 	{
+		LapizDocInfoCounts counts;
+
 		lines = ctk_text_iter_get_line (&end) - ctk_text_iter_get_line (&start) + 1;
 
-		calculate_info (doc,
-				&start, &end,
-				&chars, &words, &white_chars, &bytes);
+		lapiz_docinfo_stats_get_range (get_document_stats (doc),
+					       &start, &end,
+					       &counts);
+
+		chars = counts.chars;
+		words = counts.words;
+		white_chars = counts.white_chars;
+		bytes = counts.bytes;
 
 		lapiz_debug_message (DEBUG_PLUGINS, "Selected chars: %d", chars);
 		lapiz_debug_message (DEBUG_PLUGINS, "Selected lines: %d", lines);
@@ -443,6 +424,90 @@ static const CtkActionEntry action_entries[] =
 	  G_CALLBACK (docinfo_cb) }
 };
 
+static gboolean
+update_word_count (LapizDocInfoPluginPrivate *data)
+{
+	LapizDocInfoStats *stats;
+	LapizDocInfoCounts counts;
+	gchar *msg;
+
+	if (data->active_doc == NULL)
+	{
+		data->word_count_id = 0;
+		return FALSE;
+	}
+
+	stats = get_document_stats (data->active_doc);
+
+	/* count a slice at a time, the label keeps the last count
+	 * until the new one is complete */
+	if (!lapiz_docinfo_stats_update (stats,
+					 g_get_monotonic_time () + WORD_COUNT_SLICE_USEC))
+		return TRUE;
+
+	lapiz_docinfo_stats_get_total (stats, &counts);
+
+	msg = g_strdup_printf (ngettext ("%d word", "%d words", counts.words),
+			       counts.words);
+	ctk_label_set_text (CTK_LABEL (data->word_count_label), msg);
+	g_free (msg);
+
+	data->word_count_id = 0;
+
+	return FALSE;
+}
+
+static void
+queue_word_count (LapizDocInfoPluginPrivate *data)
+{
+	if (data->word_count_id == 0)
+		data->word_count_id = g_idle_add_full (G_PRIORITY_LOW,
+						       (GSourceFunc) update_word_count,
+						       data,
+						       NULL);
+}
+
+static void
+set_word_count_document (LapizDocInfoPluginPrivate *data,
+			 LapizDocument             *doc)
+{
+	if (data->active_doc == doc)
+		return;
+
+	if (data->active_doc != NULL)
+	{
+		g_signal_handlers_disconnect_by_func (data->active_doc,
+						      queue_word_count,
+						      data);
+		g_object_remove_weak_pointer (G_OBJECT (data->active_doc),
+					      (gpointer *) &data->active_doc);
+	}
+
+	if (data->word_count_id != 0)
+	{
+		g_source_remove (data->word_count_id);
+		data->word_count_id = 0;
+	}
+
+	data->active_doc = doc;
+
+	if (doc != NULL)
+	{
+		g_object_add_weak_pointer (G_OBJECT (doc),
+					   (gpointer *) &data->active_doc);
+		g_signal_connect_swapped (doc,
+					  "changed",
+					  G_CALLBACK (queue_word_count),
+					  data);
+
+		queue_word_count (data);
+	}
+	else
+	{
+		ctk_label_set_text (CTK_LABEL (data->word_count_label), NULL);
+	}
+}
+
 static void
 update_ui (LapizDocInfoPluginPrivate *data)
 {
@@ -457,6 +522,8 @@ update_ui (LapizDocInfoPluginPrivate *data)
 	ctk_action_group_set_sensitive (data->ui_action_group,
 					(view != NULL));
 
+	set_word_count_document (data, lapiz_window_get_active_document (window));
+
 	if (data->dialog != NULL)
 	{
 		ctk_dialog_set_response_sensitive (CTK_DIALOG (data->dialog->dialog),
@@ -574,6 +641,13 @@ lapiz_docinfo_plugin_activate (BeanActivatable *activatable)
 			       CTK_UI_MANAGER_MENUITEM,
 			       FALSE);
 
+	data->word_count_label = ctk_label_new (NULL);
+	ctk_widget_set_margin_start (data->word_count_label, 6);
+	ctk_widget_show (data->word_count_label);
+	ctk_box_pack_end (CTK_BOX (lapiz_window_get_statusbar (window)),
+			  data->word_count_label,
+			  FALSE, TRUE, 0);
+
 	update_ui (data);
 }
 
@@ -583,6 +657,7 @@ lapiz_docinfo_plugin_deactivate (BeanActivatable *activatable)
 	LapizDocInfoPluginPrivate *data;
 	LapizWindow *window;
 	CtkUIManager *manager;
+	GList *docs, *l;
 
 	lapiz_debug (DEBUG_PLUGINS);
 
@@ -595,6 +670,18 @@ lapiz_docinfo_plugin_deactivate (BeanActivatable *activatable)
 				  data->ui_id);
 	ctk_ui_manager_remove_action_group (manager,
 					    data->ui_action_group);
+
+	set_word_count_document (data, NULL);
+	ctk_widget_destroy (data->word_count_label);
+	data->word_count_label = NULL;
+
+	/* stop keeping the statistics up to date */
+	docs = lapiz_window_get_documents (window);
+	for (l = docs; l != NULL; l = g_list_next (l))
+	{
+		g_object_set_data (G_OBJECT (l->data), DOCINFO_STATS_KEY, NULL);
+	}
+	g_list_free (docs);
 }
 
 static void
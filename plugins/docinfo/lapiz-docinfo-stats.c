@@ -0,0 +1,506 @@
+/*
+ * lapiz-docinfo-stats.c
+ * This file is part of lapiz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*
+ * The counts of a buffer are kept per block of whole lines. Words never
+ * span a line break, so the counts of a block do not depend on the text
+ * around it. An edit only marks the blocks holding the changed lines as
+ * dirty and moves the lines it adds or removes in or out of them; the
+ * dirty blocks are counted again when the counts are asked for.
+ */
+
+#include <string.h>
+
+#include <pango/pango-break.h>
+
+#include "lapiz-docinfo-stats.h"
+
+/* Blocks get this many lines when they are split */
+#define BLOCK_LINES 256
+
+typedef struct
+{
+	gint n_lines;
+	gboolean dirty;
+	LapizDocInfoCounts counts;
+} Block;
+
+struct _LapizDocInfoStats
+{
+	CtkTextBuffer *buffer;
+
+	GArray *blocks;
+
+	/* the number of lines of the buffer the blocks hold */
+	gint n_lines;
+	guint n_dirty;
+
+	/* the sum of the counts of the blocks that are not dirty */
+	LapizDocInfoCounts totals;
+};
+
+static void
+counts_add (LapizDocInfoCounts       *counts,
+	    const LapizDocInfoCounts *other)
+{
+	counts->chars += other->chars;
+	counts->words += other->words;
+	counts->white_chars += other->white_chars;
+	counts->bytes += other->bytes;
+}
+
+static void
+counts_subtract (LapizDocInfoCounts       *counts,
+		 const LapizDocInfoCounts *other)
+{
+	counts->chars -= other->chars;
+	counts->words -= other->words;
+	counts->white_chars -= other->white_chars;
+	counts->bytes -= other->bytes;
+}
+
+static void
+count_range (CtkTextBuffer      *buffer,
+	     const CtkTextIter  *start,
+	     const CtkTextIter  *end,
+	     LapizDocInfoCounts *counts)
+{
+	gchar *text;
+	gint chars;
+
+	if (ctk_text_iter_compare (start, end) >= 0)
+		return;
+
+	text = ctk_text_buffer_get_slice (buffer, start, end, TRUE);
+
+	chars = g_utf8_strlen (text, -1);
+
+	counts->chars += chars;
+	counts->bytes += strlen (text);
+
+	if (chars > 0)
+	{
+		PangoLogAttr *attrs;
+		gint i;
+
+		attrs = g_new0 (PangoLogAttr, chars + 1);
+
+		pango_get_log_attrs (text,
+				     -1,
+				     0,
+				     pango_language_from_string ("C"),
+				     attrs,
+				     chars + 1);
+
+		for (i = 0; i < chars; i++)
+		{
+			if (attrs[i].is_white)
+				++counts->white_chars;
+
+			if (attrs[i].is_word_start)
+				++counts->words;
+		}
+
+		g_free (attrs);
+	}
+
+	g_free (text);
+}
+
+/* gets the start of line, or the end of the buffer past the last line */
+static void
+get_iter_at_line (CtkTextBuffer *buffer,
+		  CtkTextIter   *iter,
+		  gint           line)
+{
+	if (line >= ctk_text_buffer_get_line_count (buffer))
+		ctk_text_buffer_get_end_iter (buffer, iter);
+	else
+		ctk_text_buffer_get_iter_at_line (buffer, iter, line);
+}
+
+static void
+append_blocks (LapizDocInfoStats *stats,
+	       guint              index,
+	       gint               n_lines)
+{
+	while (n_lines > 0)
+	{
+		Block block = { 0, TRUE, { 0, 0, 0, 0 } };
+
+		block.n_lines = MIN (n_lines, BLOCK_LINES);
+		n_lines -= block.n_lines;
+
+		g_array_insert_val (stats->blocks, index, block);
+		++stats->n_dirty;
+		++index;
+	}
+}
+
+static void
+mark_dirty (LapizDocInfoStats *stats,
+	    guint              index)
+{
+	Block *block = &g_array_index (stats->blocks, Block, index);
+
+	if (!block->dirty)
+	{
+		counts_subtract (&stats->totals, &block->counts);
+		block->dirty = TRUE;
+		++stats->n_dirty;
+	}
+}
+
+static void
+remove_block (LapizDocInfoStats *stats,
+	      guint              index)
+{
+	Block *block = &g_array_index (stats->blocks, Block, index);
+
+	if (block->dirty)
+		--stats->n_dirty;
+	else
+		counts_subtract (&stats->totals, &block->counts);
+
+	g_array_remove_index (stats->blocks, index);
+}
+
+/* finds the block holding line, and the line the block starts at */
+static guint
+find_block (LapizDocInfoStats *stats,
+	    gint               line,
+	    gint              *block_start)
+{
+	gint start = 0;
+	guint i;
+
+	for (i = 0; i + 1 < stats->blocks->len; i++)
+	{
+		Block *block = &g_array_index (stats->blocks, Block, i);
+
+		if (line < start + block->n_lines)
+			break;
+
+		start += block->n_lines;
+	}
+
+	if (block_start != NULL)
+		*block_start = start;
+
+	return i;
+}
+
+/* the line before the edit may have changed too, when a line terminator
+ * was joined to it, as when a \n is inserted after a \r */
+static void
+mark_line_dirty (LapizDocInfoStats *stats,
+		 gint               line)
+{
+	if (line >= 0)
+		mark_dirty (stats, find_block (stats, line, NULL));
+}
+
+static void
+insert_text_cb (CtkTextBuffer     *buffer,
+		CtkTextIter       *pos,
+		const gchar       *text G_GNUC_UNUSED,
+		gint               length G_GNUC_UNUSED,
+		LapizDocInfoStats *stats)
+{
+	gint n_lines;
+	gint added;
+	gint line;
+	guint index;
+
+	/* pos is at the end of the inserted text */
+	n_lines = ctk_text_buffer_get_line_count (buffer);
+	added = n_lines - stats->n_lines;
+	line = ctk_text_iter_get_line (pos) - added;
+
+	index = find_block (stats, line, NULL);
+	g_array_index (stats->blocks, Block, index).n_lines += added;
+	mark_dirty (stats, index);
+
+	mark_line_dirty (stats, line - 1);
+
+	stats->n_lines = n_lines;
+}
+
+static void
+delete_range_cb (CtkTextBuffer     *buffer,
+		 CtkTextIter       *start,
+		 CtkTextIter       *end G_GNUC_UNUSED,
+		 LapizDocInfoStats *stats)
+{
+	gint n_lines;
+	gint removed;
+	gint line;
+	gint block_start;
+	guint index;
+	Block *block;
+	gint n;
+
+	/* the lines after the one of start were joined to it */
+	n_lines = ctk_text_buffer_get_line_count (buffer);
+	removed = stats->n_lines - n_lines;
+	line = ctk_text_iter_get_line (start);
+
+	index = find_block (stats, line, &block_start);
+	block = &g_array_index (stats->blocks, Block, index);
+
+	n = MIN (removed, block_start + block->n_lines - line - 1);
+	block->n_lines -= n;
+	removed -= n;
+	mark_dirty (stats, index);
+
+	++index;
+
+	while (removed > 0 && index < stats->blocks->len)
+	{
+		block = &g_array_index (stats->blocks, Block, index);
+
+		n = MIN (removed, block->n_lines);
+		block->n_lines -= n;
+		removed -= n;
+
+		if (block->n_lines == 0)
+		{
+			remove_block (stats, index);
+		}
+		else
+		{
+			mark_dirty (stats, index);
+			++index;
+		}
+	}
+
+	mark_line_dirty (stats, line - 1);
+
+	stats->n_lines = n_lines;
+}
+
+/**
+ * lapiz_docinfo_stats_new:
+ * @buffer: a #CtkTextBuffer
+ *
+ * Creates the statistics of @buffer, kept up to date as it is edited.
+ * Nothing is counted until the counts are asked for.
+ *
+ * Returns: the new statistics, free them with lapiz_docinfo_stats_free()
+ */
+LapizDocInfoStats *
+lapiz_docinfo_stats_new (CtkTextBuffer *buffer)
+{
+	LapizDocInfoStats *stats;
+
+	g_return_val_if_fail (CTK_IS_TEXT_BUFFER (buffer), NULL);
+
+	stats = g_slice_new0 (LapizDocInfoStats);
+	stats->buffer = buffer;
+	stats->blocks = g_array_new (FALSE, FALSE, sizeof (Block));
+	stats->n_lines = ctk_text_buffer_get_line_count (buffer);
+
+	append_blocks (stats, 0, stats->n_lines);
+
+	g_signal_connect_after (buffer,
+				"insert-text",
+				G_CALLBACK (insert_text_cb),
+				stats);
+	g_signal_connect_after (buffer,
+				"delete-range",
+				G_CALLBACK (delete_range_cb),
+				stats);
+
+	return stats;
+}
+
+void
+lapiz_docinfo_stats_free (LapizDocInfoStats *stats)
+{
+	if (stats == NULL)
+		return;
+
+	g_signal_handlers_disconnect_by_data (stats->buffer, stats);
+
+	g_array_free (stats->blocks, TRUE);
+	g_slice_free (LapizDocInfoStats, stats);
+}
+
+/**
+ * lapiz_docinfo_stats_update:
+ * @stats: a #LapizDocInfoStats
+ * @deadline: the monotonic time to stop at, or -1 to count everything
+ *
+ * Counts the blocks changed since the last update.
+ *
+ * Returns: %TRUE if all the blocks are counted
+ */
+gboolean
+lapiz_docinfo_stats_update (LapizDocInfoStats *stats,
+			    gint64             deadline)
+{
+	gint line = 0;
+	guint i;
+
+	g_return_val_if_fail (stats != NULL, TRUE);
+
+	for (i = 0; i < stats->blocks->len && stats->n_dirty > 0; i++)
+	{
+		Block *block = &g_array_index (stats->blocks, Block, i);
+		CtkTextIter start, end;
+
+		if (!block->dirty)
+		{
+			line += block->n_lines;
+			continue;
+		}
+
+		if (deadline >= 0 && g_get_monotonic_time () >= deadline)
+			return FALSE;
+
+		/* blocks grown by the edits, or by loading the document,
+		 * are split before they are counted */
+		if (block->n_lines > 2 * BLOCK_LINES)
+		{
+			gint n_lines = block->n_lines - BLOCK_LINES;
+
+			block->n_lines = BLOCK_LINES;
+			append_blocks (stats, i + 1, n_lines);
+
+			block = &g_array_index (stats->blocks, Block, i);
+		}
+
+		get_iter_at_line (stats->buffer, &start, line);
+		get_iter_at_line (stats->buffer, &end, line + block->n_lines);
+
+		memset (&block->counts, 0, sizeof (LapizDocInfoCounts));
+		count_range (stats->buffer, &start, &end, &block->counts);
+
+		block->dirty = FALSE;
+		--stats->n_dirty;
+		counts_add (&stats->totals, &block->counts);
+
+		line += block->n_lines;
+	}
+
+	return TRUE;
+}
+
+/**
+ * lapiz_docinfo_stats_get_total:
+ * @stats: a #LapizDocInfoStats
+ * @counts: (out): return location for the counts of the whole buffer
+ */
+void
+lapiz_docinfo_stats_get_total (LapizDocInfoStats  *stats,
+			       LapizDocInfoCounts *counts)
+{
+	g_return_if_fail (stats != NULL);
+	g_return_if_fail (counts != NULL);
+
+	lapiz_docinfo_stats_update (stats, -1);
+
+	*counts = stats->totals;
+}
+
+/**
+ * lapiz_docinfo_stats_get_range:
+ * @stats: a #LapizDocInfoStats
+ * @start: the start of the range
+ * @end: the end of the range
+ * @counts: (out): return location for the counts of the range
+ *
+ * Gets the counts of a part of the buffer. The text is only read at the
+ * edges of the range, the counts of the blocks inside it are summed.
+ */
+void
+lapiz_docinfo_stats_get_range (LapizDocInfoStats  *stats,
+			       const CtkTextIter  *start,
+			       const CtkTextIter  *end,
+			       LapizDocInfoCounts *counts)
+{
+	CtkTextIter head_end, tail_start;
+	gint line = 0;
+	gint first = -1;
+	gint last = -1;
+	gint head_line = 0, tail_line = 0;
+	gint start_line;
+	guint i;
+
+	g_return_if_fail (stats != NULL);
+	g_return_if_fail (start != NULL && end != NULL);
+	g_return_if_fail (counts != NULL);
+
+	memset (counts, 0, sizeof (LapizDocInfoCounts));
+
+	lapiz_docinfo_stats_update (stats, -1);
+
+	start_line = ctk_text_iter_get_line (start);
+
+	/* find the blocks entirely inside the range */
+	for (i = 0; i < stats->blocks->len; i++)
+	{
+		Block *block = &g_array_index (stats->blocks, Block, i);
+		CtkTextIter block_start, block_end;
+
+		if (line + block->n_lines <= start_line)
+		{
+			line += block->n_lines;
+			continue;
+		}
+
+		get_iter_at_line (stats->buffer, &block_start, line);
+		get_iter_at_line (stats->buffer, &block_end, line + block->n_lines);
+
+		if (ctk_text_iter_compare (&block_end, end) > 0)
+			break;
+
+		if (ctk_text_iter_compare (&block_start, start) >= 0)
+		{
+			if (first < 0)
+			{
+				first = i;
+				head_line = line;
+			}
+
+			last = i;
+			tail_line = line + block->n_lines;
+		}
+
+		line += block->n_lines;
+	}
+
+	if (first < 0)
+	{
+		count_range (stats->buffer, start, end, counts);
+		return;
+	}
+
+	for (i = first; i <= (guint) last; i++)
+	{
+		counts_add (counts, &g_array_index (stats->blocks, Block, i).counts);
+	}
+
+	get_iter_at_line (stats->buffer, &head_end, head_line);
+	get_iter_at_line (stats->buffer, &tail_start, tail_line);
+
+	count_range (stats->buffer, start, &head_end, counts);
+	count_range (stats->buffer, &tail_start, end, counts);
+}
@@ -0,0 +1,55 @@
+/*
+ * lapiz-docinfo-stats.h
+ * This file is part of lapiz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef __LAPIZ_DOCINFO_STATS_H__
+#define __LAPIZ_DOCINFO_STATS_H__
+
+#include <ctk/ctk.h>
+
+G_BEGIN_DECLS
+
+typedef struct _LapizDocInfoStats LapizDocInfoStats;
+
+typedef struct
+{
+	gint chars;
+	gint words;
+	gint white_chars;
+	gint bytes;
+} LapizDocInfoCounts;
+
+LapizDocInfoStats	*lapiz_docinfo_stats_new	(CtkTextBuffer      *buffer);
+
+void			 lapiz_docinfo_stats_free	(LapizDocInfoStats  *stats);
+
+gboolean		 lapiz_docinfo_stats_update	(LapizDocInfoStats  *stats,
+							 gint64              deadline);
+
+void			 lapiz_docinfo_stats_get_total	(LapizDocInfoStats  *stats,
+							 LapizDocInfoCounts *counts);
+
+void			 lapiz_docinfo_stats_get_range	(LapizDocInfoStats  *stats,
+							 const CtkTextIter  *start,
+							 const CtkTextIter  *end,
+							 LapizDocInfoCounts *counts);
+
+G_END_DECLS
+
+#endif /* __LAPIZ_DOCINFO_STATS_H__ */
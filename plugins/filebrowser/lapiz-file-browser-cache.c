@@ -0,0 +1,459 @@
+/*
+ * lapiz-file-browser-cache.c - Lapiz plugin providing easy file access
+ * from the sidepanel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "lapiz-file-browser-cache.h"
+
+/*
+ * The listing of a directory is kept in a file of its own, named after the
+ * checksum of its uri, in the user cache dir. The file starts with a header,
+ * the uri and the modification time of the directory, followed by a line
+ * per file:
+ *
+ *	type TAB hidden TAB backup TAB name TAB display name TAB content type TAB icon
+ *
+ * The names are escaped with g_strescape. The icon is the one given by
+ * g_icon_to_string, so that the special folders keep theirs, or empty for
+ * the icon of the content type. All of it can be read and written from any
+ * thread.
+ *
+ * Only the listings of native directories are kept: those of remote ones are
+ * rarely up to date by the time they are shown again, and would leave the
+ * names of remote files around. Reading a listing touches its file, so that
+ * lapiz_file_browser_cache_prune drops the ones which were not used for
+ * CACHE_MAX_AGE, and the least recently used ones beyond CACHE_MAX_FILES.
+ */
+
+#define CACHE_HEADER "lapiz-file-browser-cache 2"
+#define CACHE_FIELDS 7
+
+#define CACHE_MAX_AGE (30 * G_TIME_SPAN_DAY)
+#define CACHE_MAX_FILES 1000
+
+typedef struct
+{
+	gchar *filename;
+	gint64 mtime;
+} CacheFile;
+
+static gchar *
+get_cache_dirname (void)
+{
+	/* Same as lapiz_dirs_get_user_cache_dir, which plugins can not use */
+	return g_build_filename (g_get_user_cache_dir (),
+				 "lapiz",
+				 "filebrowser",
+				 NULL);
+}
+
+static gchar *
+get_cache_filename (GFile * dir)
+{
+	gchar *uri;
+	gchar *checksum;
+	gchar *dirname;
+	gchar *filename;
+
+	uri = g_file_get_uri (dir);
+	checksum = g_compute_checksum_for_string (G_CHECKSUM_MD5, uri, -1);
+
+	dirname = get_cache_dirname ();
+	filename = g_build_filename (dirname, checksum, NULL);
+
+	g_free (dirname);
+	g_free (checksum);
+	g_free (uri);
+
+	return filename;
+}
+
+guint64
+lapiz_file_browser_cache_get_mtime (GFileInfo * info)
+{
+	return g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED) * G_USEC_PER_SEC +
+	       g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+}
+
+static GFileInfo *
+parse_info (gchar const * line)
+{
+	GFileInfo *info;
+	gchar **fields;
+	gchar *name;
+
+	fields = g_strsplit (line, "\t", CACHE_FIELDS);
+
+	if (g_strv_length (fields) != CACHE_FIELDS || *fields[3] == '\0') {
+		g_strfreev (fields);
+		return NULL;
+	}
+
+	info = g_file_info_new ();
+
+	g_file_info_set_file_type (info, atoi (fields[0]));
+	g_file_info_set_is_hidden (info, *fields[1] == '1');
+	g_file_info_set_is_backup (info, *fields[2] == '1');
+
+	name = g_strcompress (fields[3]);
+	g_file_info_set_name (info, name);
+	g_free (name);
+
+	if (*fields[4] != '\0') {
+		name = g_strcompress (fields[4]);
+		g_file_info_set_display_name (info, name);
+		g_free (name);
+	}
+
+	if (*fields[5] != '\0')
+		g_file_info_set_content_type (info, fields[5]);
+
+	/* Fall back to the icon of the content type */
+	if (*fields[6] != '\0' || *fields[5] != '\0') {
+		GIcon *icon = NULL;
+
+		if (*fields[6] != '\0')
+			icon = g_icon_new_for_string (fields[6], NULL);
+
+		if (icon == NULL && *fields[5] != '\0')
+			icon = g_content_type_get_icon (fields[5]);
+
+		if (icon != NULL) {
+			g_file_info_set_icon (info, icon);
+			g_object_unref (icon);
+		}
+	}
+
+	g_strfreev (fields);
+
+	return info;
+}
+
+/**
+ * lapiz_file_browser_cache_read:
+ * @dir: the directory
+ * @mtime: the modification time of @dir
+ *
+ * Reads the cached listing of @dir, as long as @dir was not modified since
+ * it was written and is a native directory.
+ *
+ * Returns: the #GFileInfo of the files, or %NULL if there is no up to date
+ * listing of @dir
+ **/
+GPtrArray *
+lapiz_file_browser_cache_read (GFile * dir, guint64 mtime)
+{
+	GPtrArray *infos = NULL;
+	gchar *filename;
+	gchar *contents;
+	gchar **lines;
+	gchar *uri;
+	guint i;
+
+	if (!g_file_is_native (dir))
+		return NULL;
+
+	filename = get_cache_filename (dir);
+
+	if (!g_file_get_contents (filename, &contents, NULL, NULL)) {
+		g_free (filename);
+		return NULL;
+	}
+
+	lines = g_strsplit (contents, "\n", -1);
+	g_free (contents);
+
+	uri = g_file_get_uri (dir);
+
+	if (g_strv_length (lines) >= 3 &&
+	    strcmp (lines[0], CACHE_HEADER) == 0 &&
+	    strcmp (lines[1], uri) == 0 &&
+	    g_ascii_strtoull (lines[2], NULL, 10) == mtime) {
+		infos = g_ptr_array_new_with_free_func (g_object_unref);
+
+		for (i = 3; lines[i] != NULL && *lines[i] != '\0'; ++i) {
+			GFileInfo *info;
+
+			if ((info = parse_info (lines[i])) == NULL) {
+				g_ptr_array_unref (infos);
+				infos = NULL;
+				break;
+			}
+
+			g_ptr_array_add (infos, info);
+		}
+	}
+
+	/* Keep it from being pruned while it is in use */
+	if (infos != NULL)
+		g_utime (filename, NULL);
+
+	g_free (filename);
+	g_free (uri);
+	g_strfreev (lines);
+
+	return infos;
+}
+
+static void
+append_escaped (GString * contents, gchar const * str)
+{
+	gchar *escaped;
+
+	if (str != NULL) {
+		escaped = g_strescape (str, NULL);
+		g_string_append (contents, escaped);
+		g_free (escaped);
+	}
+}
+
+/**
+ * lapiz_file_browser_cache_write:
+ * @dir: the directory
+ * @mtime: the modification time of @dir when it was listed
+ * @infos: the #GFileInfo of the files in @dir
+ *
+ * Replaces the cached listing of @dir, if it is a native directory.
+ **/
+void
+lapiz_file_browser_cache_write (GFile * dir, guint64 mtime, GPtrArray * infos)
+{
+	GString *contents;
+	gchar *filename;
+	gchar *dirname;
+	gchar *uri;
+	guint i;
+	GError *error = NULL;
+
+	if (!g_file_is_native (dir))
+		return;
+
+	filename = get_cache_filename (dir);
+	dirname = g_path_get_dirname (filename);
+
+	if (g_mkdir_with_parents (dirname, 0755) == -1) {
+		g_free (dirname);
+		g_free (filename);
+		return;
+	}
+
+	g_free (dirname);
+
+	uri = g_file_get_uri (dir);
+	contents = g_string_new (NULL);
+
+	g_string_append_printf (contents,
+				CACHE_HEADER "\n%s\n%" G_GUINT64_FORMAT "\n",
+				uri,
+				mtime);
+
+	for (i = 0; i < infos->len; ++i) {
+		GFileInfo *info = g_ptr_array_index (infos, i);
+		gchar const *content_type;
+		GIcon *icon;
+
+		g_string_append_printf (contents,
+					"%d\t%d\t%d\t",
+					g_file_info_get_file_type (info),
+					g_file_info_get_is_hidden (info) ? 1 : 0,
+					g_file_info_get_is_backup (info) ? 1 : 0);
+
+		append_escaped (contents, g_file_info_get_name (info));
+		g_string_append_c (contents, '\t');
+
+		append_escaped (contents,
+				g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME));
+		g_string_append_c (contents, '\t');
+
+		content_type = g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE);
+
+		if (content_type != NULL)
+			g_string_append (contents, content_type);
+
+		g_string_append_c (contents, '\t');
+
+		icon = G_ICON (g_file_info_get_attribute_object (info, G_FILE_ATTRIBUTE_STANDARD_ICON));
+
+		if (icon != NULL) {
+			gchar *icon_str = g_icon_to_string (icon);
+
+			/* Icons which can not be serialized get the one of the
+			 * content type back */
+			if (icon_str != NULL && strpbrk (icon_str, "\t\n") == NULL)
+				g_string_append (contents, icon_str);
+
+			g_free (icon_str);
+		}
+
+		g_string_append_c (contents, '\n');
+	}
+
+	if (!g_file_set_contents (filename, contents->str, contents->len, &error)) {
+		g_warning ("Could not save the listing of %s: %s", uri, error->message);
+		g_error_free (error);
+	}
+
+	g_string_free (contents, TRUE);
+	g_free (filename);
+	g_free (uri);
+}
+
+/**
+ * lapiz_file_browser_cache_info_equal:
+ * @info1: a #GFileInfo
+ * @info2: a #GFileInfo of a file with the same name
+ *
+ * Returns: whether the cached attributes of both, icon included, are the same
+ **/
+gboolean
+lapiz_file_browser_cache_info_equal (GFileInfo * info1, GFileInfo * info2)
+{
+	GObject *icon1;
+	GObject *icon2;
+
+	icon1 = g_file_info_get_attribute_object (info1, G_FILE_ATTRIBUTE_STANDARD_ICON);
+	icon2 = g_file_info_get_attribute_object (info2, G_FILE_ATTRIBUTE_STANDARD_ICON);
+
+	if (icon1 != icon2 &&
+	    (icon1 == NULL || icon2 == NULL || !g_icon_equal (G_ICON (icon1), G_ICON (icon2))))
+		return FALSE;
+
+	return g_file_info_get_file_type (info1) == g_file_info_get_file_type (info2) &&
+	       g_file_info_get_is_hidden (info1) == g_file_info_get_is_hidden (info2) &&
+	       g_file_info_get_is_backup (info1) == g_file_info_get_is_backup (info2) &&
+	       g_strcmp0 (g_file_info_get_attribute_string (info1, G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME),
+			  g_file_info_get_attribute_string (info2, G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME)) == 0 &&
+	       g_strcmp0 (g_file_info_get_attribute_string (info1, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE),
+			  g_file_info_get_attribute_string (info2, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE)) == 0;
+}
+
+static void
+cache_file_free (CacheFile * file)
+{
+	g_free (file->filename);
+	g_slice_free (CacheFile, file);
+}
+
+static gint
+compare_cache_files (gconstpointer a, gconstpointer b)
+{
+	CacheFile const *file1 = *(CacheFile * const *) a;
+	CacheFile const *file2 = *(CacheFile * const *) b;
+
+	/* Most recently used first */
+	if (file1->mtime != file2->mtime)
+		return file1->mtime > file2->mtime ? -1 : 1;
+
+	return 0;
+}
+
+static void
+prune_thread (GTask        *task G_GNUC_UNUSED,
+	      gpointer      source_object G_GNUC_UNUSED,
+	      gpointer      task_data G_GNUC_UNUSED,
+	      GCancellable *cancellable G_GNUC_UNUSED)
+{
+	GDir *cache_dir;
+	GPtrArray *files;
+	gchar *dirname;
+	gchar const *name;
+	gint64 now;
+	guint i;
+
+	dirname = get_cache_dirname ();
+
+	if ((cache_dir = g_dir_open (dirname, 0, NULL)) == NULL) {
+		g_free (dirname);
+		return;
+	}
+
+	files = g_ptr_array_new_with_free_func ((GDestroyNotify) cache_file_free);
+	now = g_get_real_time ();
+
+	while ((name = g_dir_read_name (cache_dir)) != NULL) {
+		GStatBuf buf;
+		CacheFile *file;
+		gchar *filename;
+
+		filename = g_build_filename (dirname, name, NULL);
+
+		if (g_stat (filename, &buf) != 0 || !S_ISREG (buf.st_mode)) {
+			g_free (filename);
+			continue;
+		}
+
+		if (now - (gint64) buf.st_mtime * G_USEC_PER_SEC > CACHE_MAX_AGE) {
+			g_unlink (filename);
+			g_free (filename);
+			continue;
+		}
+
+		file = g_slice_new (CacheFile);
+		file->filename = filename;
+		file->mtime = buf.st_mtime;
+
+		g_ptr_array_add (files, file);
+	}
+
+	g_dir_close (cache_dir);
+	g_free (dirname);
+
+	if (files->len > CACHE_MAX_FILES) {
+		g_ptr_array_sort (files, compare_cache_files);
+
+		for (i = CACHE_MAX_FILES; i < files->len; ++i) {
+			CacheFile *file = g_ptr_array_index (files, i);
+
+			g_unlink (file->filename);
+		}
+	}
+
+	g_ptr_array_unref (files);
+}
+
+/**
+ * lapiz_file_browser_cache_prune:
+ *
+ * Removes, in a thread, the cached listings which were not used for a while
+ * and the least recently used ones when there are too many of them. Only the
+ * first call of the process does something.
+ **/
+void
+lapiz_file_browser_cache_prune (void)
+{
+	static gboolean pruned = FALSE;
+	GTask *task;
+
+	if (pruned)
+		return;
+
+	pruned = TRUE;
+
+	task = g_task_new (NULL, NULL, NULL, NULL);
+	g_task_run_in_thread (task, prune_thread);
+	g_object_unref (task);
+}
+
+// ex:ts=8:noet:
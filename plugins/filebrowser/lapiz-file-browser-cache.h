@@ -0,0 +1,44 @@
+/*
+ * lapiz-file-browser-cache.h - Lapiz plugin providing easy file access
+ * from the sidepanel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __LAPIZ_FILE_BROWSER_CACHE_H__
+#define __LAPIZ_FILE_BROWSER_CACHE_H__
+
+#include <gio/gio.h>
+
+/* The attributes needed to know whether a directory changed */
+#define LAPIZ_FILE_BROWSER_CACHE_MTIME_ATTRIBUTES G_FILE_ATTRIBUTE_TIME_MODIFIED "," \
+						  G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC
+
+guint64    lapiz_file_browser_cache_get_mtime	(GFileInfo * info);
+
+GPtrArray *lapiz_file_browser_cache_read	(GFile * dir,
+						 guint64 mtime);
+void	   lapiz_file_browser_cache_write	(GFile * dir,
+						 guint64 mtime,
+						 GPtrArray * infos);
+
+gboolean   lapiz_file_browser_cache_info_equal	(GFileInfo * info1,
+						 GFileInfo * info2);
+
+void	   lapiz_file_browser_cache_prune	(void);
+
+#endif /* __LAPIZ_FILE_BROWSER_CACHE_H__ */
+
+// ex:ts=8:noet:
@@ -40,6 +40,7 @@
 #include "lapiz-file-browser-error.h"
 #include "lapiz-file-browser-widget.h"
 #include "lapiz-file-browser-messages.h"
+#include "lapiz-file-browser-cache.h"
 
 #define FILE_BROWSER_SCHEMA 		"org.cafe.lapiz.plugins.filebrowser"
 #define FILE_BROWSER_ONLOAD_SCHEMA 	"org.cafe.lapiz.plugins.filebrowser.on-load"
@@ -767,6 +768,9 @@ lapiz_file_browser_plugin_activate (BeanActivatable *activatable)
 	                  G_CALLBACK (on_tab_added_cb),
 	                  data);
 
+	/* Drop the listings of the directories not visited for a while */
+	lapiz_file_browser_cache_prune ();
+
 	/* Register messages on the bus */
 	lapiz_file_browser_messages_register (window, data->tree_widget);
 
@@ -32,6 +32,7 @@
 #include "lapiz-file-browser-enum-types.h"
 #include "lapiz-file-browser-error.h"
 #include "lapiz-file-browser-utils.h"
+#include "lapiz-file-browser-cache.h"
 
 #define NODE_IS_DIR(node)		(FILE_IS_DIR((node)->flags))
 #define NODE_IS_HIDDEN(node)		(FILE_IS_HIDDEN((node)->flags))
@@ -41,12 +42,28 @@
 #define NODE_IS_DUMMY(node)		(FILE_IS_DUMMY((node)->flags))
 
 #define FILE_BROWSER_NODE_DIR(node)	((FileBrowserNodeDir *)(node))
-
-#define DIRECTORY_LOAD_ITEMS_PER_CALLBACK 100
+#define NODE_CHILD(dir, i)		((FileBrowserNode *) g_ptr_array_index ((dir)->children, (i)))
+
+/* Directories are enumerated in a thread which hands over sorted batches,
+ * growing from the first size to the maximum one so that the first rows
+ * show up quickly while big directories take few merges. The batches are
+ * added to the model in slices of at most DIRECTORY_LOAD_SLICE_USEC. */
+#define DIRECTORY_LOAD_ITEMS_PER_BATCH 100
+#define DIRECTORY_LOAD_MAX_ITEMS_PER_BATCH 3200
+#define DIRECTORY_LOAD_SLICE_USEC 5000
+
+/* Directory monitor events are applied together, this long after the first
+ * one of a batch */
+#define MONITOR_EVENTS_DELAY 100
+
+/* Recorded instead of the monitor event of a file deleted then created again
+ * within a batch, its node (if any) being the one of the deleted file */
+#define MONITOR_EVENT_REPLACED -1
 #define STANDARD_ATTRIBUTE_TYPES G_FILE_ATTRIBUTE_STANDARD_TYPE "," \
 				 G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN "," \
 			 	 G_FILE_ATTRIBUTE_STANDARD_IS_BACKUP "," \
 				 G_FILE_ATTRIBUTE_STANDARD_NAME "," \
+				 G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME "," \
 				 G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE "," \
 				 G_FILE_ATTRIBUTE_STANDARD_ICON
 
@@ -54,6 +71,8 @@ typedef struct _FileBrowserNode    FileBrowserNode;
 typedef struct _FileBrowserNodeDir FileBrowserNodeDir;
 typedef struct _AsyncData	   AsyncData;
 typedef struct _AsyncNode	   AsyncNode;
+typedef struct _DirEntry	   DirEntry;
+typedef struct _MonitorQuery	   MonitorQuery;
 
 typedef gint (*SortFunc) (FileBrowserNode * node1,
 			  FileBrowserNode * node2);
@@ -72,7 +91,38 @@ struct _AsyncNode
 {
 	FileBrowserNodeDir *dir;
 	GCancellable *cancellable;
-	GSList *original_children;
+
+	/* The directory as it was when the loading started, for the thread */
+	GFile *file;
+
+	/* Sorted batches of DirEntry from the thread, the first one being
+	 * added from batch_pos on */
+	GMutex lock;
+	GQueue batches;
+	guint batch_pos;
+	guint idle_id;
+
+	/* Set when the thread is done while the idle still has entries
+	 * to add, so that it finishes the loading */
+	GTask *task;
+};
+
+/* A file found by the enumeration thread, with all that can be computed
+ * outside of the main thread, or without info one which is gone */
+struct _DirEntry
+{
+	GFile *file;
+	GFileInfo *info;
+	gchar *name;
+	gchar *collate_key;
+	guint flags;
+};
+
+/* The files created in a directory, queried in a thread */
+struct _MonitorQuery
+{
+	GFile *dir;
+	GPtrArray *files;
 };
 
 typedef struct {
@@ -87,6 +137,7 @@ struct _FileBrowserNode
 	GFile *file;
 	guint flags;
 	gchar *name;
+	gchar *collate_key;
 
 	GdkPixbuf *icon;
 	GdkPixbuf *emblem;
@@ -94,16 +145,32 @@ struct _FileBrowserNode
 	FileBrowserNode *parent;
 	gint pos;
 	gboolean inserted;
+
+	guint index;	/* position in the children of the parent */
+	guint row;	/* number of rows before it among its siblings */
 };
 
 struct _FileBrowserNodeDir
 {
 	FileBrowserNode node;
-	GSList *children;
+
+	/* Sorted children. The row of the children is computed lazily and
+	 * is valid for the first rows_valid ones, as long as rows_stamp
+	 * matches the one of the model. */
+	GPtrArray *children;
+	guint rows_valid;
+	guint rows_stamp;
 
 	GCancellable *cancellable;
 	GFileMonitor *monitor;
 	LapizFileBrowserStore *model;
+
+	/* The last monitor event of each file since the previous batch
+	 * (or MONITOR_EVENT_REPLACED), and the query of the files
+	 * created by the batch being applied */
+	GHashTable *monitor_events;
+	guint monitor_events_id;
+	GCancellable *monitor_cancellable;
 };
 
 struct _LapizFileBrowserStorePrivate
@@ -118,6 +185,12 @@ struct _LapizFileBrowserStorePrivate
 
 	SortFunc sort_func;
 
+	/* All the nodes with a file, by file */
+	GHashTable *nodes;
+
+	/* Changed whenever the rows of all the nodes may have changed */
+	guint rows_stamp;
+
 	GSList *async_handles;
 	MountInfo *mount_info;
 };
@@ -187,8 +260,6 @@ static gint model_sort_default                              (FileBrowserNode * n
 							     FileBrowserNode * node2);
 static void model_check_dummy                               (LapizFileBrowserStore * model,
 							     FileBrowserNode * node);
-static void next_files_async 				    (GFileEnumerator * enumerator,
-							     AsyncNode * async);
 
 static void delete_files                                    (AsyncData              *data);
 
@@ -245,6 +316,7 @@ lapiz_file_browser_store_finalize (GObject * object)
 
 	/* Free all the nodes */
 	file_browser_node_free (obj, obj->priv->root);
+	g_hash_table_destroy (obj->priv->nodes);
 
 	/* Cancel any asynchronous operations */
 	for (item = obj->priv->async_handles; item; item = item->next)
@@ -470,6 +542,8 @@ lapiz_file_browser_store_init (LapizFileBrowserStore * obj)
 	// Default filter mode is hiding the hidden files
 	obj->priv->filter_mode = lapiz_file_browser_store_filter_mode_get_default ();
 	obj->priv->sort_func = model_sort_default;
+	obj->priv->nodes = g_hash_table_new (g_file_hash,
+					     (GEqualFunc) g_file_equal);
 }
 
 static gboolean
@@ -490,6 +564,36 @@ node_in_tree (LapizFileBrowserStore * model, FileBrowserNode * node)
 	return node_has_parent (node, model->priv->virtual_root);
 }
 
+/* Nodes are indexed from when they are added to their parent until they are
+ * freed, and have to be indexed again whenever their file changes */
+static void
+model_index_node (LapizFileBrowserStore * model, FileBrowserNode * node)
+{
+	if (node->file != NULL)
+		g_hash_table_replace (model->priv->nodes, node->file, node);
+}
+
+static void
+model_unindex_node (LapizFileBrowserStore * model, FileBrowserNode * node)
+{
+	if (node->file != NULL &&
+	    g_hash_table_lookup (model->priv->nodes, node->file) == node)
+		g_hash_table_remove (model->priv->nodes, node->file);
+}
+
+/* The child of parent for file, if there is one */
+static FileBrowserNode *
+model_find_child (LapizFileBrowserStore * model,
+		  FileBrowserNode * parent,
+		  GFile * file)
+{
+	FileBrowserNode *node;
+
+	node = g_hash_table_lookup (model->priv->nodes, file);
+
+	return node != NULL && node->parent == parent ? node : NULL;
+}
+
 static gboolean
 model_node_visibility (LapizFileBrowserStore * model,
 		       FileBrowserNode * node)
@@ -516,6 +620,229 @@ model_node_inserted (LapizFileBrowserStore * model,
 	return node == model->priv->virtual_root || (model_node_visibility (model, node) && node->inserted);
 }
 
+/* Same as model_node_inserted for the children of a node, which are all in
+ * the tree or not */
+static gboolean
+model_node_is_row (LapizFileBrowserStore * model,
+		   FileBrowserNode * node,
+		   gboolean parent_in_tree)
+{
+	if (node == model->priv->virtual_root)
+		return TRUE;
+
+	if (!node->inserted)
+		return FALSE;
+
+	if (NODE_IS_DUMMY (node))
+		return !NODE_IS_HIDDEN (node);
+
+	return parent_in_tree && !NODE_IS_FILTERED (node);
+}
+
+static gboolean
+model_dir_in_tree (LapizFileBrowserStore * model,
+		   FileBrowserNodeDir * dir)
+{
+	FileBrowserNode *node = (FileBrowserNode *) dir;
+
+	return node == model->priv->virtual_root ||
+	       node_has_parent (node, model->priv->virtual_root);
+}
+
+/* Compute the rows of the children of dir up to the one at index */
+static void
+model_update_rows (LapizFileBrowserStore * model,
+		   FileBrowserNodeDir * dir,
+		   guint index)
+{
+	FileBrowserNode *child;
+	gboolean in_tree;
+	guint row;
+	guint i;
+
+	if (dir->rows_stamp != model->priv->rows_stamp) {
+		dir->rows_stamp = model->priv->rows_stamp;
+		dir->rows_valid = 0;
+	}
+
+	if (index < dir->rows_valid || dir->rows_valid >= dir->children->len)
+		return;
+
+	in_tree = model_dir_in_tree (model, dir);
+	row = 0;
+
+	if (dir->rows_valid > 0) {
+		child = NODE_CHILD (dir, dir->rows_valid - 1);
+		row = child->row + model_node_is_row (model, child, in_tree);
+	}
+
+	for (i = dir->rows_valid; i <= index && i < dir->children->len; ++i) {
+		child = NODE_CHILD (dir, i);
+
+		child->row = row;
+
+		if (model_node_is_row (model, child, in_tree))
+			++row;
+	}
+
+	dir->rows_valid = i;
+}
+
+/* The node was inserted, deleted, shown or hidden: the rows of the
+ * siblings after it have to be computed again */
+static void
+node_invalidate_rows (FileBrowserNode * node)
+{
+	FileBrowserNodeDir *dir;
+
+	if (node->parent == NULL)
+		return;
+
+	dir = FILE_BROWSER_NODE_DIR (node->parent);
+	dir->rows_valid = MIN (dir->rows_valid, node->index + 1);
+}
+
+static void
+node_set_inserted (FileBrowserNode * node, gboolean inserted)
+{
+	node->inserted = inserted;
+	node_invalidate_rows (node);
+}
+
+/* Update the index of the children from index on, after they moved */
+static void
+dir_renumber_children (FileBrowserNodeDir * dir, guint index)
+{
+	guint i;
+
+	for (i = index; i < dir->children->len; ++i)
+		NODE_CHILD (dir, i)->index = i;
+
+	dir->rows_valid = MIN (dir->rows_valid, index);
+}
+
+static void
+dir_insert_child (FileBrowserNodeDir * dir,
+		  FileBrowserNode * child,
+		  guint index)
+{
+	g_ptr_array_insert (dir->children, index, child);
+	dir_renumber_children (dir, index);
+}
+
+static void
+dir_remove_child (FileBrowserNodeDir * dir,
+		  FileBrowserNode * child)
+{
+	guint index = child->index;
+
+	g_return_if_fail (index < dir->children->len &&
+			  NODE_CHILD (dir, index) == child);
+
+	g_ptr_array_remove_index (dir->children, index);
+	dir_renumber_children (dir, index);
+}
+
+static GPtrArray *
+dir_copy_children (FileBrowserNodeDir * dir)
+{
+	GPtrArray *copy;
+	guint i;
+
+	copy = g_ptr_array_sized_new (dir->children->len);
+
+	for (i = 0; i < dir->children->len; ++i)
+		g_ptr_array_add (copy, NODE_CHILD (dir, i));
+
+	return copy;
+}
+
+/* Drops the monitor events not applied yet */
+static void
+dir_cancel_monitor_events (FileBrowserNodeDir * dir)
+{
+	if (dir->monitor_events_id != 0) {
+		g_source_remove (dir->monitor_events_id);
+		dir->monitor_events_id = 0;
+	}
+
+	if (dir->monitor_events != NULL) {
+		g_hash_table_destroy (dir->monitor_events);
+		dir->monitor_events = NULL;
+	}
+
+	if (dir->monitor_cancellable != NULL) {
+		g_cancellable_cancel (dir->monitor_cancellable);
+		g_object_unref (dir->monitor_cancellable);
+		dir->monitor_cancellable = NULL;
+	}
+}
+
+static gint
+model_count_rows (LapizFileBrowserStore * model,
+		  FileBrowserNode * node)
+{
+	FileBrowserNodeDir *dir;
+	FileBrowserNode *last;
+
+	if (!NODE_IS_DIR (node))
+		return 0;
+
+	dir = FILE_BROWSER_NODE_DIR (node);
+
+	if (dir->children->len == 0)
+		return 0;
+
+	model_update_rows (model, dir, dir->children->len - 1);
+	last = NODE_CHILD (dir, dir->children->len - 1);
+
+	return last->row + model_node_is_row (model, last, model_dir_in_tree (model, dir));
+}
+
+static FileBrowserNode *
+model_nth_row (LapizFileBrowserStore * model,
+	       FileBrowserNode * node,
+	       gint n)
+{
+	FileBrowserNodeDir *dir;
+	FileBrowserNode *child;
+	guint lo, hi, mid;
+
+	if (node == NULL || !NODE_IS_DIR (node) || n < 0)
+		return NULL;
+
+	dir = FILE_BROWSER_NODE_DIR (node);
+
+	if (dir->children->len == 0)
+		return NULL;
+
+	model_update_rows (model, dir, dir->children->len - 1);
+
+	/* The nth row is the last child with n rows before it */
+	lo = 0;
+	hi = dir->children->len;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+
+		if (NODE_CHILD (dir, mid)->row > (guint) n)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	if (lo == 0)
+		return NULL;
+
+	child = NODE_CHILD (dir, lo - 1);
+
+	if (child->row == (guint) n &&
+	    model_node_is_row (model, child, model_dir_in_tree (model, dir)))
+		return child;
+
+	return NULL;
+}
+
 /* Interface implementation */
 
 static CtkTreeModelFlags
@@ -553,7 +880,6 @@ lapiz_file_browser_store_get_iter (CtkTreeModel * tree_model,
 	gint * indices, depth, i;
 	FileBrowserNode * node;
 	LapizFileBrowserStore * model;
-	gint num;
 
 	g_assert (LAPIZ_IS_FILE_BROWSER_STORE (tree_model));
 	g_assert (path != NULL);
@@ -564,35 +890,10 @@ lapiz_file_browser_store_get_iter (CtkTreeModel * tree_model,
 	node = model->priv->virtual_root;
 
 	for (i = 0; i < depth; ++i) {
-		GSList * item;
+		node = model_nth_row (model, node, indices[i]);
 
 		if (node == NULL)
 			return FALSE;
-
-		num = 0;
-
-		if (!NODE_IS_DIR (node))
-			return FALSE;
-
-		for (item = FILE_BROWSER_NODE_DIR (node)->children; item; item = item->next) {
-			FileBrowserNode * child;
-
-			child = (FileBrowserNode *) (item->data);
-
-			if (model_node_inserted (model, child)) {
-				if (num == indices[i]) {
-					node = child;
-					break;
-				}
-
-				num++;
-			}
-		}
-
-		if (item == NULL)
-			return FALSE;
-
-		node = (FileBrowserNode *) (item->data);
 	}
 
 	iter->user_data = node;
@@ -607,42 +908,27 @@ lapiz_file_browser_store_get_path_real (LapizFileBrowserStore * model,
 					FileBrowserNode * node)
 {
 	CtkTreePath *path;
-	gint num = 0;
 
 	path = ctk_tree_path_new ();
 
 	while (node != model->priv->virtual_root) {
-		GSList *item;
-
 		if (node->parent == NULL) {
 			ctk_tree_path_free (path);
 			return NULL;
 		}
 
-		num = 0;
-
-		for (item = FILE_BROWSER_NODE_DIR (node->parent)->children; item; item = item->next) {
-			FileBrowserNode *check;
-
-			check = (FileBrowserNode *) (item->data);
-
-			if (model_node_visibility (model, check) && (check == node || check->inserted)) {
-				if (check == node) {
-					ctk_tree_path_prepend_index (path,
-								     num);
-					break;
-				}
-
-				++num;
-			} else if (check == node) {
-				if (NODE_IS_DUMMY (node))
-					g_warning ("Dummy not visible???");
+		if (!model_node_visibility (model, node)) {
+			if (NODE_IS_DUMMY (node))
+				g_warning ("Dummy not visible???");
 
-				ctk_tree_path_free (path);
-				return NULL;
-			}
+			ctk_tree_path_free (path);
+			return NULL;
 		}
 
+		model_update_rows (model, FILE_BROWSER_NODE_DIR (node->parent),
+				   node->index);
+		ctk_tree_path_prepend_index (path, node->row);
+
 		node = node->parent;
 	}
 
@@ -704,8 +990,8 @@ lapiz_file_browser_store_iter_next (CtkTreeModel * tree_model,
 {
 	LapizFileBrowserStore * model;
 	FileBrowserNode * node;
-	GSList * item;
-	GSList * first;
+	FileBrowserNodeDir * dir;
+	guint i;
 
 	g_return_val_if_fail (LAPIZ_IS_FILE_BROWSER_STORE (tree_model),
 			      FALSE);
@@ -718,11 +1004,11 @@ lapiz_file_browser_store_iter_next (CtkTreeModel * tree_model,
 	if (node->parent == NULL)
 		return FALSE;
 
-	first = g_slist_next (g_slist_find (FILE_BROWSER_NODE_DIR (node->parent)->children, node));
+	dir = FILE_BROWSER_NODE_DIR (node->parent);
 
-	for (item = first; item; item = item->next) {
-		if (model_node_inserted (model, (FileBrowserNode *) (item->data))) {
-			iter->user_data = item->data;
+	for (i = node->index + 1; i < dir->children->len; ++i) {
+		if (model_node_inserted (model, NODE_CHILD (dir, i))) {
+			iter->user_data = NODE_CHILD (dir, i);
 			return TRUE;
 		}
 	}
@@ -737,7 +1023,8 @@ lapiz_file_browser_store_iter_children (CtkTreeModel * tree_model,
 {
 	FileBrowserNode * node;
 	LapizFileBrowserStore * model;
-	GSList * item;
+	FileBrowserNodeDir * dir;
+	guint i;
 
 	g_return_val_if_fail (LAPIZ_IS_FILE_BROWSER_STORE (tree_model),
 			      FALSE);
@@ -757,9 +1044,11 @@ lapiz_file_browser_store_iter_children (CtkTreeModel * tree_model,
 	if (!NODE_IS_DIR (node))
 		return FALSE;
 
-	for (item = FILE_BROWSER_NODE_DIR (node)->children; item; item = item->next) {
-		if (model_node_inserted (model, (FileBrowserNode *) (item->data))) {
-			iter->user_data = item->data;
+	dir = FILE_BROWSER_NODE_DIR (node);
+
+	for (i = 0; i < dir->children->len; ++i) {
+		if (model_node_inserted (model, NODE_CHILD (dir, i))) {
+			iter->user_data = NODE_CHILD (dir, i);
 			return TRUE;
 		}
 	}
@@ -771,13 +1060,16 @@ static gboolean
 filter_tree_model_iter_has_child_real (LapizFileBrowserStore * model,
 				       FileBrowserNode * node)
 {
-	GSList *item;
+	FileBrowserNodeDir *dir;
+	guint i;
 
 	if (!NODE_IS_DIR (node))
 		return FALSE;
 
-	for (item = FILE_BROWSER_NODE_DIR (node)->children; item; item = item->next) {
-		if (model_node_inserted (model, (FileBrowserNode *) (item->data)))
+	dir = FILE_BROWSER_NODE_DIR (node);
+
+	for (i = 0; i < dir->children->len; ++i) {
+		if (model_node_inserted (model, NODE_CHILD (dir, i)))
 			return TRUE;
 	}
 
@@ -812,8 +1104,6 @@ lapiz_file_browser_store_iter_n_children (CtkTreeModel * tree_model,
 {
 	FileBrowserNode *node;
 	LapizFileBrowserStore *model;
-	GSList *item;
-	gint num = 0;
 
 	g_return_val_if_fail (LAPIZ_IS_FILE_BROWSER_STORE (tree_model),
 			      FALSE);
@@ -827,14 +1117,7 @@ lapiz_file_browser_store_iter_n_children (CtkTreeModel * tree_model,
 	else
 		node = (FileBrowserNode *) (iter->user_data);
 
-	if (!NODE_IS_DIR (node))
-		return 0;
-
-	for (item = FILE_BROWSER_NODE_DIR (node)->children; item; item = item->next)
-		if (model_node_inserted (model, (FileBrowserNode *) (item->data)))
-			++num;
-
-	return num;
+	return model_count_rows (model, node);
 }
 
 static gboolean
@@ -844,8 +1127,6 @@ lapiz_file_browser_store_iter_nth_child (CtkTreeModel * tree_model,
 {
 	FileBrowserNode *node;
 	LapizFileBrowserStore *model;
-	GSList *item;
-	gint num = 0;
 
 	g_return_val_if_fail (LAPIZ_IS_FILE_BROWSER_STORE (tree_model),
 			      FALSE);
@@ -859,22 +1140,13 @@ lapiz_file_browser_store_iter_nth_child (CtkTreeModel * tree_model,
 	else
 		node = (FileBrowserNode *) (parent->user_data);
 
-	if (!NODE_IS_DIR (node))
-		return FALSE;
-
-	for (item = FILE_BROWSER_NODE_DIR (node)->children; item;
-	     item = item->next) {
-		if (model_node_inserted (model, (FileBrowserNode *) (item->data))) {
-			if (num == n) {
-				iter->user_data = item->data;
-				return TRUE;
-			}
+	node = model_nth_row (model, node, n);
 
-			++num;
-		}
-	}
+	if (node == NULL)
+		return FALSE;
 
-	return FALSE;
+	iter->user_data = node;
+	return TRUE;
 }
 
 static gboolean
@@ -909,7 +1181,7 @@ lapiz_file_browser_store_row_inserted (CtkTreeModel *tree_model G_GNUC_UNUSED,
 {
 	FileBrowserNode * node = (FileBrowserNode *)(iter->user_data);
 
-	node->inserted = TRUE;
+	node_set_inserted (node, TRUE);
 }
 
 static gboolean
@@ -996,6 +1268,7 @@ model_node_update_visibility (LapizFileBrowserStore * model,
 			      FileBrowserNode * node)
 {
 	CtkTreeIter iter;
+	guint flags = node->flags;
 
 	node->flags &= ~LAPIZ_FILE_BROWSER_STORE_FLAG_IS_FILTERED;
 
@@ -1014,29 +1287,42 @@ model_node_update_visibility (LapizFileBrowserStore * model,
 			node->flags |=
 			    LAPIZ_FILE_BROWSER_STORE_FLAG_IS_FILTERED;
 	}
+
+	if (FILE_IS_FILTERED (flags) != NODE_IS_FILTERED (node))
+		node_invalidate_rows (node);
 }
 
+/* Directories first, hidden files last, then by name. This does not
+ * touch the model, so the enumeration thread sorts with it as well */
 static gint
-collate_nodes (FileBrowserNode * node1, FileBrowserNode * node2)
+compare_files (guint flags1, gchar const * key1,
+	       guint flags2, gchar const * key2)
 {
-	if (node1->name == NULL)
-		return -1;
-	else if (node2->name == NULL)
-		return 1;
-	else {
-		gchar *k1, *k2;
-		gint result;
+	gint f1;
+	gint f2;
 
-		k1 = g_utf8_collate_key_for_filename (node1->name, -1);
-		k2 = g_utf8_collate_key_for_filename (node2->name, -1);
+	f1 = FILE_IS_DIR (flags1);
+	f2 = FILE_IS_DIR (flags2);
 
-		result = strcmp (k1, k2);
+	if (f1 != f2)
+	{
+		return f1 ? -1 : 1;
+	}
 
-		g_free (k1);
-		g_free (k2);
+	f1 = FILE_IS_HIDDEN (flags1);
+	f2 = FILE_IS_HIDDEN (flags2);
 
-		return result;
+	if (f1 != f2)
+	{
+		return f2 ? -1 : 1;
 	}
+
+	if (key1 == NULL)
+		return -1;
+	else if (key2 == NULL)
+		return 1;
+	else
+		return strcmp (key1, key2);
 }
 
 static gint
@@ -1057,32 +1343,38 @@ model_sort_default (FileBrowserNode * node1, FileBrowserNode * node2)
 		return f1 ? -1 : 1;
 	}
 
-	f1 = NODE_IS_DIR (node1);
-	f2 = NODE_IS_DIR (node2);
-
-	if (f1 != f2)
-	{
-		return f1 ? -1 : 1;
-	}
+	return compare_files (node1->flags, node1->collate_key,
+			      node2->flags, node2->collate_key);
+}
 
-	f1 = NODE_IS_HIDDEN (node1);
-	f2 = NODE_IS_HIDDEN (node2);
+static gint
+model_compare_children (gconstpointer a,
+			gconstpointer b,
+			gpointer      user_data)
+{
+	LapizFileBrowserStore *model = user_data;
 
-	if (f1 != f2)
-	{
-		return f2 ? -1 : 1;
-	}
+	return model->priv->sort_func (*(FileBrowserNode **) a,
+				       *(FileBrowserNode **) b);
+}
 
-	return collate_nodes (node1, node2);
+static void
+model_sort_children (LapizFileBrowserStore * model,
+		     FileBrowserNodeDir * dir)
+{
+	g_ptr_array_sort_with_data (dir->children,
+				    model_compare_children,
+				    model);
+	dir_renumber_children (dir, 0);
 }
 
 static void
 model_resort_node (LapizFileBrowserStore * model, FileBrowserNode * node)
 {
 	FileBrowserNodeDir *dir;
-	GSList *item;
 	FileBrowserNode *child;
 	gint pos = 0;
+	guint i;
 	CtkTreeIter iter;
 	CtkTreePath *path;
 	gint *neworder;
@@ -1091,27 +1383,23 @@ model_resort_node (LapizFileBrowserStore * model, FileBrowserNode * node)
 
 	if (!model_node_visibility (model, node->parent)) {
 		/* Just sort the children of the parent */
-		dir->children = g_slist_sort (dir->children,
-					      (GCompareFunc) (model->priv->
-							      sort_func));
+		model_sort_children (model, dir);
 	} else {
 		/* Store current positions */
-		for (item = dir->children; item; item = item->next) {
-			child = (FileBrowserNode *) (item->data);
+		for (i = 0; i < dir->children->len; ++i) {
+			child = NODE_CHILD (dir, i);
 
 			if (model_node_visibility (model, child))
 				child->pos = pos++;
 		}
 
-		dir->children = g_slist_sort (dir->children,
-					      (GCompareFunc) (model->priv->
-							      sort_func));
+		model_sort_children (model, dir);
 		neworder = g_new (gint, pos);
 		pos = 0;
 
 		/* Store the new positions */
-		for (item = dir->children; item; item = item->next) {
-			child = (FileBrowserNode *) (item->data);
+		for (i = 0; i < dir->children->len; ++i) {
+			child = NODE_CHILD (dir, i);
 
 			if (model_node_visibility (model, child))
 				neworder[pos++] = child->pos;
@@ -1197,7 +1485,7 @@ model_refilter_node (LapizFileBrowserStore * model,
 	gboolean old_visible;
 	gboolean new_visible;
 	FileBrowserNodeDir *dir;
-	GSList *item;
+	guint i;
 	CtkTreeIter iter;
 	CtkTreePath *tmppath = NULL;
 	gboolean in_tree;
@@ -1227,9 +1515,9 @@ model_refilter_node (LapizFileBrowserStore * model,
 
 		dir = FILE_BROWSER_NODE_DIR (node);
 
-		for (item = dir->children; item; item = item->next) {
+		for (i = 0; i < dir->children->len; ++i) {
 			model_refilter_node (model,
-					     (FileBrowserNode *) (item->data),
+					     NODE_CHILD (dir, i),
 					     path);
 		}
 
@@ -1242,7 +1530,7 @@ model_refilter_node (LapizFileBrowserStore * model,
 
 		if (old_visible != new_visible) {
 			if (old_visible) {
-				node->inserted = FALSE;
+				node_set_inserted (node, FALSE);
 				row_deleted (model, *path);
 			} else {
 				iter.user_data = node;
@@ -1270,11 +1558,14 @@ static void
 file_browser_node_set_name (FileBrowserNode * node)
 {
 	g_free (node->name);
+	g_free (node->collate_key);
 
 	if (node->file) {
 		node->name = lapiz_file_browser_utils_file_basename (node->file);
+		node->collate_key = g_utf8_collate_key_for_filename (node->name, -1);
 	} else {
 		node->name = NULL;
+		node->collate_key = NULL;
 	}
 }
 
@@ -1310,6 +1601,7 @@ file_browser_node_dir_new (LapizFileBrowserStore * model,
 
 	node->flags |= LAPIZ_FILE_BROWSER_STORE_FLAG_IS_DIRECTORY;
 
+	FILE_BROWSER_NODE_DIR (node)->children = g_ptr_array_new ();
 	FILE_BROWSER_NODE_DIR (node)->model = model;
 
 	return node;
@@ -1319,20 +1611,20 @@ static void
 file_browser_node_free_children (LapizFileBrowserStore * model,
 				 FileBrowserNode * node)
 {
-	GSList *item;
+	FileBrowserNodeDir *dir;
+	guint i;
 
 	if (node == NULL)
 		return;
 
 	if (NODE_IS_DIR (node)) {
-		for (item = FILE_BROWSER_NODE_DIR (node)->children; item;
-		     item = item->next)
-			file_browser_node_free (model,
-						(FileBrowserNode *) (item->
-								     data));
+		dir = FILE_BROWSER_NODE_DIR (node);
 
-		g_slist_free (FILE_BROWSER_NODE_DIR (node)->children);
-		FILE_BROWSER_NODE_DIR (node)->children = NULL;
+		for (i = 0; i < dir->children->len; ++i)
+			file_browser_node_free (model, NODE_CHILD (dir, i));
+
+		g_ptr_array_set_size (dir->children, 0);
+		dir->rows_valid = 0;
 
 		/* This node is no longer loaded */
 		node->flags &= ~LAPIZ_FILE_BROWSER_STORE_FLAG_LOADED;
@@ -1362,11 +1654,14 @@ file_browser_node_free (LapizFileBrowserStore * model,
 		}
 
 		file_browser_node_free_children (model, node);
+		g_ptr_array_unref (dir->children);
 
 		if (dir->monitor) {
 			g_file_monitor_cancel (dir->monitor);
 			g_object_unref (dir->monitor);
 		}
+
+		dir_cancel_monitor_events (dir);
 	}
 
 	if (node->file)
@@ -1375,6 +1670,7 @@ file_browser_node_free (LapizFileBrowserStore * model,
 		g_signal_emit (model, model_signals[UNLOAD], 0, uri);
 
 		g_free (uri);
+		model_unindex_node (model, node);
 		g_object_unref (node->file);
 	}
 
@@ -1385,6 +1681,7 @@ file_browser_node_free (LapizFileBrowserStore * model,
 		g_object_unref (node->emblem);
 
 	g_free (node->name);
+	g_free (node->collate_key);
 
 	if (NODE_IS_DIR (node))
 		g_slice_free (FileBrowserNodeDir, (FileBrowserNodeDir *)node);
@@ -1396,7 +1693,6 @@ file_browser_node_free (LapizFileBrowserStore * model,
  * model_remove_node_children:
  * @model: the #LapizFileBrowserStore
  * @node: the FileBrowserNode to remove
- * @path: the path of the node, or NULL to let the path be calculated
  * @free_nodes: whether to also remove the nodes from memory
  *
  * Removes all the children of node from the model. This function is used
@@ -1406,20 +1702,19 @@ file_browser_node_free (LapizFileBrowserStore * model,
 static void
 model_remove_node_children (LapizFileBrowserStore * model,
 			    FileBrowserNode * node,
-			    CtkTreePath * path,
 			    gboolean free_nodes)
 {
 	FileBrowserNodeDir *dir;
-	CtkTreePath *path_child;
-	GSList *list;
-	GSList *item;
+	GPtrArray *children;
+	guint first = 0;
+	guint i;
 
 	if (node == NULL || !NODE_IS_DIR (node))
 		return;
 
 	dir = FILE_BROWSER_NODE_DIR (node);
 
-	if (dir->children == NULL)
+	if (dir->children->len == 0)
 		return;
 
 	if (!model_node_visibility (model, node)) {
@@ -1431,23 +1726,23 @@ model_remove_node_children (LapizFileBrowserStore * model,
 		return;
 	}
 
-	if (path == NULL)
-		path_child =
-		    lapiz_file_browser_store_get_path_real (model, node);
-	else
-		path_child = ctk_tree_path_copy (path);
-
-	ctk_tree_path_down (path_child);
+	children = dir_copy_children (dir);
 
-	list = g_slist_copy (dir->children);
+	/* The dummy goes first as it comes first, then the other children
+	 * are removed from the last one: nothing has to move in the array and
+	 * the rows before the removed child stay valid */
+	if (NODE_IS_DUMMY (NODE_CHILD (dir, 0))) {
+		model_remove_node (model, g_ptr_array_index (children, 0),
+				   NULL, free_nodes);
+		first = 1;
+	}
 
-	for (item = list; item; item = item->next) {
-		model_remove_node (model, (FileBrowserNode *) (item->data),
-				   path_child, free_nodes);
+	for (i = children->len; i > first; --i) {
+		model_remove_node (model, g_ptr_array_index (children, i - 1),
+				   NULL, free_nodes);
 	}
 
-	g_slist_free (list);
-	ctk_tree_path_free (path_child);
+	g_ptr_array_unref (children);
 }
 
 /**
@@ -1471,19 +1766,19 @@ model_remove_node (LapizFileBrowserStore * model,
 	gboolean free_path = FALSE;
 	FileBrowserNode *parent;
 
-	if (path == NULL) {
+	if (path == NULL && model_node_visibility (model, node)) {
 		path =
 		    lapiz_file_browser_store_get_path_real (model, node);
 		free_path = TRUE;
 	}
 
-	model_remove_node_children (model, node, path, free_nodes);
+	model_remove_node_children (model, node, free_nodes);
 
 	/* Only delete if the node is visible in the tree (but only when it's
 	   not the virtual root) */
 	if (model_node_visibility (model, node) && node != model->priv->virtual_root)
 	{
-		node->inserted = FALSE;
+		node_set_inserted (node, FALSE);
 		row_deleted (model, path);
 	}
 
@@ -1495,10 +1790,7 @@ model_remove_node (LapizFileBrowserStore * model,
 	if (free_nodes) {
 		/* Remove the node from the parents children list */
 		if (parent)
-			FILE_BROWSER_NODE_DIR (node->parent)->children =
-			    g_slist_remove (FILE_BROWSER_NODE_DIR
-					    (node->parent)->children,
-					    node);
+			dir_remove_child (FILE_BROWSER_NODE_DIR (parent), node);
 	}
 
 	/* If this is the virtual root, than set the parent as the virtual root */
@@ -1513,38 +1805,102 @@ model_remove_node (LapizFileBrowserStore * model,
 }
 
 /**
- * model_clear:
+ * model_remove_nodes:
  * @model: the #LapizFileBrowserStore
- * @free_nodes: whether to also remove the nodes from memory
+ * @parent: the parent of the nodes
+ * @nodes: children of @parent, sorted, none of them being or containing
+ * the virtual root
  *
- * Removes all nodes from the model. This function is used
- * to remove all the nodes from the _model_. Don't use it to just free the
- * nodes in the model.
+ * Removes the nodes and all their children from the model and frees them,
+ * like model_remove_node does for each of them, but only goes through the
+ * children of @parent once.
  **/
 static void
-model_clear (LapizFileBrowserStore * model, gboolean free_nodes)
+model_remove_nodes (LapizFileBrowserStore * model,
+		    FileBrowserNode * parent,
+		    GPtrArray * nodes)
+{
+	FileBrowserNodeDir *dir = FILE_BROWSER_NODE_DIR (parent);
+	FileBrowserNode *node;
+	CtkTreePath *path;
+	guint first;
+	guint i;
+	guint j;
+	guint k;
+
+	if (nodes->len == 0)
+		return;
+
+	/* From the last one, so that the rows before it stay valid */
+	for (i = nodes->len; i > 0; --i) {
+		node = g_ptr_array_index (nodes, i - 1);
+		path = NULL;
+
+		if (model_node_visibility (model, node))
+			path = lapiz_file_browser_store_get_path_real (model, node);
+
+		model_remove_node_children (model, node, TRUE);
+
+		if (path != NULL) {
+			node_set_inserted (node, FALSE);
+			row_deleted (model, path);
+			ctk_tree_path_free (path);
+		}
+	}
+
+	/* Take them out of the children all at once */
+	first = ((FileBrowserNode *) g_ptr_array_index (nodes, 0))->index;
+
+	for (i = first, j = first, k = 0; i < dir->children->len; ++i) {
+		node = NODE_CHILD (dir, i);
+
+		if (k < nodes->len && node == g_ptr_array_index (nodes, k))
+			++k;
+		else
+			dir->children->pdata[j++] = node;
+	}
+
+	g_ptr_array_set_size (dir->children, j);
+	dir_renumber_children (dir, first);
+
+	for (i = 0; i < nodes->len; ++i)
+		file_browser_node_free (model, g_ptr_array_index (nodes, i));
+
+	if (model_node_visibility (model, parent))
+		model_check_dummy (model, parent);
+}
+
+/**
+ * model_clear:
+ * @model: the #LapizFileBrowserStore
+ * @free_nodes: whether to also remove the nodes from memory
+ *
+ * Removes all nodes from the model. This function is used
+ * to remove all the nodes from the _model_. Don't use it to just free the
+ * nodes in the model.
+ **/
+static void
+model_clear (LapizFileBrowserStore * model, gboolean free_nodes)
 {
 	CtkTreePath *path;
 	FileBrowserNodeDir *dir;
 	FileBrowserNode *dummy;
 
-	path = ctk_tree_path_new ();
-	model_remove_node_children (model, model->priv->virtual_root, path,
+	model_remove_node_children (model, model->priv->virtual_root,
 				    free_nodes);
-	ctk_tree_path_free (path);
 
 	/* Remove the dummy if there is one */
 	if (model->priv->virtual_root) {
 		dir = FILE_BROWSER_NODE_DIR (model->priv->virtual_root);
 
-		if (dir->children != NULL) {
-			dummy = (FileBrowserNode *) (dir->children->data);
+		if (dir->children->len > 0) {
+			dummy = NODE_CHILD (dir, 0);
 
 			if (NODE_IS_DUMMY (dummy)
 			    && model_node_visibility (model, dummy)) {
 				path = ctk_tree_path_new_first ();
 
-				dummy->inserted = FALSE;
+				node_set_inserted (dummy, FALSE);
 				row_deleted (model, path);
 				ctk_tree_path_free (path);
 			}
@@ -1567,7 +1923,7 @@ file_browser_node_unload (LapizFileBrowserStore * model,
 	dir = FILE_BROWSER_NODE_DIR (node);
 
 	if (remove_children)
-		model_remove_node_children (model, node, NULL, TRUE);
+		model_remove_node_children (model, node, TRUE);
 
 	if (dir->cancellable) {
 		g_cancellable_cancel (dir->cancellable);
@@ -1584,6 +1940,8 @@ file_browser_node_unload (LapizFileBrowserStore * model,
 		dir->monitor = NULL;
 	}
 
+	dir_cancel_monitor_events (dir);
+
 	node->flags &= ~LAPIZ_FILE_BROWSER_STORE_FLAG_LOADED;
 }
 
@@ -1696,21 +2054,22 @@ model_check_dummy (LapizFileBrowserStore * model, FileBrowserNode * node)
 
 		dir = FILE_BROWSER_NODE_DIR (node);
 
-		if (dir->children == NULL) {
+		if (dir->children->len == 0) {
 			model_add_dummy_node (model, node);
 			return;
 		}
 
-		dummy = (FileBrowserNode *) (dir->children->data);
+		dummy = NODE_CHILD (dir, 0);
 
 		if (!NODE_IS_DUMMY (dummy)) {
 			dummy = model_create_dummy_node (model, node);
-			dir->children = g_slist_prepend (dir->children, dummy);
+			dir_insert_child (dir, dummy, 0);
 		}
 
 		if (!model_node_visibility (model, node)) {
 			dummy->flags |=
 			    LAPIZ_FILE_BROWSER_STORE_FLAG_IS_HIDDEN;
+			node_invalidate_rows (dummy);
 			return;
 		}
 
@@ -1746,11 +2105,13 @@ model_check_dummy (LapizFileBrowserStore * model, FileBrowserNode * node)
 				dummy->flags |=
 				    LAPIZ_FILE_BROWSER_STORE_FLAG_IS_HIDDEN;
 
-				dummy->inserted = FALSE;
+				node_set_inserted (dummy, FALSE);
 				row_deleted (model, path);
 				ctk_tree_path_free (path);
 			}
 		}
+
+		node_invalidate_rows (dummy);
 	}
 }
 
@@ -1760,17 +2121,28 @@ insert_node_sorted (LapizFileBrowserStore * model,
 		    FileBrowserNode * parent)
 {
 	FileBrowserNodeDir *dir;
+	guint lo, hi, mid;
 
 	dir = FILE_BROWSER_NODE_DIR (parent);
 
+	lo = 0;
+	hi = dir->children->len;
+
 	if (model->priv->sort_func == NULL) {
-		dir->children = g_slist_append (dir->children, child);
+		lo = hi;
 	} else {
-		dir->children =
-		    g_slist_insert_sorted (dir->children, child,
-					   (GCompareFunc) (model->priv->
-							   sort_func));
+		/* Insert before the first child that does not sort before */
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+
+			if (model->priv->sort_func (child, NODE_CHILD (dir, mid)) > 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
 	}
+
+	dir_insert_child (dir, child, lo);
 }
 
 static void
@@ -1779,6 +2151,7 @@ model_add_node (LapizFileBrowserStore * model, FileBrowserNode * child,
 {
 	/* Add child to parents children */
 	insert_node_sorted (model, child, parent);
+	model_index_node (model, child);
 
 	if (model_node_visibility (model, parent) &&
 	    model_node_visibility (model, child)) {
@@ -1797,90 +2170,63 @@ model_add_node (LapizFileBrowserStore * model, FileBrowserNode * child,
 	model_check_dummy (model, child);
 }
 
+/* Takes ownership of sorted_children, which must be sorted already */
 static void
-model_add_nodes_batch (LapizFileBrowserStore * model,
-		       GSList * children,
-		       FileBrowserNode * parent)
+model_add_sorted_nodes (LapizFileBrowserStore * model,
+			GSList * sorted_children,
+			FileBrowserNode * parent)
 {
-	GSList *sorted_children;
 	GSList *child;
-	GSList *prev;
-	GSList *l;
+	GPtrArray *merged;
 	FileBrowserNodeDir *dir;
+	guint i = 0;
 
 	dir = FILE_BROWSER_NODE_DIR (parent);
 
-	sorted_children = g_slist_sort (children, (GCompareFunc) model->priv->sort_func);
-
-	child = sorted_children;
-	l = dir->children;
-	prev = NULL;
-
 	model_check_dummy (model, parent);
 
-	while (child) {
-		FileBrowserNode *node = child->data;
-		CtkTreeIter iter;
-		CtkTreePath *path;
-
-		/* reached the end of the first list, just append the second */
-		if (l == NULL) {
-
-			dir->children = g_slist_concat (dir->children, child);
-
-			for (l = child; l; l = l->next) {
-				if (model_node_visibility (model, parent) &&
-				    model_node_visibility (model, l->data)) {
-					iter.user_data = l->data;
-					path = lapiz_file_browser_store_get_path_real (model, l->data);
-
-					// Emit row inserted
-					row_inserted (model, &path, &iter);
-					ctk_tree_path_free (path);
-				}
-
-				model_check_dummy (model, l->data);
-			}
-
-			break;
-		}
-
-		if (model->priv->sort_func (l->data, node) > 0) {
-			GSList *next_child;
+	/* Merge the new nodes in the children all at once, new nodes
+	 * going after the existing ones that compare equal */
+	merged = g_ptr_array_sized_new (dir->children->len +
+					g_slist_length (sorted_children));
 
-			if (prev == NULL) {
-				/* prepend to the list */
-				dir->children = g_slist_prepend (dir->children, child);
-			} else {
-				prev->next = child;
-			}
+	for (child = sorted_children; child; child = child->next) {
+		while (i < dir->children->len &&
+		       model->priv->sort_func (NODE_CHILD (dir, i), child->data) <= 0)
+			g_ptr_array_add (merged, NODE_CHILD (dir, i++));
 
-			next_child = child->next;
-			prev = child;
-			child->next = l;
-			child = next_child;
+		g_ptr_array_add (merged, child->data);
+		model_index_node (model, child->data);
+	}
 
-			if (model_node_visibility (model, parent) &&
-			    model_node_visibility (model, node)) {
-				iter.user_data = node;
-				path = lapiz_file_browser_store_get_path_real (model, node);
+	for (; i < dir->children->len; ++i)
+		g_ptr_array_add (merged, NODE_CHILD (dir, i));
 
-				// Emit row inserted
-				row_inserted (model, &path, &iter);
-				ctk_tree_path_free (path);
-			}
+	g_ptr_array_unref (dir->children);
+	dir->children = merged;
+	dir_renumber_children (dir, 0);
 
-			model_check_dummy (model, node);
+	/* The rows are inserted in order, so the rows before each of them
+	 * only have to be computed once */
+	for (child = sorted_children; child; child = child->next) {
+		FileBrowserNode *node = child->data;
+		CtkTreeIter iter;
+		CtkTreePath *path;
 
-			/* try again at the same l position with the
-			 * next child */
-		} else {
+		if (model_node_visibility (model, parent) &&
+		    model_node_visibility (model, node)) {
+			iter.user_data = node;
+			path = lapiz_file_browser_store_get_path_real (model, node);
 
-			/* Move to the next item in the list */
-			prev = l;
-			l = l->next;
+			// Emit row inserted
+			row_inserted (model, &path, &iter);
+			ctk_tree_path_free (path);
 		}
+
+		model_check_dummy (model, node);
 	}
+
+	g_slist_free (sorted_children);
 }
 
 static gchar const *
@@ -1899,13 +2245,37 @@ backup_content_type (GFileInfo * info)
 	return content;
 }
 
+/* Only uses thread safe GIO calls, as the enumeration thread calls it */
+static guint
+file_info_get_flags (GFileInfo * info)
+{
+	gchar const * content;
+	guint flags = 0;
+
+	if (g_file_info_get_is_hidden (info) || g_file_info_get_is_backup (info))
+		flags |= LAPIZ_FILE_BROWSER_STORE_FLAG_IS_HIDDEN;
+
+	if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY)
+		flags |= LAPIZ_FILE_BROWSER_STORE_FLAG_IS_DIRECTORY;
+	else {
+		if (!(content = backup_content_type (info)))
+			content = g_file_info_get_content_type (info);
+
+		if (!content ||
+		    g_content_type_is_unknown (content) ||
+		    g_content_type_is_a (content, "text/plain"))
+			flags |= LAPIZ_FILE_BROWSER_STORE_FLAG_IS_TEXT;
+	}
+
+	return flags;
+}
+
 static void
 file_browser_node_set_from_info (LapizFileBrowserStore * model,
 				 FileBrowserNode * node,
 				 GFileInfo * info,
 				 gboolean isadded)
 {
-	gchar const * content;
 	gboolean free_info = FALSE;
 	CtkTreePath * path;
 	gchar * uri;
@@ -1932,21 +2302,7 @@ file_browser_node_set_from_info (LapizFileBrowserStore * model,
 		free_info = TRUE;
 	}
 
-	if (g_file_info_get_is_hidden (info) || g_file_info_get_is_backup (info))
-		node->flags |= LAPIZ_FILE_BROWSER_STORE_FLAG_IS_HIDDEN;
-
-	if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY)
-		node->flags |= LAPIZ_FILE_BROWSER_STORE_FLAG_IS_DIRECTORY;
-	else {
-		if (!(content = backup_content_type (info)))
-			content = g_file_info_get_content_type (info);
-
-		if (!content ||
-		    g_content_type_is_unknown (content) ||
-		    g_content_type_is_a (content, "text/plain"))
-			node->flags |= LAPIZ_FILE_BROWSER_STORE_FLAG_IS_TEXT;
-	}
-
+	node->flags |= file_info_get_flags (info);
 	model_recomposite_icon_real (model, node, info);
 
 	if (free_info)
@@ -1963,24 +2319,6 @@ file_browser_node_set_from_info (LapizFileBrowserStore * model,
 	}
 }
 
-static FileBrowserNode *
-node_list_contains_file (GSList *children, GFile * file)
-{
-	GSList *item;
-
-	for (item = children; item; item = item->next) {
-		FileBrowserNode *node;
-
-		node = (FileBrowserNode *) (item->data);
-
-		if (node->file != NULL
-		    && g_file_equal (node->file, file))
-			return node;
-	}
-
-	return NULL;
-}
-
 static FileBrowserNode *
 model_add_node_from_file (LapizFileBrowserStore * model,
 			  FileBrowserNode * parent,
@@ -1991,7 +2329,7 @@ model_add_node_from_file (LapizFileBrowserStore * model,
 	gboolean free_info = FALSE;
 	GError * error = NULL;
 
-	if ((node = node_list_contains_file (FILE_BROWSER_NODE_DIR (parent)->children, file)) == NULL) {
+	if ((node = model_find_child (model, parent, file)) == NULL) {
 		if (info == NULL) {
 			info = g_file_query_info (file,
 						  STANDARD_ATTRIBUTE_TYPES,
@@ -2023,65 +2361,118 @@ model_add_node_from_file (LapizFileBrowserStore * model,
 	return node;
 }
 
-/* We pass in a copy of the list of parent->children so that we do
- * not have to check if a file already exists among the ones we just
- * added */
 static void
-model_add_nodes_from_files (LapizFileBrowserStore * model,
-			    FileBrowserNode * parent,
-			    GSList * original_children,
-			    GList * files)
+dir_entry_free (DirEntry * entry)
 {
-	GList *item;
-	GSList *nodes = NULL;
+	g_object_unref (entry->file);
+	g_clear_object (&entry->info);
+	g_free (entry->name);
+	g_free (entry->collate_key);
+	g_slice_free (DirEntry, entry);
+}
 
-	for (item = files; item; item = item->next) {
-		GFileInfo *info = G_FILE_INFO (item->data);
-		GFileType type;
-		gchar const * name;
-		GFile * file;
-		FileBrowserNode *node;
+static gboolean
+file_info_is_shown (GFileInfo * info)
+{
+	GFileType type;
+	gchar const * name;
 
-		type = g_file_info_get_file_type (info);
+	type = g_file_info_get_file_type (info);
 
-		/* Skip all non regular, non directory files */
-		if (type != G_FILE_TYPE_REGULAR &&
-		    type != G_FILE_TYPE_DIRECTORY &&
-		    type != G_FILE_TYPE_SYMBOLIC_LINK) {
-			g_object_unref (info);
-			continue;
-		}
+	/* Skip all non regular, non directory files */
+	if (type != G_FILE_TYPE_REGULAR &&
+	    type != G_FILE_TYPE_DIRECTORY &&
+	    type != G_FILE_TYPE_SYMBOLIC_LINK)
+		return FALSE;
 
-		name = g_file_info_get_name (info);
+	name = g_file_info_get_name (info);
 
-		/* Skip '.' and '..' directories */
-		if (type == G_FILE_TYPE_DIRECTORY &&
-		    (strcmp (name, ".") == 0 ||
-		     strcmp (name, "..") == 0)) {
-			continue;
-		}
+	/* Skip '.' and '..' directories */
+	return type != G_FILE_TYPE_DIRECTORY ||
+	       (strcmp (name, ".") != 0 && strcmp (name, "..") != 0);
+}
 
-		file = g_file_get_child (parent->file, name);
+/* Called in the enumeration thread, returns NULL for the files which are
+ * not shown at all */
+static DirEntry *
+dir_entry_new (GFile * parent, GFileInfo * info)
+{
+	DirEntry *entry;
+	gchar const * display_name;
 
-		if ((node = node_list_contains_file (original_children, file)) == NULL) {
+	if (!file_info_is_shown (info))
+		return NULL;
 
-			if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY) {
-				node = file_browser_node_dir_new (model, file, parent);
-			} else {
-				node = file_browser_node_new (file, parent);
-			}
+	entry = g_slice_new (DirEntry);
+	entry->file = g_file_get_child (parent, g_file_info_get_name (info));
+	entry->info = g_object_ref (info);
 
-			file_browser_node_set_from_info (model, node, info, FALSE);
+	/* This is what lapiz_file_browser_utils_file_basename would query
+	 * again for local files */
+	display_name = g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME);
 
-			nodes = g_slist_prepend (nodes, node);
-		}
+	if (display_name != NULL && g_file_has_uri_scheme (entry->file, "file"))
+		entry->name = g_strdup (display_name);
+	else
+		entry->name = lapiz_file_browser_utils_file_basename (entry->file);
 
-		g_object_unref (file);
-		g_object_unref (info);
-	}
+	entry->collate_key = g_utf8_collate_key_for_filename (entry->name, -1);
+	entry->flags = file_info_get_flags (info);
 
-	if (nodes)
-		model_add_nodes_batch (model, nodes, parent);
+	return entry;
+}
+
+static DirEntry *
+dir_entry_new_removed (GFile * parent, gchar const * name)
+{
+	DirEntry *entry;
+
+	entry = g_slice_new0 (DirEntry);
+	entry->file = g_file_get_child (parent, name);
+
+	return entry;
+}
+
+static gint
+dir_entry_compare (gconstpointer a, gconstpointer b)
+{
+	DirEntry const *entry1 = *(DirEntry * const *) a;
+	DirEntry const *entry2 = *(DirEntry * const *) b;
+
+	return compare_files (entry1->flags, entry1->collate_key,
+			      entry2->flags, entry2->collate_key);
+}
+
+/* Creates the node for entry, unless parent has it already. The node is
+ * left for the caller to add */
+static FileBrowserNode *
+model_add_node_from_entry (LapizFileBrowserStore * model,
+			   FileBrowserNode * parent,
+			   DirEntry * entry)
+{
+	FileBrowserNode *node;
+
+	if (model_find_child (model, parent, entry->file) != NULL)
+		return NULL;
+
+	if (FILE_IS_DIR (entry->flags))
+		node = file_browser_node_dir_new (model, NULL, parent);
+	else
+		node = file_browser_node_new (NULL, parent);
+
+	/* The name was computed by the thread already */
+	node->file = g_object_ref (entry->file);
+	node->name = entry->name;
+	node->collate_key = entry->collate_key;
+	entry->name = NULL;
+	entry->collate_key = NULL;
+
+	/* The icon is not, the icon theme being for the main thread only */
+	node->flags |= entry->flags;
+	model_recomposite_icon_real (model, node, entry->info);
+	model_node_update_visibility (model, node);
+
+	return node;
 }
 
 static FileBrowserNode *
@@ -2092,7 +2483,7 @@ model_add_node_from_dir (LapizFileBrowserStore * model,
 	FileBrowserNode *node;
 
 	/* Check if it already exists */
-	if ((node = node_list_contains_file (FILE_BROWSER_NODE_DIR (parent)->children, file)) == NULL) {
+	if ((node = model_find_child (model, parent, file)) == NULL) {
 		node = file_browser_node_dir_new (model, file, parent);
 		file_browser_node_set_from_info (model, node, NULL, FALSE);
 
@@ -2110,6 +2501,206 @@ model_add_node_from_dir (LapizFileBrowserStore * model,
 	return node;
 }
 
+static void
+monitor_query_free (MonitorQuery * query)
+{
+	g_object_unref (query->dir);
+	g_ptr_array_unref (query->files);
+	g_slice_free (MonitorQuery, query);
+}
+
+static void
+query_created_files_thread (GTask        *task,
+			    gpointer      source_object G_GNUC_UNUSED,
+			    gpointer      task_data,
+			    GCancellable *cancellable)
+{
+	MonitorQuery *query = task_data;
+	GPtrArray *entries;
+	guint i;
+
+	entries = g_ptr_array_new_with_free_func ((GDestroyNotify) dir_entry_free);
+
+	for (i = 0; i < query->files->len; ++i) {
+		GFileInfo *info;
+		DirEntry *entry;
+
+		info = g_file_query_info (g_ptr_array_index (query->files, i),
+					  STANDARD_ATTRIBUTE_TYPES,
+					  G_FILE_QUERY_INFO_NONE,
+					  cancellable,
+					  NULL);
+
+		/* It is gone already */
+		if (info == NULL)
+			continue;
+
+		entry = dir_entry_new (query->dir, info);
+		g_object_unref (info);
+
+		if (entry != NULL)
+			g_ptr_array_add (entries, entry);
+	}
+
+	g_ptr_array_sort (entries, dir_entry_compare);
+	g_task_return_pointer (task, entries, (GDestroyNotify) g_ptr_array_unref);
+}
+
+static gboolean model_apply_monitor_events (FileBrowserNodeDir * dir);
+
+static void
+query_created_files_cb (GObject      *source_object G_GNUC_UNUSED,
+			GAsyncResult *result,
+			gpointer      user_data)
+{
+	FileBrowserNodeDir *dir = user_data;
+	FileBrowserNode *parent = (FileBrowserNode *)dir;
+	GPtrArray *entries;
+	GSList *nodes = NULL;
+	guint i;
+
+	entries = g_task_propagate_pointer (G_TASK (result), NULL);
+
+	/* Simply return if we were cancelled, the directory may be gone */
+	if (entries == NULL)
+		return;
+
+	g_clear_object (&dir->monitor_cancellable);
+
+	/* Files may have been added otherwise in the meantime */
+	for (i = 0; i < entries->len; ++i) {
+		FileBrowserNode *node;
+
+		node = model_add_node_from_entry (dir->model,
+						  parent,
+						  g_ptr_array_index (entries, i));
+
+		if (node != NULL)
+			nodes = g_slist_prepend (nodes, node);
+	}
+
+	g_ptr_array_unref (entries);
+
+	if (nodes)
+		model_add_sorted_nodes (dir->model, g_slist_reverse (nodes), parent);
+
+	/* Apply the events which came in while querying */
+	if (dir->monitor_events != NULL && dir->monitor_events_id == 0)
+		dir->monitor_events_id = g_timeout_add (MONITOR_EVENTS_DELAY,
+							(GSourceFunc) model_apply_monitor_events,
+							dir);
+}
+
+static gint
+compare_node_indexes (gconstpointer a, gconstpointer b)
+{
+	FileBrowserNode const *node1 = *(FileBrowserNode * const *) a;
+	FileBrowserNode const *node2 = *(FileBrowserNode * const *) b;
+
+	if (node1->index != node2->index)
+		return node1->index < node2->index ? -1 : 1;
+
+	return 0;
+}
+
+/* Removes the given children of parent at once, in any order */
+static void
+model_remove_children (LapizFileBrowserStore * model,
+		       FileBrowserNode * parent,
+		       GPtrArray * nodes)
+{
+	FileBrowserNode *virtual_root = model->priv->virtual_root;
+	FileBrowserNode *removed_root = NULL;
+	guint i;
+
+	/* Removing the virtual root moves it, which is done on its own */
+	for (i = 0; i < nodes->len; ++i) {
+		FileBrowserNode *node = g_ptr_array_index (nodes, i);
+
+		if (node == virtual_root || node_has_parent (virtual_root, node)) {
+			removed_root = node;
+			g_ptr_array_remove_index_fast (nodes, i);
+			break;
+		}
+	}
+
+	g_ptr_array_sort (nodes, compare_node_indexes);
+	model_remove_nodes (model, parent, nodes);
+
+	if (removed_root != NULL)
+		model_remove_node (model, removed_root, NULL, TRUE);
+}
+
+/* Applies the batch of monitor events of dir as a diff against its
+ * children, looked up in the index: the deleted nodes are removed at once,
+ * then the created files are queried in a thread and added at once */
+static gboolean
+model_apply_monitor_events (FileBrowserNodeDir * dir)
+{
+	FileBrowserNode *parent = (FileBrowserNode *)dir;
+	GHashTable *events;
+	GHashTableIter iter;
+	GPtrArray *removed;
+	MonitorQuery *query;
+	GTask *task;
+	gpointer key;
+	gpointer value;
+
+	dir->monitor_events_id = 0;
+
+	/* Keep the events until the files created by the previous batch
+	 * are in, query_created_files_cb applies them then */
+	if (dir->monitor_cancellable != NULL)
+		return G_SOURCE_REMOVE;
+
+	events = dir->monitor_events;
+	dir->monitor_events = NULL;
+
+	removed = g_ptr_array_new ();
+
+	query = g_slice_new (MonitorQuery);
+	query->dir = g_object_ref (parent->file);
+	query->files = g_ptr_array_new_with_free_func (g_object_unref);
+
+	g_hash_table_iter_init (&iter, events);
+
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		FileBrowserNode *node;
+		gint event;
+
+		event = GPOINTER_TO_INT (value);
+		node = model_find_child (dir->model, parent, key);
+
+		/* A replaced file may not even be a directory any more, so its
+		 * node is dropped and the new file queried from scratch */
+		if (node != NULL && event != G_FILE_MONITOR_EVENT_CREATED)
+			g_ptr_array_add (removed, node);
+
+		if ((node == NULL && event == G_FILE_MONITOR_EVENT_CREATED) ||
+		    event == MONITOR_EVENT_REPLACED)
+			g_ptr_array_add (query->files, g_object_ref (key));
+	}
+
+	g_hash_table_destroy (events);
+
+	model_remove_children (dir->model, parent, removed);
+	g_ptr_array_unref (removed);
+
+	if (query->files->len == 0) {
+		monitor_query_free (query);
+		return G_SOURCE_REMOVE;
+	}
+
+	dir->monitor_cancellable = g_cancellable_new ();
+
+	task = g_task_new (NULL, dir->monitor_cancellable, query_created_files_cb, dir);
+	g_task_set_task_data (task, query, (GDestroyNotify) monitor_query_free);
+	g_task_run_in_thread (task, query_created_files_thread);
+	g_object_unref (task);
+
+	return G_SOURCE_REMOVE;
+}
+
 static void
 on_directory_monitor_event (GFileMonitor     *monitor G_GNUC_UNUSED,
 			    GFile            *file,
@@ -2117,150 +2708,451 @@ on_directory_monitor_event (GFileMonitor     *monitor G_GNUC_UNUSED,
 			    GFileMonitorEvent event_type,
 			    FileBrowserNode  *parent)
 {
-	FileBrowserNode *node;
 	FileBrowserNodeDir *dir = FILE_BROWSER_NODE_DIR (parent);
+	gint event = event_type;
+	gpointer previous;
 
-	switch (event_type) {
-	case G_FILE_MONITOR_EVENT_DELETED:
-		node = node_list_contains_file (dir->children, file);
-
-		if (node != NULL) {
-			model_remove_node (dir->model, node, NULL, TRUE);
-		}
-		break;
-	case G_FILE_MONITOR_EVENT_CREATED:
-		if (g_file_query_exists (file, NULL)) {
-			model_add_node_from_file (dir->model, parent, file, NULL);
-		}
+	if (event_type != G_FILE_MONITOR_EVENT_DELETED &&
+	    event_type != G_FILE_MONITOR_EVENT_CREATED)
+		return;
 
-		break;
-	default:
-		break;
-	}
+	if (dir->monitor_events == NULL)
+		dir->monitor_events = g_hash_table_new_full (g_file_hash,
+							     (GEqualFunc) g_file_equal,
+							     g_object_unref,
+							     NULL);
+
+	/* Only the last event of a file matters, but a deletion must not be
+	 * lost when the file is created again right after it */
+	if (event_type == G_FILE_MONITOR_EVENT_CREATED &&
+	    g_hash_table_lookup_extended (dir->monitor_events, file, NULL, &previous) &&
+	    GPOINTER_TO_INT (previous) != G_FILE_MONITOR_EVENT_CREATED)
+		event = MONITOR_EVENT_REPLACED;
+
+	g_hash_table_replace (dir->monitor_events,
+			      g_object_ref (file),
+			      GINT_TO_POINTER (event));
+
+	if (dir->monitor_events_id == 0 && dir->monitor_cancellable == NULL)
+		dir->monitor_events_id = g_timeout_add (MONITOR_EVENTS_DELAY,
+							(GSourceFunc) model_apply_monitor_events,
+							dir);
 }
 
 static void
 async_node_free (AsyncNode *async)
 {
+	g_queue_foreach (&async->batches, (GFunc) g_ptr_array_unref, NULL);
+	g_queue_clear (&async->batches);
+	g_mutex_clear (&async->lock);
+
+	g_object_unref (async->file);
 	g_object_unref (async->cancellable);
-	g_slist_free (async->original_children);
 	g_free (async);
 }
 
 static void
-model_iterate_next_files_cb (GFileEnumerator * enumerator,
-			     GAsyncResult * result,
-			     AsyncNode * async)
+model_remove_loaded_entries (AsyncNode * async, GPtrArray * batch)
 {
-	GList * files;
-	GError * error = NULL;
-	FileBrowserNodeDir * dir = async->dir;
-	FileBrowserNode * parent = (FileBrowserNode *)dir;
+	FileBrowserNodeDir *dir = async->dir;
+	FileBrowserNode *parent = (FileBrowserNode *)dir;
+	GPtrArray *nodes;
+	guint i;
 
-	files = g_file_enumerator_next_files_finish (enumerator, result, &error);
+	nodes = g_ptr_array_sized_new (batch->len);
 
-	if (files == NULL) {
-		g_file_enumerator_close (enumerator, NULL, NULL);
-		async_node_free (async);
+	for (i = 0; i < batch->len; ++i) {
+		DirEntry *entry = g_ptr_array_index (batch, i);
+		FileBrowserNode *node;
 
-		if (!error)
-		{
-			/* We're done loading */
-			g_object_unref (dir->cancellable);
-			dir->cancellable = NULL;
+		if ((node = model_find_child (dir->model, parent, entry->file)) != NULL)
+			g_ptr_array_add (nodes, node);
+	}
+
+	model_remove_children (dir->model, parent, nodes);
+	g_ptr_array_unref (nodes);
+}
+
+/**
+ * model_add_loaded_entries:
+ * @async: the AsyncNode of the directory being loaded
+ * @deadline: the monotonic time at which to stop
+ *
+ * Adds the entries handed over by the enumeration thread until @deadline.
+ * The entries taken from a batch at once are still sorted, so they are
+ * merged in the children without sorting them again. A batch of entries
+ * without info removes their nodes instead.
+ *
+ * Returns: %TRUE if it stopped because of @deadline, %FALSE when there
+ * were no entries left or the loading was cancelled
+ **/
+static gboolean
+model_add_loaded_entries (AsyncNode * async, gint64 deadline)
+{
+	FileBrowserNodeDir *dir = async->dir;
+	FileBrowserNode *parent = (FileBrowserNode *)dir;
+
+	/* Adding nodes emits signals, which may well cancel the loading
+	 * and free the directory */
+	while (!g_cancellable_is_cancelled (async->cancellable)) {
+		GPtrArray *batch;
+		GSList *nodes = NULL;
+
+		g_mutex_lock (&async->lock);
+		batch = g_queue_peek_head (&async->batches);
+		g_mutex_unlock (&async->lock);
+
+		if (batch == NULL)
+			return FALSE;
+
+		if (batch->len > 0 &&
+		    ((DirEntry *) g_ptr_array_index (batch, 0))->info == NULL) {
+			model_remove_loaded_entries (async, batch);
+			async->batch_pos = batch->len;
+		}
+
+		while (async->batch_pos < batch->len) {
+			FileBrowserNode *node;
+
+			node = model_add_node_from_entry (dir->model,
+							  parent,
+							  g_ptr_array_index (batch, async->batch_pos++));
+
+			if (node != NULL)
+				nodes = g_slist_prepend (nodes, node);
+
+			if (async->batch_pos % 32 == 0 &&
+			    g_get_monotonic_time () >= deadline)
+				break;
+		}
+
+		if (async->batch_pos == batch->len) {
+			g_mutex_lock (&async->lock);
+			g_queue_pop_head (&async->batches);
+			g_mutex_unlock (&async->lock);
+
+			g_ptr_array_unref (batch);
+			async->batch_pos = 0;
+		}
+
+		if (nodes)
+			model_add_sorted_nodes (dir->model, g_slist_reverse (nodes), parent);
+
+		if (g_get_monotonic_time () >= deadline)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void
+model_load_directory_finish (AsyncNode * async, GTask * task)
+{
+	FileBrowserNodeDir *dir = async->dir;
+	FileBrowserNode *parent = (FileBrowserNode *)dir;
+	GError *error = NULL;
+
+	if (!g_task_propagate_boolean (task, &error)) {
+		g_signal_emit (dir->model,
+			       model_signals[ERROR],
+			       0,
+			       LAPIZ_FILE_BROWSER_ERROR_LOAD_DIRECTORY,
+			       error->message);
+
+		file_browser_node_unload (dir->model, parent, TRUE);
+		g_error_free (error);
+		return;
+	}
+
+	/* We're done loading */
+	g_object_unref (dir->cancellable);
+	dir->cancellable = NULL;
 
 /*
  * FIXME: This is temporarly, it is a bug in gio:
  * http://bugzilla.gnome.org/show_bug.cgi?id=565924
  */
-			if (g_file_is_native (parent->file) && dir->monitor == NULL) {
-				dir->monitor = g_file_monitor_directory (parent->file,
-									 G_FILE_MONITOR_NONE,
-									 NULL,
-									 NULL);
-				if (dir->monitor != NULL)
-				{
-					g_signal_connect (dir->monitor,
-							  "changed",
-							  G_CALLBACK (on_directory_monitor_event),
-							  parent);
-				}
-			}
+	if (g_file_is_native (parent->file) && dir->monitor == NULL) {
+		dir->monitor = g_file_monitor_directory (parent->file,
+							 G_FILE_MONITOR_NONE,
+							 NULL,
+							 NULL);
+		if (dir->monitor != NULL)
+		{
+			g_signal_connect (dir->monitor,
+					  "changed",
+					  G_CALLBACK (on_directory_monitor_event),
+					  parent);
+		}
+	}
 
-			model_check_dummy (dir->model, parent);
-			model_end_loading (dir->model, parent);
-		} else {
-			/* Simply return if we were cancelled */
-			if (error->domain == G_IO_ERROR && error->code == G_IO_ERROR_CANCELLED)
-				return;
+	model_check_dummy (dir->model, parent);
+	model_end_loading (dir->model, parent);
+}
 
-			/* Otherwise handle the error appropriately */
-			g_signal_emit (dir->model,
-				       model_signals[ERROR],
-				       0,
-				       LAPIZ_FILE_BROWSER_ERROR_LOAD_DIRECTORY,
-				       error->message);
+static gboolean
+model_load_directory_idle (AsyncNode * async)
+{
+	GTask *task;
+	gboolean more;
 
-			file_browser_node_unload (dir->model, (FileBrowserNode *)parent, TRUE);
-			g_error_free (error);
-		}
-	} else if (g_cancellable_is_cancelled (async->cancellable)) {
-		/* Check cancel state manually */
-		g_file_enumerator_close (enumerator, NULL, NULL);
-		async_node_free (async);
-	} else {
-		model_add_nodes_from_files (dir->model, parent, async->original_children, files);
+	more = model_add_loaded_entries (async,
+					 g_get_monotonic_time () + DIRECTORY_LOAD_SLICE_USEC);
+
+	g_mutex_lock (&async->lock);
+
+	/* The thread may have handed over another batch in the meantime */
+	if (!more && !g_cancellable_is_cancelled (async->cancellable))
+		more = !g_queue_is_empty (&async->batches);
 
-		g_list_free (files);
-		next_files_async (enumerator, async);
+	if (!more)
+		async->idle_id = 0;
+
+	g_mutex_unlock (&async->lock);
+
+	if (more)
+		return G_SOURCE_CONTINUE;
+
+	/* The thread is done already, so this is the end of the loading.
+	 * Dropping the task may free async */
+	if ((task = async->task) != NULL) {
+		async->task = NULL;
+
+		if (!g_cancellable_is_cancelled (async->cancellable))
+			model_load_directory_finish (async, task);
+
+		g_object_unref (task);
 	}
+
+	return G_SOURCE_REMOVE;
 }
 
+/* Called in the enumeration thread */
 static void
-next_files_async (GFileEnumerator * enumerator,
-		  AsyncNode * async)
+async_node_push_batch (AsyncNode * async, GPtrArray * batch)
 {
-	g_file_enumerator_next_files_async (enumerator,
-					    DIRECTORY_LOAD_ITEMS_PER_CALLBACK,
-					    G_PRIORITY_DEFAULT,
-					    async->cancellable,
-					    (GAsyncReadyCallback)model_iterate_next_files_cb,
-					    async);
+	g_mutex_lock (&async->lock);
+
+	g_queue_push_tail (&async->batches, batch);
+
+	if (async->idle_id == 0)
+		async->idle_id = g_idle_add ((GSourceFunc) model_load_directory_idle,
+					     async);
+
+	g_mutex_unlock (&async->lock);
 }
 
+/* Called in the enumeration thread */
 static void
-model_iterate_children_cb (GFile * file,
-			   GAsyncResult * result,
-			   AsyncNode * async)
+async_node_push_entries (AsyncNode * async, GPtrArray * entries)
 {
-	GError * error = NULL;
-	GFileEnumerator * enumerator;
+	g_ptr_array_sort (entries, dir_entry_compare);
+	async_node_push_batch (async, entries);
+}
 
-	if (g_cancellable_is_cancelled (async->cancellable))
-	{
-		async_node_free (async);
-		return;
+/* Called in the enumeration thread, once the cached listing was handed
+ * over: hands over the files which are gone or changed, then the ones
+ * which are new or changed. Returns whether there was any difference */
+static gboolean
+async_node_reconcile (AsyncNode * async,
+		      GPtrArray * cached,
+		      GPtrArray * infos)
+{
+	GHashTable *previous;
+	GHashTableIter iter;
+	GPtrArray *removed;
+	GPtrArray *added;
+	gpointer key;
+	gboolean changed;
+	guint i;
+
+	previous = g_hash_table_new (g_str_hash, g_str_equal);
+
+	for (i = 0; i < cached->len; ++i) {
+		GFileInfo *info = g_ptr_array_index (cached, i);
+
+		g_hash_table_insert (previous,
+				     (gpointer) g_file_info_get_name (info),
+				     info);
+	}
+
+	removed = g_ptr_array_new_with_free_func ((GDestroyNotify) dir_entry_free);
+	added = g_ptr_array_new_with_free_func ((GDestroyNotify) dir_entry_free);
+
+	for (i = 0; i < infos->len; ++i) {
+		GFileInfo *info = g_ptr_array_index (infos, i);
+		gchar const *name = g_file_info_get_name (info);
+		GFileInfo *old;
+
+		if ((old = g_hash_table_lookup (previous, name)) != NULL) {
+			g_hash_table_remove (previous, name);
+
+			if (lapiz_file_browser_cache_info_equal (old, info))
+				continue;
+
+			/* It is added again with its new info */
+			g_ptr_array_add (removed, dir_entry_new_removed (async->file, name));
+		}
+
+		g_ptr_array_add (added, dir_entry_new (async->file, info));
 	}
 
-	enumerator = g_file_enumerate_children_finish (file, result, &error);
+	/* What is left is gone */
+	g_hash_table_iter_init (&iter, previous);
+
+	while (g_hash_table_iter_next (&iter, &key, NULL))
+		g_ptr_array_add (removed, dir_entry_new_removed (async->file, key));
+
+	g_hash_table_destroy (previous);
+
+	changed = removed->len > 0 || added->len > 0;
+
+	if (removed->len > 0)
+		async_node_push_batch (async, removed);
+	else
+		g_ptr_array_unref (removed);
+
+	if (added->len > 0)
+		async_node_push_entries (async, added);
+	else
+		g_ptr_array_unref (added);
+
+	return changed;
+}
+
+static void
+model_load_directory_thread (GTask        *task,
+			     gpointer      source_object G_GNUC_UNUSED,
+			     gpointer      task_data,
+			     GCancellable *cancellable)
+{
+	AsyncNode *async = task_data;
+	GFileEnumerator *enumerator;
+	GFileInfo *info;
+	GPtrArray *cached = NULL;
+	GPtrArray *infos;
+	GPtrArray *batch = NULL;
+	guint batch_size = DIRECTORY_LOAD_ITEMS_PER_BATCH;
+	guint64 mtime = 0;
+	GError *error = NULL;
+
+	/* Only the listings of native directories are cached */
+	if (g_file_is_native (async->file) &&
+	    (info = g_file_query_info (async->file,
+				       LAPIZ_FILE_BROWSER_CACHE_MTIME_ATTRIBUTES,
+				       G_FILE_QUERY_INFO_NONE,
+				       cancellable,
+				       NULL)) != NULL) {
+		mtime = lapiz_file_browser_cache_get_mtime (info);
+		g_object_unref (info);
+	}
+
+	/* Show the cached listing right away if the directory did not
+	 * change since, the enumeration then only hands over what differs */
+	if (mtime != 0 &&
+	    (cached = lapiz_file_browser_cache_read (async->file, mtime)) != NULL) {
+		guint i;
+
+		batch = g_ptr_array_new_full (cached->len, (GDestroyNotify) dir_entry_free);
+
+		for (i = 0; i < cached->len; ++i) {
+			DirEntry *entry;
+
+			if ((entry = dir_entry_new (async->file, g_ptr_array_index (cached, i))) != NULL)
+				g_ptr_array_add (batch, entry);
+		}
+
+		async_node_push_entries (async, batch);
+		batch = NULL;
+	}
+
+	enumerator = g_file_enumerate_children (async->file,
+						STANDARD_ATTRIBUTE_TYPES,
+						G_FILE_QUERY_INFO_NONE,
+						cancellable,
+						&error);
 
 	if (enumerator == NULL) {
-		/* Simply return if we were cancelled or if the dir is not there */
-		FileBrowserNodeDir *dir = async->dir;
+		if (cached != NULL)
+			g_ptr_array_unref (cached);
 
-		/* Otherwise handle the error appropriately */
-		g_signal_emit (dir->model,
-			       model_signals[ERROR],
-			       0,
-			       LAPIZ_FILE_BROWSER_ERROR_LOAD_DIRECTORY,
-			       error->message);
+		g_task_return_error (task, error);
+		return;
+	}
 
-		file_browser_node_unload (dir->model, (FileBrowserNode *)dir, TRUE);
-		g_error_free (error);
-		async_node_free (async);
-	} else {
-		next_files_async (enumerator, async);
+	infos = g_ptr_array_new_with_free_func (g_object_unref);
+
+	while ((info = g_file_enumerator_next_file (enumerator, cancellable, &error)) != NULL) {
+		if (!file_info_is_shown (info)) {
+			g_object_unref (info);
+			continue;
+		}
+
+		g_ptr_array_add (infos, info);
+
+		if (cached != NULL)
+			continue;
+
+		if (batch == NULL)
+			batch = g_ptr_array_new_full (batch_size, (GDestroyNotify) dir_entry_free);
+
+		g_ptr_array_add (batch, dir_entry_new (async->file, info));
+
+		if (batch->len == batch_size) {
+			async_node_push_entries (async, batch);
+
+			batch = NULL;
+			batch_size = MIN (batch_size * 2, DIRECTORY_LOAD_MAX_ITEMS_PER_BATCH);
+		}
+	}
+
+	if (batch != NULL)
+		async_node_push_entries (async, batch);
+
+	g_file_enumerator_close (enumerator, NULL, NULL);
+	g_object_unref (enumerator);
+
+	if (error == NULL) {
+		gboolean changed = TRUE;
+
+		if (cached != NULL)
+			changed = async_node_reconcile (async, cached, infos);
+
+		if (changed && mtime != 0)
+			lapiz_file_browser_cache_write (async->file, mtime, infos);
 	}
+
+	if (cached != NULL)
+		g_ptr_array_unref (cached);
+
+	g_ptr_array_unref (infos);
+
+	if (error != NULL)
+		g_task_return_error (task, error);
+	else
+		g_task_return_boolean (task, TRUE);
+}
+
+static void
+model_load_directory_cb (GObject      *source_object G_GNUC_UNUSED,
+			 GAsyncResult *result,
+			 gpointer      user_data G_GNUC_UNUSED)
+{
+	GTask *task = G_TASK (result);
+	AsyncNode *async = g_task_get_task_data (task);
+	gboolean pending;
+
+	g_mutex_lock (&async->lock);
+	pending = async->idle_id != 0;
+	g_mutex_unlock (&async->lock);
+
+	/* Let the idle add the remaining entries first, it finishes the
+	 * loading afterwards. Otherwise simply return if we were cancelled,
+	 * the directory may be gone already */
+	if (pending)
+		async->task = g_object_ref (task);
+	else if (!g_cancellable_is_cancelled (async->cancellable))
+		model_load_directory_finish (async, task);
 }
 
 static void
@@ -2269,6 +3161,7 @@ model_load_directory (LapizFileBrowserStore * model,
 {
 	FileBrowserNodeDir *dir;
 	AsyncNode *async;
+	GTask *task;
 
 	g_return_if_fail (NODE_IS_DIR (node));
 
@@ -2284,19 +3177,19 @@ model_load_directory (LapizFileBrowserStore * model,
 
 	dir->cancellable = g_cancellable_new ();
 
-	async = g_new (AsyncNode, 1);
+	async = g_new0 (AsyncNode, 1);
 	async->dir = dir;
 	async->cancellable = g_object_ref (dir->cancellable);
-	async->original_children = g_slist_copy (dir->children);
-
-	/* Start loading async */
-	g_file_enumerate_children_async (node->file,
-					 STANDARD_ATTRIBUTE_TYPES,
-					 G_FILE_QUERY_INFO_NONE,
-					 G_PRIORITY_DEFAULT,
-					 async->cancellable,
-					 (GAsyncReadyCallback)model_iterate_children_cb,
-					 async);
+	async->file = g_object_ref (node->file);
+	g_mutex_init (&async->lock);
+	g_queue_init (&async->batches);
+
+	/* Enumerate, name and sort the files in a thread, the main loop
+	 * only adds the sorted batches it hands over */
+	task = g_task_new (NULL, async->cancellable, model_load_directory_cb, NULL);
+	g_task_set_task_data (task, async, (GDestroyNotify) async_node_free);
+	g_task_run_in_thread (task, model_load_directory_thread);
+	g_object_unref (task);
 }
 
 static GList *
@@ -2324,8 +3217,9 @@ model_fill (LapizFileBrowserStore * model, FileBrowserNode * node,
 {
 	gboolean free_path = FALSE;
 	CtkTreeIter iter = {0,};
-	GSList *item;
+	FileBrowserNodeDir *dir;
 	FileBrowserNode *child;
+	guint i;
 
 	if (node == NULL) {
 		node = model->priv->virtual_root;
@@ -2357,9 +3251,10 @@ model_fill (LapizFileBrowserStore * model, FileBrowserNode * node,
 		/* Go to the first child */
 		ctk_tree_path_down (*path);
 
-		for (item = FILE_BROWSER_NODE_DIR (node)->children; item;
-		     item = item->next) {
-			child = (FileBrowserNode *) (item->data);
+		dir = FILE_BROWSER_NODE_DIR (node);
+
+		for (i = 0; i < dir->children->len; ++i) {
+			child = NODE_CHILD (dir, i);
 
 			if (model_node_visibility (model, child)) {
 				model_fill (model, child, path);
@@ -2387,8 +3282,9 @@ set_virtual_root_from_node (LapizFileBrowserStore * model,
 	FileBrowserNode *prev;
 	FileBrowserNode *check;
 	FileBrowserNodeDir *dir;
-	GSList *item;
-	GSList *copy;
+	FileBrowserNodeDir *check_dir;
+	GPtrArray *copy;
+	guint i, j;
 	CtkTreePath *empty = NULL;
 
 	g_assert (node != NULL);
@@ -2399,10 +3295,17 @@ set_virtual_root_from_node (LapizFileBrowserStore * model,
 	/* Free all the nodes below that we don't need in cache */
 	while (prev != model->priv->root) {
 		dir = FILE_BROWSER_NODE_DIR (next);
-		copy = g_slist_copy (dir->children);
+		copy = dir_copy_children (dir);
+
+		/* Only keep the node in the chain */
+		if (prev != node) {
+			g_ptr_array_set_size (dir->children, 0);
+			g_ptr_array_add (dir->children, prev);
+			dir_renumber_children (dir, 0);
+		}
 
-		for (item = copy; item; item = item->next) {
-			check = (FileBrowserNode *) (item->data);
+		for (i = 0; i < copy->len; ++i) {
+			check = g_ptr_array_index (copy, i);
 
 			if (prev == node) {
 				/* Only free the children, keeping this depth in cache */
@@ -2415,8 +3318,6 @@ set_virtual_root_from_node (LapizFileBrowserStore * model,
 				}
 			} else if (check != prev) {
 				/* Only free when the node is not in the chain */
-				dir->children =
-				    g_slist_remove (dir->children, check);
 				file_browser_node_free (model, check);
 			}
 		}
@@ -2424,28 +3325,25 @@ set_virtual_root_from_node (LapizFileBrowserStore * model,
 		if (prev != node)
 			file_browser_node_unload (model, next, FALSE);
 
-		g_slist_free (copy);
+		g_ptr_array_unref (copy);
 		prev = next;
 		next = prev->parent;
 	}
 
 	/* Free all the nodes up that we don't need in cache */
-	for (item = FILE_BROWSER_NODE_DIR (node)->children; item;
-	     item = item->next) {
-		check = (FileBrowserNode *) (item->data);
+	dir = FILE_BROWSER_NODE_DIR (node);
+
+	for (i = 0; i < dir->children->len; ++i) {
+		check = NODE_CHILD (dir, i);
 
 		if (NODE_IS_DIR (check)) {
-			for (copy =
-			     FILE_BROWSER_NODE_DIR (check)->children; copy;
-			     copy = copy->next) {
+			check_dir = FILE_BROWSER_NODE_DIR (check);
+
+			for (j = 0; j < check_dir->children->len; ++j) {
 				file_browser_node_free_children (model,
-								 (FileBrowserNode
-								  *)
-								 (copy->
-								  data));
+								 NODE_CHILD (check_dir, j));
 				file_browser_node_unload (model,
-							  (FileBrowserNode
-							   *) (copy->data),
+							  NODE_CHILD (check_dir, j),
 							  FALSE);
 			}
 		} else if (NODE_IS_DUMMY (check)) {
@@ -2456,6 +3354,7 @@ set_virtual_root_from_node (LapizFileBrowserStore * model,
 
 	/* Now finally, set the virtual root, and load it up! */
 	model->priv->virtual_root = node;
+	model->priv->rows_stamp++;
 
 	/* Notify that the virtual-root has changed before loading up new nodes so that the
 	   "root_changed" signal can be emitted before any "inserted" signals */
@@ -2494,46 +3393,18 @@ set_virtual_root_from_file (LapizFileBrowserStore * model,
 	set_virtual_root_from_node (model, parent);
 }
 
-static FileBrowserNode *
-model_find_node_children (LapizFileBrowserStore * model,
-			  FileBrowserNode * parent,
-			  GFile * file)
-{
-	FileBrowserNodeDir *dir;
-	FileBrowserNode *child;
-	FileBrowserNode *result;
-	GSList *children;
-
-	if (!NODE_IS_DIR (parent))
-		return NULL;
-
-	dir = FILE_BROWSER_NODE_DIR (parent);
-
-	for (children = dir->children; children; children = children->next) {
-		child = (FileBrowserNode *)(children->data);
-
-		result = model_find_node (model, child, file);
-
-		if (result)
-			return result;
-	}
-
-	return NULL;
-}
-
 static FileBrowserNode *
 model_find_node (LapizFileBrowserStore * model,
 		 FileBrowserNode * node,
 		 GFile * file)
 {
-	if (node == NULL)
-		node = model->priv->root;
+	FileBrowserNode *result;
 
-	if (node->file && g_file_equal (node->file, file))
-		return node;
+	result = g_hash_table_lookup (model->priv->nodes, file);
 
-	if (NODE_IS_DIR (node) && g_file_has_prefix (file, node->file))
-		return model_find_node_children (model, node, file);
+	if (result == NULL || node == NULL || result == node ||
+	    node_has_parent (result, node))
+		return result;
 
 	return NULL;
 }
@@ -2606,6 +3477,7 @@ handle_root_error (LapizFileBrowserStore * model, GError *error)
 	/* Set the virtual root to the root */
 	root = model->priv->root;
 	model->priv->virtual_root = root;
+	model->priv->rows_stamp++;
 
 	/* Set the root to be loaded */
 	root->flags |= LAPIZ_FILE_BROWSER_STORE_FLAG_LOADED;
@@ -2972,10 +3844,12 @@ lapiz_file_browser_store_set_root_and_virtual_root (LapizFileBrowserStore *
 
 	model->priv->root = NULL;
 	model->priv->virtual_root = NULL;
+	model->priv->rows_stamp++;
 
 	if (file != NULL) {
 		/* Create the root node */
 		node = file_browser_node_dir_new (model, file, NULL);
+		model_index_node (model, node);
 
 		g_object_unref (file);
 
@@ -3045,7 +3919,8 @@ _lapiz_file_browser_store_iter_collapsed (LapizFileBrowserStore * model,
 					  CtkTreeIter * iter)
 {
 	FileBrowserNode *node;
-	GSList *item;
+	FileBrowserNodeDir *dir;
+	guint i;
 
 	g_return_if_fail (LAPIZ_IS_FILE_BROWSER_STORE (model));
 	g_return_if_fail (iter != NULL);
@@ -3055,10 +3930,10 @@ _lapiz_file_browser_store_iter_collapsed (LapizFileBrowserStore * model,
 
 	if (NODE_IS_DIR (node) && NODE_LOADED (node)) {
 		/* Unload children of the children, keeping 1 depth in cache */
+		dir = FILE_BROWSER_NODE_DIR (node);
 
-		for (item = FILE_BROWSER_NODE_DIR (node)->children; item;
-		     item = item->next) {
-			node = (FileBrowserNode *) (item->data);
+		for (i = 0; i < dir->children->len; ++i) {
+			node = NODE_CHILD (dir, i);
 
 			if (NODE_IS_DIR (node) && NODE_LOADED (node)) {
 				file_browser_node_unload (model, node,
@@ -3131,10 +4006,12 @@ lapiz_file_browser_store_refresh (LapizFileBrowserStore * model)
 }
 
 static void
-reparent_node (FileBrowserNode * node, gboolean reparent)
+reparent_node (LapizFileBrowserStore * model,
+	       FileBrowserNode * node,
+	       gboolean reparent)
 {
 	FileBrowserNodeDir * dir;
-	GSList * child;
+	guint i;
 	GFile * parent;
 	gchar * base;
 
@@ -3145,17 +4022,19 @@ reparent_node (FileBrowserNode * node, gboolean reparent)
 	if (reparent) {
 		parent = node->parent->file;
 		base = g_file_get_basename (node->file);
+		model_unindex_node (model, node);
 		g_object_unref (node->file);
 
 		node->file = g_file_get_child (parent, base);
+		model_index_node (model, node);
 		g_free (base);
 	}
 
 	if (NODE_IS_DIR (node)) {
 		dir = FILE_BROWSER_NODE_DIR (node);
 
-		for (child = dir->children; child; child = child->next) {
-			reparent_node ((FileBrowserNode *)child->data, TRUE);
+		for (i = 0; i < dir->children->len; ++i) {
+			reparent_node (model, NODE_CHILD (dir, i), TRUE);
 		}
 	}
 }
@@ -3193,14 +4072,16 @@ lapiz_file_browser_store_rename (LapizFileBrowserStore * model,
 	}
 
 	if (g_file_move (node->file, file, G_FILE_COPY_NONE, NULL, NULL, NULL, &err)) {
+		model_unindex_node (model, node);
 		previous = node->file;
 		node->file = file;
+		model_index_node (model, node);
 
 		/* This makes sure the actual info for the node is requeried */
 		file_browser_node_set_name (node);
 		file_browser_node_set_from_info (model, node, NULL, TRUE);
 
-		reparent_node (node, FALSE);
+		reparent_node (model, node, FALSE);
 
 		if (model_node_visibility (model, node)) {
 			path = lapiz_file_browser_store_get_path_real (model, node);
@@ -65,10 +65,18 @@ typedef struct _ModelineOptions
 	guint		right_margin_position;
 
 	ModelineSet	set;
+
+	/* hash of the head and tail of the buffer the options come from */
+	guint		regions_hash;
 } ModelineOptions;
 
 #define MODELINE_OPTIONS_DATA_KEY "ModelineOptionsDataKey"
 
+/* Modelines are only looked for on the first and last lines */
+#define MODELINE_LINES 10
+
+#define PARAGRAPH_SEPARATOR "\xe2\x80\xa9"
+
 static gboolean
 has_option (ModelineOptions *options,
             ModelineSet      set)
@@ -168,12 +176,12 @@ load_language_mappings (void)
 }
 
 static gchar *
-get_language_id (const gchar *language_name, GHashTable *mapping)
+get_language_id (const gchar *language_name, gsize len, GHashTable *mapping)
 {
 	gchar *name;
 	gchar *language_id;
 
-	name = g_ascii_strdown (language_name, -1);
+	name = g_ascii_strdown (language_name, len);
 
 	language_id = g_hash_table_lookup (mapping, name);
 
@@ -190,38 +198,81 @@ get_language_id (const gchar *language_name, GHashTable *mapping)
 }
 
 static gchar *
-get_language_id_vim (const gchar *language_name)
+get_language_id_vim (const gchar *language_name, gsize len)
 {
 	if (vim_languages == NULL)
 		load_language_mappings ();
 
-	return get_language_id (language_name, vim_languages);
+	return get_language_id (language_name, len, vim_languages);
 }
 
 static gchar *
-get_language_id_emacs (const gchar *language_name)
+get_language_id_emacs (const gchar *language_name, gsize len)
 {
 	if (emacs_languages == NULL)
 		load_language_mappings ();
 
-	return get_language_id (language_name, emacs_languages);
+	return get_language_id (language_name, len, emacs_languages);
 }
 
 static gchar *
-get_language_id_kate (const gchar *language_name)
+get_language_id_kate (const gchar *language_name, gsize len)
 {
 	if (kate_languages == NULL)
 		load_language_mappings ();
 
-	return get_language_id (language_name, kate_languages);
+	return get_language_id (language_name, len, kate_languages);
 }
 
 static gboolean
-skip_whitespaces (gchar **s)
+skip_whitespaces (const gchar **s,
+		  const gchar  *end)
 {
-	while (**s != '\0' && g_ascii_isspace (**s))
+	while (*s < end && g_ascii_isspace (**s))
 		(*s)++;
-	return **s != '\0';
+	return *s < end;
+}
+
+static gboolean
+has_prefix (const gchar *s,
+	    const gchar *end,
+	    const gchar *prefix)
+{
+	gsize len = strlen (prefix);
+
+	return (gsize) (end - s) >= len && strncmp (s, prefix, len) == 0;
+}
+
+/* Keys and values point into the scanned text and are not nul-terminated */
+static gboolean
+token_equal (const gchar *token,
+	     gsize        len,
+	     const gchar *str)
+{
+	return strlen (str) == len && strncmp (token, str, len) == 0;
+}
+
+/* Same as atoi() on the leading digits of the token */
+static guint
+token_to_uint (const gchar *token,
+	       gsize        len)
+{
+	guint val = 0;
+	gsize i;
+
+	for (i = 0; i < len && g_ascii_isdigit (token[i]); i++)
+		val = val * 10 + (token[i] - '0');
+
+	return val;
+}
+
+static gboolean
+token_is_true (const gchar *token,
+	       gsize        len)
+{
+	return token_equal (token, len, "on") ||
+	       token_equal (token, len, "true") ||
+	       token_equal (token, len, "1");
 }
 
 /* Parse vi(m) modelines.
@@ -230,79 +281,77 @@ skip_whitespaces (gchar **s)
  *   - second form:  [text]{white}{vi:|vim:|ex:}[white]se[t] {options}:[text]
  * They can happen on the three first or last lines.
  */
-static gchar *
-parse_vim_modeline (gchar           *s,
+static const gchar *
+parse_vim_modeline (const gchar     *s,
+		    const gchar     *end,
 		    ModelineOptions *options)
 {
 	gboolean in_set = FALSE;
 	gboolean neg;
 	guint intval;
-	GString *key, *value;
+	const gchar *key, *value;
+	gsize key_len, value_len;
 
-	key = g_string_sized_new (8);
-	value = g_string_sized_new (8);
-
-	while (*s != '\0' && !(in_set && *s == ':'))
+	while (s < end && !(in_set && *s == ':'))
 	{
-		while (*s != '\0' && (*s == ':' || g_ascii_isspace (*s)))
+		while (s < end && (*s == ':' || g_ascii_isspace (*s)))
 			s++;
 
-		if (*s == '\0')
+		if (s == end)
 			break;
 
-		if (strncmp (s, "set ", 4) == 0 ||
-		    strncmp (s, "se ", 3) == 0)
+		if (has_prefix (s, end, "set ") ||
+		    has_prefix (s, end, "se "))
 		{
-			s = strchr(s, ' ') + 1;
+			s = (const gchar *) memchr (s, ' ', end - s) + 1;
 			in_set = TRUE;
 		}
 
 		neg = FALSE;
-		if (strncmp (s, "no", 2) == 0)
+		if (has_prefix (s, end, "no"))
 		{
 			neg = TRUE;
 			s += 2;
 		}
 
-		g_string_assign (key, "");
-		g_string_assign (value, "");
-
-		while (*s != '\0' && *s != ':' && *s != '=' &&
+		key = s;
+		while (s < end && *s != ':' && *s != '=' &&
 		       !g_ascii_isspace (*s))
 		{
-			g_string_append_c (key, *s);
 			s++;
 		}
+		key_len = s - key;
 
-		if (*s == '=')
+		value = s;
+		if (s < end && *s == '=')
 		{
-			s++;
-			while (*s != '\0' && *s != ':' &&
+			value = ++s;
+			while (s < end && *s != ':' &&
 			       !g_ascii_isspace (*s))
 			{
-				g_string_append_c (value, *s);
 				s++;
 			}
 		}
+		value_len = s - value;
 
-		if (strcmp (key->str, "ft") == 0 ||
-		    strcmp (key->str, "filetype") == 0)
+		if (token_equal (key, key_len, "ft") ||
+		    token_equal (key, key_len, "filetype"))
 		{
 			g_free (options->language_id);
-			options->language_id = get_language_id_vim (value->str);
+			options->language_id = get_language_id_vim (value, value_len);
 
 			options->set |= MODELINE_SET_LANGUAGE;
 		}
-		else if (strcmp (key->str, "et") == 0 ||
-		    strcmp (key->str, "expandtab") == 0)
+		else if (token_equal (key, key_len, "et") ||
+		    token_equal (key, key_len, "expandtab"))
 		{
 			options->insert_spaces = !neg;
 			options->set |= MODELINE_SET_INSERT_SPACES;
 		}
-		else if (strcmp (key->str, "ts") == 0 ||
-			 strcmp (key->str, "tabstop") == 0)
+		else if (token_equal (key, key_len, "ts") ||
+			 token_equal (key, key_len, "tabstop"))
 		{
-			intval = atoi (value->str);
+			intval = token_to_uint (value, value_len);
 
 			if (intval)
 			{
@@ -310,10 +359,10 @@ parse_vim_modeline (gchar           *s,
 				options->set |= MODELINE_SET_TAB_WIDTH;
 			}
 		}
-		else if (strcmp (key->str, "sw") == 0 ||
-			 strcmp (key->str, "shiftwidth") == 0)
+		else if (token_equal (key, key_len, "sw") ||
+			 token_equal (key, key_len, "shiftwidth"))
 		{
-			intval = atoi (value->str);
+			intval = token_to_uint (value, value_len);
 
 			if (intval)
 			{
@@ -321,15 +370,15 @@ parse_vim_modeline (gchar           *s,
 				options->set |= MODELINE_SET_INDENT_WIDTH;
 			}
 		}
-		else if (strcmp (key->str, "wrap") == 0)
+		else if (token_equal (key, key_len, "wrap"))
 		{
 			options->wrap_mode = neg ? CTK_WRAP_NONE : CTK_WRAP_WORD;
 
 			options->set |= MODELINE_SET_WRAP_MODE;
 		}
-		else if (strcmp (key->str, "textwidth") == 0)
+		else if (token_equal (key, key_len, "textwidth"))
 		{
-			intval = atoi (value->str);
+			intval = token_to_uint (value, value_len);
 
 			if (intval)
 			{
@@ -343,9 +392,6 @@ parse_vim_modeline (gchar           *s,
 		}
 	}
 
-	g_string_free (key, TRUE);
-	g_string_free (value, TRUE);
-
 	return s;
 }
 
@@ -355,64 +401,61 @@ parse_vim_modeline (gchar           *s,
  * a shebang (#!)
  * See http://www.delorie.com/gnu/docs/emacs/emacs_486.html
  */
-static gchar *
-parse_emacs_modeline (gchar           *s,
+static const gchar *
+parse_emacs_modeline (const gchar     *s,
+		      const gchar     *end,
 		      ModelineOptions *options)
 {
 	guint intval;
-	GString *key, *value;
-
-	key = g_string_sized_new (8);
-	value = g_string_sized_new (8);
+	const gchar *key, *value;
+	gsize key_len, value_len;
 
-	while (*s != '\0')
+	while (s < end)
 	{
-		while (*s != '\0' && (*s == ';' || g_ascii_isspace (*s)))
+		while (s < end && (*s == ';' || g_ascii_isspace (*s)))
 			s++;
-		if (*s == '\0' || strncmp (s, "-*-", 3) == 0)
+		if (s == end || has_prefix (s, end, "-*-"))
 			break;
 
-		g_string_assign (key, "");
-		g_string_assign (value, "");
-
-		while (*s != '\0' && *s != ':' && *s != ';' &&
+		key = s;
+		while (s < end && *s != ':' && *s != ';' &&
 		       !g_ascii_isspace (*s))
 		{
-			g_string_append_c (key, *s);
 			s++;
 		}
+		key_len = s - key;
 
-		if (!skip_whitespaces (&s))
+		if (!skip_whitespaces (&s, end))
 			break;
 
 		if (*s != ':')
 			continue;
 		s++;
 
-		if (!skip_whitespaces (&s))
+		if (!skip_whitespaces (&s, end))
 			break;
 
-		while (*s != '\0' && *s != ';' && !g_ascii_isspace (*s))
-		{
-			g_string_append_c (value, *s);
+		value = s;
+		while (s < end && *s != ';' && !g_ascii_isspace (*s))
 			s++;
-		}
+		value_len = s - value;
 
 		lapiz_debug_message (DEBUG_PLUGINS,
-				     "Emacs modeline bit: %s = %s",
-				     key->str, value->str);
+				     "Emacs modeline bit: %.*s = %.*s",
+				     (gint) key_len, key,
+				     (gint) value_len, value);
 
 		/* "Mode" key is case insenstive */
-		if (g_ascii_strcasecmp (key->str, "Mode") == 0)
+		if (key_len == 4 && g_ascii_strncasecmp (key, "Mode", 4) == 0)
 		{
 			g_free (options->language_id);
-			options->language_id = get_language_id_emacs (value->str);
+			options->language_id = get_language_id_emacs (value, value_len);
 
 			options->set |= MODELINE_SET_LANGUAGE;
 		}
-		else if (strcmp (key->str, "tab-width") == 0)
+		else if (token_equal (key, key_len, "tab-width"))
 		{
-			intval = atoi (value->str);
+			intval = token_to_uint (value, value_len);
 
 			if (intval)
 			{
@@ -420,9 +463,9 @@ parse_emacs_modeline (gchar           *s,
 				options->set |= MODELINE_SET_TAB_WIDTH;
 			}
 		}
-		else if (strcmp (key->str, "indent-offset") == 0)
+		else if (token_equal (key, key_len, "indent-offset"))
 		{
-			intval = atoi (value->str);
+			intval = token_to_uint (value, value_len);
 
 			if (intval)
 			{
@@ -430,26 +473,23 @@ parse_emacs_modeline (gchar           *s,
 				options->set |= MODELINE_SET_INDENT_WIDTH;
 			}
 		}
-		else if (strcmp (key->str, "indent-tabs-mode") == 0)
+		else if (token_equal (key, key_len, "indent-tabs-mode"))
 		{
-			intval = strcmp (value->str, "nil") == 0;
+			intval = token_equal (value, value_len, "nil");
 			options->insert_spaces = intval;
 
 			options->set |= MODELINE_SET_INSERT_SPACES;
 		}
-		else if (strcmp (key->str, "autowrap") == 0)
+		else if (token_equal (key, key_len, "autowrap"))
 		{
-			intval = strcmp (value->str, "nil") != 0;
+			intval = !token_equal (value, value_len, "nil");
 			options->wrap_mode = intval ? CTK_WRAP_WORD : CTK_WRAP_NONE;
 
 			options->set |= MODELINE_SET_WRAP_MODE;
 		}
 	}
 
-	g_string_free (key, TRUE);
-	g_string_free (value, TRUE);
-
-	return *s == '\0' ? s : s + 2;
+	return s == end ? s : s + 2;
 }
 
 /*
@@ -458,59 +498,56 @@ parse_emacs_modeline (gchar           *s,
  * These can happen on the 10 first or 10 last lines of the buffer.
  * See http://wiki.kate-editor.org/index.php/Modelines
  */
-static gchar *
-parse_kate_modeline (gchar           *s,
+static const gchar *
+parse_kate_modeline (const gchar     *s,
+		     const gchar     *end,
 		     ModelineOptions *options)
 {
 	guint intval;
-	GString *key, *value;
-
-	key = g_string_sized_new (8);
-	value = g_string_sized_new (8);
+	const gchar *key, *value;
+	gsize key_len, value_len;
 
-	while (*s != '\0')
+	while (s < end)
 	{
-		while (*s != '\0' && (*s == ';' || g_ascii_isspace (*s)))
+		while (s < end && (*s == ';' || g_ascii_isspace (*s)))
 			s++;
-		if (*s == '\0')
+		if (s == end)
 			break;
 
-		g_string_assign (key, "");
-		g_string_assign (value, "");
-
-		while (*s != '\0' && *s != ';' && !g_ascii_isspace (*s))
-		{
-			g_string_append_c (key, *s);
+		key = s;
+		while (s < end && *s != ';' && !g_ascii_isspace (*s))
 			s++;
-		}
+		key_len = s - key;
 
-		if (!skip_whitespaces (&s))
+		if (!skip_whitespaces (&s, end))
 			break;
 		if (*s == ';')
 			continue;
 
-		while (*s != '\0' && *s != ';' &&
+		value = s;
+		while (s < end && *s != ';' &&
 		       !g_ascii_isspace (*s))
 		{
-			g_string_append_c (value, *s);
 			s++;
 		}
+		value_len = s - value;
 
 		lapiz_debug_message (DEBUG_PLUGINS,
-				     "Kate modeline bit: %s = %s",
-				     key->str, value->str);
+				     "Kate modeline bit: %.*s = %.*s",
+				     (gint) key_len, key,
+				     (gint) value_len, value);
 
-		if (strcmp (key->str, "hl") == 0 ||
-		    strcmp (key->str, "syntax") == 0)
+		if (token_equal (key, key_len, "hl") ||
+		    token_equal (key, key_len, "syntax"))
 		{
 			g_free (options->language_id);
-			options->language_id = get_language_id_kate (value->str);
+			options->language_id = get_language_id_kate (value, value_len);
 
 			options->set |= MODELINE_SET_LANGUAGE;
 		}
-		else if (strcmp (key->str, "tab-width") == 0)
+		else if (token_equal (key, key_len, "tab-width"))
 		{
-			intval = atoi (value->str);
+			intval = token_to_uint (value, value_len);
 
 			if (intval)
 			{
@@ -518,33 +555,29 @@ parse_kate_modeline (gchar           *s,
 				options->set |= MODELINE_SET_TAB_WIDTH;
 			}
 		}
-		else if (strcmp (key->str, "indent-width") == 0)
+		else if (token_equal (key, key_len, "indent-width"))
 		{
-			intval = atoi (value->str);
+			intval = token_to_uint (value, value_len);
 			if (intval) options->indent_width = intval;
 		}
-		else if (strcmp (key->str, "space-indent") == 0)
+		else if (token_equal (key, key_len, "space-indent"))
 		{
-			intval = strcmp (value->str, "on") == 0 ||
-			         strcmp (value->str, "true") == 0 ||
-			         strcmp (value->str, "1") == 0;
+			intval = token_is_true (value, value_len);
 
 			options->insert_spaces = intval;
 			options->set |= MODELINE_SET_INSERT_SPACES;
 		}
-		else if (strcmp (key->str, "word-wrap") == 0)
+		else if (token_equal (key, key_len, "word-wrap"))
 		{
-			intval = strcmp (value->str, "on") == 0 ||
-			         strcmp (value->str, "true") == 0 ||
-			         strcmp (value->str, "1") == 0;
+			intval = token_is_true (value, value_len);
 
 			options->wrap_mode = intval ? CTK_WRAP_WORD : CTK_WRAP_NONE;
 
 			options->set |= MODELINE_SET_WRAP_MODE;
 		}
-		else if (strcmp (key->str, "word-wrap-column") == 0)
+		else if (token_equal (key, key_len, "word-wrap-column"))
 		{
-			intval = atoi (value->str);
+			intval = token_to_uint (value, value_len);
 
 			if (intval)
 			{
@@ -557,9 +590,6 @@ parse_kate_modeline (gchar           *s,
 		}
 	}
 
-	g_string_free (key, TRUE);
-	g_string_free (value, TRUE);
-
 	return s;
 }
 
@@ -567,7 +597,8 @@ parse_kate_modeline (gchar           *s,
  * Line numbers are counted starting at one.
  */
 static void
-parse_modeline (gchar           *s,
+parse_modeline (const gchar     *s,
+		const gchar     *end,
 		gint             line_number,
 		gint             line_count,
 		ModelineOptions *options)
@@ -575,35 +606,87 @@ parse_modeline (gchar           *s,
 	gchar prev;
 
 	/* look for the beginning of a modeline */
-	for (prev = ' '; (s != NULL) && (*s != '\0'); prev = *(s++))
+	for (prev = ' '; s < end; prev = *(s++))
 	{
 		if (!g_ascii_isspace (prev))
 			continue;
 
 		if ((line_number <= 3 || line_number > line_count - 3) &&
-		    (strncmp (s, "ex:", 3) == 0 ||
-		     strncmp (s, "vi:", 3) == 0 ||
-		     strncmp (s, "vim:", 4) == 0))
+		    (has_prefix (s, end, "ex:") ||
+		     has_prefix (s, end, "vi:") ||
+		     has_prefix (s, end, "vim:")))
 		{
 			lapiz_debug_message (DEBUG_PLUGINS, "Vim modeline on line %d", line_number);
 
-		    	while (*s != ':') s++;
-		    	s = parse_vim_modeline (s + 1, options);
+			s = memchr (s, ':', end - s);
+			s = parse_vim_modeline (s + 1, end, options);
 		}
-		else if (line_number <= 2 && strncmp (s, "-*-", 3) == 0)
+		else if (line_number <= 2 && has_prefix (s, end, "-*-"))
 		{
 			lapiz_debug_message (DEBUG_PLUGINS, "Emacs modeline on line %d", line_number);
 
-			s = parse_emacs_modeline (s + 3, options);
+			s = parse_emacs_modeline (s + 3, end, options);
 		}
 		else if ((line_number <= 10 || line_number > line_count - 10) &&
-			 strncmp (s, "kate:", 5) == 0)
+			 has_prefix (s, end, "kate:"))
 		{
 			lapiz_debug_message (DEBUG_PLUGINS, "Kate modeline on line %d", line_number);
 
-			s = parse_kate_modeline (s + 5, options);
+			s = parse_kate_modeline (s + 5, end, options);
+		}
+
+		if (s == end)
+			break;
+	}
+}
+
+/* Returns the end of the line starting at @s and stores the start of the
+ * following one in @next. Handles the same delimiters as CtkTextBuffer.
+ */
+static const gchar *
+find_line_end (const gchar  *s,
+	       const gchar **next)
+{
+	for (; *s != '\0'; s++)
+	{
+		if (*s == '\n')
+		{
+			*next = s + 1;
+			return s;
+		}
+		else if (*s == '\r')
+		{
+			*next = s[1] == '\n' ? s + 2 : s + 1;
+			return s;
+		}
+		else if (strncmp (s, PARAGRAPH_SEPARATOR, 3) == 0)
+		{
+			*next = s + 3;
+			return s;
 		}
 	}
+
+	*next = s;
+	return s;
+}
+
+/* Scan every line of a region of the buffer, @first_line being the number
+ * of its first line.
+ */
+static void
+parse_region (const gchar     *text,
+	      gint             first_line,
+	      gint             line_count,
+	      ModelineOptions *options)
+{
+	const gchar *s, *end, *next;
+	gint line;
+
+	for (s = text, line = first_line; *s != '\0'; s = next, line++)
+	{
+		end = find_line_end (s, &next);
+		parse_modeline (s, end, line, line_count, options);
+	}
 }
 
 static gboolean
@@ -668,78 +751,88 @@ free_modeline_options (ModelineOptions *options)
 	g_slice_free (ModelineOptions, options);
 }
 
+/* Whether the view still has every setting @previous applied */
+static gboolean
+modeline_still_applied (CtkSourceView   *view,
+                        ModelineOptions *previous)
+{
+	guint set;
+
+	for (set = 1; set <= MODELINE_SET_INSERT_SPACES; set <<= 1)
+	{
+		if ((previous->set & set) &&
+		    !check_previous (view, previous, set))
+		{
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
 void
 modeline_parser_apply_modeline (CtkSourceView *view)
 {
 	ModelineOptions options;
+	ModelineOptions *previous;
 	CtkTextBuffer *buffer;
-	CtkTextIter iter, liter;
+	CtkTextIter start, end;
+	gchar *head, *tail;
 	gint line_count;
-
-	options.language_id = NULL;
-	options.set = MODELINE_SET_NONE;
+	gint tail_line;
+	guint hash;
 
 	buffer = ctk_text_view_get_buffer (CTK_TEXT_VIEW (view));
-	ctk_text_buffer_get_start_iter (buffer, &iter);
-
 	line_count = ctk_text_buffer_get_line_count (buffer);
 
-	/* Parse the modelines on the 10 first lines... */
-	while ((ctk_text_iter_get_line (&iter) < 10) &&
-	       !ctk_text_iter_is_end (&iter))
-	{
-		gchar *line;
-
-		liter = iter;
-		ctk_text_iter_forward_to_line_end (&iter);
-		line = ctk_text_buffer_get_text (buffer, &liter, &iter, TRUE);
-
-		parse_modeline (line,
-				1 + ctk_text_iter_get_line (&iter),
-				line_count,
-				&options);
+	/* Modelines are not allowed in between the 10 first and the 10 last
+	 * lines, so get these two regions in one go each.
+	 */
+	ctk_text_buffer_get_start_iter (buffer, &start);
+	ctk_text_buffer_get_iter_at_line (buffer, &end, MODELINE_LINES);
+	head = ctk_text_buffer_get_text (buffer, &start, &end, TRUE);
+
+	tail_line = MAX (MODELINE_LINES, line_count - MODELINE_LINES);
+	ctk_text_buffer_get_iter_at_line (buffer, &start, tail_line);
+	ctk_text_buffer_get_end_iter (buffer, &end);
+	if (tail_line < line_count)
+		tail = ctk_text_buffer_get_text (buffer, &start, &end, TRUE);
+	else
+		tail = g_strdup ("");
 
-		ctk_text_iter_forward_line (&iter);
+	/* Once the buffer is longer than both regions, line numbers relative
+	 * to the end do not depend on the line count anymore.
+	 */
+	hash = g_str_hash (head);
+	hash = (hash << 5) + hash + g_str_hash (tail);
+	if (line_count <= 2 * MODELINE_LINES)
+		hash = (hash << 5) + hash + line_count;
 
-		g_free (line);
-	}
+	previous = g_object_get_data (G_OBJECT (buffer),
+	                              MODELINE_OPTIONS_DATA_KEY);
 
-	/* ...and on the 10 last ones (modelines are not allowed in between) */
-	if (!ctk_text_iter_is_end (&iter))
+	/* Neither the modelines nor the settings they gave changed (e.g.
+	 * a save after editing the middle of the file): applying them
+	 * again would only relayout the view.
+	 */
+	if (previous != NULL &&
+	    previous->regions_hash == hash &&
+	    modeline_still_applied (view, previous))
 	{
-		gint cur_line;
-		guint remaining_lines;
-
-		/* we are on the 11th line (count from 0) */
-		cur_line = ctk_text_iter_get_line (&iter);
-		/* g_assert (10 == cur_line); */
-
-		remaining_lines = line_count - cur_line - 1;
-
-		if (remaining_lines > 10)
-		{
-			ctk_text_buffer_get_end_iter (buffer, &iter);
-			ctk_text_iter_backward_lines (&iter, 9);
-		}
+		g_free (head);
+		g_free (tail);
+		return;
 	}
 
-	while (!ctk_text_iter_is_end (&iter))
-	{
-		gchar *line;
-
-		liter = iter;
-		ctk_text_iter_forward_to_line_end (&iter);
-		line = ctk_text_buffer_get_text (buffer, &liter, &iter, TRUE);
-
-		parse_modeline (line,
-				1 + ctk_text_iter_get_line (&iter),
-				line_count,
-				&options);
+	options.language_id = NULL;
+	options.set = MODELINE_SET_NONE;
+	options.regions_hash = hash;
 
-		ctk_text_iter_forward_line (&iter);
+	parse_region (head, 1, line_count, &options);
+	parse_region (tail, tail_line + 1, line_count, &options);
 
-		g_free (line);
-	}
+	g_free (head);
+	g_free (tail);
 
 	/* Try to set language */
 	if (has_option (&options, MODELINE_SET_LANGUAGE) && options.language_id)
@@ -758,9 +851,6 @@ modeline_parser_apply_modeline (CtkSourceView *view)
 		}
 	}
 
-	ModelineOptions *previous = g_object_get_data (G_OBJECT (buffer),
-	                                               MODELINE_OPTIONS_DATA_KEY);
-
 	/* Apply the options we got from modelines and restore defaults if
 	   we set them before */
 	if (has_option (&options, MODELINE_SET_INSERT_SPACES))
@@ -826,22 +916,19 @@ modeline_parser_apply_modeline (CtkSourceView *view)
 
 	if (previous)
 	{
+		g_free (previous->language_id);
 		*previous = options;
-		previous->language_id = g_strdup (options.language_id);
 	}
 	else
 	{
 		previous = g_slice_new (ModelineOptions);
 		*previous = options;
-		previous->language_id = g_strdup (options.language_id);
 
 		g_object_set_data_full (G_OBJECT (buffer),
 		                        MODELINE_OPTIONS_DATA_KEY,
 		                        previous,
 		                        (GDestroyNotify)free_modeline_options);
 	}
-
-	g_free (options.language_id);
 }
 
 void
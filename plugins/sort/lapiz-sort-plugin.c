@@ -27,6 +27,7 @@
 
 #include "lapiz-sort-plugin.h"
 
+#include <math.h>
 #include <string.h>
 #include <glib/gi18n-lib.h>
 #include <gmodule.h>
@@ -39,6 +40,10 @@
 
 #define MENU_PATH "/MenuBar/EditMenu/EditOps_6"
 
+/* Below this many lines the sort is done in the calling thread */
+#define PARALLEL_SORT_MIN_LINES 10000
+#define MAX_SORT_THREADS 8
+
 static void bean_activatable_iface_init (BeanActivatableInterface *iface);
 
 enum {
@@ -53,6 +58,9 @@ typedef struct
 	CtkWidget *reverse_order_checkbutton;
 	CtkWidget *ignore_case_checkbutton;
 	CtkWidget *remove_dups_checkbutton;
+	CtkWidget *sort_type_combobox;
+	CtkWidget *field_spinbutton;
+	CtkWidget *delimiter_entry;
 
 	LapizDocument *doc;
 
@@ -67,14 +75,55 @@ struct _LapizSortPluginPrivate
 	guint ui_id;
 };
 
+/* Keep in sync with the items of sort_type_combobox */
+typedef enum
+{
+	SORT_TYPE_TEXT,
+	SORT_TYPE_NUMBER,
+	SORT_TYPE_NATURAL
+} SortType;
+
 typedef struct
 {
 	gboolean ignore_case;
 	gboolean reverse_order;
 	gboolean remove_duplicates;
 	gint starting_column;
+	SortType type;
+	gint field; /* 0 for the whole line */
+	gchar *delimiter; /* NULL to split the fields on blanks */
 } SortInfo;
 
+/* A line with its sort key, computed once before sorting */
+typedef struct
+{
+	const gchar *text;
+	const gchar *key;
+	gdouble number;
+	guint short_line : 1;
+	guint has_number : 1;
+} SortLine;
+
+/* A part of the lines, given its keys and sorted in its own thread */
+typedef struct
+{
+	SortLine **lines;
+	gsize n_lines;
+	const SortInfo *sort_info;
+	GStringChunk *keys;
+} SortRun;
+
+/* Two adjacent sorted runs of src, merged into dest */
+typedef struct
+{
+	SortLine **src;
+	SortLine **dest;
+	gsize start;
+	gsize middle;
+	gsize end;
+	const SortInfo *sort_info;
+} SortMerge;
+
 G_DEFINE_DYNAMIC_TYPE_EXTENDED (LapizSortPlugin,
                                 lapiz_sort_plugin,
                                 BEAN_TYPE_EXTENSION_BASE,
@@ -181,6 +230,9 @@ get_sort_dialog (LapizSortPlugin *plugin)
 					  "col_num_spinbutton", &dialog->col_num_spinbutton,
 					  "ignore_case_checkbutton", &dialog->ignore_case_checkbutton,
 					  "remove_dups_checkbutton", &dialog->remove_dups_checkbutton,
+					  "sort_type_combobox", &dialog->sort_type_combobox,
+					  "field_spinbutton", &dialog->field_spinbutton,
+					  "delimiter_entry", &dialog->delimiter_entry,
 					  NULL);
 	g_free (ui_file);
 
@@ -250,112 +302,312 @@ sort_cb (CtkAction       *action G_GNUC_UNUSED,
 	ctk_widget_show (CTK_WIDGET (dialog->dialog));
 }
 
-/* Compares two strings for the sorting algorithm. Uses the UTF-8 processing
- * functions in GLib to be as correct as possible.*/
-static gint
-compare_algorithm (gconstpointer s1,
-		   gconstpointer s2,
-		   gpointer	 data)
+/* Gets the part of the line the sort key is made from */
+static gchar *
+get_key_text (const gchar    *line,
+	      const SortInfo *sort_info)
 {
-	gint length1, length2;
-	gint ret;
-	gchar *string1, *string2;
-	gchar *substring1, *substring2;
-	gchar *key1, *key2;
-	SortInfo *sort_info;
+	const gchar *field = line;
+	const gchar *field_end;
+	gint i;
 
-	lapiz_debug (DEBUG_PLUGINS);
+	if (sort_info->field > 0)
+	{
+		for (i = 1; i <= sort_info->field; i++)
+		{
+			if (sort_info->delimiter != NULL)
+			{
+				if (i > 1)
+				{
+					field = strstr (field, sort_info->delimiter);
+					if (field == NULL)
+						return g_strdup ("");
+
+					field += strlen (sort_info->delimiter);
+				}
+			}
+			else
+			{
+				/* fields are separated by runs of blanks, and
+				 * the leading ones are skipped */
+				while (*field == ' ' || *field == '\t')
+					++field;
+
+				if (i > 1 && *field == '\0')
+					return g_strdup ("");
+			}
+
+			if (i < sort_info->field && sort_info->delimiter == NULL)
+			{
+				while (*field != '\0' && *field != ' ' && *field != '\t')
+					++field;
+			}
+		}
+
+		if (sort_info->delimiter != NULL)
+			field_end = strstr (field, sort_info->delimiter);
+		else
+			field_end = field + strcspn (field, " \t");
+
+		if (field_end != NULL)
+			return g_strndup (field, field_end - field);
+	}
+
+	return g_strdup (field);
+}
+
+static void
+make_sort_key (SortLine       *line,
+	       const SortInfo *sort_info,
+	       GStringChunk   *keys)
+{
+	gchar *text;
+	gchar *casefolded = NULL;
+	const gchar *start;
+	gchar *number_end;
+	gchar *key;
 
-	sort_info = (SortInfo *) data;
-	g_return_val_if_fail (sort_info != NULL, -1);
+	text = get_key_text (line->text, sort_info);
 
-	if (!sort_info->ignore_case)
+	if (sort_info->ignore_case)
 	{
-		string1 = *((gchar **) s1);
-		string2 = *((gchar **) s2);
+		casefolded = g_utf8_casefold (text, -1);
+		g_free (text);
+		text = casefolded;
 	}
-	else
+
+	line->short_line = g_utf8_strlen (text, -1) < sort_info->starting_column;
+	line->has_number = FALSE;
+
+	if (line->short_line)
 	{
-		string1 = g_utf8_casefold (*((gchar **) s1), -1);
-		string2 = g_utf8_casefold (*((gchar **) s2), -1);
+		line->key = "";
+		g_free (text);
+		return;
 	}
 
-	length1 = g_utf8_strlen (string1, -1);
-	length2 = g_utf8_strlen (string2, -1);
+	start = g_utf8_offset_to_pointer (text, MAX (sort_info->starting_column, 0));
 
-	if ((length1 < sort_info->starting_column) &&
-	    (length2 < sort_info->starting_column))
+	switch (sort_info->type)
 	{
-		ret = 0;
+		case SORT_TYPE_NUMBER:
+			line->number = g_ascii_strtod (start, &number_end);
+			line->has_number = number_end != start && !isnan (line->number);
+
+			/* the text breaks the ties between equal numbers */
+			key = g_utf8_collate_key (start, -1);
+			break;
+
+		case SORT_TYPE_NATURAL:
+			key = g_utf8_collate_key_for_filename (start, -1);
+			break;
+
+		default:
+			key = g_utf8_collate_key (start, -1);
+			break;
 	}
-	else if (length1 < sort_info->starting_column)
+
+	line->key = g_string_chunk_insert (keys, key);
+
+	g_free (key);
+	g_free (text);
+}
+
+/* Compares two lines by their precomputed keys. The lines shorter than
+ * the starting column come first, then with numeric sorting the lines
+ * without a number */
+static gint
+compare_lines (gconstpointer l1,
+	       gconstpointer l2,
+	       gpointer      data)
+{
+	const SortLine *line1 = *((const SortLine **) l1);
+	const SortLine *line2 = *((const SortLine **) l2);
+	const SortInfo *sort_info = data;
+	gint ret;
+
+	if (line1->short_line || line2->short_line)
 	{
-		ret = -1;
+		ret = (gint) line2->short_line - (gint) line1->short_line;
 	}
-	else if (length2 < sort_info->starting_column)
+	else if (sort_info->type == SORT_TYPE_NUMBER &&
+		 (line1->has_number != line2->has_number))
 	{
-		ret = 1;
+		ret = (gint) line1->has_number - (gint) line2->has_number;
 	}
-	else if (sort_info->starting_column < 1)
+	else if (sort_info->type == SORT_TYPE_NUMBER &&
+		 line1->has_number &&
+		 line1->number != line2->number)
 	{
-		key1 = g_utf8_collate_key (string1, -1);
-		key2 = g_utf8_collate_key (string2, -1);
-		ret = strcmp (key1, key2);
-
-		g_free (key1);
-		g_free (key2);
+		ret = line1->number < line2->number ? -1 : 1;
 	}
 	else
 	{
-		/* A character column offset is required, so figure out
-		 * the correct offset into the UTF-8 string. */
-		substring1 = g_utf8_offset_to_pointer (string1, sort_info->starting_column);
-		substring2 = g_utf8_offset_to_pointer (string2, sort_info->starting_column);
-
-		key1 = g_utf8_collate_key (substring1, -1);
-		key2 = g_utf8_collate_key (substring2, -1);
-		ret = strcmp (key1, key2);
+		ret = strcmp (line1->key, line2->key);
+	}
 
-		g_free (key1);
-		g_free (key2);
+	if (sort_info->reverse_order)
+	{
+		ret = -1 * ret;
 	}
 
-	/* Do the necessary cleanup. */
-	if (sort_info->ignore_case)
+	return ret;
+}
+
+static gpointer
+sort_run (SortRun *run)
+{
+	gsize i;
+
+	for (i = 0; i < run->n_lines; i++)
 	{
-		g_free (string1);
-		g_free (string2);
+		make_sort_key (run->lines[i], run->sort_info, run->keys);
 	}
 
-	if (sort_info->reverse_order)
+	g_sort_array (run->lines,
+		      run->n_lines,
+		      sizeof (gpointer),
+		      compare_lines,
+		      (gpointer) run->sort_info);
+
+	return NULL;
+}
+
+/* merges keeping the order of equal lines, so that the sort is stable */
+static gpointer
+sort_merge (SortMerge *merge)
+{
+	gsize i = merge->start;
+	gsize j = merge->middle;
+	gsize k = merge->start;
+
+	while (i < merge->middle && j < merge->end)
 	{
-		ret = -1 * ret;
+		if (compare_lines (&merge->src[j],
+				   &merge->src[i],
+				   (gpointer) merge->sort_info) < 0)
+			merge->dest[k++] = merge->src[j++];
+		else
+			merge->dest[k++] = merge->src[i++];
 	}
 
-	return ret;
+	while (i < merge->middle)
+		merge->dest[k++] = merge->src[i++];
+
+	while (j < merge->end)
+		merge->dest[k++] = merge->src[j++];
+
+	return NULL;
 }
 
-static gchar *
-get_line_slice (CtkTextBuffer *buf,
-		gint           line)
+/* Gives the lines their keys and sorts them. Large selections are split
+ * in one run per processor; the runs are sorted in parallel and then
+ * merged pairwise, also in parallel */
+static void
+sort_lines (SortLine       **lines,
+	    gsize            n_lines,
+	    const SortInfo  *sort_info,
+	    GStringChunk   **keys,
+	    guint            n_runs)
 {
-	CtkTextIter start, end;
-	char *ret;
+	SortRun *runs;
+	GThread **threads;
+	gsize *bounds;
+	SortLine **src, **dest;
+	guint i;
 
-	ctk_text_buffer_get_iter_at_line (buf, &start, line);
-	end = start;
+	runs = g_new0 (SortRun, n_runs);
+	threads = g_new0 (GThread *, n_runs);
+	bounds = g_new (gsize, n_runs + 1);
 
-	if (!ctk_text_iter_ends_line (&start))
-		ctk_text_iter_forward_to_line_end (&end);
+	for (i = 0; i <= n_runs; i++)
+	{
+		bounds[i] = n_lines * i / n_runs;
+	}
 
-	ret= ctk_text_buffer_get_slice (buf,
-					  &start,
-					  &end,
-					  TRUE);
+	for (i = 0; i < n_runs; i++)
+	{
+		runs[i].lines = lines + bounds[i];
+		runs[i].n_lines = bounds[i + 1] - bounds[i];
+		runs[i].sort_info = sort_info;
+		runs[i].keys = keys[i];
+
+		if (n_runs > 1)
+			threads[i] = g_thread_new ("lapiz-sort",
+						   (GThreadFunc) sort_run,
+						   &runs[i]);
+		else
+			sort_run (&runs[i]);
+	}
 
-	g_assert (ret != NULL);
+	for (i = 0; i < n_runs && n_runs > 1; i++)
+	{
+		g_thread_join (threads[i]);
+	}
 
-	return ret;
+	src = lines;
+	dest = n_runs > 1 ? g_new (SortLine *, n_lines) : NULL;
+
+	while (n_runs > 1)
+	{
+		SortMerge *merges;
+		guint n_merges = n_runs / 2;
+		SortLine **tmp;
+
+		merges = g_new (SortMerge, n_merges);
+
+		for (i = 0; i < n_merges; i++)
+		{
+			merges[i].src = src;
+			merges[i].dest = dest;
+			merges[i].start = bounds[2 * i];
+			merges[i].middle = bounds[2 * i + 1];
+			merges[i].end = bounds[2 * i + 2];
+			merges[i].sort_info = sort_info;
+
+			threads[i] = g_thread_new ("lapiz-sort",
+						   (GThreadFunc) sort_merge,
+						   &merges[i]);
+		}
+
+		/* an odd run out is merged in the next round */
+		if (n_runs % 2 == 1)
+		{
+			memcpy (dest + bounds[n_runs - 1],
+				src + bounds[n_runs - 1],
+				(n_lines - bounds[n_runs - 1]) * sizeof (SortLine *));
+		}
+
+		for (i = 0; i < n_merges; i++)
+		{
+			g_thread_join (threads[i]);
+		}
+
+		g_free (merges);
+
+		for (i = 0; i <= n_runs / 2; i++)
+		{
+			bounds[i] = bounds[MIN (2 * i, n_runs)];
+		}
+
+		n_runs = (n_runs + 1) / 2;
+		bounds[n_runs] = n_lines;
+
+		tmp = src;
+		src = dest;
+		dest = tmp;
+	}
+
+	if (src != lines)
+	{
+		memcpy (lines, src, n_lines * sizeof (SortLine *));
+		dest = src;
+	}
+
+	g_free (dest);
+	g_free (bounds);
+	g_free (threads);
+	g_free (runs);
 }
 
 static void
@@ -365,10 +617,17 @@ sort_real (SortDialog *dialog)
 	CtkTextIter start, end;
 	gint start_line, end_line;
 	gint i;
-	gchar *last_row = NULL;
+	const gchar *last_row = NULL;
 	gint num_lines;
-	gchar **lines;
+	gchar *text, *p;
+	gint text_len;
+	SortLine *lines;
+	SortLine **sorted;
+	GStringChunk **keys;
+	guint n_runs;
+	GString *result;
 	SortInfo *sort_info;
+	const gchar *delimiter;
 
 	lapiz_debug (DEBUG_PLUGINS);
 
@@ -380,72 +639,115 @@ sort_real (SortDialog *dialog)
 	sort_info->reverse_order = ctk_toggle_button_get_active (CTK_TOGGLE_BUTTON (dialog->reverse_order_checkbutton));
 	sort_info->remove_duplicates = ctk_toggle_button_get_active (CTK_TOGGLE_BUTTON (dialog->remove_dups_checkbutton));
 	sort_info->starting_column = ctk_spin_button_get_value_as_int (CTK_SPIN_BUTTON (dialog->col_num_spinbutton)) - 1;
+	sort_info->type = MAX (ctk_combo_box_get_active (CTK_COMBO_BOX (dialog->sort_type_combobox)), 0);
+	sort_info->field = ctk_spin_button_get_value_as_int (CTK_SPIN_BUTTON (dialog->field_spinbutton));
 
-	start = dialog->start;
-	end = dialog->end;
-	start_line = ctk_text_iter_get_line (&start);
-	end_line = ctk_text_iter_get_line (&end);
+	delimiter = ctk_entry_get_text (CTK_ENTRY (dialog->delimiter_entry));
+	if (delimiter != NULL && *delimiter != '\0')
+		sort_info->delimiter = g_strdup (delimiter);
 
-	/* if we are at line start our last line is the previus one.
-	 * Otherwise the last line is the current one but we try to
-	 * move the iter after the line terminator */
-	if (ctk_text_iter_get_line_offset (&end) == 0)
+	start_line = ctk_text_iter_get_line (&dialog->start);
+	end_line = ctk_text_iter_get_line (&dialog->end);
+
+	/* if we are at line start our last line is the previus one */
+	if (ctk_text_iter_get_line_offset (&dialog->end) == 0)
 		end_line = MAX (start_line, end_line - 1);
-	else
-		ctk_text_iter_forward_line (&end);
 
 	num_lines = end_line - start_line + 1;
-	lines = g_new0 (gchar *, num_lines + 1);
 
 	lapiz_debug_message (DEBUG_PLUGINS, "Building list...");
 
+	/* the text of all the lines is read at once and split in place,
+	 * the lines point into it */
+	ctk_text_buffer_get_iter_at_line (CTK_TEXT_BUFFER (doc), &start, start_line);
+	ctk_text_buffer_get_iter_at_line (CTK_TEXT_BUFFER (doc), &end, end_line);
+
+	if (!ctk_text_iter_ends_line (&end))
+		ctk_text_iter_forward_to_line_end (&end);
+
+	text = ctk_text_buffer_get_slice (CTK_TEXT_BUFFER (doc),
+					  &start,
+					  &end,
+					  TRUE);
+	text_len = strlen (text);
+
+	lines = g_new0 (SortLine, num_lines);
+	sorted = g_new (SortLine *, num_lines);
+
+	p = text;
 	for (i = 0; i < num_lines; i++)
 	{
-		lines[i] = get_line_slice (CTK_TEXT_BUFFER (doc), start_line + i);
-	}
+		gint delimiter_index, next_start;
 
-	lines[num_lines] = NULL;
+		pango_find_paragraph_boundary (p,
+					       text_len - (p - text),
+					       &delimiter_index,
+					       &next_start);
+
+		lines[i].text = p;
+		sorted[i] = &lines[i];
+
+		p[delimiter_index] = '\0';
+		p += MAX (next_start, delimiter_index);
+	}
 
 	lapiz_debug_message (DEBUG_PLUGINS, "Sort list...");
 
-	g_sort_array (lines,
-		      num_lines,
-		      sizeof (gpointer),
-		      compare_algorithm,
-		      sort_info);
+	n_runs = 1;
+	if (num_lines >= PARALLEL_SORT_MIN_LINES)
+		n_runs = CLAMP (g_get_num_processors (), 1, MAX_SORT_THREADS);
 
-	lapiz_debug_message (DEBUG_PLUGINS, "Rebuilding document...");
+	keys = g_new (GStringChunk *, n_runs);
+	for (i = 0; i < (gint) n_runs; i++)
+	{
+		keys[i] = g_string_chunk_new (64 * 1024);
+	}
 
-	ctk_source_buffer_begin_not_undoable_action (CTK_SOURCE_BUFFER (doc));
+	sort_lines (sorted, num_lines, sort_info, keys, n_runs);
 
-	ctk_text_buffer_delete (CTK_TEXT_BUFFER (doc),
-				&start,
-				&end);
+	lapiz_debug_message (DEBUG_PLUGINS, "Rebuilding document...");
+
+	result = g_string_sized_new (text_len + 1);
 
 	for (i = 0; i < num_lines; i++)
 	{
 		if (sort_info->remove_duplicates &&
 		    last_row != NULL &&
-		    (strcmp (last_row, lines[i]) == 0))
+		    (strcmp (last_row, sorted[i]->text) == 0))
 			continue;
 
-		ctk_text_buffer_insert (CTK_TEXT_BUFFER (doc),
-					&start,
-					lines[i],
-					-1);
+		if (last_row != NULL)
+			g_string_append_c (result, '\n');
 
-		if (i < (num_lines - 1))
-			ctk_text_buffer_insert (CTK_TEXT_BUFFER (doc),
-						&start,
-						"\n",
-						-1);
+		g_string_append (result, sorted[i]->text);
 
-		last_row = lines[i];
+		last_row = sorted[i]->text;
 	}
 
+	ctk_source_buffer_begin_not_undoable_action (CTK_SOURCE_BUFFER (doc));
+
+	ctk_text_buffer_delete (CTK_TEXT_BUFFER (doc),
+				&start,
+				&end);
+
+	ctk_text_buffer_insert (CTK_TEXT_BUFFER (doc),
+				&start,
+				result->str,
+				result->len);
+
 	ctk_source_buffer_end_not_undoable_action (CTK_SOURCE_BUFFER (doc));
 
-	g_strfreev (lines);
+	for (i = 0; i < (gint) n_runs; i++)
+	{
+		g_string_chunk_free (keys[i]);
+	}
+
+	g_free (keys);
+	g_string_free (result, TRUE);
+	g_free (sorted);
+	g_free (lines);
+	g_free (text);
+	g_free (sort_info->delimiter);
 	g_free (sort_info);
 
 	lapiz_debug_message (DEBUG_PLUGINS, "Done.");
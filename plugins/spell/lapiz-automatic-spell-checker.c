@@ -39,10 +39,25 @@
 #include <string.h>
 
 #include <glib/gi18n.h>
+#include <ctksourceview/ctksource.h>
 
 #include "lapiz-automatic-spell-checker.h"
 #include "lapiz-spell-utils.h"
 
+/* Large ranges (the whole document once loaded, pasted text, the ranges
+ * highlighted by the syntax highlighting) are not checked at once: they
+ * are tagged as unchecked and checked in idle slices of CHECK_SLICE_USEC,
+ * CHECK_CHUNK_LINES lines at a time, the visible lines first. Lines longer
+ * than CHECK_CHUNK_CHARS are split between two words. The words whose
+ * verdict is not cached yet are checked against the dictionary in a worker
+ * thread, and the lines are checked again once they come back. The
+ * priority is the same as the search highlighting one, below the resize
+ * and above the redraw priority. */
+#define CHECK_CHUNK_LINES	100
+#define CHECK_CHUNK_CHARS	(16 * 1024)
+#define CHECK_SLICE_USEC	4000
+#define CHECK_PRIORITY		(G_PRIORITY_HIGH_IDLE + 15)
+
 struct _LapizAutomaticSpellChecker {
 	LapizDocument		*doc;
 	GSList 			*views;
@@ -55,6 +70,15 @@ struct _LapizAutomaticSpellChecker {
 	CtkTextMark		*mark_click;
 
        	LapizSpellChecker	*spell_checker;
+
+	CtkTextTag		*tag_unchecked;
+	guint			 check_id;
+
+	/* the batch of words being checked by the worker thread,
+	 * and their verdicts once it is done */
+	GCancellable		*cancellable;
+	GPtrArray		*batch_words;
+	GHashTable		*batch_verdicts;
 };
 
 static GQuark automatic_spell_checker_id = 0;
@@ -207,6 +231,447 @@ check_range (LapizAutomaticSpellChecker *spell,
 	}
 }
 
+static gboolean
+lookup_word (LapizAutomaticSpellChecker *spell,
+	     const gchar                *word,
+	     gboolean                   *correct)
+{
+	gpointer verdict;
+
+	if (spell->batch_verdicts != NULL &&
+	    g_hash_table_lookup_extended (spell->batch_verdicts, word, NULL, &verdict))
+	{
+		*correct = GPOINTER_TO_INT (verdict);
+		return TRUE;
+	}
+
+	return lapiz_spell_checker_lookup_word (spell->spell_checker, word, correct);
+}
+
+static void
+clear_batch (LapizAutomaticSpellChecker *spell)
+{
+	if (spell->batch_verdicts != NULL)
+	{
+		g_hash_table_destroy (spell->batch_verdicts);
+		spell->batch_verdicts = NULL;
+	}
+
+	if (spell->batch_words != NULL)
+	{
+		g_ptr_array_unref (spell->batch_words);
+		spell->batch_words = NULL;
+	}
+}
+
+/* Checks the words of the lines between @start and @end, which must be
+ * at the start of a line or of a word (or at the end of the buffer). The
+ * words are found with the same Pango word boundaries CtkTextIter uses,
+ * but on the text of each line at once. If the verdict of some words is
+ * not known yet, they are added to @unknown and the lines are left
+ * unchecked. As check_range() does, the word being typed at the cursor
+ * is only checked if it is already highlighted. */
+static gboolean
+check_lines (LapizAutomaticSpellChecker *spell,
+	     const CtkTextIter          *start,
+	     const CtkTextIter          *end,
+	     GHashTable                 *unknown)
+{
+	CtkTextBuffer *buffer = CTK_TEXT_BUFFER (spell->doc);
+	CtkTextIter line_start;
+	CtkTextIter cursor;
+	CtkTextIter precursor;
+	GArray *misspelled;
+	PangoLogAttr *attrs = NULL;
+	gint n_attrs = 0;
+	gint cursor_offset;
+	gboolean highlight;
+	guint i;
+
+	ctk_text_buffer_get_iter_at_mark (buffer,
+					  &cursor,
+					  ctk_text_buffer_get_insert (buffer));
+	cursor_offset = ctk_text_iter_get_offset (&cursor);
+
+	precursor = cursor;
+	ctk_text_iter_backward_char (&precursor);
+
+	highlight = ctk_text_iter_has_tag (&cursor, spell->tag_highlight) ||
+		    ctk_text_iter_has_tag (&precursor, spell->tag_highlight);
+
+	/* pairs of start and end offsets */
+	misspelled = g_array_new (FALSE, FALSE, sizeof (gint));
+
+	line_start = *start;
+
+	while (ctk_text_iter_compare (&line_start, end) < 0)
+	{
+		CtkTextIter line_end;
+		gchar *text;
+		const gchar *p;
+		const gchar *word_start = NULL;
+		gint word_start_char = 0;
+		gint line_offset;
+		gint line_char;
+		gint n_chars;
+		gint c;
+
+		line_end = line_start;
+		if (!ctk_text_iter_ends_line (&line_end))
+			ctk_text_iter_forward_to_line_end (&line_end);
+
+		if (ctk_text_iter_compare (end, &line_end) < 0)
+			line_end = *end;
+
+		/* the slice keeps the character offsets of the text */
+		text = ctk_text_iter_get_slice (&line_start, &line_end);
+		n_chars = g_utf8_strlen (text, -1);
+
+		if (n_chars + 1 > n_attrs)
+		{
+			n_attrs = n_chars + 1;
+			attrs = g_renew (PangoLogAttr, attrs, n_attrs);
+		}
+
+		pango_get_log_attrs (text, strlen (text), -1, NULL, attrs, n_chars + 1);
+
+		line_offset = ctk_text_iter_get_offset (&line_start);
+		line_char = ctk_text_iter_get_line_offset (&line_start);
+
+		for (c = 0, p = text; c <= n_chars; ++c)
+		{
+			if (word_start != NULL && attrs[c].is_word_end)
+			{
+				CtkTextIter wstart = line_start;
+				gchar *word;
+				gboolean correct;
+
+				ctk_text_iter_set_line_offset (&wstart, line_char + word_start_char);
+
+				if (line_offset + word_start_char < cursor_offset &&
+				    cursor_offset <= line_offset + c &&
+				    !highlight)
+				{
+					/* this word is being actively edited,
+					 * defer its check until the cursor
+					 * leaves it */
+					CtkTextIter wend = line_start;
+
+					ctk_text_iter_set_line_offset (&wend, line_char + c);
+
+					ctk_text_buffer_move_mark (buffer, spell->mark_insert_start, &wstart);
+					ctk_text_buffer_move_mark (buffer, spell->mark_insert_end, &wend);
+					spell->deferred_check = TRUE;
+				}
+				else if (!ctk_source_buffer_iter_has_context_class (CTK_SOURCE_BUFFER (buffer),
+										    &wstart,
+										    "no-spell-check"))
+				{
+					word = g_strndup (word_start, p - word_start);
+
+					if (!lookup_word (spell, word, &correct))
+					{
+						g_hash_table_add (unknown, word);
+						word = NULL;
+					}
+					else if (!correct)
+					{
+						gint offset;
+
+						offset = line_offset + word_start_char;
+						g_array_append_val (misspelled, offset);
+						offset = line_offset + c;
+						g_array_append_val (misspelled, offset);
+					}
+
+					g_free (word);
+				}
+
+				word_start = NULL;
+			}
+
+			if (c == n_chars)
+				break;
+
+			if (attrs[c].is_word_start)
+			{
+				word_start = p;
+				word_start_char = c;
+			}
+
+			p = g_utf8_next_char (p);
+		}
+
+		g_free (text);
+
+		if (!ctk_text_iter_forward_line (&line_start))
+			break;
+	}
+
+	g_free (attrs);
+
+	if (g_hash_table_size (unknown) > 0)
+	{
+		g_array_free (misspelled, TRUE);
+		return FALSE;
+	}
+
+	ctk_text_buffer_remove_tag (buffer, spell->tag_highlight, start, end);
+
+	for (i = 0; i < misspelled->len; i += 2)
+	{
+		CtkTextIter wstart, wend;
+
+		ctk_text_buffer_get_iter_at_offset (buffer, &wstart,
+						    g_array_index (misspelled, gint, i));
+		ctk_text_buffer_get_iter_at_offset (buffer, &wend,
+						    g_array_index (misspelled, gint, i + 1));
+
+		ctk_text_buffer_apply_tag (buffer, spell->tag_highlight, &wstart, &wend);
+	}
+
+	ctk_text_buffer_remove_tag (buffer, spell->tag_unchecked, start, end);
+
+	g_array_free (misspelled, TRUE);
+
+	return TRUE;
+}
+
+/* finds at most CHECK_CHUNK_LINES lines, or CHECK_CHUNK_CHARS characters,
+ * from the word of the first unchecked character between @range_start and
+ * @range_end */
+static gboolean
+find_unchecked_lines_in_range (LapizAutomaticSpellChecker *spell,
+			       const CtkTextIter          *range_start,
+			       const CtkTextIter          *range_end,
+			       CtkTextIter                *start,
+			       CtkTextIter                *end)
+{
+	CtkTextIter limit;
+
+	*start = *range_start;
+
+	if (!ctk_text_iter_has_tag (start, spell->tag_unchecked) &&
+	    !ctk_text_iter_forward_to_tag_toggle (start, spell->tag_unchecked))
+	{
+		return FALSE;
+	}
+
+	if (ctk_text_iter_compare (start, range_end) >= 0)
+		return FALSE;
+
+	*end = *start;
+	ctk_text_iter_forward_to_tag_toggle (end, spell->tag_unchecked);
+	if (!ctk_text_iter_starts_line (end))
+		ctk_text_iter_forward_line (end);
+
+	/* the words are checked whole */
+	if (ctk_text_iter_inside_word (start) && !ctk_text_iter_starts_word (start))
+		ctk_text_iter_backward_word_start (start);
+
+	limit = *start;
+	ctk_text_iter_forward_lines (&limit, CHECK_CHUNK_LINES);
+
+	if (ctk_text_iter_compare (&limit, end) < 0)
+		*end = limit;
+
+	/* a long line is split before a word */
+	limit = *start;
+	ctk_text_iter_forward_chars (&limit, CHECK_CHUNK_CHARS);
+
+	if (ctk_text_iter_compare (&limit, end) < 0)
+	{
+		if (ctk_text_iter_inside_word (&limit) && !ctk_text_iter_starts_word (&limit))
+		{
+			CtkTextIter word_start = limit;
+
+			/* unless the word is longer than the chunk */
+			if (ctk_text_iter_backward_word_start (&word_start) &&
+			    ctk_text_iter_compare (&word_start, start) > 0)
+				limit = word_start;
+			else
+				ctk_text_iter_forward_word_end (&limit);
+		}
+
+		if (ctk_text_iter_compare (&limit, end) < 0)
+			*end = limit;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+find_unchecked_lines (LapizAutomaticSpellChecker *spell,
+		      CtkTextIter                *start,
+		      CtkTextIter                *end)
+{
+	CtkTextIter range_start, range_end;
+	GSList *l;
+
+	for (l = spell->views; l != NULL; l = g_slist_next (l))
+	{
+		CtkTextView *view = CTK_TEXT_VIEW (l->data);
+		CdkRectangle rect;
+
+		ctk_text_view_get_visible_rect (view, &rect);
+		ctk_text_view_get_line_at_y (view, &range_start, rect.y, NULL);
+		ctk_text_view_get_line_at_y (view, &range_end, rect.y + rect.height, NULL);
+		ctk_text_iter_forward_line (&range_end);
+
+		if (find_unchecked_lines_in_range (spell, &range_start, &range_end, start, end))
+			return TRUE;
+	}
+
+	ctk_text_buffer_get_bounds (CTK_TEXT_BUFFER (spell->doc), &range_start, &range_end);
+
+	return find_unchecked_lines_in_range (spell, &range_start, &range_end, start, end);
+}
+
+static void schedule_check (LapizAutomaticSpellChecker *spell);
+
+static void
+words_checked (GObject      *source_object,
+	       GAsyncResult *result,
+	       gpointer      user_data)
+{
+	LapizAutomaticSpellChecker *spell = user_data;
+	GArray *verdicts;
+	GError *error = NULL;
+	guint i;
+
+	verdicts = lapiz_spell_checker_check_words_finish (LAPIZ_SPELL_CHECKER (source_object),
+							   result,
+							   &error);
+
+	/* only cancelled when the automatic spell checker is freed */
+	if (error != NULL)
+	{
+		g_error_free (error);
+		return;
+	}
+
+	g_clear_object (&spell->cancellable);
+
+	if (verdicts != NULL)
+	{
+		/* kept until the lines are checked, in case the
+		 * verdicts do not all fit in the cache */
+		spell->batch_verdicts = g_hash_table_new (g_str_hash, g_str_equal);
+
+		for (i = 0; i < verdicts->len; i++)
+		{
+			g_hash_table_insert (spell->batch_verdicts,
+					     g_ptr_array_index (spell->batch_words, i),
+					     GINT_TO_POINTER (g_array_index (verdicts, gboolean, i)));
+		}
+
+		g_array_unref (verdicts);
+	}
+	else
+	{
+		clear_batch (spell);
+	}
+
+	schedule_check (spell);
+}
+
+static void
+check_unknown_words (LapizAutomaticSpellChecker *spell,
+		     GHashTable                 *unknown)
+{
+	GHashTableIter iter;
+	gpointer word;
+
+	clear_batch (spell);
+
+	spell->batch_words = g_ptr_array_new_with_free_func (g_free);
+
+	g_hash_table_iter_init (&iter, unknown);
+	while (g_hash_table_iter_next (&iter, &word, NULL))
+	{
+		g_hash_table_iter_steal (&iter);
+		g_ptr_array_add (spell->batch_words, word);
+	}
+
+	spell->cancellable = g_cancellable_new ();
+
+	lapiz_spell_checker_check_words_async (spell->spell_checker,
+					       spell->batch_words,
+					       spell->cancellable,
+					       words_checked,
+					       spell);
+}
+
+static gboolean
+check_slice (LapizAutomaticSpellChecker *spell)
+{
+	gint64 deadline;
+	CtkTextIter start, end;
+
+	deadline = g_get_monotonic_time () + CHECK_SLICE_USEC;
+
+	do
+	{
+		GHashTable *unknown;
+		gboolean checked;
+
+		if (!find_unchecked_lines (spell, &start, &end))
+		{
+			clear_batch (spell);
+			spell->check_id = 0;
+
+			return G_SOURCE_REMOVE;
+		}
+
+		unknown = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+		checked = check_lines (spell, &start, &end, unknown);
+
+		if (!checked)
+		{
+			/* wait for the dictionary */
+			check_unknown_words (spell, unknown);
+			g_hash_table_destroy (unknown);
+			spell->check_id = 0;
+
+			return G_SOURCE_REMOVE;
+		}
+
+		g_hash_table_destroy (unknown);
+		clear_batch (spell);
+	}
+	while (g_get_monotonic_time () < deadline);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void
+schedule_check (LapizAutomaticSpellChecker *spell)
+{
+	/* a batch of words is being checked, the check goes on
+	 * once it is done */
+	if (spell->check_id != 0 || spell->cancellable != NULL)
+		return;
+
+	spell->check_id = g_idle_add_full (CHECK_PRIORITY,
+					   (GSourceFunc) check_slice,
+					   spell,
+					   NULL);
+}
+
+static void
+check_range_later (LapizAutomaticSpellChecker *spell,
+		   const CtkTextIter          *start,
+		   const CtkTextIter          *end)
+{
+	ctk_text_buffer_apply_tag (CTK_TEXT_BUFFER (spell->doc),
+				   spell->tag_unchecked,
+				   start,
+				   end);
+
+	schedule_check (spell);
+}
+
 static void
 check_deferred_range (LapizAutomaticSpellChecker *spell,
 		      gboolean                    force_all)
@@ -249,10 +714,17 @@ insert_text_after (CtkTextBuffer              *buffer,
 {
 	CtkTextIter start;
 
+	/* the whole document is checked once loaded */
+	if (lapiz_document_is_loading (spell->doc))
+		return;
+
 	/* we need to check a range of text. */
 	ctk_text_buffer_get_iter_at_mark (buffer, &start, spell->mark_insert_start);
 
-	check_range (spell, start, *iter, FALSE);
+	if (ctk_text_iter_get_line (iter) - ctk_text_iter_get_line (&start) > CHECK_CHUNK_LINES)
+		check_range_later (spell, &start, iter);
+	else
+		check_range (spell, start, *iter, FALSE);
 
 	ctk_text_buffer_move_mark (buffer, spell->mark_insert_end, iter);
 }
@@ -270,9 +742,21 @@ delete_range_after (CtkTextBuffer              *buffer G_GNUC_UNUSED,
 		    CtkTextIter                *end,
 		    LapizAutomaticSpellChecker *spell)
 {
+	if (lapiz_document_is_loading (spell->doc))
+		return;
+
 	check_range (spell, *start, *end, FALSE);
 }
 
+static void
+document_loaded (LapizDocument              *doc G_GNUC_UNUSED,
+		 const GError               *error,
+		 LapizAutomaticSpellChecker *spell)
+{
+	if (error == NULL)
+		lapiz_automatic_spell_checker_recheck_all (spell);
+}
+
 static void
 mark_set (CtkTextBuffer              *buffer,
 	  CtkTextIter                *iter G_GNUC_UNUSED,
@@ -583,7 +1067,7 @@ lapiz_automatic_spell_checker_recheck_all (LapizAutomaticSpellChecker *spell)
 
 	ctk_text_buffer_get_bounds (CTK_TEXT_BUFFER (spell->doc), &start, &end);
 
-	check_range (spell, start, end, TRUE);
+	check_range_later (spell, &start, &end);
 }
 
 static void
@@ -708,7 +1192,7 @@ highlight_updated (CtkSourceBuffer            *buffer G_GNUC_UNUSED,
 		   CtkTextIter                *end,
 		   LapizAutomaticSpellChecker *spell)
 {
-	check_range (spell, *start, *end, FALSE);
+	check_range_later (spell, start, end);
 }
 
 static void
@@ -768,6 +1252,10 @@ lapiz_automatic_spell_checker_new (LapizDocument     *doc,
 			  "mark-set",
 			  G_CALLBACK (mark_set),
 			  spell);
+	g_signal_connect (doc,
+			  "loaded",
+			  G_CALLBACK (document_loaded),
+			  spell);
 
 	g_signal_connect (doc,
 	                  "highlight-updated",
@@ -791,6 +1279,10 @@ lapiz_automatic_spell_checker_new (LapizDocument     *doc,
 			  G_CALLBACK (set_language_cb),
 			  spell);
 
+	spell->tag_unchecked = ctk_text_buffer_create_tag (CTK_TEXT_BUFFER (doc),
+							   NULL,
+							   NULL);
+
 	spell->tag_highlight = ctk_text_buffer_create_tag (
 				CTK_TEXT_BUFFER (doc),
 				"ctkspell-misspelled",
@@ -914,6 +1406,17 @@ lapiz_automatic_spell_checker_free_internal (LapizAutomaticSpellChecker *spell)
 
 	g_return_if_fail (spell != NULL);
 
+	if (spell->check_id != 0)
+		g_source_remove (spell->check_id);
+
+	if (spell->cancellable != NULL)
+	{
+		g_cancellable_cancel (spell->cancellable);
+		g_object_unref (spell->cancellable);
+	}
+
+	clear_batch (spell);
+
 	table = ctk_text_buffer_get_tag_table (CTK_TEXT_BUFFER (spell->doc));
 
 	if (table != NULL && spell->tag_highlight != NULL)
@@ -932,6 +1435,7 @@ lapiz_automatic_spell_checker_free_internal (LapizAutomaticSpellChecker *spell)
 					spell);
 
 		ctk_text_tag_table_remove (table, spell->tag_highlight);
+		ctk_text_tag_table_remove (table, spell->tag_unchecked);
 	}
 
 	g_signal_handlers_disconnect_matched (G_OBJECT (spell->doc),
@@ -0,0 +1,194 @@
+/*
+ * lapiz-spell-cache.c
+ * This file is part of lapiz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/* A least recently used cache of the dictionary verdicts, one per
+ * language, shared by the spell checkers of all the documents.
+ *
+ * Only the verdicts of the dictionary and of the personal word list
+ * are cached: the words added to the session of a spell checker must
+ * be handled by the spell checker itself. The caches are only used
+ * from the main thread.
+ */
+
+#include "lapiz-spell-cache.h"
+
+#define MAX_CACHED_WORDS 16384
+
+typedef struct
+{
+	gchar    *word;
+	gboolean  correct;
+} CacheEntry;
+
+struct _LapizSpellCache
+{
+	gint        ref_count;
+	gchar      *language_key;
+
+	/* word -> GList link in lru, whose data is a CacheEntry */
+	GHashTable *words;
+
+	/* most recently used first */
+	GQueue      lru;
+};
+
+/* language key -> LapizSpellCache */
+static GHashTable *caches = NULL;
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+	g_free (entry->word);
+	g_slice_free (CacheEntry, entry);
+}
+
+/**
+ * lapiz_spell_cache_get_for_language:
+ * @language_key: the key of the language, as returned by
+ * lapiz_spell_checker_language_to_key()
+ *
+ * Returns: (transfer full): the cache of @language_key, to be released
+ * with lapiz_spell_cache_unref()
+ */
+LapizSpellCache *
+lapiz_spell_cache_get_for_language (const gchar *language_key)
+{
+	LapizSpellCache *cache;
+
+	g_return_val_if_fail (language_key != NULL, NULL);
+
+	if (caches == NULL)
+		caches = g_hash_table_new (g_str_hash, g_str_equal);
+
+	cache = g_hash_table_lookup (caches, language_key);
+
+	if (cache != NULL)
+	{
+		++cache->ref_count;
+		return cache;
+	}
+
+	cache = g_slice_new0 (LapizSpellCache);
+	cache->ref_count = 1;
+	cache->language_key = g_strdup (language_key);
+	cache->words = g_hash_table_new (g_str_hash, g_str_equal);
+	g_queue_init (&cache->lru);
+
+	g_hash_table_insert (caches, cache->language_key, cache);
+
+	return cache;
+}
+
+void
+lapiz_spell_cache_unref (LapizSpellCache *cache)
+{
+	g_return_if_fail (cache != NULL);
+
+	if (--cache->ref_count > 0)
+		return;
+
+	g_hash_table_remove (caches, cache->language_key);
+
+	if (g_hash_table_size (caches) == 0)
+	{
+		g_hash_table_destroy (caches);
+		caches = NULL;
+	}
+
+	g_hash_table_destroy (cache->words);
+	g_queue_foreach (&cache->lru, (GFunc) cache_entry_free, NULL);
+	g_queue_clear (&cache->lru);
+
+	g_free (cache->language_key);
+	g_slice_free (LapizSpellCache, cache);
+}
+
+/**
+ * lapiz_spell_cache_lookup:
+ * @cache: a #LapizSpellCache
+ * @word: the word to look up
+ * @correct: (out): return location for the verdict
+ *
+ * Returns: %TRUE if the verdict of @word is in the cache
+ */
+gboolean
+lapiz_spell_cache_lookup (LapizSpellCache *cache,
+			  const gchar     *word,
+			  gboolean        *correct)
+{
+	GList *link;
+
+	g_return_val_if_fail (cache != NULL, FALSE);
+	g_return_val_if_fail (word != NULL, FALSE);
+
+	link = g_hash_table_lookup (cache->words, word);
+
+	if (link == NULL)
+		return FALSE;
+
+	if (link != cache->lru.head)
+	{
+		g_queue_unlink (&cache->lru, link);
+		g_queue_push_head_link (&cache->lru, link);
+	}
+
+	*correct = ((CacheEntry *) link->data)->correct;
+
+	return TRUE;
+}
+
+void
+lapiz_spell_cache_insert (LapizSpellCache *cache,
+			  const gchar     *word,
+			  gboolean         correct)
+{
+	CacheEntry *entry;
+	GList *link;
+
+	g_return_if_fail (cache != NULL);
+	g_return_if_fail (word != NULL);
+
+	link = g_hash_table_lookup (cache->words, word);
+
+	if (link != NULL)
+	{
+		((CacheEntry *) link->data)->correct = correct;
+
+		g_queue_unlink (&cache->lru, link);
+		g_queue_push_head_link (&cache->lru, link);
+
+		return;
+	}
+
+	if (cache->lru.length >= MAX_CACHED_WORDS)
+	{
+		entry = g_queue_pop_tail (&cache->lru);
+
+		g_hash_table_remove (cache->words, entry->word);
+		cache_entry_free (entry);
+	}
+
+	entry = g_slice_new (CacheEntry);
+	entry->word = g_strdup (word);
+	entry->correct = correct;
+
+	g_queue_push_head (&cache->lru, entry);
+	g_hash_table_insert (cache->words, entry->word, cache->lru.head);
+}
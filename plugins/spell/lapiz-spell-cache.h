@@ -0,0 +1,44 @@
+/*
+ * lapiz-spell-cache.h
+ * This file is part of lapiz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef __LAPIZ_SPELL_CACHE_H__
+#define __LAPIZ_SPELL_CACHE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _LapizSpellCache LapizSpellCache;
+
+LapizSpellCache	*lapiz_spell_cache_get_for_language	(const gchar     *language_key);
+
+void		 lapiz_spell_cache_unref		(LapizSpellCache *cache);
+
+gboolean	 lapiz_spell_cache_lookup		(LapizSpellCache *cache,
+							 const gchar     *word,
+							 gboolean        *correct);
+
+void		 lapiz_spell_cache_insert		(LapizSpellCache *cache,
+							 const gchar     *word,
+							 gboolean         correct);
+
+G_END_DECLS
+
+#endif /* __LAPIZ_SPELL_CACHE_H__ */
@@ -37,8 +37,10 @@
 
 #include <glib/gi18n.h>
 #include <glib.h>
+#include <gio/gio.h>
 
 #include "lapiz-spell-checker.h"
+#include "lapiz-spell-cache.h"
 #include "lapiz-spell-utils.h"
 #include "lapiz-spell-marshal.h"
 
@@ -49,8 +51,60 @@ struct _LapizSpellChecker
 	EnchantDict                     *dict;
 	EnchantBroker                   *broker;
 	const LapizSpellCheckerLanguage *active_lang;
+
+	/* the dictionary is also used by the threads checking the words
+	 * of lapiz_spell_checker_check_words_async(); the generation is
+	 * bumped every time the dictionary is released, so that the
+	 * verdicts of a released dictionary are discarded */
+	GMutex                           dict_lock;
+	guint                            dict_generation;
+
+	/* verdicts of the current language */
+	LapizSpellCache                 *cache;
+
+	/* words added to the session, which are not shared through
+	 * the cache */
+	GHashTable                      *session_words;
+
+	/* word -> NULL-terminated array of suggestions, filled by
+	 * lapiz_spell_checker_prefetch_suggestions(), and word -> GTask
+	 * of the prefetches still running */
+	GHashTable                      *suggestions;
+	GHashTable                      *pending_suggestions;
+
+	/* the prefetches use a dictionary of their own, from a broker of
+	 * their own since a broker hands out the same dictionary for a
+	 * language, so that the main thread never waits for them. It
+	 * misses the words added since it was requested, which only
+	 * matters for the suggestions. */
+	GMutex                           suggest_lock;
+	EnchantBroker                   *suggest_broker;
+	EnchantDict                     *suggest_dict;
+	gchar                           *suggest_lang;
 };
 
+/* the suggestions are only prefetched for the next few misspelled
+ * words, the table is simply emptied when it is full */
+#define MAX_CACHED_SUGGESTIONS 32
+
+typedef struct
+{
+	GPtrArray *words;
+	GArray    *verdicts;
+	guint      generation;
+} CheckWordsData;
+
+typedef struct
+{
+	gchar     *word;
+	gchar     *lang;
+	guint      generation;
+
+	/* set by the thread, the suggestions before done, atomic */
+	gchar    **suggestions;
+	gint       done;
+} SuggestData;
+
 /* GObject properties */
 enum {
 	PROP_0 = 0,
@@ -110,6 +164,30 @@ lapiz_spell_checker_get_property (GObject    *object,
 	}
 }
 
+static void
+release_dict (LapizSpellChecker *spell)
+{
+	g_mutex_lock (&spell->dict_lock);
+
+	if (spell->dict != NULL)
+	{
+		enchant_broker_free_dict (spell->broker, spell->dict);
+		spell->dict = NULL;
+	}
+
+	++spell->dict_generation;
+
+	g_mutex_unlock (&spell->dict_lock);
+
+	if (spell->cache != NULL)
+	{
+		lapiz_spell_cache_unref (spell->cache);
+		spell->cache = NULL;
+	}
+
+	g_hash_table_remove_all (spell->suggestions);
+}
+
 static void
 lapiz_spell_checker_finalize (GObject *object)
 {
@@ -119,12 +197,27 @@ lapiz_spell_checker_finalize (GObject *object)
 
 	spell_checker = LAPIZ_SPELL_CHECKER (object);
 
-	if (spell_checker->dict != NULL)
-		enchant_broker_free_dict (spell_checker->broker, spell_checker->dict);
+	release_dict (spell_checker);
 
 	if (spell_checker->broker != NULL)
 		enchant_broker_free (spell_checker->broker);
 
+	g_hash_table_destroy (spell_checker->session_words);
+	g_hash_table_destroy (spell_checker->suggestions);
+	g_hash_table_destroy (spell_checker->pending_suggestions);
+	g_mutex_clear (&spell_checker->dict_lock);
+
+	/* the running prefetches hold a reference to the checker */
+	if (spell_checker->suggest_dict != NULL)
+		enchant_broker_free_dict (spell_checker->suggest_broker,
+					  spell_checker->suggest_dict);
+
+	if (spell_checker->suggest_broker != NULL)
+		enchant_broker_free (spell_checker->suggest_broker);
+
+	g_free (spell_checker->suggest_lang);
+	g_mutex_clear (&spell_checker->suggest_lock);
+
 	G_OBJECT_CLASS (lapiz_spell_checker_parent_class)->finalize (object);
 }
 
@@ -199,6 +292,22 @@ lapiz_spell_checker_init (LapizSpellChecker *spell_checker)
 	spell_checker->broker = enchant_broker_init ();
 	spell_checker->dict = NULL;
 	spell_checker->active_lang = NULL;
+
+	g_mutex_init (&spell_checker->dict_lock);
+	spell_checker->session_words = g_hash_table_new_full (g_str_hash,
+							      g_str_equal,
+							      g_free,
+							      NULL);
+	spell_checker->suggestions = g_hash_table_new_full (g_str_hash,
+							    g_str_equal,
+							    g_free,
+							    (GDestroyNotify) g_strfreev);
+	spell_checker->pending_suggestions = g_hash_table_new_full (g_str_hash,
+								    g_str_equal,
+								    g_free,
+								    g_object_unref);
+
+	g_mutex_init (&spell_checker->suggest_lock);
 }
 
 LapizSpellChecker *
@@ -269,8 +378,13 @@ lazy_init (LapizSpellChecker               *spell,
 
 		key = lapiz_spell_checker_language_to_key (spell->active_lang);
 
+		g_mutex_lock (&spell->dict_lock);
 		spell->dict = enchant_broker_request_dict (spell->broker,
 							   key);
+		g_mutex_unlock (&spell->dict_lock);
+
+		if (spell->dict != NULL)
+			spell->cache = lapiz_spell_cache_get_for_language (key);
 	}
 
 	if (spell->dict == NULL)
@@ -294,11 +408,9 @@ lapiz_spell_checker_set_language (LapizSpellChecker               *spell,
 
 	g_return_val_if_fail (LAPIZ_IS_SPELL_CHECKER (spell), FALSE);
 
-	if (spell->dict != NULL)
-	{
-		enchant_broker_free_dict (spell->broker, spell->dict);
-		spell->dict = NULL;
-	}
+	/* the session goes away with the dictionary */
+	release_dict (spell);
+	g_hash_table_remove_all (spell->session_words);
 
 	ret = lazy_init (spell, language);
 
@@ -322,57 +434,250 @@ lapiz_spell_checker_get_language (LapizSpellChecker *spell)
 	return spell->active_lang;
 }
 
-gboolean
-lapiz_spell_checker_check_word (LapizSpellChecker *spell,
-				const gchar       *word,
-				gssize             len)
+/* checks @word against the dictionary of @generation, returns %FALSE
+ * in @correct if the word is misspelled or on error. Can be called
+ * from any thread. Returns %FALSE if the dictionary was released. */
+static gboolean
+dict_check_word (LapizSpellChecker *spell,
+		 guint              generation,
+		 const gchar       *word,
+		 gssize             len,
+		 gboolean          *correct)
 {
 	gint enchant_result;
-	gboolean res = FALSE;
 
-	g_return_val_if_fail (LAPIZ_IS_SPELL_CHECKER (spell), FALSE);
-	g_return_val_if_fail (word != NULL, FALSE);
+	g_mutex_lock (&spell->dict_lock);
 
-	if (!lazy_init (spell, spell->active_lang))
+	if (spell->dict == NULL || spell->dict_generation != generation)
+	{
+		g_mutex_unlock (&spell->dict_lock);
 		return FALSE;
+	}
 
-	if (len < 0)
-		len = strlen (word);
-
-	if (strcmp (word, "lapiz") == 0)
-		return TRUE;
+	enchant_result = enchant_dict_check (spell->dict, word, len);
 
-	if (lapiz_spell_utils_is_digit (word, len))
-		return TRUE;
+	if (enchant_result == -1)
+	{
+		g_warning ("Spell checker plugin: error checking word '%s' (%s).",
+			   word, enchant_dict_get_error (spell->dict));
+	}
 
-	g_return_val_if_fail (spell->dict != NULL, FALSE);
-	enchant_result = enchant_dict_check (spell->dict, word, len);
+	g_mutex_unlock (&spell->dict_lock);
 
 	switch (enchant_result)
 	{
 		case -1:
 			/* error */
-			res = FALSE;
-
-			g_warning ("Spell checker plugin: error checking word '%s' (%s).",
-				   word, enchant_dict_get_error (spell->dict));
-
+			*correct = FALSE;
 			break;
 		case 1:
 			/* it is not in the directory */
-			res = FALSE;
+			*correct = FALSE;
 			break;
 		case 0:
 			/* is is in the directory */
-			res = TRUE;
+			*correct = TRUE;
 			break;
 		default:
 			g_return_val_if_reached (FALSE);
 	}
 
+	return TRUE;
+}
+
+/**
+ * lapiz_spell_checker_lookup_word:
+ * @spell: a #LapizSpellChecker
+ * @word: a nul-terminated word
+ * @correct: (out): return location for the verdict
+ *
+ * Looks up the verdict of @word without consulting the dictionary:
+ * only the words that are always accepted, the words added to the
+ * session and the cached verdicts are known.
+ *
+ * Returns: %TRUE if the verdict of @word is known
+ */
+gboolean
+lapiz_spell_checker_lookup_word (LapizSpellChecker *spell,
+				 const gchar       *word,
+				 gboolean          *correct)
+{
+	g_return_val_if_fail (LAPIZ_IS_SPELL_CHECKER (spell), FALSE);
+	g_return_val_if_fail (word != NULL, FALSE);
+
+	if (!lazy_init (spell, spell->active_lang))
+	{
+		*correct = FALSE;
+		return TRUE;
+	}
+
+	if ((strcmp (word, "lapiz") == 0) ||
+	    lapiz_spell_utils_is_digit (word, -1) ||
+	    g_hash_table_contains (spell->session_words, word))
+	{
+		*correct = TRUE;
+		return TRUE;
+	}
+
+	return lapiz_spell_cache_lookup (spell->cache, word, correct);
+}
+
+gboolean
+lapiz_spell_checker_check_word (LapizSpellChecker *spell,
+				const gchar       *word,
+				gssize             len)
+{
+	gchar *w = NULL;
+	gboolean res = FALSE;
+
+	g_return_val_if_fail (LAPIZ_IS_SPELL_CHECKER (spell), FALSE);
+	g_return_val_if_fail (word != NULL, FALSE);
+
+	if (len >= 0 && word[len] != '\0')
+		word = w = g_strndup (word, len);
+
+	if (!lapiz_spell_checker_lookup_word (spell, word, &res))
+	{
+		if (dict_check_word (spell, spell->dict_generation, word, -1, &res))
+			lapiz_spell_cache_insert (spell->cache, word, res);
+	}
+
+	g_free (w);
+
 	return res;
 }
 
+static void
+check_words_data_free (CheckWordsData *data)
+{
+	g_ptr_array_unref (data->words);
+	g_array_unref (data->verdicts);
+	g_slice_free (CheckWordsData, data);
+}
+
+static void
+check_words_thread (GTask        *task,
+		    gpointer      source_object,
+		    gpointer      task_data,
+		    GCancellable *cancellable G_GNUC_UNUSED)
+{
+	LapizSpellChecker *spell = source_object;
+	CheckWordsData *data = task_data;
+	guint i;
+
+	for (i = 0; i < data->words->len; i++)
+	{
+		gboolean correct;
+
+		if (g_task_return_error_if_cancelled (task))
+			return;
+
+		/* the lock is taken word by word, so that the main thread
+		 * never waits for more than one lookup */
+		if (!dict_check_word (spell,
+				      data->generation,
+				      g_ptr_array_index (data->words, i),
+				      -1,
+				      &correct))
+		{
+			g_task_return_boolean (task, FALSE);
+			return;
+		}
+
+		g_array_append_val (data->verdicts, correct);
+	}
+
+	g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * lapiz_spell_checker_check_words_async:
+ * @spell: a #LapizSpellChecker
+ * @words: (element-type utf8): the nul-terminated words to check
+ * @cancellable: (allow-none): a #GCancellable
+ * @callback: called when the words have been checked
+ * @user_data: data for @callback
+ *
+ * Checks a batch of words against the dictionary in a worker thread.
+ * The verdicts are added to the cache, so that they are returned by
+ * lapiz_spell_checker_lookup_word() afterwards.
+ */
+void
+lapiz_spell_checker_check_words_async (LapizSpellChecker   *spell,
+				       GPtrArray           *words,
+				       GCancellable        *cancellable,
+				       GAsyncReadyCallback  callback,
+				       gpointer             user_data)
+{
+	GTask *task;
+	CheckWordsData *data;
+
+	g_return_if_fail (LAPIZ_IS_SPELL_CHECKER (spell));
+	g_return_if_fail (words != NULL);
+
+	task = g_task_new (spell, cancellable, callback, user_data);
+
+	if (!lazy_init (spell, spell->active_lang))
+	{
+		g_task_return_boolean (task, FALSE);
+		g_object_unref (task);
+		return;
+	}
+
+	data = g_slice_new (CheckWordsData);
+	data->words = g_ptr_array_ref (words);
+	data->verdicts = g_array_sized_new (FALSE, FALSE, sizeof (gboolean), words->len);
+	data->generation = spell->dict_generation;
+
+	g_task_set_task_data (task, data, (GDestroyNotify) check_words_data_free);
+	g_task_run_in_thread (task, check_words_thread);
+	g_object_unref (task);
+}
+
+/**
+ * lapiz_spell_checker_check_words_finish:
+ * @spell: a #LapizSpellChecker
+ * @result: the #GAsyncResult passed to the callback
+ * @error: return location for a #GError
+ *
+ * Returns: (transfer full): the verdicts of the words, in the same
+ * order, or %NULL if the dictionary changed in the meantime or on
+ * error
+ */
+GArray *
+lapiz_spell_checker_check_words_finish (LapizSpellChecker  *spell,
+					GAsyncResult       *result,
+					GError            **error)
+{
+	CheckWordsData *data;
+	guint i;
+
+	g_return_val_if_fail (LAPIZ_IS_SPELL_CHECKER (spell), NULL);
+	g_return_val_if_fail (g_task_is_valid (result, spell), NULL);
+
+	if (!g_task_propagate_boolean (G_TASK (result), error))
+		return NULL;
+
+	data = g_task_get_task_data (G_TASK (result));
+
+	if (data->generation != spell->dict_generation)
+		return NULL;
+
+	for (i = 0; i < data->words->len; i++)
+	{
+		const gchar *word = g_ptr_array_index (data->words, i);
+
+		/* the word may have been added to the session meanwhile */
+		if (!g_hash_table_contains (spell->session_words, word))
+		{
+			lapiz_spell_cache_insert (spell->cache,
+						  word,
+						  g_array_index (data->verdicts, gboolean, i));
+		}
+	}
+
+	return g_array_ref (data->verdicts);
+}
 
 /* return NULL on error or if no suggestions are found */
 GSList *
@@ -396,7 +701,44 @@ lapiz_spell_checker_get_suggestions (LapizSpellChecker *spell,
 	if (len < 0)
 		len = strlen (word);
 
+	if (word[len] == '\0')
+	{
+		gchar **cached;
+		GTask *pending;
+
+		cached = g_hash_table_lookup (spell->suggestions, word);
+
+		/* a prefetch which is done but not handed over yet saves
+		 * computing them again; one still running is not waited
+		 * for, the dictionary of the main thread is faster to get */
+		pending = g_hash_table_lookup (spell->pending_suggestions, word);
+
+		if (cached == NULL && pending != NULL)
+		{
+			SuggestData *data = g_task_get_task_data (pending);
+
+			if (data->generation == spell->dict_generation &&
+			    g_atomic_int_get (&data->done))
+			{
+				cached = data->suggestions;
+			}
+		}
+
+		if (cached != NULL)
+		{
+			for (i = 0; cached[i] != NULL; i++)
+			{
+				suggestions_list = g_slist_prepend (suggestions_list,
+								    g_strdup (cached[i]));
+			}
+
+			return g_slist_reverse (suggestions_list);
+		}
+	}
+
+	g_mutex_lock (&spell->dict_lock);
 	suggestions = enchant_dict_suggest (spell->dict, word, len, &n_suggestions);
+	g_mutex_unlock (&spell->dict_lock);
 
 	if (n_suggestions == 0)
 		return NULL;
@@ -417,11 +759,144 @@ lapiz_spell_checker_get_suggestions (LapizSpellChecker *spell,
 	return suggestions_list;
 }
 
+static void
+suggest_data_free (SuggestData *data)
+{
+	g_free (data->word);
+	g_free (data->lang);
+	g_strfreev (data->suggestions);
+	g_slice_free (SuggestData, data);
+}
+
+static void
+suggest_thread (GTask        *task,
+		gpointer      source_object,
+		gpointer      task_data,
+		GCancellable *cancellable G_GNUC_UNUSED)
+{
+	LapizSpellChecker *spell = source_object;
+	SuggestData *data = task_data;
+	gchar **suggestions = NULL;
+	gchar **result;
+	size_t n_suggestions = 0;
+	size_t i;
+
+	g_mutex_lock (&spell->suggest_lock);
+
+	if (g_strcmp0 (spell->suggest_lang, data->lang) != 0)
+	{
+		if (spell->suggest_dict != NULL)
+			enchant_broker_free_dict (spell->suggest_broker, spell->suggest_dict);
+
+		if (spell->suggest_broker == NULL)
+			spell->suggest_broker = enchant_broker_init ();
+
+		spell->suggest_dict = enchant_broker_request_dict (spell->suggest_broker,
+								   data->lang);
+
+		g_free (spell->suggest_lang);
+		spell->suggest_lang = g_strdup (data->lang);
+	}
+
+	if (spell->suggest_dict != NULL)
+		suggestions = enchant_dict_suggest (spell->suggest_dict,
+						    data->word,
+						    -1,
+						    &n_suggestions);
+
+	result = g_new0 (gchar *, n_suggestions + 1);
+
+	/* The single suggestions are freed with the array */
+	for (i = 0; i < n_suggestions; i++)
+		result[i] = suggestions[i];
+
+	g_free (suggestions);
+
+	g_mutex_unlock (&spell->suggest_lock);
+
+	data->suggestions = result;
+	g_atomic_int_set (&data->done, TRUE);
+
+	g_task_return_boolean (task, TRUE);
+}
+
+static void
+suggest_ready (GObject      *source_object,
+	       GAsyncResult *result,
+	       gpointer      user_data G_GNUC_UNUSED)
+{
+	LapizSpellChecker *spell = LAPIZ_SPELL_CHECKER (source_object);
+	SuggestData *data;
+
+	data = g_task_get_task_data (G_TASK (result));
+
+	/* the prefetch was dropped by lapiz_spell_checker_set_correction() */
+	if (g_hash_table_lookup (spell->pending_suggestions, data->word) != result)
+		return;
+
+	if (data->generation == spell->dict_generation)
+	{
+		if (g_hash_table_size (spell->suggestions) >= MAX_CACHED_SUGGESTIONS)
+			g_hash_table_remove_all (spell->suggestions);
+
+		g_hash_table_insert (spell->suggestions,
+				     g_strdup (data->word),
+				     data->suggestions);
+		data->suggestions = NULL;
+	}
+
+	/* drops the last reference to the task */
+	g_hash_table_remove (spell->pending_suggestions, data->word);
+}
+
+/**
+ * lapiz_spell_checker_prefetch_suggestions:
+ * @spell: a #LapizSpellChecker
+ * @word: a nul-terminated misspelled word
+ *
+ * Computes the suggestions for @word in a worker thread, so that
+ * the next lapiz_spell_checker_get_suggestions() call for @word
+ * returns at once.
+ */
+void
+lapiz_spell_checker_prefetch_suggestions (LapizSpellChecker *spell,
+					  const gchar       *word)
+{
+	GTask *task;
+	SuggestData *data;
+
+	g_return_if_fail (LAPIZ_IS_SPELL_CHECKER (spell));
+	g_return_if_fail (word != NULL);
+
+	if (g_hash_table_contains (spell->suggestions, word) ||
+	    g_hash_table_contains (spell->pending_suggestions, word))
+	{
+		return;
+	}
+
+	if (!lazy_init (spell, spell->active_lang))
+		return;
+
+	data = g_slice_new0 (SuggestData);
+	data->word = g_strdup (word);
+	data->lang = g_strdup (lapiz_spell_checker_language_to_key (spell->active_lang));
+	data->generation = spell->dict_generation;
+
+	task = g_task_new (spell, NULL, suggest_ready, NULL);
+	g_task_set_task_data (task, data, (GDestroyNotify) suggest_data_free);
+
+	g_hash_table_insert (spell->pending_suggestions, g_strdup (word), task);
+
+	g_task_run_in_thread (task, suggest_thread);
+}
+
 gboolean
 lapiz_spell_checker_add_word_to_personal (LapizSpellChecker *spell,
 					  const gchar       *word,
 					  gssize             len)
 {
+	gchar *w;
+
 	g_return_val_if_fail (LAPIZ_IS_SPELL_CHECKER (spell), FALSE);
 	g_return_val_if_fail (word != NULL, FALSE);
 
@@ -433,8 +908,14 @@ lapiz_spell_checker_add_word_to_personal (LapizSpellChecker *spell,
 	if (len < 0)
 		len = strlen (word);
 
+	g_mutex_lock (&spell->dict_lock);
 	enchant_dict_add (spell->dict, word, len);
+	g_mutex_unlock (&spell->dict_lock);
 
+	/* the personal word list is shared by all the documents */
+	w = g_strndup (word, len);
+	lapiz_spell_cache_insert (spell->cache, w, TRUE);
+	g_free (w);
 
 	g_signal_emit (G_OBJECT (spell), signals[ADD_WORD_TO_PERSONAL], 0, word, len);
 
@@ -457,7 +938,11 @@ lapiz_spell_checker_add_word_to_session (LapizSpellChecker *spell,
 	if (len < 0)
 		len = strlen (word);
 
+	g_mutex_lock (&spell->dict_lock);
 	enchant_dict_add_to_session (spell->dict, word, len);
+	g_mutex_unlock (&spell->dict_lock);
+
+	g_hash_table_add (spell->session_words, g_strndup (word, len));
 
 	g_signal_emit (G_OBJECT (spell), signals[ADD_WORD_TO_SESSION], 0, word, len);
 
@@ -470,11 +955,8 @@ lapiz_spell_checker_clear_session (LapizSpellChecker *spell)
 	g_return_val_if_fail (LAPIZ_IS_SPELL_CHECKER (spell), FALSE);
 
 	/* free and re-request dictionary */
-	if (spell->dict != NULL)
-	{
-		enchant_broker_free_dict (spell->broker, spell->dict);
-		spell->dict = NULL;
-	}
+	release_dict (spell);
+	g_hash_table_remove_all (spell->session_words);
 
 	if (!lazy_init (spell, spell->active_lang))
 		return FALSE;
@@ -495,6 +977,8 @@ lapiz_spell_checker_set_correction (LapizSpellChecker *spell,
 				    const gchar       *replacement,
 				    gssize             r_len)
 {
+	gchar *w;
+
 	g_return_val_if_fail (LAPIZ_IS_SPELL_CHECKER (spell), FALSE);
 	g_return_val_if_fail (word != NULL, FALSE);
 	g_return_val_if_fail (replacement != NULL, FALSE);
@@ -510,11 +994,19 @@ lapiz_spell_checker_set_correction (LapizSpellChecker *spell,
 	if (r_len < 0)
 		r_len = strlen (replacement);
 
+	g_mutex_lock (&spell->dict_lock);
 	enchant_dict_store_replacement (spell->dict,
 					word,
 					w_len,
 					replacement,
 					r_len);
+	g_mutex_unlock (&spell->dict_lock);
+
+	/* the suggestions of the word may start with the replacement now */
+	w = g_strndup (word, w_len);
+	g_hash_table_remove (spell->suggestions, w);
+	g_hash_table_remove (spell->pending_suggestions, w);
+	g_free (w);
 
 	return TRUE;
 }
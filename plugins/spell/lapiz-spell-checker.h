@@ -32,6 +32,7 @@
 
 #include <glib.h>
 #include <glib-object.h>
+#include <gio/gio.h>
 
 #include "lapiz-spell-checker-language.h"
 
@@ -82,10 +83,28 @@ gboolean		 lapiz_spell_checker_check_word 	(LapizSpellChecker               *spe
 								 const gchar                     *word,
 								 gssize                           len);
 
+gboolean		 lapiz_spell_checker_lookup_word	(LapizSpellChecker               *spell,
+								 const gchar                     *word,
+								 gboolean                        *correct);
+
+void			 lapiz_spell_checker_check_words_async	(LapizSpellChecker               *spell,
+								 GPtrArray                       *words,
+								 GCancellable                    *cancellable,
+								 GAsyncReadyCallback              callback,
+								 gpointer                         user_data);
+
+GArray			*lapiz_spell_checker_check_words_finish	(LapizSpellChecker               *spell,
+								 GAsyncResult                    *result,
+								 GError                         **error);
+
 GSList 			*lapiz_spell_checker_get_suggestions 	(LapizSpellChecker               *spell,
 								 const gchar                     *word,
 								 gssize                           len);
 
+void			 lapiz_spell_checker_prefetch_suggestions
+								(LapizSpellChecker               *spell,
+								 const gchar                     *word);
+
 gboolean		 lapiz_spell_checker_add_word_to_personal
 								(LapizSpellChecker               *spell,
 								 const gchar                     *word,
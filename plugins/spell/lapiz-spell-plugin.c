@@ -141,6 +141,17 @@ typedef enum
 	AUTOCHECK_ALWAYS
 } LapizSpellPluginAutocheckType;
 
+/* The "Check Spelling" dialog walks the misspelled words of the check
+ * range from the current mark. The words ahead of it are scanned in idle
+ * slices: the misspelled ones are queued, and their suggestions computed
+ * in a worker thread for the first few of them, while the user looks at
+ * the current one. The words whose verdict is not cached yet are checked
+ * against the dictionary in batches, in a worker thread too. */
+#define SCAN_QUEUE_LENGTH	32
+#define SCAN_PREFETCH		3
+#define SCAN_BATCH_WORDS	256
+#define SCAN_SLICE_USEC		4000
+
 typedef struct _CheckRange CheckRange;
 
 struct _CheckRange
@@ -152,8 +163,27 @@ struct _CheckRange
 	gint mw_end;   /* end */
 
 	CtkTextMark *current_mark;
+
+	/* the words before it have been scanned */
+	CtkTextMark *scan_mark;
+
+	/* the misspelled words found by the scan, as MisspelledWord */
+	GQueue misspelled;
+
+	guint scan_id;
+
+	/* the batch of words being checked, and the offset of the
+	 * end of the last batch */
+	GCancellable *cancellable;
+	gint batch_end;
 };
 
+typedef struct
+{
+	CtkTextMark *start;
+	CtkTextMark *end;
+} MisspelledWord;
+
 static GQuark spell_checker_id = 0;
 static GQuark check_range_id = 0;
 
@@ -362,6 +392,390 @@ update_current (LapizDocument *doc,
 	}
 }
 
+static void
+misspelled_word_free (MisspelledWord *mw)
+{
+	g_slice_free (MisspelledWord, mw);
+}
+
+/* the check range goes away with the document, so its marks
+ * are not deleted here */
+static void
+check_range_free (CheckRange *range)
+{
+	if (range->scan_id != 0)
+		g_source_remove (range->scan_id);
+
+	if (range->cancellable != NULL)
+	{
+		g_cancellable_cancel (range->cancellable);
+		g_object_unref (range->cancellable);
+	}
+
+	g_queue_foreach (&range->misspelled, (GFunc) misspelled_word_free, NULL);
+	g_queue_clear (&range->misspelled);
+
+	g_free (range);
+}
+
+static void
+clear_scan (LapizDocument *doc,
+	    CheckRange    *range)
+{
+	MisspelledWord *mw;
+
+	while ((mw = g_queue_pop_head (&range->misspelled)) != NULL)
+	{
+		ctk_text_buffer_delete_mark (CTK_TEXT_BUFFER (doc), mw->start);
+		ctk_text_buffer_delete_mark (CTK_TEXT_BUFFER (doc), mw->end);
+		misspelled_word_free (mw);
+	}
+
+	if (range->scan_id != 0)
+	{
+		g_source_remove (range->scan_id);
+		range->scan_id = 0;
+	}
+
+	if (range->cancellable != NULL)
+	{
+		g_cancellable_cancel (range->cancellable);
+		g_clear_object (&range->cancellable);
+	}
+
+	range->batch_end = -1;
+}
+
+/* gets the word starting at @start, as get_current_word() does
+ * for the current mark */
+static gboolean
+get_word_at (const CtkTextIter *start,
+	     CtkTextIter       *end,
+	     const CtkTextIter *range_end)
+{
+	*end = *start;
+
+	if (!ctk_text_iter_is_end (end))
+		ctk_text_iter_forward_word_end (end);
+
+	if (ctk_text_iter_compare (end, range_end) > 0)
+		*end = *range_end;
+
+	return ctk_text_iter_compare (start, end) < 0;
+}
+
+/* moves @iter to the next word, as goto_next_word() does
+ * for the current mark */
+static gboolean
+forward_to_next_word (CtkTextIter       *iter,
+		      const CtkTextIter *range_end)
+{
+	CtkTextIter old_iter;
+	CtkTextIter end_iter;
+
+	ctk_text_buffer_get_end_iter (ctk_text_iter_get_buffer (iter), &end_iter);
+
+	old_iter = *iter;
+
+	ctk_text_iter_forward_word_ends (iter, 2);
+	ctk_text_iter_backward_word_start (iter);
+
+	return lapiz_spell_utils_skip_no_spell_check (iter, &end_iter) &&
+	       (ctk_text_iter_compare (&old_iter, iter) < 0) &&
+	       (ctk_text_iter_compare (iter, &end_iter) < 0) &&
+	       (ctk_text_iter_compare (iter, range_end) < 0);
+}
+
+static void
+prefetch_suggestions (LapizDocument     *doc,
+		      CheckRange        *range,
+		      LapizSpellChecker *spell)
+{
+	GList *l;
+	gint n;
+
+	for (l = range->misspelled.head, n = 0;
+	     l != NULL && n < SCAN_PREFETCH;
+	     l = l->next, n++)
+	{
+		MisspelledWord *mw = l->data;
+		CtkTextIter start, end;
+		gchar *word;
+
+		ctk_text_buffer_get_iter_at_mark (CTK_TEXT_BUFFER (doc), &start, mw->start);
+		ctk_text_buffer_get_iter_at_mark (CTK_TEXT_BUFFER (doc), &end, mw->end);
+
+		word = ctk_text_buffer_get_slice (CTK_TEXT_BUFFER (doc), &start, &end, TRUE);
+		lapiz_spell_checker_prefetch_suggestions (spell, word);
+		g_free (word);
+	}
+}
+
+static void schedule_scan (LapizDocument *doc);
+
+static void
+scan_words_checked (GObject      *source_object,
+		    GAsyncResult *result,
+		    gpointer      user_data)
+{
+	LapizDocument *doc = user_data;
+	CheckRange *range;
+	GArray *verdicts;
+	GError *error = NULL;
+
+	verdicts = lapiz_spell_checker_check_words_finish (LAPIZ_SPELL_CHECKER (source_object),
+							   result,
+							   &error);
+
+	/* cancelled, the document may be gone */
+	if (error != NULL)
+	{
+		g_error_free (error);
+		return;
+	}
+
+	range = get_check_range (doc);
+	g_clear_object (&range->cancellable);
+
+	if (verdicts != NULL)
+		g_array_unref (verdicts);
+	else
+		range->batch_end = -1;
+
+	schedule_scan (doc);
+}
+
+/* checks the words from @start in a batch, the verdicts end up in
+ * the cache of the spell checker */
+static void
+check_words_ahead (LapizDocument     *doc,
+		   CheckRange        *range,
+		   LapizSpellChecker *spell,
+		   const CtkTextIter *start,
+		   const CtkTextIter *range_end)
+{
+	GHashTable *unknown;
+	GPtrArray *words;
+	CtkTextIter iter, end;
+	gint n;
+
+	unknown = g_hash_table_new (g_str_hash, g_str_equal);
+	words = g_ptr_array_new_with_free_func (g_free);
+
+	iter = *start;
+	end = iter;
+
+	for (n = 0; n < SCAN_BATCH_WORDS; n++)
+	{
+		gchar *word;
+		gboolean correct;
+
+		if (!get_word_at (&iter, &end, range_end))
+			break;
+
+		word = ctk_text_buffer_get_slice (CTK_TEXT_BUFFER (doc), &iter, &end, TRUE);
+
+		if (lapiz_spell_checker_lookup_word (spell, word, &correct) ||
+		    g_hash_table_contains (unknown, word))
+		{
+			g_free (word);
+		}
+		else
+		{
+			g_hash_table_add (unknown, word);
+			g_ptr_array_add (words, word);
+		}
+
+		if (!forward_to_next_word (&iter, range_end))
+			break;
+	}
+
+	range->batch_end = ctk_text_iter_get_offset (&end);
+
+	/* the words are owned by the array */
+	g_hash_table_destroy (unknown);
+
+	range->cancellable = g_cancellable_new ();
+
+	lapiz_spell_checker_check_words_async (spell,
+					       words,
+					       range->cancellable,
+					       scan_words_checked,
+					       doc);
+
+	g_ptr_array_unref (words);
+}
+
+static void
+queue_misspelled_word (LapizDocument     *doc,
+		       CheckRange        *range,
+		       LapizSpellChecker *spell,
+		       const CtkTextIter *start,
+		       const CtkTextIter *end,
+		       const gchar       *word)
+{
+	MisspelledWord *mw;
+
+	mw = g_slice_new (MisspelledWord);
+	mw->start = ctk_text_buffer_create_mark (CTK_TEXT_BUFFER (doc), NULL, start, TRUE);
+	mw->end = ctk_text_buffer_create_mark (CTK_TEXT_BUFFER (doc), NULL, end, FALSE);
+
+	g_queue_push_tail (&range->misspelled, mw);
+
+	if (g_queue_get_length (&range->misspelled) <= SCAN_PREFETCH)
+		lapiz_spell_checker_prefetch_suggestions (spell, word);
+}
+
+static gboolean
+scan_slice (LapizDocument *doc)
+{
+	CheckRange *range;
+	LapizSpellChecker *spell;
+	CtkTextIter start, end, range_end;
+	gint64 deadline;
+
+	range = get_check_range (doc);
+	spell = get_spell_checker_from_document (doc);
+
+	deadline = g_get_monotonic_time () + SCAN_SLICE_USEC;
+
+	ctk_text_buffer_get_iter_at_mark (CTK_TEXT_BUFFER (doc),
+					  &range_end,
+					  range->end_mark);
+
+	/* the scan stops when enough words are queued, and goes on
+	 * when they are shown */
+	while (g_queue_get_length (&range->misspelled) < SCAN_QUEUE_LENGTH)
+	{
+		gchar *word;
+		gboolean correct;
+
+		ctk_text_buffer_get_iter_at_mark (CTK_TEXT_BUFFER (doc),
+						  &start,
+						  range->scan_mark);
+
+		if (!get_word_at (&start, &end, &range_end))
+			break;
+
+		word = ctk_text_buffer_get_slice (CTK_TEXT_BUFFER (doc), &start, &end, TRUE);
+
+		if (!lapiz_spell_checker_lookup_word (spell, word, &correct))
+		{
+			if (ctk_text_iter_get_offset (&start) >= range->batch_end)
+			{
+				g_free (word);
+
+				/* wait for the dictionary */
+				check_words_ahead (doc, range, spell, &start, &range_end);
+				range->scan_id = 0;
+
+				return G_SOURCE_REMOVE;
+			}
+
+			/* already in the last batch, but not in the
+			 * cache anymore */
+			correct = lapiz_spell_checker_check_word (spell, word, -1);
+		}
+
+		if (!correct)
+			queue_misspelled_word (doc, range, spell, &start, &end, word);
+
+		g_free (word);
+
+		if (!forward_to_next_word (&start, &range_end))
+			start = range_end;
+
+		ctk_text_buffer_move_mark (CTK_TEXT_BUFFER (doc),
+					   range->scan_mark,
+					   &start);
+
+		if (g_get_monotonic_time () >= deadline)
+			return G_SOURCE_CONTINUE;
+	}
+
+	range->scan_id = 0;
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+schedule_scan (LapizDocument *doc)
+{
+	CheckRange *range;
+
+	range = get_check_range (doc);
+
+	if (range->scan_id != 0 || range->cancellable != NULL)
+		return;
+
+	range->scan_id = g_idle_add_full (G_PRIORITY_LOW,
+					  (GSourceFunc) scan_slice,
+					  doc,
+					  NULL);
+}
+
+/* the words between the current mark and the scan mark are only
+ * known not to be misspelled as long as they are not edited, the
+ * scan starts over from the current mark when they are */
+static void
+edited_check_range (LapizDocument *doc,
+		    gint           start,
+		    gint           end)
+{
+	CheckRange *range;
+	CtkTextIter current_iter, scan_iter;
+
+	range = get_check_range (doc);
+
+	ctk_text_buffer_get_iter_at_mark (CTK_TEXT_BUFFER (doc),
+					  &current_iter,
+					  range->current_mark);
+	ctk_text_buffer_get_iter_at_mark (CTK_TEXT_BUFFER (doc),
+					  &scan_iter,
+					  range->scan_mark);
+
+	if (end < ctk_text_iter_get_offset (&current_iter) ||
+	    start > ctk_text_iter_get_offset (&scan_iter))
+	{
+		return;
+	}
+
+	clear_scan (doc, range);
+
+	ctk_text_buffer_move_mark (CTK_TEXT_BUFFER (doc),
+				   range->scan_mark,
+				   &current_iter);
+}
+
+static void
+on_check_range_insert_text (CtkTextBuffer *buffer,
+			    CtkTextIter   *location,
+			    gchar         *text,
+			    gint           len,
+			    gpointer       user_data G_GNUC_UNUSED)
+{
+	gint end;
+
+	/* @location is at the end of the inserted text by now */
+	end = ctk_text_iter_get_offset (location);
+
+	edited_check_range (LAPIZ_DOCUMENT (buffer),
+			    end - g_utf8_strlen (text, len),
+			    end);
+}
+
+static void
+on_check_range_delete_range (CtkTextBuffer *buffer,
+			     CtkTextIter   *start,
+			     CtkTextIter   *end G_GNUC_UNUSED,
+			     gpointer       user_data G_GNUC_UNUSED)
+{
+	/* both iters are where the text was by now */
+	edited_check_range (LAPIZ_DOCUMENT (buffer),
+			    ctk_text_iter_get_offset (start),
+			    ctk_text_iter_get_offset (start));
+}
+
 static void
 set_check_range (LapizDocument *doc,
 		 CtkTextIter   *start,
@@ -391,10 +805,23 @@ set_check_range (LapizDocument *doc,
 		range->current_mark = ctk_text_buffer_create_mark (CTK_TEXT_BUFFER (doc),
 				"check_range_current_mark", &iter, TRUE);
 
+		range->scan_mark = ctk_text_buffer_create_mark (CTK_TEXT_BUFFER (doc),
+				"check_range_scan_mark", &iter, TRUE);
+
+		range->batch_end = -1;
+
 		g_object_set_qdata_full (G_OBJECT (doc),
 				 check_range_id,
 				 range,
-				 (GDestroyNotify)g_free);
+				 (GDestroyNotify)check_range_free);
+
+		/* the range goes away with the document, and so do these */
+		g_signal_connect_after (doc, "insert-text",
+					G_CALLBACK (on_check_range_insert_text),
+					NULL);
+		g_signal_connect_after (doc, "delete-range",
+					G_CALLBACK (on_check_range_delete_range),
+					NULL);
 	}
 
 	if (lapiz_spell_utils_skip_no_spell_check (start, end))
@@ -433,6 +860,17 @@ set_check_range (LapizDocument *doc,
 	range->mw_end = -1;
 
 	update_current (doc, ctk_text_iter_get_offset (start));
+
+	clear_scan (doc, range);
+
+	ctk_text_buffer_get_iter_at_mark (CTK_TEXT_BUFFER (doc),
+					  &iter,
+					  range->current_mark);
+	ctk_text_buffer_move_mark (CTK_TEXT_BUFFER (doc),
+				   range->scan_mark,
+				   &iter);
+
+	schedule_scan (doc);
 }
 
 static gchar *
@@ -519,6 +957,66 @@ goto_next_word (LapizDocument *doc)
 	return FALSE;
 }
 
+/* pops the next word queued by the scan which is still misspelled */
+static gchar *
+pop_misspelled_word (LapizDocument     *doc,
+		     CheckRange        *range,
+		     LapizSpellChecker *spell,
+		     gint              *start,
+		     gint              *end)
+{
+	MisspelledWord *mw;
+	CtkTextIter current_iter, range_end;
+
+	ctk_text_buffer_get_iter_at_mark (CTK_TEXT_BUFFER (doc),
+					  &current_iter,
+					  range->current_mark);
+	ctk_text_buffer_get_iter_at_mark (CTK_TEXT_BUFFER (doc),
+					  &range_end,
+					  range->end_mark);
+
+	while ((mw = g_queue_pop_head (&range->misspelled)) != NULL)
+	{
+		CtkTextIter s, e;
+		gchar *word = NULL;
+
+		ctk_text_buffer_get_iter_at_mark (CTK_TEXT_BUFFER (doc), &s, mw->start);
+		ctk_text_buffer_get_iter_at_mark (CTK_TEXT_BUFFER (doc), &e, mw->end);
+
+		ctk_text_buffer_delete_mark (CTK_TEXT_BUFFER (doc), mw->start);
+		ctk_text_buffer_delete_mark (CTK_TEXT_BUFFER (doc), mw->end);
+		misspelled_word_free (mw);
+
+		/* the text may have changed since the word was queued, or
+		 * the word may have been ignored or added meanwhile */
+		if (ctk_text_iter_compare (&s, &current_iter) < 0 ||
+		    ctk_text_iter_compare (&s, &e) >= 0)
+		{
+			continue;
+		}
+
+		word = ctk_text_buffer_get_slice (CTK_TEXT_BUFFER (doc), &s, &e, TRUE);
+
+		if (lapiz_spell_checker_check_word (spell, word, -1))
+		{
+			g_free (word);
+			continue;
+		}
+
+		*start = ctk_text_iter_get_offset (&s);
+		*end = ctk_text_iter_get_offset (&e);
+
+		if (forward_to_next_word (&s, &range_end))
+			update_current (doc, ctk_text_iter_get_offset (&s));
+		else
+			update_current (doc, ctk_text_buffer_get_char_count (CTK_TEXT_BUFFER (doc)));
+
+		return word;
+	}
+
+	return NULL;
+}
+
 static gchar *
 get_next_misspelled_word (LapizView *view)
 {
@@ -527,6 +1025,7 @@ get_next_misspelled_word (LapizView *view)
 	gint start, end;
 	gchar *word;
 	LapizSpellChecker *spell;
+	CtkTextIter current_iter, scan_iter;
 
 	g_return_val_if_fail (view != NULL, NULL);
 
@@ -539,29 +1038,60 @@ get_next_misspelled_word (LapizView *view)
 	spell = get_spell_checker_from_document (doc);
 	g_return_val_if_fail (spell != NULL, NULL);
 
-	word = get_current_word (doc, &start, &end);
-	if (word == NULL)
-		return NULL;
-
-	lapiz_debug_message (DEBUG_PLUGINS, "Word to check: %s", word);
+	word = pop_misspelled_word (doc, range, spell, &start, &end);
 
-	while (lapiz_spell_checker_check_word (spell, word, -1))
+	if (word == NULL)
 	{
-		g_free (word);
-
-		if (!goto_next_word (doc))
-			return NULL;
+		/* the scan did not get further yet, the words it went
+		 * past are not misspelled: it starts over from the
+		 * current mark when they are edited */
+		ctk_text_buffer_get_iter_at_mark (CTK_TEXT_BUFFER (doc),
+						  &current_iter,
+						  range->current_mark);
+		ctk_text_buffer_get_iter_at_mark (CTK_TEXT_BUFFER (doc),
+						  &scan_iter,
+						  range->scan_mark);
+
+		if (ctk_text_iter_compare (&current_iter, &scan_iter) < 0)
+			update_current (doc, ctk_text_iter_get_offset (&scan_iter));
 
-		/* may return null if we reached the end of the selection */
 		word = get_current_word (doc, &start, &end);
 		if (word == NULL)
 			return NULL;
 
 		lapiz_debug_message (DEBUG_PLUGINS, "Word to check: %s", word);
+
+		while (lapiz_spell_checker_check_word (spell, word, -1))
+		{
+			g_free (word);
+
+			if (!goto_next_word (doc))
+				return NULL;
+
+			/* may return null if we reached the end of the selection */
+			word = get_current_word (doc, &start, &end);
+			if (word == NULL)
+				return NULL;
+
+			lapiz_debug_message (DEBUG_PLUGINS, "Word to check: %s", word);
+		}
+
+		if (!goto_next_word (doc))
+			update_current (doc, ctk_text_buffer_get_char_count (CTK_TEXT_BUFFER (doc)));
+
+		/* the scan goes on from here */
+		ctk_text_buffer_get_iter_at_mark (CTK_TEXT_BUFFER (doc),
+						  &current_iter,
+						  range->current_mark);
+		ctk_text_buffer_move_mark (CTK_TEXT_BUFFER (doc),
+					   range->scan_mark,
+					   &current_iter);
 	}
 
-	if (!goto_next_word (doc))
-		update_current (doc, ctk_text_buffer_get_char_count (CTK_TEXT_BUFFER (doc)));
+	/* keep the queue filled, and the suggestions of the next
+	 * words ready */
+	prefetch_suggestions (doc, range, spell);
+	schedule_scan (doc);
 
 	if (word != NULL)
 	{
@@ -22,6 +22,7 @@
 #include <config.h>
 #endif
 
+#include <gio/gio.h>
 #include <libbean/bean-activatable.h>
 
 #include <lapiz/lapiz-window.h>
@@ -34,6 +35,7 @@ static void bean_activatable_iface_init (BeanActivatableInterface *iface);
 struct _LapizTrailSavePluginPrivate
 {
 	CtkWidget *window;
+	GSettings *settings;
 };
 
 enum {
@@ -49,92 +51,301 @@ G_DEFINE_DYNAMIC_TYPE_EXTENDED (LapizTrailSavePlugin,
                                 G_IMPLEMENT_INTERFACE_DYNAMIC (BEAN_TYPE_ACTIVATABLE,
                                                                bean_activatable_iface_init))
 
-static void
-strip_trailing_spaces (CtkTextBuffer *text_buffer)
+/* number of lines read from the buffer at once while scanning */
+#define SEGMENT_LINES 4096
+
+/* the tag marking the lines changed since the last save */
+#define CHANGED_LINES_TAG "lapiz-trail-save-changed-lines"
+
+/* GSettings keys */
+#define TRAIL_SAVE_SCHEMA		"org.cafe.lapiz.plugins.trailsave"
+#define ONLY_CHANGED_LINES_KEY		"only-changed-lines"
+
+typedef struct
 {
-	gint line_count, line_num;
-	CtkTextIter line_start, line_end;
-	gchar *slice;
-	gchar byte;
-	gint byte_index;
-	gint strip_start_index, strip_end_index;
-	gboolean should_strip;
-	CtkTextIter strip_start, strip_end;
+	gint start;
+	gint end;
+} StripRange;
 
-	g_assert (text_buffer != NULL);
+/* Scans the lines between @start and @end, which must be at the start
+ * of a line (or at the end of the buffer), and appends the character
+ * offsets of their trailing spaces and tabs to @ranges */
+static void
+collect_strip_ranges (CtkTextBuffer     *text_buffer,
+		      const CtkTextIter *start,
+		      const CtkTextIter *end,
+		      GArray            *ranges)
+{
+	CtkTextIter segment_start, segment_end;
 
-	line_count = ctk_text_buffer_get_line_count (text_buffer);
+	segment_start = *start;
 
-	for (line_num = 0; line_num < line_count; ++line_num)
+	while (ctk_text_iter_compare (&segment_start, end) < 0)
 	{
-		/* Get line text */
-		ctk_text_buffer_get_iter_at_line (text_buffer, &line_start, line_num);
+		gchar *slice;
+		const gchar *p;
+		gint offset;
+		gint strip_start = -1;
 
-		if (line_num == line_count - 1)
-		{
-			ctk_text_buffer_get_end_iter (text_buffer, &line_end);
-		}
-		else
-		{
-			ctk_text_buffer_get_iter_at_line (text_buffer, &line_end, line_num + 1);
-		}
+		segment_end = segment_start;
+		ctk_text_iter_forward_lines (&segment_end, SEGMENT_LINES);
 
-		slice = ctk_text_buffer_get_slice (text_buffer, &line_start, &line_end, TRUE);
+		if (ctk_text_iter_compare (&segment_end, end) > 0)
+			segment_end = *end;
 
-		if (slice == NULL)
-		{
-			continue;
-		}
+		slice = ctk_text_buffer_get_slice (text_buffer,
+						   &segment_start,
+						   &segment_end,
+						   TRUE);
+		offset = ctk_text_iter_get_offset (&segment_start);
 
-		/* Find indices of bytes that should be stripped */
-		should_strip = FALSE;
-
-		for (byte_index = 0; slice [byte_index] != 0; ++byte_index)
+		for (p = slice; *p != '\0'; ++p)
 		{
-			byte = slice [byte_index];
+			gchar byte = *p;
 
 			if ((byte == ' ') || (byte == '\t'))
 			{
-				if (!should_strip)
-				{
-					strip_start_index = byte_index;
-					should_strip = TRUE;
-				}
-
-				strip_end_index = byte_index + 1;
+				if (strip_start < 0)
+					strip_start = offset;
 			}
 			else if ((byte == '\r') || (byte == '\n'))
 			{
-				break;
+				if (strip_start >= 0)
+				{
+					StripRange range = { strip_start, offset };
+
+					g_array_append_val (ranges, range);
+					strip_start = -1;
+				}
 			}
 			else
 			{
-				should_strip = FALSE;
+				strip_start = -1;
 			}
-		}
 
-		g_free (slice);
+			/* count characters, not bytes */
+			if ((byte & 0xC0) != 0x80)
+				++offset;
+		}
 
-		/* Strip trailing spaces */
-		if (should_strip)
+		/* the last line of the buffer has no line terminator */
+		if (strip_start >= 0)
 		{
-			ctk_text_buffer_get_iter_at_line_index (text_buffer, &strip_start, line_num, strip_start_index);
-			ctk_text_buffer_get_iter_at_line_index (text_buffer, &strip_end, line_num, strip_end_index);
-			ctk_text_buffer_delete (text_buffer, &strip_start, &strip_end);
+			StripRange range = { strip_start, offset };
+
+			g_array_append_val (ranges, range);
 		}
+
+		g_free (slice);
+
+		segment_start = segment_end;
 	}
 }
 
+static void
+collect_changed_lines_strip_ranges (CtkTextBuffer *text_buffer,
+				    CtkTextTag    *tag,
+				    GArray        *ranges)
+{
+	CtkTextIter iter, range_start, last_end;
+
+	ctk_text_buffer_get_start_iter (text_buffer, &iter);
+	last_end = iter;
+
+	while (ctk_text_iter_has_tag (&iter, tag) ||
+	       ctk_text_iter_forward_to_tag_toggle (&iter, tag))
+	{
+		range_start = iter;
+		ctk_text_iter_forward_to_tag_toggle (&iter, tag);
+
+		/* extend the tagged range to whole lines */
+		ctk_text_iter_set_line_offset (&range_start, 0);
+		if (ctk_text_iter_compare (&range_start, &last_end) < 0)
+			range_start = last_end;
+
+		if (!ctk_text_iter_starts_line (&iter))
+			ctk_text_iter_forward_line (&iter);
+
+		collect_strip_ranges (text_buffer, &range_start, &iter, ranges);
+
+		last_end = iter;
+	}
+}
+
+/* tags the whole lines between @start and @end as changed */
+static void
+mark_changed_lines (CtkTextBuffer     *text_buffer,
+		    const CtkTextIter *start,
+		    const CtkTextIter *end)
+{
+	CtkTextIter line_start, line_end;
+
+	if (lapiz_document_is_loading (LAPIZ_DOCUMENT (text_buffer)))
+		return;
+
+	line_start = *start;
+	ctk_text_iter_set_line_offset (&line_start, 0);
+
+	line_end = *end;
+	ctk_text_iter_forward_line (&line_end);
+
+	ctk_text_buffer_apply_tag_by_name (text_buffer,
+					   CHANGED_LINES_TAG,
+					   &line_start,
+					   &line_end);
+}
+
+static void
+on_insert_text (CtkTextBuffer        *text_buffer,
+		CtkTextIter          *location,
+		const gchar          *text,
+		gint                  len,
+		LapizTrailSavePlugin *plugin G_GNUC_UNUSED)
+{
+	CtkTextIter start;
+
+	/* we connect after the default handler, location points
+	 * to the end of the inserted text */
+	start = *location;
+	ctk_text_iter_backward_chars (&start, g_utf8_strlen (text, len));
+
+	mark_changed_lines (text_buffer, &start, location);
+}
+
+static void
+on_delete_range (CtkTextBuffer        *text_buffer,
+		 CtkTextIter          *start,
+		 CtkTextIter          *end G_GNUC_UNUSED,
+		 LapizTrailSavePlugin *plugin G_GNUC_UNUSED)
+{
+	mark_changed_lines (text_buffer, start, start);
+}
+
+static void
+strip_trailing_spaces (CtkTextBuffer        *text_buffer,
+		       LapizTrailSavePlugin *plugin)
+{
+	GArray *ranges;
+	CtkTextTag *tag;
+	gint i;
+
+	g_assert (text_buffer != NULL);
+
+	ranges = g_array_new (FALSE, FALSE, sizeof (StripRange));
+
+	tag = ctk_text_tag_table_lookup (ctk_text_buffer_get_tag_table (text_buffer),
+					 CHANGED_LINES_TAG);
+
+	if (tag != NULL &&
+	    g_settings_get_boolean (plugin->priv->settings, ONLY_CHANGED_LINES_KEY))
+	{
+		collect_changed_lines_strip_ranges (text_buffer, tag, ranges);
+	}
+	else
+	{
+		CtkTextIter start, end;
+
+		ctk_text_buffer_get_bounds (text_buffer, &start, &end);
+		collect_strip_ranges (text_buffer, &start, &end, ranges);
+	}
+
+	if (ranges->len == 0)
+	{
+		g_array_free (ranges, TRUE);
+		return;
+	}
+
+	g_signal_handlers_block_by_func (text_buffer, on_insert_text, plugin);
+	g_signal_handlers_block_by_func (text_buffer, on_delete_range, plugin);
+
+	ctk_text_buffer_begin_user_action (text_buffer);
+
+	/* delete back to front, so that the offsets of the ranges
+	 * not deleted yet stay valid */
+	for (i = ranges->len - 1; i >= 0; --i)
+	{
+		StripRange *range = &g_array_index (ranges, StripRange, i);
+		CtkTextIter strip_start, strip_end;
+
+		ctk_text_buffer_get_iter_at_offset (text_buffer, &strip_start, range->start);
+		ctk_text_buffer_get_iter_at_offset (text_buffer, &strip_end, range->end);
+		ctk_text_buffer_delete (text_buffer, &strip_start, &strip_end);
+	}
+
+	ctk_text_buffer_end_user_action (text_buffer);
+
+	g_signal_handlers_unblock_by_func (text_buffer, on_delete_range, plugin);
+	g_signal_handlers_unblock_by_func (text_buffer, on_insert_text, plugin);
+
+	g_array_free (ranges, TRUE);
+}
+
+static void
+clear_changed_lines (CtkTextBuffer *text_buffer)
+{
+	CtkTextIter start, end;
+
+	ctk_text_buffer_get_bounds (text_buffer, &start, &end);
+	ctk_text_buffer_remove_tag_by_name (text_buffer,
+					    CHANGED_LINES_TAG,
+					    &start,
+					    &end);
+}
+
 static void
 on_save (LapizDocument         *document,
 	 const gchar           *uri G_GNUC_UNUSED,
 	 LapizEncoding         *encoding G_GNUC_UNUSED,
 	 LapizDocumentSaveFlags save_flags G_GNUC_UNUSED,
-	 LapizTrailSavePlugin  *plugin G_GNUC_UNUSED)
+	 LapizTrailSavePlugin  *plugin)
+{
+	CtkTextBuffer *text_buffer = CTK_TEXT_BUFFER (document);
+
+	strip_trailing_spaces (text_buffer, plugin);
+}
+
+static void
+on_saved_or_loaded (LapizDocument        *document,
+		    const GError         *error,
+		    LapizTrailSavePlugin *plugin G_GNUC_UNUSED)
+{
+	if (error == NULL)
+		clear_changed_lines (CTK_TEXT_BUFFER (document));
+}
+
+static void
+connect_document (LapizDocument        *document,
+		  LapizTrailSavePlugin *plugin)
 {
 	CtkTextBuffer *text_buffer = CTK_TEXT_BUFFER (document);
 
-	strip_trailing_spaces (text_buffer);
+	if (ctk_text_tag_table_lookup (ctk_text_buffer_get_tag_table (text_buffer),
+				       CHANGED_LINES_TAG) == NULL)
+	{
+		ctk_text_buffer_create_tag (text_buffer, CHANGED_LINES_TAG, NULL);
+	}
+
+	g_signal_connect (document, "save", G_CALLBACK (on_save), plugin);
+	g_signal_connect (document, "saved", G_CALLBACK (on_saved_or_loaded), plugin);
+	g_signal_connect (document, "loaded", G_CALLBACK (on_saved_or_loaded), plugin);
+	g_signal_connect_after (document, "insert-text", G_CALLBACK (on_insert_text), plugin);
+	g_signal_connect_after (document, "delete-range", G_CALLBACK (on_delete_range), plugin);
+}
+
+static void
+disconnect_document (LapizDocument        *document,
+		     LapizTrailSavePlugin *plugin)
+{
+	CtkTextTagTable *tag_table;
+	CtkTextTag *tag;
+
+	g_signal_handlers_disconnect_by_data (document, plugin);
+
+	tag_table = ctk_text_buffer_get_tag_table (CTK_TEXT_BUFFER (document));
+	tag = ctk_text_tag_table_lookup (tag_table, CHANGED_LINES_TAG);
+
+	if (tag != NULL)
+		ctk_text_tag_table_remove (tag_table, tag);
 }
 
 static void
@@ -142,10 +353,7 @@ on_tab_added (LapizWindow          *window G_GNUC_UNUSED,
 	      LapizTab             *tab,
 	      LapizTrailSavePlugin *plugin)
 {
-	LapizDocument *document;
-
-	document = lapiz_tab_get_document (tab);
-	g_signal_connect (document, "save", G_CALLBACK (on_save), plugin);
+	connect_document (lapiz_tab_get_document (tab), plugin);
 }
 
 static void
@@ -153,10 +361,7 @@ on_tab_removed (LapizWindow          *window G_GNUC_UNUSED,
 		LapizTab             *tab,
 		LapizTrailSavePlugin *plugin)
 {
-	LapizDocument *document;
-
-	document = lapiz_tab_get_document (tab);
-	g_signal_handlers_disconnect_by_data (document, plugin);
+	disconnect_document (lapiz_tab_get_document (tab), plugin);
 }
 
 static void
@@ -183,7 +388,7 @@ lapiz_trail_save_plugin_activate (BeanActivatable *activatable)
 	     documents_iter = documents_iter->next)
 	{
 		document = (LapizDocument *) documents_iter->data;
-		g_signal_connect (document, "save", G_CALLBACK (on_save), plugin);
+		connect_document (document, plugin);
 	}
 
 	g_list_free (documents);
@@ -212,7 +417,7 @@ lapiz_trail_save_plugin_deactivate (BeanActivatable *activatable)
 	     documents_iter = documents_iter->next)
 	{
 		document = (LapizDocument *) documents_iter->data;
-		g_signal_handlers_disconnect_by_data (document, plugin);
+		disconnect_document (document, plugin);
 	}
 
 	g_list_free (documents);
@@ -224,6 +429,7 @@ lapiz_trail_save_plugin_init (LapizTrailSavePlugin *plugin)
 	lapiz_debug_message (DEBUG_PLUGINS, "LapizTrailSavePlugin initializing");
 
 	plugin->priv = lapiz_trail_save_plugin_get_instance_private (plugin);
+	plugin->priv->settings = g_settings_new (TRAIL_SAVE_SCHEMA);
 }
 
 static void
@@ -239,6 +445,12 @@ lapiz_trail_save_plugin_dispose (GObject *object)
 		plugin->priv->window = NULL;
 	}
 
+	if (plugin->priv->settings != NULL)
+	{
+		g_object_unref (plugin->priv->settings);
+		plugin->priv->settings = NULL;
+	}
+
 	G_OBJECT_CLASS (lapiz_trail_save_plugin_parent_class)->dispose (object);
 }
 
@@ -0,0 +1,177 @@
+/*
+ * document-loader-benchmark.c
+ * This file is part of lapiz
+ *
+ * lapiz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * lapiz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lapiz; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/* The benchmarks only run in perf mode:
+ *   ./document-loader-benchmark -m perf
+ */
+
+#include "lapiz-gio-document-loader.h"
+#include "lapiz-prefs-manager-app.h"
+#include <gio/gio.h>
+#include <ctk/ctk.h>
+#include <glib.h>
+#include <string.h>
+
+#define MB (1024 * 1024)
+
+static gboolean test_completed;
+
+static const gchar line[] =
+	"Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do "
+	"eiusmod tempor incididunt ut labore et dolore magna aliqua. \xc3\xa8\xc3\xa0\n";
+
+static GFile *
+create_document (const gchar *filename,
+                 gsize        size)
+{
+	GFileOutputStream *stream;
+	GString *block;
+	GFile *file;
+	gsize written = 0;
+	GError *error = NULL;
+
+	file = g_file_new_for_path (filename);
+	stream = g_file_replace (file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, &error);
+	g_assert_no_error (error);
+
+	block = g_string_sized_new (MB + sizeof (line));
+	while (block->len < MB)
+		g_string_append (block, line);
+
+	while (written < size)
+	{
+		gsize len = MIN (block->len, size - written);
+
+		/* never cut a line in the middle of a character */
+		if (len < block->len)
+			len -= len % (sizeof (line) - 1);
+
+		if (len == 0)
+			break;
+
+		g_output_stream_write_all (G_OUTPUT_STREAM (stream),
+		                           block->str, len,
+		                           NULL, NULL, &error);
+		g_assert_no_error (error);
+
+		written += len;
+	}
+
+	g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, &error);
+	g_assert_no_error (error);
+
+	g_string_free (block, TRUE);
+	g_object_unref (stream);
+
+	return file;
+}
+
+static void
+on_document_loaded (LapizDocument *document G_GNUC_UNUSED,
+                    GError        *error,
+                    gpointer       data G_GNUC_UNUSED)
+{
+	g_assert_no_error (error);
+
+	test_completed = TRUE;
+}
+
+static void
+benchmark_load (gsize size)
+{
+	LapizDocument *document;
+	GFile *file;
+	GTimer *timer;
+	gchar *uri;
+	gdouble elapsed;
+	GError *error = NULL;
+
+	if (!g_test_perf ())
+	{
+		g_test_skip ("only run in perf mode");
+		return;
+	}
+
+	file = create_document ("document-loader-benchmark.txt", size);
+	uri = g_file_get_uri (file);
+
+	document = lapiz_document_new ();
+	g_signal_connect (document,
+	                  "loaded",
+	                  G_CALLBACK (on_document_loaded),
+	                  NULL);
+
+	test_completed = FALSE;
+	timer = g_timer_new ();
+
+	lapiz_document_load (document, uri, NULL, 0, FALSE);
+
+	while (!test_completed)
+	{
+		g_main_context_iteration (NULL, TRUE);
+	}
+
+	elapsed = g_timer_elapsed (timer, NULL);
+
+	g_test_maximized_result ((gdouble) size / MB / elapsed,
+	                         "Loaded %" G_GSIZE_FORMAT " MB in %.3f s: %.1f MB/s",
+	                         size / MB, elapsed, (gdouble) size / MB / elapsed);
+
+	g_timer_destroy (timer);
+	g_object_unref (document);
+
+	g_file_delete (file, NULL, &error);
+	g_assert_no_error (error);
+
+	g_free (uri);
+	g_object_unref (file);
+}
+
+static void
+test_load_10mb ()
+{
+	benchmark_load (10 * (gsize) MB);
+}
+
+static void
+test_load_100mb ()
+{
+	benchmark_load (100 * (gsize) MB);
+}
+
+static void
+test_load_1gb ()
+{
+	benchmark_load (1024 * (gsize) MB);
+}
+
+int main (int   argc,
+          char *argv[])
+{
+	g_test_init (&argc, &argv, NULL);
+
+	lapiz_prefs_manager_app_init ();
+
+	g_test_add_func ("/document-loader-benchmark/10MB", test_load_10mb);
+	g_test_add_func ("/document-loader-benchmark/100MB", test_load_100mb);
+	g_test_add_func ("/document-loader-benchmark/1GB", test_load_1gb);
+
+	return g_test_run ();
+}
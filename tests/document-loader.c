@@ -140,6 +140,12 @@ test_loader (const gchar *filename,
 static void
 test_end_line_stripping ()
 {
+	/* no size, read from the stream */
+	test_loader ("document-loader.txt",
+	             "",
+	             "",
+	             -1);
+
 	test_loader ("document-loader.txt",
 	             "hello world\n",
 	             "hello world",
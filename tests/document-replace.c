@@ -0,0 +1,225 @@
+/*
+ * document-replace.c
+ * This file is part of lapiz
+ *
+ * lapiz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * lapiz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lapiz; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "lapiz-document.h"
+#include "lapiz-prefs-manager-app.h"
+#include <ctk/ctk.h>
+#include <glib.h>
+#include <string.h>
+
+static LapizDocument *
+create_document (const gchar *contents)
+{
+	LapizDocument *doc;
+
+	doc = lapiz_document_new ();
+
+	ctk_source_buffer_begin_not_undoable_action (CTK_SOURCE_BUFFER (doc));
+	ctk_text_buffer_set_text (CTK_TEXT_BUFFER (doc), contents, -1);
+	ctk_source_buffer_end_not_undoable_action (CTK_SOURCE_BUFFER (doc));
+
+	return doc;
+}
+
+static gchar *
+get_text (LapizDocument *doc)
+{
+	CtkTextIter start, end;
+
+	ctk_text_buffer_get_bounds (CTK_TEXT_BUFFER (doc), &start, &end);
+
+	return ctk_text_buffer_get_text (CTK_TEXT_BUFFER (doc), &start, &end, TRUE);
+}
+
+static void
+check_replace_all (const gchar *contents,
+		   const gchar *find,
+		   const gchar *replace,
+		   guint        flags,
+		   gint         expected_count,
+		   const gchar *expected)
+{
+	LapizDocument *doc;
+	gchar *text;
+	gint count;
+
+	doc = create_document (contents);
+
+	count = lapiz_document_replace_all (doc, find, replace, flags);
+	g_assert_cmpint (count, ==, expected_count);
+
+	text = get_text (doc);
+	g_assert_cmpstr (text, ==, expected);
+	g_free (text);
+
+	g_object_unref (doc);
+}
+
+static void
+test_regex ()
+{
+	guint flags = 0;
+
+	LAPIZ_SEARCH_SET_MATCH_REGEX (flags, TRUE);
+	LAPIZ_SEARCH_SET_CASE_SENSITIVE (flags, TRUE);
+
+	check_replace_all ("a=1\nb=2\nc=3",
+			   "(\\w)=(\\d)",
+			   "\\2=\\1",
+			   flags,
+			   3,
+			   "1=a\n2=b\n3=c");
+
+	check_replace_all ("no match here",
+			   "[0-9]+",
+			   "N",
+			   flags,
+			   0,
+			   "no match here");
+
+	check_replace_all ("Foo foo FOO",
+			   "foo",
+			   "bar",
+			   flags,
+			   1,
+			   "Foo bar FOO");
+
+	LAPIZ_SEARCH_SET_CASE_SENSITIVE (flags, FALSE);
+
+	check_replace_all ("Foo foo FOO",
+			   "foo",
+			   "bar",
+			   flags,
+			   3,
+			   "bar bar bar");
+}
+
+static void
+test_regex_entire_word ()
+{
+	guint flags = 0;
+
+	LAPIZ_SEARCH_SET_MATCH_REGEX (flags, TRUE);
+	LAPIZ_SEARCH_SET_CASE_SENSITIVE (flags, TRUE);
+	LAPIZ_SEARCH_SET_ENTIRE_WORD (flags, TRUE);
+
+	check_replace_all ("cat concat cat catalog cat",
+			   "cat",
+			   "dog",
+			   flags,
+			   3,
+			   "dog concat dog catalog dog");
+}
+
+static void
+test_regex_multibyte ()
+{
+	guint flags = 0;
+
+	LAPIZ_SEARCH_SET_MATCH_REGEX (flags, TRUE);
+	LAPIZ_SEARCH_SET_CASE_SENSITIVE (flags, TRUE);
+
+	check_replace_all ("ñandú ñu\nñandú",
+			   "ñ(\\w+)",
+			   "n\\1",
+			   flags,
+			   3,
+			   "nandú nu\nnandú");
+}
+
+static void
+test_regex_single_undo ()
+{
+	LapizDocument *doc;
+	GString *contents;
+	gchar *text;
+	guint flags = 0;
+	gint i;
+
+	LAPIZ_SEARCH_SET_MATCH_REGEX (flags, TRUE);
+	LAPIZ_SEARCH_SET_CASE_SENSITIVE (flags, TRUE);
+
+	contents = g_string_new (NULL);
+
+	for (i = 0; i < 10000; i++)
+		g_string_append_printf (contents, "line %d\n", i);
+
+	doc = create_document (contents->str);
+
+	g_assert_cmpint (lapiz_document_replace_all (doc, "line (\\d+)", "\\1", flags), ==, 10000);
+	g_assert (ctk_source_buffer_can_undo (CTK_SOURCE_BUFFER (doc)));
+
+	ctk_source_buffer_undo (CTK_SOURCE_BUFFER (doc));
+
+	g_assert (!ctk_source_buffer_can_undo (CTK_SOURCE_BUFFER (doc)));
+
+	text = get_text (doc);
+	g_assert_cmpstr (text, ==, contents->str);
+	g_free (text);
+
+	g_string_free (contents, TRUE);
+	g_object_unref (doc);
+}
+
+static void
+test_regex_keeps_marks ()
+{
+	LapizDocument *doc;
+	CtkTextMark *mark;
+	CtkTextIter iter;
+	gchar *text;
+	guint flags = 0;
+
+	LAPIZ_SEARCH_SET_MATCH_REGEX (flags, TRUE);
+	LAPIZ_SEARCH_SET_CASE_SENSITIVE (flags, TRUE);
+
+	doc = create_document ("foo middle foo");
+
+	/* a mark between the matches stays on the same text */
+	ctk_text_buffer_get_iter_at_offset (CTK_TEXT_BUFFER (doc), &iter, 6);
+	mark = ctk_text_buffer_create_mark (CTK_TEXT_BUFFER (doc), NULL, &iter, TRUE);
+
+	g_assert_cmpint (lapiz_document_replace_all (doc, "fo+", "barbaz", flags), ==, 2);
+
+	text = get_text (doc);
+	g_assert_cmpstr (text, ==, "barbaz middle barbaz");
+	g_free (text);
+
+	ctk_text_buffer_get_iter_at_mark (CTK_TEXT_BUFFER (doc), &iter, mark);
+	g_assert_cmpint (ctk_text_iter_get_offset (&iter), ==, 9);
+
+	g_object_unref (doc);
+}
+
+int main (int   argc,
+          char *argv[])
+{
+	g_test_init (&argc, &argv, NULL);
+
+	lapiz_prefs_manager_app_init ();
+
+	g_test_add_func ("/document-replace/regex", test_regex);
+	g_test_add_func ("/document-replace/regex-entire-word", test_regex_entire_word);
+	g_test_add_func ("/document-replace/regex-multibyte", test_regex_multibyte);
+	g_test_add_func ("/document-replace/regex-single-undo", test_regex_single_undo);
+	g_test_add_func ("/document-replace/regex-keeps-marks", test_regex_keeps_marks);
+
+	return g_test_run ();
+}
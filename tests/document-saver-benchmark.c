@@ -0,0 +1,156 @@
+/*
+ * document-saver-benchmark.c
+ * This file is part of lapiz
+ *
+ * lapiz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * lapiz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lapiz; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/* The benchmarks only run in perf mode:
+ *   ./document-saver-benchmark -m perf
+ */
+
+#include "lapiz-gio-document-saver.h"
+#include "lapiz-prefs-manager-app.h"
+#include <gio/gio.h>
+#include <ctk/ctk.h>
+#include <glib.h>
+#include <string.h>
+
+#define MB (1024 * 1024)
+#define BENCHMARK_FILE "document-saver-benchmark.txt"
+
+static gboolean test_completed;
+
+static const gchar short_line[] = "abc\n";
+static const gchar long_line[] =
+	"Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do "
+	"eiusmod tempor incididunt ut labore et dolore magna aliqua. \xc3\xa8\xc3\xa0\n";
+
+static LapizDocument *
+create_document (const gchar *line,
+                 gsize        size)
+{
+	LapizDocument *document;
+	GString *contents;
+
+	contents = g_string_sized_new (size + strlen (line));
+	while (contents->len < size)
+		g_string_append (contents, line);
+
+	document = lapiz_document_new ();
+	ctk_text_buffer_set_text (CTK_TEXT_BUFFER (document), contents->str, contents->len);
+
+	g_string_free (contents, TRUE);
+
+	return document;
+}
+
+static void
+on_document_saved (LapizDocument *document G_GNUC_UNUSED,
+                   GError        *error,
+                   gpointer       data G_GNUC_UNUSED)
+{
+	g_assert_no_error (error);
+
+	test_completed = TRUE;
+}
+
+static void
+benchmark_save (const gchar              *line,
+                gsize                     size,
+                LapizDocumentNewlineType  newline_type)
+{
+	LapizDocument *document;
+	GFile *file;
+	GTimer *timer;
+	gchar *uri;
+	gdouble elapsed;
+	GError *error = NULL;
+
+	if (!g_test_perf ())
+	{
+		g_test_skip ("only run in perf mode");
+		return;
+	}
+
+	document = create_document (line, size);
+	lapiz_document_set_newline_type (document, newline_type);
+
+	g_signal_connect (document,
+	                  "saved",
+	                  G_CALLBACK (on_document_saved),
+	                  NULL);
+
+	file = g_file_new_for_path (BENCHMARK_FILE);
+	uri = g_file_get_uri (file);
+
+	test_completed = FALSE;
+	timer = g_timer_new ();
+
+	lapiz_document_save_as (document, uri, lapiz_encoding_get_utf8 (), 0);
+
+	while (!test_completed)
+	{
+		g_main_context_iteration (NULL, TRUE);
+	}
+
+	elapsed = g_timer_elapsed (timer, NULL);
+
+	g_test_maximized_result ((gdouble) size / MB / elapsed,
+	                         "Saved %" G_GSIZE_FORMAT " MB of %" G_GSIZE_FORMAT " byte lines in %.3f s: %.1f MB/s",
+	                         size / MB, strlen (line), elapsed, (gdouble) size / MB / elapsed);
+
+	g_timer_destroy (timer);
+	g_object_unref (document);
+
+	g_file_delete (file, NULL, &error);
+	g_assert_no_error (error);
+
+	g_free (uri);
+	g_object_unref (file);
+}
+
+static void
+test_save_short_lines ()
+{
+	benchmark_save (short_line, 16 * (gsize) MB, LAPIZ_DOCUMENT_NEWLINE_TYPE_LF);
+}
+
+static void
+test_save_short_lines_crlf ()
+{
+	benchmark_save (short_line, 16 * (gsize) MB, LAPIZ_DOCUMENT_NEWLINE_TYPE_CR_LF);
+}
+
+static void
+test_save_long_lines ()
+{
+	benchmark_save (long_line, 100 * (gsize) MB, LAPIZ_DOCUMENT_NEWLINE_TYPE_LF);
+}
+
+int main (int   argc,
+          char *argv[])
+{
+	g_test_init (&argc, &argv, NULL);
+
+	lapiz_prefs_manager_app_init ();
+
+	g_test_add_func ("/document-saver-benchmark/short-lines", test_save_short_lines);
+	g_test_add_func ("/document-saver-benchmark/short-lines-crlf", test_save_short_lines_crlf);
+	g_test_add_func ("/document-saver-benchmark/long-lines", test_save_long_lines);
+
+	return g_test_run ();
+}
@@ -280,7 +280,12 @@ static NewLineTestData newline_test_data[] = {
 	{LAPIZ_DOCUMENT_NEWLINE_TYPE_CR, "\rhello\rworld", "\rhello\rworld\r"},
 	{LAPIZ_DOCUMENT_NEWLINE_TYPE_CR, "\rhello\rworld\r", "\rhello\rworld\r\r"},
 	{LAPIZ_DOCUMENT_NEWLINE_TYPE_CR, "\nhello\r\nworld", "\rhello\rworld\r"},
-	{LAPIZ_DOCUMENT_NEWLINE_TYPE_CR, "\nhello\r\nworld\r", "\rhello\rworld\r\r"}
+	{LAPIZ_DOCUMENT_NEWLINE_TYPE_CR, "\nhello\r\nworld\r", "\rhello\rworld\r\r"},
+
+	{LAPIZ_DOCUMENT_NEWLINE_TYPE_CR, "hello\nhello\xe6\x96\x87\nworld\n", "hello\rhello\xe6\x96\x87\rworld\r\r"},
+	{LAPIZ_DOCUMENT_NEWLINE_TYPE_LF, "hello\rhello\xe6\x96\x87\rworld\r", "hello\nhello\xe6\x96\x87\nworld\n\n"},
+	{LAPIZ_DOCUMENT_NEWLINE_TYPE_LF, "hello\xe2\x80\xa9world\xe2\x82\xac\r\n", "hello\nworld\xe2\x82\xac\n\n"},
+	{LAPIZ_DOCUMENT_NEWLINE_TYPE_CR_LF, "hello\xe2\x80\xa9world\xe2\x82\xac\r\n", "hello\r\nworld\xe2\x82\xac\r\n\r\n"}
 };
 
 static void
@@ -331,6 +336,51 @@ test_local ()
 	            0,
 	            NULL,
 	            saver_test_data_new (DEFAULT_LOCAL_URI, "hello world\n\n", NULL));
+
+	/* empty file should not have a trailing newline */
+	test_saver (DEFAULT_LOCAL_URI,
+	            "",
+	            LAPIZ_DOCUMENT_NEWLINE_TYPE_CR_LF,
+	            0,
+	            NULL,
+	            saver_test_data_new (DEFAULT_LOCAL_URI, "", NULL));
+}
+
+static void
+test_local_edit_while_saving ()
+{
+	LapizDocument *document;
+	GFile *file;
+	gchar *uri;
+
+	document = create_document ("hello world");
+
+	g_signal_connect (document, "saved", G_CALLBACK (complete_test_error), NULL);
+	g_signal_connect_after (document, "saved", G_CALLBACK (complete_test), NULL);
+
+	test_completed = FALSE;
+
+	file = g_file_new_for_commandline_arg (DEFAULT_LOCAL_URI);
+	uri = g_file_get_uri (file);
+
+	lapiz_document_save_as (document, uri, lapiz_encoding_get_utf8 (), 0);
+
+	/* the saver works on a snapshot, this edit is not written */
+	ctk_text_buffer_insert_at_cursor (CTK_TEXT_BUFFER (document), "!", -1);
+
+	while (!test_completed)
+	{
+		g_main_context_iteration (NULL, TRUE);
+	}
+
+	g_assert_cmpstr (read_file (DEFAULT_LOCAL_URI), ==, "hello world\n");
+	g_assert (ctk_text_buffer_get_modified (CTK_TEXT_BUFFER (document)));
+
+	g_file_delete (file, NULL, NULL);
+
+	g_free (uri);
+	g_object_unref (file);
+	g_object_unref (document);
 }
 
 static void
@@ -698,6 +748,7 @@ int main (int   argc,
 
 	g_test_add_func ("/document-saver/local", test_local);
 	g_test_add_func ("/document-saver/local-new-line", test_local_newline);
+	g_test_add_func ("/document-saver/local-edit-while-saving", test_local_edit_while_saving);
 
 	if (have_unowned)
 	{
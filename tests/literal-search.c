@@ -0,0 +1,228 @@
+/*
+ * literal-search.c
+ * This file is part of lapiz
+ *
+ * lapiz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * lapiz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lapiz; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "lapiz-literal-search.h"
+#include "lapiz-document.h"
+#include <ctk/ctk.h>
+#include <glib.h>
+#include <string.h>
+
+static void
+check_find (const gchar *needle,
+	    guint        flags,
+	    const gchar *text,
+	    gint         expected_start,
+	    gint         expected_end)
+{
+	LapizLiteralSearch *search;
+	gsize match_start, match_end;
+	gboolean found;
+
+	search = lapiz_literal_search_new (needle, flags);
+
+	found = lapiz_literal_search_find (search, text, 0, strlen (text),
+					   &match_start, &match_end);
+
+	if (expected_start < 0)
+	{
+		g_assert (!found);
+	}
+	else
+	{
+		g_assert (found);
+		g_assert_cmpint (match_start, ==, expected_start);
+		g_assert_cmpint (match_end, ==, expected_end);
+	}
+
+	lapiz_literal_search_free (search);
+}
+
+static void
+test_find ()
+{
+	guint cs = LAPIZ_SEARCH_CASE_SENSITIVE;
+
+	check_find ("o", cs, "hello world", 4, 5);
+	check_find ("wor", cs, "hello world", 6, 9);
+	check_find ("world", cs, "hello world", 6, 11);
+	check_find ("World", cs, "hello world", -1, -1);
+	check_find ("aab", cs, "aaaab", 2, 5);
+	check_find ("ñu", cs, "ñandú ñu", 8, 11);
+	check_find ("", cs, "hello", -1, -1);
+}
+
+static void
+test_find_case_insensitive ()
+{
+	check_find ("WORLD", 0, "hello world", 6, 11);
+	check_find ("wo", 0, "hello WORLD", 6, 8);
+	check_find ("HELLO", 0, "say Hello", 4, 9);
+
+	/* not ASCII: compared character by character */
+	check_find ("ÑANDÚ", 0, "un ñandú", 3, 10);
+	check_find ("ñandú", 0, "un ÑANDÚ", 3, 10);
+}
+
+static void
+test_find_entire_word ()
+{
+	guint flags = LAPIZ_SEARCH_CASE_SENSITIVE | LAPIZ_SEARCH_ENTIRE_WORD;
+
+	check_find ("foo", flags, "foobar foo", 7, 10);
+	check_find ("foo", flags, "x_foo foo1 foo", 11, 14);
+	check_find ("foo", flags, "barfoo", -1, -1);
+	check_find ("ñu", flags, "ñus ñu", 5, 8);
+}
+
+static void
+test_find_last ()
+{
+	LapizLiteralSearch *search;
+	gsize match_start, match_end;
+
+	search = lapiz_literal_search_new ("aa", LAPIZ_SEARCH_CASE_SENSITIVE);
+
+	g_assert (lapiz_literal_search_find_last (search, "aaa", 0, 3,
+						  &match_start, &match_end));
+	g_assert_cmpint (match_start, ==, 1);
+	g_assert_cmpint (match_end, ==, 3);
+
+	lapiz_literal_search_free (search);
+}
+
+static void
+check_buffer_search (CtkTextBuffer *buffer,
+		     const gchar   *needle,
+		     guint          flags,
+		     gint           from,
+		     gboolean       forward,
+		     gint           expected_start,
+		     gint           expected_end)
+{
+	LapizLiteralSearch *search;
+	CtkTextIter iter;
+	CtkTextIter match_start;
+	CtkTextIter match_end;
+	gboolean found;
+
+	search = lapiz_literal_search_new (needle, flags);
+	ctk_text_buffer_get_iter_at_offset (buffer, &iter, from);
+
+	if (forward)
+		found = lapiz_literal_search_forward (search, &iter, NULL,
+						      &match_start, &match_end);
+	else
+		found = lapiz_literal_search_backward (search, &iter, NULL,
+						       &match_start, &match_end);
+
+	if (expected_start < 0)
+	{
+		g_assert (!found);
+	}
+	else
+	{
+		g_assert (found);
+		g_assert_cmpint (ctk_text_iter_get_offset (&match_start), ==, expected_start);
+		g_assert_cmpint (ctk_text_iter_get_offset (&match_end), ==, expected_end);
+	}
+
+	lapiz_literal_search_free (search);
+}
+
+static void
+test_buffer ()
+{
+	CtkTextBuffer *buffer;
+	GString *str;
+	gint offset;
+
+	/* long enough for several windows */
+	str = g_string_new (NULL);
+
+	while (str->len < 300 * 1024)
+		g_string_append (str, "lorem ipsum dolor sit amet\n");
+
+	offset = g_utf8_strlen (str->str, -1);
+	g_string_append (str, "ñandú\nNeedle in\nthe haystack\n");
+
+	buffer = ctk_text_buffer_new (NULL);
+	ctk_text_buffer_set_text (buffer, str->str, -1);
+
+	check_buffer_search (buffer, "needle", 0, 0, TRUE, offset + 6, offset + 12);
+	check_buffer_search (buffer, "needle", LAPIZ_SEARCH_CASE_SENSITIVE, 0, TRUE, -1, -1);
+	check_buffer_search (buffer, "amet\nñandú", 0, 0, TRUE, offset - 5, offset + 5);
+	check_buffer_search (buffer, "in\nthe", 0, 0, TRUE, offset + 13, offset + 19);
+
+	check_buffer_search (buffer, "lorem", 0, offset, FALSE, offset - 27, offset - 22);
+	check_buffer_search (buffer, "ñandú", 0, offset + 10, FALSE, offset, offset + 5);
+	check_buffer_search (buffer, "haystack", 0, offset, FALSE, -1, -1);
+
+	g_object_unref (buffer);
+	g_string_free (str, TRUE);
+}
+
+static void
+count_match (const CtkTextIter *match_start,
+	     const CtkTextIter *match_end,
+	     gint              *count)
+{
+	g_assert_cmpint (ctk_text_iter_get_offset (match_end) -
+			 ctk_text_iter_get_offset (match_start), ==, 2);
+
+	(*count)++;
+}
+
+static void
+test_foreach ()
+{
+	CtkTextBuffer *buffer;
+	LapizLiteralSearch *search;
+	CtkTextIter start, end;
+	gint count = 0;
+
+	buffer = ctk_text_buffer_new (NULL);
+	ctk_text_buffer_set_text (buffer, "ab ñb AB\naB aaa", -1);
+	ctk_text_buffer_get_bounds (buffer, &start, &end);
+
+	search = lapiz_literal_search_new ("ab", 0);
+	lapiz_literal_search_foreach (search, &start, &end,
+				      (LapizLiteralSearchFunc) count_match,
+				      &count);
+
+	g_assert_cmpint (count, ==, 3);
+
+	lapiz_literal_search_free (search);
+	g_object_unref (buffer);
+}
+
+int main (int   argc,
+          char *argv[])
+{
+	g_test_init (&argc, &argv, NULL);
+
+	g_test_add_func ("/literal-search/find", test_find);
+	g_test_add_func ("/literal-search/find-case-insensitive", test_find_case_insensitive);
+	g_test_add_func ("/literal-search/find-entire-word", test_find_entire_word);
+	g_test_add_func ("/literal-search/find-last", test_find_last);
+	g_test_add_func ("/literal-search/buffer", test_buffer);
+	g_test_add_func ("/literal-search/foreach", test_foreach);
+
+	return g_test_run ();
+}
@@ -0,0 +1,275 @@
+/*
+ * match-index.c
+ * This file is part of lapiz
+ *
+ * lapiz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * lapiz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lapiz; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "lapiz-match-index.h"
+#include "lapiz-document.h"
+#include "lapiz-prefs-manager-app.h"
+#include <ctk/ctk.h>
+#include <glib.h>
+#include <string.h>
+
+static void
+check_match (LapizMatchIndex *index,
+	     guint            n,
+	     gint             expected_start,
+	     gint             expected_end)
+{
+	gint start, end;
+
+	lapiz_match_index_get_nth (index, n, &start, &end);
+
+	g_assert_cmpint (start, ==, expected_start);
+	g_assert_cmpint (end, ==, expected_end);
+}
+
+static void
+test_index ()
+{
+	LapizMatchIndex *index;
+
+	index = lapiz_match_index_new ();
+
+	lapiz_match_index_append (index, 0, 2);
+	lapiz_match_index_append (index, 5, 8);
+	lapiz_match_index_append (index, 10, 11);
+
+	g_assert_cmpint (lapiz_match_index_get_length (index), ==, 3);
+
+	g_assert_cmpint (lapiz_match_index_find_next (index, 0), ==, 0);
+	g_assert_cmpint (lapiz_match_index_find_next (index, 1), ==, 1);
+	g_assert_cmpint (lapiz_match_index_find_next (index, 11), ==, 3);
+
+	g_assert_cmpint (lapiz_match_index_find_prev (index, 1), ==, -1);
+	g_assert_cmpint (lapiz_match_index_find_prev (index, 8), ==, 1);
+	g_assert_cmpint (lapiz_match_index_find_prev (index, 20), ==, 2);
+
+	g_assert_cmpint (lapiz_match_index_lookup (index, 5, 8), ==, 1);
+	g_assert_cmpint (lapiz_match_index_lookup (index, 5, 7), ==, -1);
+
+	/* an insertion and a deletion before the last match */
+	lapiz_match_index_shift (index, 9, 4);
+	check_match (index, 2, 14, 15);
+
+	lapiz_match_index_shift (index, 3, -2);
+	check_match (index, 0, 0, 2);
+	check_match (index, 1, 3, 6);
+	check_match (index, 2, 12, 13);
+
+	lapiz_match_index_insert (index, 2, 8, 9);
+	check_match (index, 2, 8, 9);
+	check_match (index, 3, 12, 13);
+
+	lapiz_match_index_remove (index, 0, 2);
+	g_assert_cmpint (lapiz_match_index_get_length (index), ==, 2);
+	check_match (index, 0, 8, 9);
+	check_match (index, 1, 12, 13);
+
+	lapiz_match_index_free (index);
+}
+
+static LapizDocument *
+create_document (const gchar *contents,
+		 const gchar *search_text,
+		 guint        flags)
+{
+	LapizDocument *doc;
+
+	doc = lapiz_document_new ();
+	ctk_text_buffer_set_text (CTK_TEXT_BUFFER (doc), contents, -1);
+	lapiz_document_set_search_text (doc, search_text, flags);
+
+	return doc;
+}
+
+static gint
+get_match_count (LapizDocument *doc)
+{
+	while (lapiz_document_get_search_match_count (doc) < 0)
+		g_main_context_iteration (NULL, TRUE);
+
+	return lapiz_document_get_search_match_count (doc);
+}
+
+/* the count kept up to date with the edits is the one of the text */
+static void
+check_count (LapizDocument *doc,
+	     const gchar   *search_text,
+	     guint          flags)
+{
+	LapizDocument *fresh;
+	CtkTextIter start, end;
+	gchar *text;
+
+	ctk_text_buffer_get_bounds (CTK_TEXT_BUFFER (doc), &start, &end);
+	text = ctk_text_buffer_get_text (CTK_TEXT_BUFFER (doc), &start, &end, TRUE);
+
+	fresh = create_document (text, search_text, flags);
+
+	g_assert_cmpint (get_match_count (doc), ==, get_match_count (fresh));
+
+	g_object_unref (fresh);
+	g_free (text);
+}
+
+static void
+test_count ()
+{
+	LapizDocument *doc;
+	GString *contents;
+	gint i;
+
+	contents = g_string_new (NULL);
+
+	for (i = 0; i < 20000; i++)
+		g_string_append_printf (contents, "line %d of the needle file\n", i);
+
+	doc = create_document (contents->str, "needle", 0);
+	g_assert_cmpint (get_match_count (doc), ==, 20000);
+
+	lapiz_document_set_search_text (doc, "LINE 1", LAPIZ_SEARCH_ENTIRE_WORD);
+	g_assert_cmpint (get_match_count (doc), ==, 1);
+
+	g_object_unref (doc);
+	g_string_free (contents, TRUE);
+}
+
+static void
+test_count_regex ()
+{
+	LapizDocument *doc;
+	guint flags = 0;
+
+	LAPIZ_SEARCH_SET_MATCH_REGEX (flags, TRUE);
+
+	doc = create_document ("a1 b22 c333\nd4444", "[0-9]+", flags);
+	g_assert_cmpint (get_match_count (doc), ==, 4);
+
+	g_object_unref (doc);
+}
+
+static void
+test_edits ()
+{
+	LapizDocument *doc;
+	CtkTextBuffer *buffer;
+	CtkTextIter start, end;
+
+	doc = create_document ("foo bar\nfoo\nbarfoo bar foo\n", "foo", 0);
+	buffer = CTK_TEXT_BUFFER (doc);
+	g_assert_cmpint (get_match_count (doc), ==, 4);
+
+	/* a new match */
+	ctk_text_buffer_get_iter_at_line (buffer, &start, 1);
+	ctk_text_buffer_insert (buffer, &start, "fo", -1);
+	check_count (doc, "foo", 0);
+
+	/* a match joined across a deletion */
+	ctk_text_buffer_get_iter_at_offset (buffer, &start, 0);
+	ctk_text_buffer_insert (buffer, &start, "fXoo ", -1);
+	ctk_text_buffer_get_iter_at_offset (buffer, &start, 1);
+	end = start;
+	ctk_text_iter_forward_char (&end);
+	ctk_text_buffer_delete (buffer, &start, &end);
+	check_count (doc, "foo", 0);
+
+	/* a match broken */
+	ctk_text_buffer_get_end_iter (buffer, &end);
+	start = end;
+	ctk_text_iter_backward_chars (&start, 3);
+	ctk_text_buffer_delete (buffer, &start, &end);
+	check_count (doc, "foo", 0);
+
+	/* typing at the end */
+	ctk_text_buffer_get_end_iter (buffer, &end);
+	ctk_text_buffer_insert (buffer, &end, "foo", -1);
+	check_count (doc, "foo", 0);
+
+	g_object_unref (doc);
+}
+
+/* inserting in a run of the same character changes how the matches after
+ * it are paired */
+static void
+test_edits_overlapping ()
+{
+	LapizDocument *doc;
+	CtkTextIter iter;
+
+	doc = create_document ("aaaa\naaaaaaa\naa\n", "aa", 0);
+	g_assert_cmpint (get_match_count (doc), ==, 6);
+
+	ctk_text_buffer_get_iter_at_line_offset (CTK_TEXT_BUFFER (doc), &iter, 1, 1);
+	ctk_text_buffer_insert (CTK_TEXT_BUFFER (doc), &iter, "a", -1);
+	check_count (doc, "aa", 0);
+
+	g_object_unref (doc);
+
+	doc = create_document ("aaaa\naaaaaaa\naa\n", "a\na", 0);
+	g_assert_cmpint (get_match_count (doc), ==, 2);
+
+	ctk_text_buffer_get_iter_at_line_offset (CTK_TEXT_BUFFER (doc), &iter, 1, 0);
+	ctk_text_buffer_insert (CTK_TEXT_BUFFER (doc), &iter, "b", -1);
+	check_count (doc, "a\na", 0);
+
+	g_object_unref (doc);
+}
+
+static void
+test_search ()
+{
+	LapizDocument *doc;
+	CtkTextIter iter;
+	CtkTextIter match_start, match_end;
+
+	doc = create_document ("one two one two one", "one", 0);
+	g_assert_cmpint (get_match_count (doc), ==, 3);
+
+	ctk_text_buffer_get_iter_at_offset (CTK_TEXT_BUFFER (doc), &iter, 1);
+
+	g_assert (lapiz_document_search_forward (doc, &iter, NULL, &match_start, &match_end));
+	g_assert_cmpint (ctk_text_iter_get_offset (&match_start), ==, 8);
+	g_assert_cmpint (lapiz_document_get_search_match_index (doc, &match_start, &match_end), ==, 2);
+
+	g_assert (lapiz_document_search_backward (doc, NULL, &match_start, &match_start, &match_end));
+	g_assert_cmpint (ctk_text_iter_get_offset (&match_start), ==, 0);
+	g_assert_cmpint (lapiz_document_get_search_match_index (doc, &match_start, &match_end), ==, 1);
+
+	ctk_text_buffer_get_iter_at_offset (CTK_TEXT_BUFFER (doc), &iter, 17);
+	g_assert (!lapiz_document_search_forward (doc, &iter, NULL, NULL, NULL));
+
+	g_object_unref (doc);
+}
+
+int main (int   argc,
+          char *argv[])
+{
+	g_test_init (&argc, &argv, NULL);
+
+	lapiz_prefs_manager_app_init ();
+
+	g_test_add_func ("/match-index/index", test_index);
+	g_test_add_func ("/match-index/count", test_count);
+	g_test_add_func ("/match-index/count-regex", test_count_regex);
+	g_test_add_func ("/match-index/edits", test_edits);
+	g_test_add_func ("/match-index/edits-overlapping", test_edits_overlapping);
+	g_test_add_func ("/match-index/search", test_search);
+
+	return g_test_run ();
+}
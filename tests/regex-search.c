@@ -0,0 +1,249 @@
+/*
+ * regex-search.c
+ * This file is part of lapiz
+ *
+ * lapiz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * lapiz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lapiz; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "lapiz-utils.h"
+#include <ctk/ctk.h>
+#include <glib.h>
+#include <string.h>
+
+#define SEARCH_FLAGS (CTK_TEXT_SEARCH_VISIBLE_ONLY | CTK_TEXT_SEARCH_TEXT_ONLY)
+
+/* Longer than a search window, so that the matches cross windows */
+#define LONG_PADDING (200 * 1024)
+
+static CtkTextBuffer *
+create_buffer (const gchar *text)
+{
+	CtkTextBuffer *buffer;
+
+	buffer = ctk_text_buffer_new (NULL);
+	ctk_text_buffer_set_text (buffer, text, -1);
+
+	return buffer;
+}
+
+/* Prepends at least @n_chars characters of filler lines to @text */
+static gchar *
+pad_text (const gchar *text,
+	  gint         n_chars)
+{
+	GString *str;
+
+	str = g_string_sized_new (n_chars + strlen (text));
+
+	while (str->len < (gsize) n_chars)
+		g_string_append (str, "lorem ipsum dolor sit amet\n");
+
+	g_string_append (str, text);
+
+	return g_string_free (str, FALSE);
+}
+
+static void
+check_search (CtkTextBuffer *buffer,
+	      const gchar   *pattern,
+	      gint           from,
+	      gboolean       forward,
+	      gint           expected_start,
+	      gint           expected_end)
+{
+	CtkTextIter iter;
+	CtkTextIter match_start;
+	CtkTextIter match_end;
+	gboolean found;
+
+	ctk_text_buffer_get_iter_at_offset (buffer, &iter, from);
+
+	found = lapiz_ctk_text_iter_regex_search (&iter,
+						  pattern,
+						  SEARCH_FLAGS,
+						  &match_start,
+						  &match_end,
+						  NULL,
+						  forward,
+						  NULL);
+
+	if (expected_start < 0)
+	{
+		g_assert (!found);
+		return;
+	}
+
+	g_assert (found);
+	g_assert_cmpint (ctk_text_iter_get_offset (&match_start), ==, expected_start);
+	g_assert_cmpint (ctk_text_iter_get_offset (&match_end), ==, expected_end);
+}
+
+static void
+test_forward ()
+{
+	CtkTextBuffer *buffer;
+
+	buffer = create_buffer ("one two\nthree two");
+
+	check_search (buffer, "t[a-z]o", 0, TRUE, 4, 7);
+	check_search (buffer, "t[a-z]o", 7, TRUE, 14, 17);
+	check_search (buffer, "t[a-z]o", 15, TRUE, -1, -1);
+	check_search (buffer, "^one", 0, TRUE, 0, 3);
+	check_search (buffer, "^three", 0, TRUE, -1, -1);
+	check_search (buffer, "two$", 0, TRUE, 14, 17);
+
+	g_object_unref (buffer);
+}
+
+static void
+test_backward ()
+{
+	CtkTextBuffer *buffer;
+
+	buffer = create_buffer ("one two\nthree two");
+
+	check_search (buffer, "t[a-z]o", 17, FALSE, 14, 17);
+	check_search (buffer, "t[a-z]o", 14, FALSE, 4, 7);
+	check_search (buffer, "t[a-z]o", 4, FALSE, -1, -1);
+	check_search (buffer, "^one", 17, FALSE, 0, 3);
+
+	g_object_unref (buffer);
+}
+
+static void
+test_long_forward ()
+{
+	CtkTextBuffer *buffer;
+	gchar *text;
+	gint offset;
+
+	text = pad_text ("needle\nin the haystack\n", LONG_PADDING);
+	offset = g_utf8_strlen (text, -1) - strlen ("needle\nin the haystack\n");
+
+	buffer = create_buffer (text);
+
+	check_search (buffer, "needle", 0, TRUE, offset, offset + 6);
+
+	/* a match spanning lines and windows */
+	check_search (buffer, "amet\\nneedle\\nin", 0, TRUE, offset - 5, offset + 9);
+
+	/* lookbehind sees the text of the previous window */
+	check_search (buffer, "(?<=amet\\n)needle", 0, TRUE, offset, offset + 6);
+
+	/* ^ and $ still refer to the start and the end of the search */
+	check_search (buffer, "^needle", 0, TRUE, -1, -1);
+	check_search (buffer, "haystack\\n$", 0, TRUE, offset + 14, offset + 23);
+
+	g_object_unref (buffer);
+	g_free (text);
+}
+
+static void
+test_long_backward ()
+{
+	CtkTextBuffer *buffer;
+	gchar *padding;
+	gchar *text;
+	gint end;
+
+	padding = pad_text ("", LONG_PADDING);
+	text = g_strconcat ("needle\n", padding, NULL);
+	buffer = create_buffer (text);
+
+	end = ctk_text_buffer_get_char_count (buffer);
+
+	check_search (buffer, "needle", end, FALSE, 0, 6);
+	check_search (buffer, "^needle", end, FALSE, 0, 6);
+	check_search (buffer, "^lorem", end, FALSE, -1, -1);
+
+	/* a match going on past the text after its window is not cut */
+	check_search (buffer, "needle\\n(lorem ipsum dolor sit amet\\n)+", end, FALSE, 0, end);
+
+	g_object_unref (buffer);
+	g_free (text);
+
+	/* nor missed when the text after the window does not complete it */
+	text = g_strconcat ("needle\n", padding, "x", NULL);
+	buffer = create_buffer (text);
+
+	end = ctk_text_buffer_get_char_count (buffer);
+
+	check_search (buffer, "needle[^x]*x", end, FALSE, 0, end);
+
+	g_object_unref (buffer);
+	g_free (padding);
+	g_free (text);
+}
+
+static void
+test_replace_text ()
+{
+	CtkTextBuffer *buffer;
+	CtkTextIter iter;
+	CtkTextIter match_start;
+	CtkTextIter match_end;
+	gchar *replace;
+
+	buffer = create_buffer ("key1 = value1\nkey2 = value2\n");
+	ctk_text_buffer_get_end_iter (buffer, &iter);
+
+	replace = g_strdup ("\\2 = \\1");
+
+	g_assert (lapiz_ctk_text_iter_regex_search (&iter,
+						    "(\\w+) = (\\w+)",
+						    SEARCH_FLAGS,
+						    &match_start,
+						    &match_end,
+						    NULL,
+						    FALSE,
+						    &replace));
+
+	/* the references are expanded with the match that was found */
+	g_assert_cmpstr (replace, ==, "value2 = key2");
+
+	g_free (replace);
+	g_object_unref (buffer);
+}
+
+static void
+test_pattern_change ()
+{
+	CtkTextBuffer *buffer;
+
+	buffer = create_buffer ("Alpha beta alpha");
+
+	check_search (buffer, "alpha", 0, TRUE, 11, 16);
+	check_search (buffer, "beta", 0, TRUE, 6, 10);
+	check_search (buffer, "alpha", 0, TRUE, 11, 16);
+	check_search (buffer, "(", 0, TRUE, -1, -1);
+
+	g_object_unref (buffer);
+}
+
+int main (int   argc,
+          char *argv[])
+{
+	g_test_init (&argc, &argv, NULL);
+
+	g_test_add_func ("/regex-search/forward", test_forward);
+	g_test_add_func ("/regex-search/backward", test_backward);
+	g_test_add_func ("/regex-search/long-forward", test_long_forward);
+	g_test_add_func ("/regex-search/long-backward", test_long_backward);
+	g_test_add_func ("/regex-search/replace-text", test_replace_text);
+	g_test_add_func ("/regex-search/pattern-change", test_pattern_change);
+
+	return g_test_run ();
+}
@@ -30,6 +30,9 @@
 
 #define TEXT_TO_CONVERT "this is some text to make the tests"
 #define TEXT_TO_GUESS "hello \xe6\x96\x87 world"
+#define ASCII_LINE "the quick brown fox jumps over the lazy dog\n"
+
+#define MB (1024 * 1024)
 
 static void
 print_hex (gchar *ptr, gint len)
@@ -196,6 +199,136 @@ do_test (const gchar *test_in,
 	return out;
 }
 
+/* Feeds @text to @converter @chunk_size bytes at a time, the way a
+ * GConverterInputStream or the loader does */
+static gchar *
+convert_in_chunks (LapizSmartCharsetConverter *converter,
+                   const gchar                *text,
+                   gsize                       len,
+                   gsize                       chunk_size,
+                   gsize                      *out_len)
+{
+	gchar *out;
+	gsize out_size;
+	gsize in_pos = 0;
+	gsize in_end;
+	gsize nwritten = 0;
+
+	out_size = len * 4 + 16;
+	out = g_malloc (out_size + 1);
+	in_end = MIN (chunk_size, len);
+
+	while (TRUE)
+	{
+		GConverterResult res;
+		gsize bytes_read;
+		gsize bytes_written;
+		GError *err = NULL;
+
+		res = g_converter_convert (G_CONVERTER (converter),
+		                           text + in_pos,
+		                           in_end - in_pos,
+		                           out + nwritten,
+		                           out_size - nwritten,
+		                           in_end == len ? G_CONVERTER_INPUT_AT_END : G_CONVERTER_NO_FLAGS,
+		                           &bytes_read,
+		                           &bytes_written,
+		                           &err);
+
+		if (res == G_CONVERTER_ERROR &&
+		    in_end < len &&
+		    g_error_matches (err, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT))
+		{
+			g_error_free (err);
+			in_end = MIN (in_end + chunk_size, len);
+			continue;
+		}
+
+		g_assert_no_error (err);
+
+		in_pos += bytes_read;
+		nwritten += bytes_written;
+
+		if (res == G_CONVERTER_FINISHED)
+			break;
+
+		if (in_pos == in_end || (bytes_read == 0 && bytes_written == 0))
+		{
+			g_assert_cmpuint (in_end, <, len);
+			in_end = MIN (in_end + chunk_size, len);
+		}
+	}
+
+	g_assert_cmpuint (in_pos, ==, len);
+
+	out[nwritten] = '\0';
+	*out_len = nwritten;
+
+	return out;
+}
+
+/* Repeats @utf8 until @size bytes, encodes it in @charset and checks that
+ * it is guessed and decoded back whatever the size of the input chunks */
+static void
+check_guess (const gchar *utf8,
+             gsize        size,
+             const gchar *charset,
+             GSList      *encodings)
+{
+	GString *text;
+	gchar *encoded;
+	gsize encoded_len;
+	GError *err = NULL;
+	const gsize chunk_sizes[] = { 1, 3, 7, 64, 4096, 70000, MB };
+	guint i;
+
+	text = g_string_new (NULL);
+	do
+	{
+		g_string_append (text, utf8);
+	} while (text->len < size);
+
+	encoded = g_convert (text->str, text->len, charset, "UTF-8",
+	                     NULL, &encoded_len, &err);
+	g_assert_no_error (err);
+
+	for (i = 0; i < G_N_ELEMENTS (chunk_sizes); i++)
+	{
+		LapizSmartCharsetConverter *converter;
+		gchar *out;
+		gsize out_len;
+
+		converter = lapiz_smart_charset_converter_new (encodings);
+
+		out = convert_in_chunks (converter, encoded, encoded_len,
+		                         chunk_sizes[i], &out_len);
+
+		g_assert (lapiz_smart_charset_converter_get_guessed (converter) ==
+		          lapiz_encoding_get_from_charset (charset));
+		g_assert_cmpuint (out_len, ==, text->len);
+		g_assert (memcmp (out, text->str, out_len) == 0);
+
+		g_free (out);
+		g_object_unref (converter);
+	}
+
+	g_free (encoded);
+	g_string_free (text, TRUE);
+}
+
+static GSList *
+get_default_candidates ()
+{
+	GSList *encs = NULL;
+
+	encs = g_slist_append (encs, (gpointer)lapiz_encoding_get_utf8 ());
+	encs = g_slist_append (encs, (gpointer)lapiz_encoding_get_from_charset ("GBK"));
+	encs = g_slist_append (encs, (gpointer)lapiz_encoding_get_from_charset ("ISO-8859-15"));
+	encs = g_slist_append (encs, (gpointer)lapiz_encoding_get_from_charset ("UTF-16"));
+
+	return encs;
+}
+
 static void
 do_test_roundtrip (const char *str, const char *charset)
 {
@@ -344,6 +477,162 @@ test_guessed ()
 	g_free (aux2);
 }
 
+static void
+test_mixed_corpus ()
+{
+	GSList *encs;
+
+	encs = get_default_candidates ();
+
+	check_guess ("hello \xe6\x96\x87 world, caf\xc3\xa9\n", 50000, "UTF-8", encs);
+	check_guess ("\xe4\xbd\xa0\xe5\xa5\xbd\xef\xbc\x8c\xe4\xb8\x96\xe7\x95\x8c\n", 50000, "GBK", encs);
+	check_guess ("un caf\xc3\xa9, 2 \xe2\x82\xac s'il vous pla\xc3\xaet.\n", 50000, "ISO-8859-15", encs);
+	check_guess (TEXT_TO_GUESS "\n", 50000, "UTF-16", encs);
+
+	g_slist_free (encs);
+}
+
+static void
+test_late_non_ascii ()
+{
+	GSList *encs;
+	GString *text;
+
+	encs = get_default_candidates ();
+	text = g_string_new (NULL);
+
+	/* the first non-ASCII character comes long after the guess was made
+	 * on ASCII text only */
+	while (text->len < 200000)
+		g_string_append (text, ASCII_LINE);
+
+	g_string_append (text, "caf\xc3\xa9,\n");
+	check_guess (text->str, text->len, "ISO-8859-15", encs);
+	check_guess (text->str, text->len, "UTF-8", encs);
+
+	g_string_free (text, TRUE);
+	g_slist_free (encs);
+}
+
+static void
+test_partial_input ()
+{
+	LapizSmartCharsetConverter *converter;
+	GSList *encs;
+	gchar *out;
+	gsize out_len;
+
+	encs = get_default_candidates ();
+
+	/* characters cut between the chunks while guessing */
+	converter = lapiz_smart_charset_converter_new (encs);
+	out = convert_in_chunks (converter, TEXT_TO_GUESS, strlen (TEXT_TO_GUESS), 1, &out_len);
+
+	g_assert_cmpstr (out, ==, TEXT_TO_GUESS);
+	g_assert (lapiz_smart_charset_converter_get_guessed (converter) == lapiz_encoding_get_utf8 ());
+
+	g_free (out);
+	g_object_unref (converter);
+	g_slist_free (encs);
+}
+
+static void
+test_confidence ()
+{
+	LapizSmartCharsetConverter *converter;
+	GSList *encs = NULL;
+	gchar *out;
+	gsize out_len;
+	gdouble confidence;
+
+	encs = g_slist_append (encs, (gpointer)lapiz_encoding_get_utf8 ());
+	encs = g_slist_append (encs, (gpointer)lapiz_encoding_get_from_charset ("ISO-8859-15"));
+
+	/* a single UTF-8 character is a hint, not a proof */
+	converter = lapiz_smart_charset_converter_new (encs);
+	out = convert_in_chunks (converter, TEXT_TO_GUESS, strlen (TEXT_TO_GUESS), MB, &out_len);
+	confidence = lapiz_smart_charset_converter_get_confidence (converter);
+
+	g_assert (confidence > 0.0 && confidence < 1.0);
+
+	g_free (out);
+	g_object_unref (converter);
+
+	/* nothing but ISO-8859-15 can decode it */
+	converter = lapiz_smart_charset_converter_new (encs);
+	out = convert_in_chunks (converter, "caf\xe9\n", 5, MB, &out_len);
+
+	g_assert_cmpstr (out, ==, "caf\xc3\xa9\n");
+	g_assert_cmpfloat (lapiz_smart_charset_converter_get_confidence (converter), ==, 1.0);
+
+	g_free (out);
+	g_object_unref (converter);
+	g_slist_free (encs);
+}
+
+static void
+benchmark_throughput (const gchar *line,
+                      const gchar *charset)
+{
+	LapizSmartCharsetConverter *converter;
+	GString *text;
+	GSList *encs;
+	GTimer *timer;
+	gchar *encoded;
+	gchar *out;
+	gsize encoded_len;
+	gsize out_len;
+	gdouble elapsed;
+	GError *err = NULL;
+
+	if (!g_test_perf ())
+	{
+		g_test_skip ("only run in perf mode");
+		return;
+	}
+
+	text = g_string_sized_new (64 * MB + 256);
+	while (text->len < 64 * MB)
+		g_string_append (text, line);
+
+	encoded = g_convert (text->str, text->len, charset, "UTF-8",
+	                     NULL, &encoded_len, &err);
+	g_assert_no_error (err);
+
+	encs = get_default_candidates ();
+	converter = lapiz_smart_charset_converter_new (encs);
+
+	timer = g_timer_new ();
+	out = convert_in_chunks (converter, encoded, encoded_len, MB, &out_len);
+	elapsed = g_timer_elapsed (timer, NULL);
+
+	g_assert_cmpuint (out_len, ==, text->len);
+
+	g_test_maximized_result ((gdouble) encoded_len / MB / elapsed,
+	                         "Converted %" G_GSIZE_FORMAT " MB of %s in %.3f s: %.1f MB/s",
+	                         encoded_len / MB, charset, elapsed,
+	                         (gdouble) encoded_len / MB / elapsed);
+
+	g_timer_destroy (timer);
+	g_object_unref (converter);
+	g_slist_free (encs);
+	g_free (out);
+	g_free (encoded);
+	g_string_free (text, TRUE);
+}
+
+static void
+test_throughput_utf8 ()
+{
+	benchmark_throughput (ASCII_LINE "caf\xc3\xa9 \xe6\x96\x87\n", "UTF-8");
+}
+
+static void
+test_throughput_latin ()
+{
+	benchmark_throughput (ASCII_LINE "un caf\xc3\xa9, s'il vous pla\xc3\xaet.\n", "ISO-8859-15");
+}
+
 int main (int   argc,
           char *argv[])
 {
@@ -353,6 +642,12 @@ int main (int   argc,
 	//g_test_add_func ("/smart-converter/xxx-xxx", test_xxx_xxx);
 	g_test_add_func ("/smart-converter/guessed", test_guessed);
 	g_test_add_func ("/smart-converter/empty", test_empty);
+	g_test_add_func ("/smart-converter/mixed-corpus", test_mixed_corpus);
+	g_test_add_func ("/smart-converter/late-non-ascii", test_late_non_ascii);
+	g_test_add_func ("/smart-converter/partial-input", test_partial_input);
+	g_test_add_func ("/smart-converter/confidence", test_confidence);
+	g_test_add_func ("/smart-converter/throughput-utf8", test_throughput_utf8);
+	g_test_add_func ("/smart-converter/throughput-latin", test_throughput_latin);
 
 	return g_test_run ();
 }
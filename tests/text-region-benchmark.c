@@ -0,0 +1,265 @@
+/*
+ * text-region-benchmark.c
+ * This file is part of lapiz
+ *
+ * lapiz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * lapiz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lapiz; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/* The benchmarks only run in perf mode:
+ *   ./text-region-benchmark -m perf
+ *
+ * A recorded edit trace can be replayed by pointing
+ * LAPIZ_TEXT_REGION_TRACE to a file with one operation per line:
+ *   i <offset> <length>   insert length characters at offset
+ *   d <offset> <length>   delete length characters at offset
+ *   a <start> <end>       add the range to the region
+ *   s <start> <end>       subtract the range from the region
+ *   x <start> <end>       intersect the region with the range
+ * Offsets beyond the end of the buffer are clamped.
+ */
+
+#include "lapiztextregion.h"
+#include <ctk/ctk.h>
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TRACE_LENGTH 200000
+
+typedef struct
+{
+	gchar op;
+	gint  a;
+	gint  b;
+} TraceOp;
+
+static const gchar line[] =
+	"Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do "
+	"eiusmod tempor incididunt ut labore et dolore magna aliqua.\n";
+
+static GArray *
+load_trace (const gchar *filename)
+{
+	GArray *trace;
+	gchar *contents;
+	gchar **lines;
+	gint i;
+	GError *error = NULL;
+
+	g_file_get_contents (filename, &contents, NULL, &error);
+	g_assert_no_error (error);
+
+	trace = g_array_new (FALSE, FALSE, sizeof (TraceOp));
+	lines = g_strsplit (contents, "\n", -1);
+
+	for (i = 0; lines[i] != NULL; i++)
+	{
+		TraceOp op;
+
+		if (sscanf (lines[i], " %c %d %d", &op.op, &op.a, &op.b) == 3 &&
+		    strchr ("idasx", op.op) != NULL)
+		{
+			g_array_append_val (trace, op);
+		}
+	}
+
+	g_strfreev (lines);
+	g_free (contents);
+
+	return trace;
+}
+
+/* a typing session: the cursor mostly moves forward, the typed text
+ * is added to the region and now and then some of it is deleted or
+ * the region around the cursor is checked, as the spell checker and
+ * the modified lines tracking do */
+static GArray *
+generate_trace (gint length)
+{
+	GArray *trace;
+	GRand *rand;
+	gint cursor = 0;
+	gint n_chars;
+	gint i;
+
+	trace = g_array_new (FALSE, FALSE, sizeof (TraceOp));
+	rand = g_rand_new_with_seed (42);
+	n_chars = 1000 * (sizeof (line) - 1);
+
+	for (i = 0; i < length; i++)
+	{
+		TraceOp op;
+		gint r = g_rand_int_range (rand, 0, 100);
+
+		if (r < 5)
+			cursor = g_rand_int_range (rand, 0, n_chars);
+
+		if (r < 50)
+		{
+			op.op = 'i';
+			op.a = cursor;
+			op.b = g_rand_int_range (rand, 1, 8);
+			cursor += op.b;
+			n_chars += op.b;
+		}
+		else if (r < 60)
+		{
+			op.op = 'd';
+			op.b = MIN (cursor, g_rand_int_range (rand, 1, 4));
+			op.a = cursor - op.b;
+			cursor -= op.b;
+			n_chars -= op.b;
+		}
+		else if (r < 80)
+		{
+			op.op = 'a';
+			op.a = MAX (0, cursor - 8);
+			op.b = cursor;
+		}
+		else if (r < 90)
+		{
+			op.op = 's';
+			op.a = MAX (0, cursor - g_rand_int_range (rand, 1, 200));
+			op.b = cursor;
+		}
+		else
+		{
+			op.op = 'x';
+			op.a = MAX (0, cursor - 2000);
+			op.b = cursor + 2000;
+		}
+
+		g_array_append_val (trace, op);
+	}
+
+	g_rand_free (rand);
+
+	return trace;
+}
+
+static void
+get_iter (CtkTextBuffer *buffer,
+	  CtkTextIter   *iter,
+	  gint           offset)
+{
+	ctk_text_buffer_get_iter_at_offset (buffer, iter, MAX (offset, 0));
+}
+
+static void
+replay (CtkTextBuffer   *buffer,
+	LapizTextRegion *region,
+	GArray          *trace)
+{
+	gchar *text;
+	guint i;
+
+	text = g_strnfill (4096, 'x');
+
+	for (i = 0; i < trace->len; i++)
+	{
+		TraceOp *op = &g_array_index (trace, TraceOp, i);
+		CtkTextIter start, end;
+		LapizTextRegion *intersection;
+
+		get_iter (buffer, &start, op->a);
+
+		switch (op->op)
+		{
+		case 'i':
+			ctk_text_buffer_insert (buffer, &start, text, CLAMP (op->b, 0, 4096));
+			break;
+		case 'd':
+			get_iter (buffer, &end, op->a + op->b);
+			ctk_text_buffer_delete (buffer, &start, &end);
+			break;
+		case 'a':
+			get_iter (buffer, &end, op->b);
+			lapiz_text_region_add (region, &start, &end);
+			break;
+		case 's':
+			get_iter (buffer, &end, op->b);
+			lapiz_text_region_subtract (region, &start, &end);
+			break;
+		case 'x':
+			get_iter (buffer, &end, op->b);
+			intersection = lapiz_text_region_intersect (region, &start, &end);
+			if (intersection != NULL)
+				lapiz_text_region_destroy (intersection, TRUE);
+			break;
+		}
+	}
+
+	g_free (text);
+}
+
+static void
+test_replay ()
+{
+	CtkTextBuffer *buffer;
+	LapizTextRegion *region;
+	const gchar *filename;
+	GArray *trace;
+	GString *text;
+	GTimer *timer;
+	gdouble elapsed;
+
+	if (!g_test_perf ())
+	{
+		g_test_skip ("only run in perf mode");
+		return;
+	}
+
+	filename = g_getenv ("LAPIZ_TEXT_REGION_TRACE");
+	if (filename != NULL)
+		trace = load_trace (filename);
+	else
+		trace = generate_trace (TRACE_LENGTH);
+
+	text = g_string_new (NULL);
+	while (text->len < 1000 * (sizeof (line) - 1))
+		g_string_append (text, line);
+
+	buffer = ctk_text_buffer_new (NULL);
+	ctk_text_buffer_set_text (buffer, text->str, text->len);
+	region = lapiz_text_region_new (buffer);
+
+	timer = g_timer_new ();
+
+	replay (buffer, region, trace);
+
+	elapsed = g_timer_elapsed (timer, NULL);
+
+	g_test_minimized_result (elapsed,
+	                         "Replayed %u operations in %.3f s, %d subregions left",
+	                         trace->len, elapsed,
+	                         lapiz_text_region_subregions (region));
+
+	g_timer_destroy (timer);
+	lapiz_text_region_destroy (region, TRUE);
+	g_object_unref (buffer);
+	g_string_free (text, TRUE);
+	g_array_free (trace, TRUE);
+}
+
+int main (int   argc,
+          char *argv[])
+{
+	g_test_init (&argc, &argv, NULL);
+
+	g_test_add_func ("/text-region-benchmark/replay", test_replay);
+
+	return g_test_run ();
+}
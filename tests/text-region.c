@@ -0,0 +1,288 @@
+/*
+ * text-region.c
+ * This file is part of lapiz
+ *
+ * lapiz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * lapiz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lapiz; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "lapiztextregion.h"
+#include <ctk/ctk.h>
+#include <glib.h>
+#include <string.h>
+
+static CtkTextBuffer *
+create_buffer (void)
+{
+	CtkTextBuffer *buffer;
+
+	buffer = ctk_text_buffer_new (NULL);
+	ctk_text_buffer_set_text (buffer, "0123456789abcdefghijklmnopqrstuvwxyz", -1);
+
+	return buffer;
+}
+
+static void
+region_add (LapizTextRegion *region,
+	    gint             start,
+	    gint             end)
+{
+	CtkTextBuffer *buffer;
+	CtkTextIter start_iter, end_iter;
+
+	buffer = lapiz_text_region_get_buffer (region);
+	ctk_text_buffer_get_iter_at_offset (buffer, &start_iter, start);
+	ctk_text_buffer_get_iter_at_offset (buffer, &end_iter, end);
+
+	lapiz_text_region_add (region, &start_iter, &end_iter);
+}
+
+static void
+region_subtract (LapizTextRegion *region,
+		 gint             start,
+		 gint             end)
+{
+	CtkTextBuffer *buffer;
+	CtkTextIter start_iter, end_iter;
+
+	buffer = lapiz_text_region_get_buffer (region);
+	ctk_text_buffer_get_iter_at_offset (buffer, &start_iter, start);
+	ctk_text_buffer_get_iter_at_offset (buffer, &end_iter, end);
+
+	lapiz_text_region_subtract (region, &start_iter, &end_iter);
+}
+
+/* checks the subregions against a list of start, end offset pairs
+ * terminated by -1 */
+static void
+check_region (LapizTextRegion *region,
+	      ...)
+{
+	va_list args;
+	gint n = 0;
+	gint expected;
+
+	va_start (args, region);
+
+	while ((expected = va_arg (args, gint)) != -1)
+	{
+		CtkTextIter start, end;
+
+		g_assert (lapiz_text_region_nth_subregion (region, n, &start, &end));
+
+		g_assert_cmpint (ctk_text_iter_get_offset (&start), ==, expected);
+		g_assert_cmpint (ctk_text_iter_get_offset (&end), ==, va_arg (args, gint));
+
+		++n;
+	}
+
+	va_end (args);
+
+	g_assert_cmpint (lapiz_text_region_subregions (region), ==, n);
+}
+
+static void
+test_add ()
+{
+	CtkTextBuffer *buffer;
+	LapizTextRegion *region;
+
+	buffer = create_buffer ();
+	region = lapiz_text_region_new (buffer);
+
+	region_add (region, 10, 12);
+	region_add (region, 2, 4);
+	region_add (region, 20, 25);
+	check_region (region, 2, 4, 10, 12, 20, 25, -1);
+
+	/* touching subregions are merged */
+	region_add (region, 4, 6);
+	check_region (region, 2, 6, 10, 12, 20, 25, -1);
+
+	/* the range covers several subregions */
+	region_add (region, 11, 21);
+	check_region (region, 2, 6, 10, 25, -1);
+
+	/* the range is inside a subregion */
+	region_add (region, 12, 14);
+	check_region (region, 2, 6, 10, 25, -1);
+
+	/* empty ranges are ignored */
+	region_add (region, 30, 30);
+	check_region (region, 2, 6, 10, 25, -1);
+
+	lapiz_text_region_destroy (region, TRUE);
+	g_object_unref (buffer);
+}
+
+static void
+test_subtract ()
+{
+	CtkTextBuffer *buffer;
+	LapizTextRegion *region;
+
+	buffer = create_buffer ();
+	region = lapiz_text_region_new (buffer);
+
+	region_add (region, 2, 10);
+	region_add (region, 15, 20);
+	region_add (region, 25, 30);
+
+	/* the range is inside a subregion */
+	region_subtract (region, 4, 6);
+	check_region (region, 2, 4, 6, 10, 15, 20, 25, 30, -1);
+
+	/* the range trims two subregions and removes the one in between */
+	region_subtract (region, 8, 27);
+	check_region (region, 2, 4, 6, 8, 27, 30, -1);
+
+	/* the range only touches a subregion */
+	region_subtract (region, 4, 6);
+	check_region (region, 2, 4, 6, 8, 27, 30, -1);
+
+	region_subtract (region, 0, 36);
+	check_region (region, -1);
+
+	lapiz_text_region_destroy (region, TRUE);
+	g_object_unref (buffer);
+}
+
+static void
+test_intersect ()
+{
+	CtkTextBuffer *buffer;
+	LapizTextRegion *region, *intersection;
+	CtkTextIter start, end;
+
+	buffer = create_buffer ();
+	region = lapiz_text_region_new (buffer);
+
+	region_add (region, 2, 10);
+	region_add (region, 15, 20);
+	region_add (region, 25, 30);
+
+	ctk_text_buffer_get_iter_at_offset (buffer, &start, 5);
+	ctk_text_buffer_get_iter_at_offset (buffer, &end, 27);
+	intersection = lapiz_text_region_intersect (region, &start, &end);
+
+	check_region (intersection, 5, 10, 15, 20, 25, 27, -1);
+	lapiz_text_region_destroy (intersection, TRUE);
+
+	ctk_text_buffer_get_iter_at_offset (buffer, &start, 10);
+	ctk_text_buffer_get_iter_at_offset (buffer, &end, 15);
+	g_assert (lapiz_text_region_intersect (region, &start, &end) == NULL);
+
+	lapiz_text_region_destroy (region, TRUE);
+	g_object_unref (buffer);
+}
+
+static void
+test_edits ()
+{
+	CtkTextBuffer *buffer;
+	LapizTextRegion *region;
+	CtkTextIter start, end;
+
+	buffer = create_buffer ();
+	region = lapiz_text_region_new (buffer);
+
+	region_add (region, 2, 4);
+	region_add (region, 10, 12);
+	region_add (region, 20, 25);
+
+	/* text inserted at the edges of a subregion extends it */
+	ctk_text_buffer_get_iter_at_offset (buffer, &start, 10);
+	ctk_text_buffer_insert (buffer, &start, "xx", -1);
+	check_region (region, 2, 4, 10, 14, 22, 27, -1);
+
+	ctk_text_buffer_get_iter_at_offset (buffer, &start, 14);
+	ctk_text_buffer_insert (buffer, &start, "x", -1);
+	check_region (region, 2, 4, 10, 15, 23, 28, -1);
+
+	/* text inserted before a subregion moves it */
+	ctk_text_buffer_get_iter_at_offset (buffer, &start, 0);
+	ctk_text_buffer_insert (buffer, &start, "xxx", -1);
+	check_region (region, 5, 7, 13, 18, 26, 31, -1);
+
+	/* a deletion spanning the end of a subregion trims it */
+	ctk_text_buffer_get_iter_at_offset (buffer, &start, 16);
+	ctk_text_buffer_get_iter_at_offset (buffer, &end, 20);
+	ctk_text_buffer_delete (buffer, &start, &end);
+	check_region (region, 5, 7, 13, 16, 22, 27, -1);
+
+	/* a deletion covering a subregion leaves it empty... */
+	ctk_text_buffer_get_iter_at_offset (buffer, &start, 4);
+	ctk_text_buffer_get_iter_at_offset (buffer, &end, 8);
+	ctk_text_buffer_delete (buffer, &start, &end);
+	check_region (region, 4, 4, 9, 12, 18, 23, -1);
+
+	/* ...until the next subtraction */
+	region_subtract (region, 9, 10);
+	check_region (region, 10, 12, 18, 23, -1);
+
+	lapiz_text_region_destroy (region, TRUE);
+
+	/* the region is not updated anymore */
+	ctk_text_buffer_set_text (buffer, "", -1);
+	g_object_unref (buffer);
+}
+
+static void
+test_iterator ()
+{
+	CtkTextBuffer *buffer;
+	LapizTextRegion *region;
+	LapizTextRegionIterator iter;
+	CtkTextIter start, end;
+
+	buffer = create_buffer ();
+	region = lapiz_text_region_new (buffer);
+
+	region_add (region, 2, 4);
+	region_add (region, 10, 12);
+	region_add (region, 20, 25);
+
+	lapiz_text_region_get_iterator (region, &iter, 1);
+	g_assert (!lapiz_text_region_iterator_is_end (&iter));
+
+	lapiz_text_region_iterator_get_subregion (&iter, &start, &end);
+	g_assert_cmpint (ctk_text_iter_get_offset (&start), ==, 10);
+	g_assert_cmpint (ctk_text_iter_get_offset (&end), ==, 12);
+
+	g_assert (lapiz_text_region_iterator_next (&iter));
+	lapiz_text_region_iterator_get_subregion (&iter, &start, &end);
+	g_assert_cmpint (ctk_text_iter_get_offset (&start), ==, 20);
+	g_assert_cmpint (ctk_text_iter_get_offset (&end), ==, 25);
+
+	g_assert (!lapiz_text_region_iterator_next (&iter));
+	g_assert (lapiz_text_region_iterator_is_end (&iter));
+
+	lapiz_text_region_destroy (region, TRUE);
+	g_object_unref (buffer);
+}
+
+int main (int   argc,
+          char *argv[])
+{
+	g_test_init (&argc, &argv, NULL);
+
+	g_test_add_func ("/text-region/add", test_add);
+	g_test_add_func ("/text-region/subtract", test_subtract);
+	g_test_add_func ("/text-region/intersect", test_intersect);
+	g_test_add_func ("/text-region/edits", test_edits);
+	g_test_add_func ("/text-region/iterator", test_iterator);
+
+	return g_test_run ();
+}
@@ -0,0 +1,180 @@
+/*
+ * utf8-scanner.c
+ * This file is part of lapiz
+ *
+ * lapiz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * lapiz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lapiz; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "lapiz-utf8-scanner.h"
+#include <glib.h>
+#include <string.h>
+
+static void
+scan_in_chunks (const gchar   *text,
+		gsize          chunk_len,
+		LapizUtf8Scan *scan)
+{
+	gsize len = strlen (text);
+	gsize pos = 0;
+
+	lapiz_utf8_scan_init (scan);
+
+	while (pos < len)
+	{
+		const gchar *end;
+		gsize n = MIN (chunk_len, len - pos);
+
+		/* an incomplete char is passed again with the next bytes */
+		while (!lapiz_utf8_scan (scan, text + pos, n, &end) &&
+		       end == text + pos && n < len - pos)
+		{
+			n++;
+		}
+
+		pos = end - text;
+	}
+
+	lapiz_utf8_scan_finish (scan);
+}
+
+static void
+test_scan (const gchar              *text,
+	   gsize                     n_chars,
+	   gsize                     n_lf,
+	   gsize                     n_cr,
+	   gsize                     n_crlf,
+	   LapizDocumentNewlineType  newline_type)
+{
+	gsize chunk_len;
+
+	/* 1 byte chunks split every CRLF and every character, big ones
+	 * go through the vectorized path */
+	for (chunk_len = 1; chunk_len <= 64; chunk_len *= 2)
+	{
+		LapizUtf8Scan scan;
+
+		scan_in_chunks (text, chunk_len, &scan);
+
+		g_assert_cmpuint (scan.n_bytes, ==, strlen (text));
+		g_assert_cmpuint (scan.n_chars, ==, n_chars);
+		g_assert_cmpuint (scan.n_lf, ==, n_lf);
+		g_assert_cmpuint (scan.n_cr, ==, n_cr);
+		g_assert_cmpuint (scan.n_crlf, ==, n_crlf);
+		g_assert_cmpuint (lapiz_utf8_scan_get_line_count (&scan), ==, n_lf + n_cr + n_crlf + 1);
+		g_assert_cmpint (lapiz_utf8_scan_get_newline_type (&scan), ==, newline_type);
+	}
+}
+
+static void
+test_newlines ()
+{
+	test_scan ("", 0, 0, 0, 0, LAPIZ_DOCUMENT_NEWLINE_TYPE_DEFAULT);
+	test_scan ("\r", 1, 0, 1, 0, LAPIZ_DOCUMENT_NEWLINE_TYPE_CR);
+	test_scan ("hello\nhow\nare\nyou", 17, 3, 0, 0, LAPIZ_DOCUMENT_NEWLINE_TYPE_LF);
+	test_scan ("hello\rhow\rare\ryou\r", 18, 0, 4, 0, LAPIZ_DOCUMENT_NEWLINE_TYPE_CR);
+	test_scan ("hello\r\nhow\r\nare\r\nyou", 20, 0, 0, 3, LAPIZ_DOCUMENT_NEWLINE_TYPE_CR_LF);
+	test_scan ("a very long first line without any line ending\r\nsecond\nthird\r",
+		   61, 1, 1, 1, LAPIZ_DOCUMENT_NEWLINE_TYPE_CR_LF);
+}
+
+static void
+test_multibyte ()
+{
+	test_scan ("\343\203\200\343\203\200", 2, 0, 0, 0, LAPIZ_DOCUMENT_NEWLINE_TYPE_DEFAULT);
+	test_scan ("h\303\251llo w\303\266rld, this line is longer than a vector\n\360\237\230\200\n",
+		   49, 2, 0, 0, LAPIZ_DOCUMENT_NEWLINE_TYPE_LF);
+}
+
+static void
+test_invalid ()
+{
+	const gchar *invalid[] = {
+		"\300\200",		/* overlong */
+		"\340\200\200",		/* overlong */
+		"\355\240\200",		/* surrogate */
+		"\364\220\200\200",	/* out of range */
+		"\377",
+		"\200"
+	};
+	gchar text[64];
+	const gchar *end;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (invalid); i++)
+	{
+		g_assert (!lapiz_utf8_validate (invalid[i], strlen (invalid[i]), &end));
+		g_assert (end == invalid[i]);
+	}
+
+	/* embedded nul and invalid byte in the middle of a vector */
+	memset (text, 'a', sizeof (text));
+	text[40] = '\0';
+	g_assert (!lapiz_utf8_validate (text, sizeof (text), &end));
+	g_assert (end == text + 40);
+
+	text[40] = '\377';
+	g_assert (!lapiz_utf8_validate (text, sizeof (text), &end));
+	g_assert (end == text + 40);
+
+	text[40] = 'a';
+	g_assert (lapiz_utf8_validate (text, sizeof (text), &end));
+	g_assert (end == text + sizeof (text));
+}
+
+static void
+test_drop_pending_cr ()
+{
+	const gchar *text = "ab\r\303\251\r\ncd";
+	LapizUtf8Scan scan;
+	LapizUtf8Scan next;
+	const gchar *end;
+
+	/* a chunk ending with a CR and a truncated character, as the
+	 * loader splits them: the CR goes with the next chunk */
+	lapiz_utf8_scan_init (&scan);
+	g_assert (!lapiz_utf8_scan (&scan, text, 4, &end));
+	g_assert (end == text + 3);
+	g_assert (lapiz_utf8_scan_drop_pending_cr (&scan));
+	g_assert (!lapiz_utf8_scan_drop_pending_cr (&scan));
+	g_assert_cmpuint (scan.n_bytes, ==, 2);
+	g_assert_cmpuint (scan.n_chars, ==, 2);
+
+	lapiz_utf8_scan_init (&next);
+	g_assert (lapiz_utf8_scan (&next, text + 2, strlen (text) - 2, &end));
+	lapiz_utf8_scan_finish (&next);
+
+	lapiz_utf8_scan_merge (&scan, &next);
+
+	g_assert_cmpuint (scan.n_bytes, ==, strlen (text));
+	g_assert_cmpuint (scan.n_chars, ==, 8);
+	g_assert_cmpuint (scan.n_lf, ==, 0);
+	g_assert_cmpuint (scan.n_cr, ==, 1);
+	g_assert_cmpuint (scan.n_crlf, ==, 1);
+	g_assert_cmpint (lapiz_utf8_scan_get_newline_type (&scan), ==, LAPIZ_DOCUMENT_NEWLINE_TYPE_CR);
+}
+
+int main (int   argc,
+          char *argv[])
+{
+	g_test_init (&argc, &argv, NULL);
+
+	g_test_add_func ("/utf8-scanner/newlines", test_newlines);
+	g_test_add_func ("/utf8-scanner/multibyte", test_multibyte);
+	g_test_add_func ("/utf8-scanner/invalid", test_invalid);
+	g_test_add_func ("/utf8-scanner/drop-pending-cr", test_drop_pending_cr);
+
+	return g_test_run ();
+}